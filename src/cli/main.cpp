@@ -5,6 +5,7 @@
 #include "lib/cxxopts.hpp"
 
 #include "vixen/core.h"
+#include "vixen/xbox_pool.h"
 #include "vixen/settings.h"
 #include "vixen/thread.h"
 
@@ -37,13 +38,23 @@ int main(int argc, const char *argv[]) {
     printf("------------------\n");
 
     cxxopts::Options options(basename((char*)argv[0]), "viXen - 6th generation (Original) XBOX Emulator\n");
-    options.custom_help("-m mcpx_path -b bios_path -r xbox_rev [-d image_path] [-g image_path]");
+    options.custom_help("-m mcpx_path -b bios_path -r xbox_rev [-d image_path] [-g image_path] [-c mode]");
     options.add_options()
         ("m, mcpx", "Path to MCPX ROM", cxxopts::value<std::string>(), "mcpx_path")
         ("b, bios", "Path to BIOS ROM", cxxopts::value<std::string>(), "bios_path")
         ("d, hd-image", "Path to hard disk drive image", cxxopts::value<std::string>(), "image_path")
         ("g, xgd-image", "Path to Xbox Game Disc image", cxxopts::value<std::string>(), "image_path")
         ("r, revision", "XBOX revision (retail | debug)", cxxopts::value<std::string>(), "xbox_rev")
+        ("c, clock", "Guest clock mode (realtime | scaled | deterministic)", cxxopts::value<std::string>()->default_value("realtime"), "mode")
+        ("clock-scale", "Guest time per unit of host time in scaled mode", cxxopts::value<float>()->default_value("1.0"), "factor")
+        ("skip-idle", "Fast-forward the guest clock while the CPU is idle")
+        ("kernel-irqchip", "Emulate the PIC and PIT in the hypervisor, if supported")
+        ("ram-backing", "Guest RAM backing (default | thp | hugetlb)", cxxopts::value<std::string>()->default_value("default"), "type")
+        ("numa-node", "Host NUMA node to allocate guest RAM from", cxxopts::value<int>()->default_value("-1"), "node")
+        ("prefault-ram", "Allocate all guest RAM up front instead of on first access")
+        ("raster-threads", "Number of extra host threads rendering 3D graphics (-1 = one less than the host cores)", cxxopts::value<int>()->default_value("-1"), "count")
+        ("instances", "Number of independent machines to run", cxxopts::value<int>()->default_value("1"), "count")
+        ("threads", "Number of host threads shared by the machines' CPUs (0 = one per machine)", cxxopts::value<int>()->default_value("0"), "count")
         ("h, help", "Shows this message");
 
     auto args = options.parse(argc, argv);
@@ -97,7 +108,7 @@ int main(int argc, const char *argv[]) {
     }
     log_info("success\n");
 
-    Xbox *xbox = new Xbox(cpuModuleInstance.cpuModule);
+    Xbox *xbox = new Xbox(cpuModuleInstance.cpuModule, cpuModuleInstance.caps);
 
     viXenSettings *settings = xbox->GetSettings();
     settings->cpu_singleStep = false;
@@ -111,7 +122,6 @@ int main(int argc, const char *argv[]) {
     settings->debug_dumpStack_upperBound = 0x10;
     settings->debug_dumpStack_lowerBound = 0x20;
     settings->gdb_enable = false;
-    settings->hw_sysclock_tickRate = 1000.0f;
     settings->hw_enableSuperIO = true;
     settings->hw_charDrivers[0].type = CHD_HostSerialPort;
     settings->hw_charDrivers[0].params.hostSerialPort.portNum = 5;
@@ -132,6 +142,44 @@ int main(int argc, const char *argv[]) {
         return 1;
     }
 
+    std::string clockMode = args["clock"].as<std::string>();
+    if (clockMode == "realtime") {
+        settings->emu_clockMode = VCM_RealTime;
+    }
+    else if (clockMode == "scaled") {
+        settings->emu_clockMode = VCM_Scaled;
+        settings->emu_clockScale = args["clock-scale"].as<float>();
+    }
+    else if (clockMode == "deterministic") {
+        settings->emu_clockMode = VCM_Deterministic;
+    }
+    else {
+        printf("Invalid clock mode specified.\n");
+        std::cout << options.help();
+        return 1;
+    }
+    settings->emu_skipIdle = args.count("skip-idle") > 0;
+    settings->cpu_inKernelIRQChip = args.count("kernel-irqchip") > 0;
+
+    std::string ramBacking = args["ram-backing"].as<std::string>();
+    if (ramBacking == "default") {
+        settings->ram_backing = RAMB_Default;
+    }
+    else if (ramBacking == "thp") {
+        settings->ram_backing = RAMB_TransparentHugePages;
+    }
+    else if (ramBacking == "hugetlb") {
+        settings->ram_backing = RAMB_HugeTLB;
+    }
+    else {
+        printf("Invalid RAM backing specified.\n");
+        std::cout << options.help();
+        return 1;
+    }
+    settings->ram_numaNode = args["numa-node"].as<int>();
+    settings->ram_prefault = args.count("prefault-ram") > 0;
+    settings->gpu_rasterThreads = args["raster-threads"].as<int>();
+
     if (strlen(vhd_path) == 0) {
         settings->vhd_type = VHD_Dummy;
     }
@@ -150,7 +198,37 @@ int main(int argc, const char *argv[]) {
         settings->vdvd_parameters.image.preserveImage = true;
     }
 
-    EmulatorStatus status = xbox->Run();
+    // Additional machines share the ROM and disc images with the first one,
+    // and run on a pool of threads
+    std::vector<Xbox *> machines { xbox };
+    for (int i = 1; i < args["instances"].as<int>(); i++) {
+        Xbox *machine = new Xbox(cpuModuleInstance.cpuModule, cpuModuleInstance.caps);
+        machine->CopySettings(settings);
+
+        // Host serial ports can only be opened by one machine
+        for (int port = 0; port < 2; port++) {
+            machine->GetSettings()->hw_charDrivers[port].type = CHD_Null;
+        }
+        machines.push_back(machine);
+    }
+
+    EmulatorStatus status;
+    if (machines.size() == 1) {
+        status = xbox->Run();
+    }
+    else {
+        int numThreads = args["threads"].as<int>();
+        XboxPool pool(numThreads > 0 ? numThreads : (uint32_t)machines.size());
+        status = EMUS_OK;
+        for (auto machine : machines) {
+            EmulatorStatus machineStatus = pool.Add(machine);
+            if (machineStatus != EMUS_OK) {
+                status = machineStatus;
+            }
+        }
+        pool.Wait();
+    }
+
     if (status == EMUS_OK) {
         log_info("Emulator exited successfully\n");
     }
@@ -180,6 +258,8 @@ int main(int argc, const char *argv[]) {
         }
     }
 
-    delete xbox;
+    for (auto machine : machines) {
+        delete machine;
+    }
     return status;
 }
@@ -2,6 +2,10 @@
 
 #include <stdint.h>
 
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
 namespace vixen {
 
 #define BITMASK64(bit) (1ULL << (uint64_t)(bit))
@@ -29,4 +33,54 @@ inline void Bitmap64Clear(Bitmap64 *bitmap, uint8_t bit) {
 	*bitmap &= ~BITMASK64(bit);
 }
 
-}
\ No newline at end of file
+/*!
+ * Returns the index of the least significant bit set in the 64-bit bitmap,
+ * or -1 if no bits are set.
+ */
+inline int Bitmap64FindFirstSet(Bitmap64 bitmap) {
+	if (bitmap == 0) {
+		return -1;
+	}
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, bitmap);
+	return (int)index;
+#else
+	return __builtin_ctzll(bitmap);
+#endif
+}
+
+/*!
+ * Returns the index of the most significant bit set in the 64-bit bitmap,
+ * or -1 if no bits are set.
+ */
+inline int Bitmap64FindLastSet(Bitmap64 bitmap) {
+	if (bitmap == 0) {
+		return -1;
+	}
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, bitmap);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(bitmap);
+#endif
+}
+
+/*!
+ * Rotates the 64-bit bitmap left by the specified number of bits.
+ */
+inline Bitmap64 Bitmap64RotateLeft(Bitmap64 bitmap, uint8_t count) {
+	count &= 63;
+	return (count == 0) ? bitmap : (bitmap << count) | (bitmap >> (64 - count));
+}
+
+/*!
+ * Rotates the 64-bit bitmap right by the specified number of bits.
+ */
+inline Bitmap64 Bitmap64RotateRight(Bitmap64 bitmap, uint8_t count) {
+	count &= 63;
+	return (count == 0) ? bitmap : (bitmap >> count) | (bitmap << (64 - count));
+}
+
+}
@@ -0,0 +1,35 @@
+#include "vixen/fileimage.h"
+
+#include <map>
+#include <mutex>
+
+namespace vixen {
+
+std::shared_ptr<SharedFileImage> SharedFileImage::Open(const std::string& path) {
+    // Images outlive their users only as long as another user needs them
+    static std::mutex s_mutex;
+    static std::map<std::string, std::weak_ptr<SharedFileImage>> s_images;
+
+    std::lock_guard<std::mutex> lk(s_mutex);
+    auto it = s_images.find(path);
+    if (it != s_images.end()) {
+        auto image = it->second.lock();
+        if (image != nullptr) {
+            return image;
+        }
+        s_images.erase(it);
+    }
+
+    SharedFileImage *mapped = SharedFileImage_Map(path);
+    if (mapped == nullptr) {
+        return nullptr;
+    }
+    std::shared_ptr<SharedFileImage> image(mapped);
+    s_images[path] = image;
+    return image;
+}
+
+SharedFileImage::~SharedFileImage() {
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <stdint.h>
+
+namespace vixen {
+
+// ----- Shared file image ----------------------------------------------------
+
+/*!
+ * A read-only view of a file shared by every user in the process.
+ *
+ * Images are opened once per path and stay mapped while anyone holds a
+ * reference to them, so that machines booting from the same ROM or disc
+ * image share the same host pages. On Linux, the pages are also shared with
+ * other processes through the page cache.
+ */
+class SharedFileImage {
+public:
+    /*!
+     * Opens the image at the specified path, or returns the one already
+     * opened by another user. Returns nullptr if the file could not be
+     * opened or is empty.
+     */
+    static std::shared_ptr<SharedFileImage> Open(const std::string& path);
+
+    virtual ~SharedFileImage();
+
+    const uint8_t *GetData() const { return m_data; }
+    uint64_t GetSize() const { return m_size; }
+
+    /*!
+     * Maps a private copy-on-write view of the first size bytes of the image
+     * at the specified page-aligned address, replacing the memory that was
+     * there. Pages are shared with the image until they are written to.
+     *
+     * Returns false if the view could not be mapped, in which case the caller
+     * should copy the data instead.
+     */
+    virtual bool MapCopyOnWrite(void *address, size_t size) const = 0;
+
+protected:
+    const uint8_t *m_data = nullptr;
+    uint64_t m_size = 0;
+};
+
+// ----- Platform-specific functions ------------------------------------------
+
+/*!
+ * Maps the file at the specified path into memory.
+ * Returns nullptr if the file could not be mapped.
+ */
+SharedFileImage *SharedFileImage_Map(const std::string& path);
+
+}
@@ -1,6 +1,10 @@
 #include "io.h"
 #include "vixen/log.h"
 
+#include <cstring>
+#include <iterator>
+#include <thread>
+
 namespace vixen {
 
 // ----- Default I/O device implementation ------------------------------------
@@ -25,37 +29,220 @@ bool IODevice::MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
 
 // ----- I/O mapper -----------------------------------------------------------
 
+IOMapper::IOMapper() {
+    m_ioTable = new IODevice*[IO_PORT_COUNT];
+    memset(m_ioTable, 0, IO_PORT_COUNT * sizeof(IODevice *));
+    memset(m_mmioDirectory, 0, sizeof(m_mmioDirectory));
+    m_sharedPage = MappedDevice{ 0, 0, nullptr };
+    m_stats = nullptr;
+    m_statsUsers = 0;
+    m_postedWriteFunc = nullptr;
+    m_postedWriteUserData = nullptr;
+    m_ramAliasFunc = nullptr;
+    m_ramAliasUserData = nullptr;
+}
+
+IOMapper::~IOMapper() {
+    delete[] m_ioTable;
+    for (uint32_t i = 0; i < MMIO_DIRECTORY_ENTRIES; i++) {
+        delete[] m_mmioDirectory[i];
+    }
+}
+
 bool IOMapper::MapIODevice(uint32_t basePort, uint32_t numPorts, IODevice *device) {
-    return MapDevice(m_mappedIODevices, basePort, numPorts, device);
+    if (basePort + numPorts > IO_PORT_COUNT) {
+        log_warning("IOMapper::MapIODevice: Port range 0x%x..0x%x is out of bounds\n", basePort, basePort + numPorts - 1);
+        return false;
+    }
+    if (!MapDevice(m_mappedIODevices, basePort, numPorts, device)) {
+        return false;
+    }
+    UpdateIOTable(basePort, basePort + numPorts - 1);
+    return true;
 }
 
 bool IOMapper::MapMMIODevice(uint32_t baseAddress, uint32_t numAddresses, IODevice *device) {
-    return MapDevice(m_mappedMMIODevices, baseAddress, numAddresses, device);
+    if (!MapDevice(m_mappedMMIODevices, baseAddress, numAddresses, device)) {
+        return false;
+    }
+    UpdateMMIOTable(baseAddress, baseAddress + numAddresses - 1);
+    return true;
+}
+
+bool IOMapper::UnmapIODevice(uint32_t basePort) {
+    auto it = m_mappedIODevices.find(basePort);
+    if (it == m_mappedIODevices.end()) {
+        return false;
+    }
+    uint32_t last = it->second.lastAddress;
+    m_mappedIODevices.erase(it);
+    UpdateIOTable(basePort, last);
+    return true;
+}
+
+bool IOMapper::UnmapMMIODevice(uint32_t baseAddress) {
+    auto it = m_mappedMMIODevices.find(baseAddress);
+    if (it == m_mappedMMIODevices.end()) {
+        return false;
+    }
+    uint32_t last = it->second.lastAddress;
+
+    // Writes to the device can no longer be posted
+    auto pw = m_postedWriteRanges.lower_bound(baseAddress);
+    while (pw != m_postedWriteRanges.end() && pw->first <= last) {
+        if (m_postedWriteFunc != nullptr) {
+            m_postedWriteFunc(pw->first, pw->second - pw->first + 1, false, m_postedWriteUserData);
+        }
+        pw = m_postedWriteRanges.erase(pw);
+    }
+
+    // Nor can its memory be accessed directly
+    auto ra = m_ramAliases.lower_bound(baseAddress);
+    while (ra != m_ramAliases.end() && ra->first <= last) {
+        if (m_ramAliasFunc != nullptr) {
+            m_ramAliasFunc(ra->first, ra->second.lastAddress - ra->first + 1, nullptr, m_ramAliasUserData);
+        }
+        ra = m_ramAliases.erase(ra);
+    }
+
+    m_mappedMMIODevices.erase(it);
+    UpdateMMIOTable(baseAddress, last);
+    return true;
+}
+
+bool IOMapper::AddPostedWriteRange(uint32_t baseAddress, uint32_t size) {
+    if (size == 0 || baseAddress + (size - 1) < baseAddress) {
+        log_warning("IOMapper::AddPostedWriteRange: Invalid range 0x%x, size 0x%x\n", baseAddress, size);
+        return false;
+    }
+    uint32_t last = baseAddress + size - 1;
+
+    // The range must be covered by a single device...
+    if (!IsWithinMMIODevice(baseAddress, last)) {
+        log_warning("IOMapper::AddPostedWriteRange: Range 0x%x..0x%x is not mapped to a device\n", baseAddress, last);
+        return false;
+    }
+
+    // ...and must not overlap other posted write ranges
+    auto pu = m_postedWriteRanges.upper_bound(baseAddress);
+    if ((pu != m_postedWriteRanges.end() && pu->first <= last) ||
+        (pu != m_postedWriteRanges.begin() && std::prev(pu)->second >= baseAddress)) {
+        log_warning("IOMapper::AddPostedWriteRange: Range 0x%x..0x%x overlaps another posted write range\n", baseAddress, last);
+        return false;
+    }
+
+    m_postedWriteRanges[baseAddress] = last;
+    if (m_postedWriteFunc != nullptr) {
+        m_postedWriteFunc(baseAddress, size, true, m_postedWriteUserData);
+    }
+    return true;
+}
+
+bool IOMapper::RemovePostedWriteRange(uint32_t baseAddress) {
+    auto it = m_postedWriteRanges.find(baseAddress);
+    if (it == m_postedWriteRanges.end()) {
+        return false;
+    }
+    if (m_postedWriteFunc != nullptr) {
+        m_postedWriteFunc(it->first, it->second - it->first + 1, false, m_postedWriteUserData);
+    }
+    m_postedWriteRanges.erase(it);
+    return true;
+}
+
+void IOMapper::SetPostedWriteHandler(PostedWriteRangeFunc func, void *userData) {
+    m_postedWriteFunc = func;
+    m_postedWriteUserData = userData;
+    if (func != nullptr) {
+        for (auto it = m_postedWriteRanges.begin(); it != m_postedWriteRanges.end(); it++) {
+            func(it->first, it->second - it->first + 1, true, userData);
+        }
+    }
+}
+
+bool IOMapper::AddRAMAlias(uint32_t baseAddress, uint32_t size, void *hostMemory) {
+    if (size == 0 || baseAddress + (size - 1) < baseAddress || hostMemory == nullptr) {
+        log_warning("IOMapper::AddRAMAlias: Invalid range 0x%x, size 0x%x\n", baseAddress, size);
+        return false;
+    }
+    uint32_t last = baseAddress + size - 1;
+
+    if (!IsWithinMMIODevice(baseAddress, last)) {
+        log_warning("IOMapper::AddRAMAlias: Range 0x%x..0x%x is not mapped to a device\n", baseAddress, last);
+        return false;
+    }
+
+    auto ru = m_ramAliases.upper_bound(baseAddress);
+    if ((ru != m_ramAliases.end() && ru->first <= last) ||
+        (ru != m_ramAliases.begin() && std::prev(ru)->second.lastAddress >= baseAddress)) {
+        log_warning("IOMapper::AddRAMAlias: Range 0x%x..0x%x overlaps another RAM alias\n", baseAddress, last);
+        return false;
+    }
+
+    m_ramAliases[baseAddress] = RAMAlias{ last, hostMemory };
+    if (m_ramAliasFunc != nullptr) {
+        m_ramAliasFunc(baseAddress, size, hostMemory, m_ramAliasUserData);
+    }
+    return true;
+}
+
+bool IOMapper::RemoveRAMAlias(uint32_t baseAddress) {
+    auto it = m_ramAliases.find(baseAddress);
+    if (it == m_ramAliases.end()) {
+        return false;
+    }
+    if (m_ramAliasFunc != nullptr) {
+        m_ramAliasFunc(it->first, it->second.lastAddress - it->first + 1, nullptr, m_ramAliasUserData);
+    }
+    m_ramAliases.erase(it);
+    return true;
+}
+
+void IOMapper::SetRAMAliasHandler(RAMAliasFunc func, void *userData) {
+    m_ramAliasFunc = func;
+    m_ramAliasUserData = userData;
+    if (func != nullptr) {
+        for (auto it = m_ramAliases.begin(); it != m_ramAliases.end(); it++) {
+            func(it->first, it->second.lastAddress - it->first + 1, it->second.hostMemory, userData);
+        }
+    }
+}
+
+bool IOMapper::IsWithinMMIODevice(uint32_t base, uint32_t last) {
+    IODevice *device;
+    return LookupDevice(m_mappedMMIODevices, base, &device) && LookupMMIODevice(last) == device;
 }
 
 bool IOMapper::MapDevice(std::map<uint32_t, MappedDevice>& iomap, uint32_t base, uint32_t size, IODevice *device) {
+    if (size == 0 || base + (size - 1) < base) {
+        log_warning("IOMapper::MapDevice: Invalid %s range 0x%x, size 0x%x\n",
+            (&iomap == &m_mappedIODevices) ? "I/O" : "MMIO",
+            base, size);
+        return false;
+    }
+
     uint32_t last = base + size - 1;
 
-    // Ensure there are no overlapping ranges
+    // Ensure there are no overlapping ranges. The first range that starts
+    // after the base address must also start after the last address...
     auto pu = iomap.upper_bound(base);
-    if (pu != iomap.end()) {
-        if ((base >= pu->first && base <= pu->second.lastAddress) || (last >= pu->first && last <= pu->second.lastAddress)) {
-            log_warning("IOMapper::MapDevice: Attempted to map a device to %s range 0x%x..0x%x, but another device is already mapped to range 0x%x..0x%x\n",
-                (&iomap == &m_mappedIODevices) ? "I/O" : "MMIO",
-                base, last,
-                pu->first, pu->second.lastAddress);
-            return false;
-        }
+    if (pu != iomap.end() && pu->first <= last) {
+        log_warning("IOMapper::MapDevice: Attempted to map a device to %s range 0x%x..0x%x, but another device is already mapped to range 0x%x..0x%x\n",
+            (&iomap == &m_mappedIODevices) ? "I/O" : "MMIO",
+            base, last,
+            pu->first, pu->second.lastAddress);
+        return false;
     }
 
-    auto pl = iomap.lower_bound(last);
-    if (pl != iomap.begin()) pl--;
-    if (pl != iomap.begin()) {
-        if ((base >= pl->first && base <= pl->second.lastAddress) || (last >= pl->first && last <= pl->second.lastAddress)) {
+    // ...and the range that starts at or before the base address must end
+    // before it
+    if (pu != iomap.begin()) {
+        auto pl = std::prev(pu);
+        if (pl->second.lastAddress >= base) {
             log_warning("IOMapper::MapDevice: Attempted to map a device to %s range 0x%x..0x%x, but another device is already mapped to range 0x%x..0x%x\n",
                 (&iomap == &m_mappedIODevices) ? "I/O" : "MMIO",
                 base, last,
-                pu->first, pu->second.lastAddress);
+                pl->first, pl->second.lastAddress);
             return false;
         }
     }
@@ -66,10 +253,6 @@ bool IOMapper::MapDevice(std::map<uint32_t, MappedDevice>& iomap, uint32_t base,
     return true;
 }
 
-bool IOMapper::AddDevice(IODevice *device) {
-    return m_dynamicDevices.emplace(device).second;
-}
-
 bool IOMapper::LookupDevice(std::map<uint32_t, MappedDevice>& iomap, uint32_t addr, IODevice **device) {
     auto p = iomap.upper_bound(addr);
 
@@ -89,92 +272,188 @@ bool IOMapper::LookupDevice(std::map<uint32_t, MappedDevice>& iomap, uint32_t ad
     return false;
 }
 
-bool IOMapper::IORead(uint32_t addr, uint32_t *value, uint8_t size) {
-    // Try looking up a device mapped to the specified port first
-    IODevice *dev;
-    if (LookupDevice(m_mappedIODevices, addr, &dev)) {
-        return dev->IORead(addr, value, size);
+void IOMapper::UpdateIOTable(uint32_t base, uint32_t last) {
+    for (uint32_t port = base; port <= last; port++) {
+        IODevice *dev;
+        m_ioTable[port] = LookupDevice(m_mappedIODevices, port, &dev) ? dev : nullptr;
     }
+}
+
+void IOMapper::UpdateMMIOTable(uint32_t base, uint32_t last) {
+    uint32_t firstPage = base >> MMIO_PAGE_SHIFT;
+    uint32_t lastPage = last >> MMIO_PAGE_SHIFT;
+
+    for (uint32_t page = firstPage; ; page++) {
+        uint32_t pageStart = page << MMIO_PAGE_SHIFT;
+        uint32_t pageEnd = pageStart + ((1 << MMIO_PAGE_SHIFT) - 1);
+
+        // Find the mappings that overlap this page: the one that starts at or
+        // before the page, if it reaches into it, and any that start inside it
+        MappedDevice *entry = nullptr;
+        uint32_t count = 0;
+        auto it = m_mappedMMIODevices.upper_bound(pageStart);
+        if (it != m_mappedMMIODevices.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.lastAddress >= pageStart) {
+                entry = &prev->second;
+                count++;
+            }
+        }
+        for (; it != m_mappedMMIODevices.end() && it->first <= pageEnd && count < 2; ++it) {
+            entry = &it->second;
+            count++;
+        }
+        if (count > 1) {
+            entry = &m_sharedPage;
+        }
+
+        MappedDevice **&table = m_mmioDirectory[page >> (MMIO_TABLE_SHIFT - MMIO_PAGE_SHIFT)];
+        if (table == nullptr && entry != nullptr) {
+            table = new MappedDevice*[MMIO_TABLE_ENTRIES];
+            memset(table, 0, MMIO_TABLE_ENTRIES * sizeof(MappedDevice *));
+        }
+        if (table != nullptr) {
+            table[page & (MMIO_TABLE_ENTRIES - 1)] = entry;
+        }
 
-    // Otherwise search for one of the dynamically mapped devices
-    for (auto it = m_dynamicDevices.begin(); it != m_dynamicDevices.end(); it++) {
-        auto dev = *it;
-        if (dev->IORead(addr, value, size)) {
-            return true;
+        if (page == lastPage) {
+            break;
         }
     }
+}
+
+bool IOMapper::DispatchIORead(uint32_t addr, uint32_t *value, uint8_t size) {
+    IODevice *dev = m_ioTable[addr & (IO_PORT_COUNT - 1)];
+    if (dev != nullptr) {
+        IODeviceLockGuard lk(dev->GetDeviceLock());
+        return dev->IORead(addr, value, size);
+    }
 
     log_warning("IOMapper::IORead:   Unhandled I/O!  address = 0x%x,  size = %u,  read\n", addr, size);
     *value = 0;
     return false;
 }
 
-bool IOMapper::IOWrite(uint32_t addr, uint32_t value, uint8_t size) {
-    // Try looking up a device mapped to the specified port first
-    IODevice *dev;
-    if (LookupDevice(m_mappedIODevices, addr, &dev)) {
+bool IOMapper::DispatchIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
+    IODevice *dev = m_ioTable[addr & (IO_PORT_COUNT - 1)];
+    if (dev != nullptr) {
+        IODeviceLockGuard lk(dev->GetDeviceLock());
         return dev->IOWrite(addr, value, size);
     }
 
-    // Otherwise search for one of the dynamically mapped devices
-    for (auto it = m_dynamicDevices.begin(); it != m_dynamicDevices.end(); it++) {
-        auto dev = *it;
-        if (dev->IOWrite(addr, value, size)) {
-            return true;
-        }
-    }
-
     log_warning("IOMapper::IOWrite:  Unhandled I/O!  address = 0x%x,  size = %u,  write 0x%x\n", addr, size, value);
     return false;
 }
 
-bool IOMapper::MMIORead(uint32_t addr, uint32_t *value, uint8_t size) {
+bool IOMapper::DispatchMMIORead(uint32_t addr, uint32_t *value, uint8_t size) {
     if ((addr & (size - 1)) != 0) {
         log_warning("IOMapper::MMIORead:   Unaligned MMIO read!   address = 0x%x,  size = %u\n", addr, size);
         return false;
     }
 
-    // Try looking up a device mapped to the specified port first
-    IODevice *dev;
-    if (LookupDevice(m_mappedMMIODevices, addr, &dev)) {
+    IODevice *dev = LookupMMIODevice(addr);
+    if (dev != nullptr) {
+        IODeviceLockGuard lk(dev->GetDeviceLock());
         return dev->MMIORead(addr, value, size);
     }
 
-    // Otherwise search for one of the dynamically mapped devices
-    for (auto it = m_dynamicDevices.begin(); it != m_dynamicDevices.end(); it++) {
-        auto dev = *it;
-        if (dev->MMIORead(addr, value, size)) {
-            return true;
-        }
-    }
-
     log_warning("IOMapper::MMIORead:   Unhandled MMIO!  address = 0x%x,  size = %u,  read\n", addr, size);
     *value = 0;
     return false;
 }
 
-bool IOMapper::MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
+bool IOMapper::DispatchMMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
     if ((addr & (size - 1)) != 0) {
         log_warning("IOMapper::MMIOWrite:  Unaligned MMIO write!  address = 0x%x,  size = %u,  value = 0x%x\n", addr, size, value);
         return false;
     }
 
-    // Try looking up a device mapped to the specified port first
-    IODevice *dev;
-    if (LookupDevice(m_mappedMMIODevices, addr, &dev)) {
+    IODevice *dev = LookupMMIODevice(addr);
+    if (dev != nullptr) {
+        IODeviceLockGuard lk(dev->GetDeviceLock());
         return dev->MMIOWrite(addr, value, size);
     }
 
-    // Otherwise search for one of the dynamically mapped devices
-    for (auto it = m_dynamicDevices.begin(); it != m_dynamicDevices.end(); it++) {
-        auto dev = *it;
-        if (dev->MMIOWrite(addr, value, size)) {
-            return true;
-        }
-    }
-
     log_warning("IOMapper::MMIOWrite:  Unhandled MMIO!  address = 0x%x,  size = %u,  write 0x%x\n", addr, size, value);
     return false;
 }
 
-}
\ No newline at end of file
+void IOMapper::SetStatistics(IOStatistics *stats) {
+    m_stats.store(stats);
+
+    // Dispatches that picked up the previous object may still be recording
+    // into it
+    while (m_statsUsers.load(std::memory_order_acquire) != 0) {
+        std::this_thread::yield();
+    }
+}
+
+IOStatistics *IOMapper::AcquireStatistics() {
+    // Keep dispatches cheap while statistics are disabled
+    if (m_stats.load(std::memory_order_relaxed) == nullptr) {
+        return nullptr;
+    }
+
+    // Announce the dispatch before loading the object again, so that
+    // SetStatistics either sees it or has already replaced the object
+    m_statsUsers.fetch_add(1);
+    IOStatistics *stats = m_stats.load();
+    if (stats == nullptr) {
+        ReleaseStatistics();
+    }
+    return stats;
+}
+
+void IOMapper::ReleaseStatistics() {
+    m_statsUsers.fetch_sub(1, std::memory_order_release);
+}
+
+bool IOMapper::IORead(uint32_t addr, uint32_t *value, uint8_t size) {
+    IOStatistics *stats = AcquireStatistics();
+    if (stats != nullptr) {
+        auto start = IOStatistics::Clock::now();
+        bool handled = DispatchIORead(addr, value, size);
+        stats->RecordAccess(IO_SPACE_PIO, m_ioTable[addr & (IO_PORT_COUNT - 1)], addr, false, size, handled, IOStatistics::NanosSince(start));
+        ReleaseStatistics();
+        return handled;
+    }
+    return DispatchIORead(addr, value, size);
+}
+
+bool IOMapper::IOWrite(uint32_t addr, uint32_t value, uint8_t size) {
+    IOStatistics *stats = AcquireStatistics();
+    if (stats != nullptr) {
+        auto start = IOStatistics::Clock::now();
+        bool handled = DispatchIOWrite(addr, value, size);
+        stats->RecordAccess(IO_SPACE_PIO, m_ioTable[addr & (IO_PORT_COUNT - 1)], addr, true, size, handled, IOStatistics::NanosSince(start));
+        ReleaseStatistics();
+        return handled;
+    }
+    return DispatchIOWrite(addr, value, size);
+}
+
+bool IOMapper::MMIORead(uint32_t addr, uint32_t *value, uint8_t size) {
+    IOStatistics *stats = AcquireStatistics();
+    if (stats != nullptr) {
+        auto start = IOStatistics::Clock::now();
+        bool handled = DispatchMMIORead(addr, value, size);
+        stats->RecordAccess(IO_SPACE_MMIO, LookupMMIODevice(addr), addr, false, size, handled, IOStatistics::NanosSince(start));
+        ReleaseStatistics();
+        return handled;
+    }
+    return DispatchMMIORead(addr, value, size);
+}
+
+bool IOMapper::MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
+    IOStatistics *stats = AcquireStatistics();
+    if (stats != nullptr) {
+        auto start = IOStatistics::Clock::now();
+        bool handled = DispatchMMIOWrite(addr, value, size);
+        stats->RecordAccess(IO_SPACE_MMIO, LookupMMIODevice(addr), addr, true, size, handled, IOStatistics::NanosSince(start));
+        ReleaseStatistics();
+        return handled;
+    }
+    return DispatchMMIOWrite(addr, value, size);
+}
+
+}
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <map>
-#include <set>
+#include <mutex>
+
+#include "iostats.h"
 
 namespace vixen {
 
@@ -15,6 +18,18 @@ class IOMapper;
  * I/O functions return true if the I/O operation was handled by the device.
  *
  * The default implementations read the value 0 and don't handle I/O.
+ *
+ * Concurrency contract:
+ * - I/O functions are only invoked from the CPU thread.
+ * - Devices whose state is also accessed from other threads (their own
+ *   worker or timer threads, or IRQs raised by other devices' threads) must
+ *   have a device lock. The I/O mapper holds the lock while dispatching
+ *   accesses to the device, and every other thread must hold it while
+ *   accessing the device's state. Devices without a lock are only ever
+ *   accessed from the CPU thread.
+ * - A device may raise IRQs while holding its own lock. Interrupt
+ *   controllers never call back into other devices, so locks are always
+ *   acquired in the order device -> PCI IRQ routing -> interrupt controller.
  */
 class IODevice {
 public:
@@ -25,6 +40,47 @@ public:
 
     virtual bool MMIORead(uint32_t addr, uint32_t *value, uint8_t size);
     virtual bool MMIOWrite(uint32_t addr, uint32_t value, uint8_t size);
+
+    /*!
+     * Retrieves the lock that protects the device's state, or nullptr if the
+     * device is only accessed from the CPU thread.
+     */
+    std::mutex *GetDeviceLock() { return m_deviceLock; }
+
+protected:
+    /*!
+     * Sets the lock that protects the device's state. Several I/O devices
+     * may share the same lock if they are views of the same hardware.
+     */
+    void SetDeviceLock(std::mutex *lock) { m_deviceLock = lock; }
+
+private:
+    std::mutex *m_deviceLock = nullptr;
+};
+
+/*!
+ * Holds a device lock for the duration of a scope. Does nothing if the
+ * device has no lock.
+ */
+class IODeviceLockGuard {
+public:
+    IODeviceLockGuard(std::mutex *lock) : m_lock(lock) {
+        if (m_lock != nullptr) {
+            m_lock->lock();
+        }
+    }
+
+    ~IODeviceLockGuard() {
+        if (m_lock != nullptr) {
+            m_lock->unlock();
+        }
+    }
+
+private:
+    std::mutex *m_lock;
+
+    IODeviceLockGuard(const IODeviceLockGuard&) = delete;
+    IODeviceLockGuard& operator=(const IODeviceLockGuard&) = delete;
 };
 
 /*!
@@ -34,30 +90,121 @@ struct MappedDevice {
     // I/O or MMIO addresses
     uint32_t baseAddress;
     uint32_t lastAddress;
-    
+
     // The device itself
     IODevice *device;
 };
 
+/*!
+ * Function invoked when a range of MMIO addresses starts or stops accepting
+ * posted writes.
+ */
+typedef void (*PostedWriteRangeFunc)(uint32_t baseAddress, uint32_t size, bool posted, void *userData);
+
+/*!
+ * Function invoked when a RAM alias is added or removed. hostMemory is
+ * nullptr when the alias is removed.
+ */
+typedef void (*RAMAliasFunc)(uint32_t baseAddress, uint32_t size, void *hostMemory, void *userData);
+
+/*!
+ * A range of MMIO addresses backed by host memory.
+ */
+struct RAMAlias {
+    uint32_t lastAddress;
+    void *hostMemory;
+};
+
+// Number of addressable I/O ports
+#define IO_PORT_COUNT          0x10000
+
+// MMIO dispatch table geometry: a 1024-entry directory of 1024-entry tables
+// of 4 KiB pages, covering the entire 4 GiB physical address space
+#define MMIO_PAGE_SHIFT        12
+#define MMIO_TABLE_SHIFT       22
+#define MMIO_TABLE_ENTRIES     1024
+#define MMIO_DIRECTORY_ENTRIES 1024
+
 /*!
  * Maps I/O and MMIO reads and writes to the corresponding devices.
+ *
+ * Mappings are kept in ordered maps for bookkeeping, and mirrored into flat
+ * dispatch tables so that every access is resolved in constant time:
+ * - port I/O uses a direct table with one entry per port;
+ * - MMIO uses a two-level page table with one entry per 4 KiB page. Pages
+ *   shared by more than one mapping fall back to the ordered map.
  */
 class IOMapper {
 public:
+    IOMapper();
+    ~IOMapper();
+
     /*!
     * Maps a device to the specified range of ports.
     */
     bool MapIODevice(uint32_t basePort, uint32_t numPorts, IODevice *device);
-    
+
     /*!
      * Maps a device to the specified MMIO range.
      */
     bool MapMMIODevice(uint32_t baseAddress, uint32_t numAddresses, IODevice *device);
 
     /*!
-     * Adds a device with dynamic I/O address mapping.
+     * Removes the device mapped to the range of ports starting at the
+     * specified base port.
+     */
+    bool UnmapIODevice(uint32_t basePort);
+
+    /*!
+     * Removes the device mapped to the MMIO range starting at the specified
+     * base address.
+     */
+    bool UnmapMMIODevice(uint32_t baseAddress);
+
+    /*!
+     * Allows writes to the specified MMIO range to be posted: the CPU may
+     * buffer them and deliver them to the device later, in order and on the
+     * CPU thread, before it handles any other I/O or MMIO access. Reads are
+     * always dispatched immediately.
+     *
+     * Only suitable for registers whose writes have no side effects that the
+     * guest expects to observe without reading from the device, such as
+     * doorbells and framebuffers. The range must lie within a mapped device,
+     * and is removed when that device is unmapped.
+     */
+    bool AddPostedWriteRange(uint32_t baseAddress, uint32_t size);
+
+    /*!
+     * Removes the posted write range starting at the specified base address.
+     */
+    bool RemovePostedWriteRange(uint32_t baseAddress);
+
+    /*!
+     * Sets the function notified when posted write ranges are added or
+     * removed, and reports the existing ranges to it. Only set by CPUs that
+     * can buffer writes; otherwise all writes are dispatched immediately.
+     */
+    void SetPostedWriteHandler(PostedWriteRangeFunc func, void *userData);
+
+    /*!
+     * Declares that the specified MMIO range is backed by host memory, so
+     * that the CPU may map the memory into the guest and let the guest access
+     * it directly. The device must still handle accesses to the range for
+     * CPUs that cannot do so. The range must lie within a mapped device, and
+     * is removed when that device is unmapped.
+     */
+    bool AddRAMAlias(uint32_t baseAddress, uint32_t size, void *hostMemory);
+
+    /*!
+     * Removes the RAM alias starting at the specified base address.
+     */
+    bool RemoveRAMAlias(uint32_t baseAddress);
+
+    /*!
+     * Sets the function notified when RAM aliases are added or removed, and
+     * reports the existing aliases to it.
      */
-    bool AddDevice(IODevice *device);
+    void SetRAMAliasHandler(RAMAliasFunc func, void *userData);
 
     bool IORead(uint32_t addr, uint32_t *value, uint8_t size);
     bool IOWrite(uint32_t addr, uint32_t value, uint8_t size);
@@ -65,7 +212,35 @@ public:
     bool MMIORead(uint32_t addr, uint32_t *value, uint8_t size);
     bool MMIOWrite(uint32_t addr, uint32_t value, uint8_t size);
 
+    /*!
+     * Enables collection of access statistics into the specified object, or
+     * disables it if nullptr. Collection is disabled by default.
+     *
+     * May be called from any thread while the CPU runs, but not from an I/O
+     * handler. Returns once no dispatch is using the previous object, which
+     * may then be destroyed.
+     */
+    void SetStatistics(IOStatistics *stats);
+    IOStatistics *GetStatistics() { return m_stats.load(); }
+
+    /*!
+     * Returns the statistics object to record into, keeping it alive until
+     * ReleaseStatistics() is called. Returns nullptr, with nothing to
+     * release, if statistics are disabled.
+     */
+    IOStatistics *AcquireStatistics();
+    void ReleaseStatistics();
+
 private:
+    /*!
+     * Dispatches accesses to the mapped devices without collecting
+     * statistics.
+     */
+    bool DispatchIORead(uint32_t addr, uint32_t *value, uint8_t size);
+    bool DispatchIOWrite(uint32_t addr, uint32_t value, uint8_t size);
+    bool DispatchMMIORead(uint32_t addr, uint32_t *value, uint8_t size);
+    bool DispatchMMIOWrite(uint32_t addr, uint32_t value, uint8_t size);
+
     /*!
      * Looks up the I/O device mapped to the specified I/O or MMIO address,
      * depending on the map used.
@@ -79,9 +254,67 @@ private:
      */
     bool MapDevice(std::map<uint32_t, MappedDevice>& iomap, uint32_t base, uint32_t size, IODevice *device);
 
+    /*!
+     * Resolves the device that handles the specified MMIO address using the
+     * page table. Returns nullptr if no device is mapped to that address.
+     */
+    inline IODevice *LookupMMIODevice(uint32_t addr) {
+        MappedDevice **table = m_mmioDirectory[addr >> MMIO_TABLE_SHIFT];
+        if (table == nullptr) {
+            return nullptr;
+        }
+        MappedDevice *entry = table[(addr >> MMIO_PAGE_SHIFT) & (MMIO_TABLE_ENTRIES - 1)];
+        if (entry == nullptr) {
+            return nullptr;
+        }
+        if (entry == &m_sharedPage) {
+            IODevice *dev;
+            return LookupDevice(m_mappedMMIODevices, addr, &dev) ? dev : nullptr;
+        }
+        if (addr - entry->baseAddress > entry->lastAddress - entry->baseAddress) {
+            return nullptr;
+        }
+        return entry->device;
+    }
+
+    /*!
+     * Rebuilds the I/O port table entries in the specified range.
+     */
+    void UpdateIOTable(uint32_t base, uint32_t last);
+
+    /*!
+     * Rebuilds the MMIO page table entries covering the specified range.
+     */
+    void UpdateMMIOTable(uint32_t base, uint32_t last);
+
+    /*!
+     * Determines if the range lies within a single mapped MMIO device.
+     */
+    bool IsWithinMMIODevice(uint32_t base, uint32_t last);
+
     std::map<uint32_t, MappedDevice> m_mappedIODevices;
     std::map<uint32_t, MappedDevice> m_mappedMMIODevices;
-    std::set<IODevice *> m_dynamicDevices;
+
+    // Posted write ranges, mapping base addresses to last addresses
+    std::map<uint32_t, uint32_t> m_postedWriteRanges;
+    PostedWriteRangeFunc m_postedWriteFunc;
+    void *m_postedWriteUserData;
+
+    // RAM aliases, keyed by base address
+    std::map<uint32_t, RAMAlias> m_ramAliases;
+    RAMAliasFunc m_ramAliasFunc;
+    void *m_ramAliasUserData;
+
+    IODevice **m_ioTable;
+    MappedDevice **m_mmioDirectory[MMIO_DIRECTORY_ENTRIES];
+
+    // Sentinel for pages that contain more than one mapping
+    MappedDevice m_sharedPage;
+
+    std::atomic<IOStatistics *> m_stats;
+
+    // Number of dispatches that may be recording into m_stats
+    std::atomic<uint32_t> m_statsUsers;
 };
 
 }
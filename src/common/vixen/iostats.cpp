@@ -0,0 +1,178 @@
+#include "iostats.h"
+#include "vixen/log.h"
+
+namespace vixen {
+
+static const char *kSpaceNames[] = { "pio", "mmio" };
+static const char *kExitNames[] = { "pio", "mmio" };
+
+// ----- Statistics records ---------------------------------------------------
+
+void IOLatencyStats::Record(uint64_t nanos) {
+    count++;
+    totalNanos += nanos;
+    if (nanos > maxNanos) {
+        maxNanos = nanos;
+    }
+
+    // Find the log2 bucket of the latency
+    uint8_t bucket = 0;
+    while (nanos > 1 && bucket < IOSTATS_LATENCY_BUCKETS - 1) {
+        nanos >>= 1;
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+void IOLatencyStats::WriteJSON(FILE *fp) const {
+    fprintf(fp, "{ \"count\": %llu, \"total_ns\": %llu, \"max_ns\": %llu, \"log2_ns_histogram\": [",
+        (unsigned long long)count, (unsigned long long)totalNanos, (unsigned long long)maxNanos);
+    for (int i = 0; i < IOSTATS_LATENCY_BUCKETS; i++) {
+        fprintf(fp, "%s%llu", (i == 0) ? "" : ", ", (unsigned long long)histogram[i]);
+    }
+    fprintf(fp, "] }");
+}
+
+void IOAccessStats::Record(bool isWrite, uint8_t size, bool handled, uint64_t nanos) {
+    if (isWrite) {
+        writes++;
+    }
+    else {
+        reads++;
+    }
+    if (!handled) {
+        unhandled++;
+    }
+
+    switch (size) {
+    case 1: sizes[0]++; break;
+    case 2: sizes[1]++; break;
+    case 4: sizes[2]++; break;
+    default: sizes[3]++; break;
+    }
+
+    latency.Record(nanos);
+}
+
+void IOAccessStats::WriteJSON(FILE *fp) const {
+    fprintf(fp, "{ \"reads\": %llu, \"writes\": %llu, \"unhandled\": %llu, ",
+        (unsigned long long)reads, (unsigned long long)writes, (unsigned long long)unhandled);
+    fprintf(fp, "\"sizes\": { \"1\": %llu, \"2\": %llu, \"4\": %llu, \"other\": %llu }, \"latency\": ",
+        (unsigned long long)sizes[0], (unsigned long long)sizes[1], (unsigned long long)sizes[2], (unsigned long long)sizes[3]);
+    latency.WriteJSON(fp);
+    fprintf(fp, " }");
+}
+
+void IOExitStats::WriteJSON(FILE *fp) const {
+    fprintf(fp, "{ \"accesses\": %llu, \"latency\": ", (unsigned long long)accesses);
+    latency.WriteJSON(fp);
+    fprintf(fp, " }");
+}
+
+// ----- Statistics collector -------------------------------------------------
+
+void IOStatistics::SetDeviceName(IODevice *device, const char *name) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_deviceNames[device] = name;
+}
+
+void IOStatistics::RecordAccess(IOAccessSpace space, IODevice *device, uint32_t addr, bool isWrite, uint8_t size, bool handled, uint64_t nanos) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_deviceStats[space][device].Record(isWrite, size, handled, nanos);
+    m_regionStats[space][addr >> IOSTATS_REGION_SHIFT].Record(isWrite, size, handled, nanos);
+}
+
+void IOStatistics::RecordExit(IOExitKind kind, uint32_t accesses, uint64_t nanos) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_exitStats[kind].accesses += accesses;
+    m_exitStats[kind].latency.Record(nanos);
+}
+
+void IOStatistics::Reset() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (int i = 0; i < 2; i++) {
+        m_deviceStats[i].clear();
+        m_regionStats[i].clear();
+    }
+    for (int i = 0; i < IO_EXIT_KIND_COUNT; i++) {
+        m_exitStats[i] = IOExitStats();
+    }
+}
+
+bool IOStatistics::GetDeviceStats(IOAccessSpace space, IODevice *device, IOAccessStats *stats) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_deviceStats[space].find(device);
+    if (it == m_deviceStats[space].end()) {
+        return false;
+    }
+    *stats = it->second;
+    return true;
+}
+
+bool IOStatistics::GetRegionStats(IOAccessSpace space, uint32_t addr, IOAccessStats *stats) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    auto it = m_regionStats[space].find(addr >> IOSTATS_REGION_SHIFT);
+    if (it == m_regionStats[space].end()) {
+        return false;
+    }
+    *stats = it->second;
+    return true;
+}
+
+void IOStatistics::GetExitStats(IOExitKind kind, IOExitStats *stats) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    *stats = m_exitStats[kind];
+}
+
+bool IOStatistics::DumpJSON(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) {
+        log_warning("IOStatistics::DumpJSON: Could not open %s for writing\n", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+
+    fprintf(fp, "{\n  \"exits\": {");
+    for (int i = 0; i < IO_EXIT_KIND_COUNT; i++) {
+        fprintf(fp, "%s\n    \"%s\": ", (i == 0) ? "" : ",", kExitNames[i]);
+        m_exitStats[i].WriteJSON(fp);
+    }
+    fprintf(fp, "\n  }");
+
+    for (int space = 0; space < 2; space++) {
+        fprintf(fp, ",\n  \"%s_devices\": [", kSpaceNames[space]);
+        bool first = true;
+        for (auto it = m_deviceStats[space].begin(); it != m_deviceStats[space].end(); ++it) {
+            auto name = m_deviceNames.find(it->first);
+            fprintf(fp, "%s\n    { \"device\": \"", first ? "" : ",");
+            if (name != m_deviceNames.end()) {
+                fprintf(fp, "%s", name->second.c_str());
+            }
+            else {
+                fprintf(fp, "%p", (void *)it->first);
+            }
+            fprintf(fp, "\", \"stats\": ");
+            it->second.WriteJSON(fp);
+            fprintf(fp, " }");
+            first = false;
+        }
+        fprintf(fp, "\n  ]");
+
+        fprintf(fp, ",\n  \"%s_regions\": [", kSpaceNames[space]);
+        first = true;
+        for (auto it = m_regionStats[space].begin(); it != m_regionStats[space].end(); ++it) {
+            fprintf(fp, "%s\n    { \"base\": \"0x%08x\", \"stats\": ", first ? "" : ",", it->first << IOSTATS_REGION_SHIFT);
+            it->second.WriteJSON(fp);
+            fprintf(fp, " }");
+            first = false;
+        }
+        fprintf(fp, "\n  ]");
+    }
+
+    fprintf(fp, "\n}\n");
+    fclose(fp);
+    return true;
+}
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace vixen {
+
+class IODevice;
+
+// Number of buckets in the latency histograms. Bucket N counts accesses that
+// took between 2^N and 2^(N+1)-1 nanoseconds; the last bucket also counts
+// anything slower.
+#define IOSTATS_LATENCY_BUCKETS  32
+
+// Granularity of the per-region statistics
+#define IOSTATS_REGION_SHIFT     12
+
+/*!
+ * Address space of an I/O access.
+ */
+enum IOAccessSpace {
+    IO_SPACE_PIO,
+    IO_SPACE_MMIO,
+};
+
+/*!
+ * Kinds of CPU exits that are accounted for separately from device accesses.
+ */
+enum IOExitKind {
+    IO_EXIT_PIO,
+    IO_EXIT_MMIO,
+    IO_EXIT_KIND_COUNT,
+};
+
+/*!
+ * Log-scale latency histogram.
+ */
+struct IOLatencyStats {
+    uint64_t count = 0;
+    uint64_t totalNanos = 0;
+    uint64_t maxNanos = 0;
+    uint64_t histogram[IOSTATS_LATENCY_BUCKETS] = { 0 };
+
+    void Record(uint64_t nanos);
+    void WriteJSON(FILE *fp) const;
+};
+
+/*!
+ * Accumulated statistics for a set of I/O accesses.
+ */
+struct IOAccessStats {
+    uint64_t reads = 0;
+    uint64_t writes = 0;
+    uint64_t unhandled = 0;
+
+    // Accesses by size: 1, 2, 4 and other sizes
+    uint64_t sizes[4] = { 0 };
+
+    IOLatencyStats latency;
+
+    void Record(bool isWrite, uint8_t size, bool handled, uint64_t nanos);
+    void WriteJSON(FILE *fp) const;
+};
+
+/*!
+ * Accumulated statistics for a kind of CPU exit.
+ */
+struct IOExitStats {
+    // Number of device accesses performed while handling the exits
+    uint64_t accesses = 0;
+
+    IOLatencyStats latency;
+
+    void WriteJSON(FILE *fp) const;
+};
+
+/*!
+ * Collects I/O and MMIO access statistics per device and per 4 KiB region,
+ * as well as the total time spent handling each kind of CPU exit.
+ *
+ * Recording is thread-safe. The data is meant to be inspected after (or
+ * while) the emulator runs through the accessor methods or dumped as JSON.
+ */
+class IOStatistics {
+public:
+    typedef std::chrono::high_resolution_clock Clock;
+
+    /*!
+     * Assigns a human-readable name to a device for reporting.
+     */
+    void SetDeviceName(IODevice *device, const char *name);
+
+    /*!
+     * Records a single device access.
+     */
+    void RecordAccess(IOAccessSpace space, IODevice *device, uint32_t addr, bool isWrite, uint8_t size, bool handled, uint64_t nanos);
+
+    /*!
+     * Records the handling of a CPU exit caused by I/O, including all device
+     * accesses performed while handling it.
+     */
+    void RecordExit(IOExitKind kind, uint32_t accesses, uint64_t nanos);
+
+    /*!
+     * Clears all accumulated statistics. Device names are preserved.
+     */
+    void Reset();
+
+    /*!
+     * Retrieves a snapshot of the statistics for a device. Returns false if
+     * the device was never accessed.
+     */
+    bool GetDeviceStats(IOAccessSpace space, IODevice *device, IOAccessStats *stats);
+
+    /*!
+     * Retrieves a snapshot of the statistics for the 4 KiB region containing
+     * the specified address. Returns false if the region was never accessed.
+     */
+    bool GetRegionStats(IOAccessSpace space, uint32_t addr, IOAccessStats *stats);
+
+    /*!
+     * Retrieves a snapshot of the statistics for an exit kind.
+     */
+    void GetExitStats(IOExitKind kind, IOExitStats *stats);
+
+    /*!
+     * Writes all statistics to the specified file in JSON format.
+     */
+    bool DumpJSON(const char *path);
+
+    /*!
+     * Returns the number of nanoseconds elapsed since the specified time.
+     */
+    static inline uint64_t NanosSince(Clock::time_point start) {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    }
+
+private:
+    std::mutex m_mutex;
+
+    std::map<IODevice *, std::string> m_deviceNames;
+    std::map<IODevice *, IOAccessStats> m_deviceStats[2];
+    std::map<uint32_t, IOAccessStats> m_regionStats[2];
+    IOExitStats m_exitStats[IO_EXIT_KIND_COUNT];
+};
+
+}
@@ -0,0 +1,72 @@
+#if defined(__linux__) || defined(LINUX)
+
+#include "vixen/fileimage.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vixen {
+
+class LinuxSharedFileImage : public SharedFileImage {
+public:
+    LinuxSharedFileImage(int fd, const uint8_t *data, uint64_t size);
+    ~LinuxSharedFileImage();
+
+    bool MapCopyOnWrite(void *address, size_t size) const override;
+private:
+    int m_fd;
+};
+
+SharedFileImage *SharedFileImage_Map(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return nullptr;
+    }
+
+    return new LinuxSharedFileImage(fd, (const uint8_t *)data, st.st_size);
+}
+
+LinuxSharedFileImage::LinuxSharedFileImage(int fd, const uint8_t *data, uint64_t size)
+    : m_fd(fd)
+{
+    m_data = data;
+    m_size = size;
+}
+
+LinuxSharedFileImage::~LinuxSharedFileImage() {
+    munmap((void *)m_data, m_size);
+    close(m_fd);
+}
+
+bool LinuxSharedFileImage::MapCopyOnWrite(void *address, size_t size) const {
+    if (size > m_size) {
+        return false;
+    }
+
+    void *view = mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, m_fd, 0);
+    if (view != MAP_FAILED) {
+        return true;
+    }
+
+    // A failed fixed mapping may have unmapped the previous memory
+    mmap(address, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+    return false;
+}
+
+}
+
+#endif // LINUX
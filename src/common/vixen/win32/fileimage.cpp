@@ -0,0 +1,69 @@
+#ifdef _WIN32
+
+#include "vixen/fileimage.h"
+
+#include <Windows.h>
+
+namespace vixen {
+
+class Win32SharedFileImage : public SharedFileImage {
+public:
+	Win32SharedFileImage(HANDLE hFile, HANDLE hMapping, const uint8_t *data, uint64_t size);
+	~Win32SharedFileImage();
+
+	bool MapCopyOnWrite(void *address, size_t size) const override;
+private:
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+};
+
+SharedFileImage *SharedFileImage_Map(const std::string& path) {
+	HANDLE hFile = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE) {
+		return nullptr;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(hFile, &size) || size.QuadPart <= 0) {
+		CloseHandle(hFile);
+		return nullptr;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL) {
+		CloseHandle(hFile);
+		return nullptr;
+	}
+
+	void *data = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL) {
+		CloseHandle(hMapping);
+		CloseHandle(hFile);
+		return nullptr;
+	}
+
+	return new Win32SharedFileImage(hFile, hMapping, (const uint8_t *)data, size.QuadPart);
+}
+
+Win32SharedFileImage::Win32SharedFileImage(HANDLE hFile, HANDLE hMapping, const uint8_t *data, uint64_t size)
+	: m_hFile(hFile)
+	, m_hMapping(hMapping)
+{
+	m_data = data;
+	m_size = size;
+}
+
+Win32SharedFileImage::~Win32SharedFileImage() {
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+}
+
+bool Win32SharedFileImage::MapCopyOnWrite(void *address, size_t size) const {
+	// Views cannot be placed over memory that is already allocated
+	return false;
+}
+
+}
+
+#endif // _WIN32
@@ -62,27 +62,20 @@ static void parseCR4Flags(uint32_t flags, char *str) {
 void DumpCPURegisters(Cpu *cpu) {
 	char temp[128];
 
-    CpuReg regs[] = {
-        REG_CS, REG_EIP, REG_EBP,
-        REG_SS, REG_EAX, REG_ESP,
-        REG_DS, REG_ECX, REG_CR0,
-        REG_ES, REG_EDX, REG_CR2,
-        REG_FS, REG_EBX, REG_CR3,
-        REG_GS, REG_ESI, REG_CR4,
-        REG_TR, REG_EDI, REG_EFLAGS,
-    };
-    uint32_t vals[ARRAY_SIZE(regs)];
-
-    cpu->RegRead(regs, vals, ARRAY_SIZE(regs));
+    RegisterFile regs;
+    cpu->GetRegisterFile(&regs);
+    uint32_t cr0 = regs.Get(REG_CR0);
+    uint32_t cr4 = regs.Get(REG_CR4);
+    uint32_t eflags = regs.Get(REG_EFLAGS);
 	
-	/*                          */ log_debug("CPU registers:\n");
-    /*                          */ log_debug(" CS = %04x  EIP = %08x  EBP = %08x\n", vals[0], vals[1], vals[2]);
-    /*                          */ log_debug(" SS = %04x  EAX = %08x  ESP = %08x\n", vals[3], vals[4], vals[5]);
-    parseCR0Flags(vals[8], temp);  log_debug(" DS = %04x  ECX = %08x  CR0 = %08x  %s\n", vals[6], vals[7], vals[8], temp);
-    /*                          */ log_debug(" ES = %04x  EDX = %08x  CR2 = %08x\n", vals[9], vals[10], vals[11]);
-    /*                          */ log_debug(" FS = %04x  EBX = %08x  CR3 = %08x\n", vals[12], vals[13], vals[14]);
-    parseCR4Flags(vals[17], temp); log_debug(" GS = %04x  ESI = %08x  CR4 = %08x  %s\n", vals[15], vals[16], vals[17], temp);
-    parseEFlags(vals[20], temp);   log_debug(" TR = %04x  EDI = %08x  EFL = %08x  %s\n", vals[18], vals[19], vals[20], temp);
+	/*                        */ log_debug("CPU registers:\n");
+    /*                        */ log_debug(" CS = %04x  EIP = %08x  EBP = %08x\n", regs.Get(REG_CS), regs.Get(REG_EIP), regs.Get(REG_EBP));
+    /*                        */ log_debug(" SS = %04x  EAX = %08x  ESP = %08x\n", regs.Get(REG_SS), regs.Get(REG_EAX), regs.Get(REG_ESP));
+    parseCR0Flags(cr0, temp);    log_debug(" DS = %04x  ECX = %08x  CR0 = %08x  %s\n", regs.Get(REG_DS), regs.Get(REG_ECX), cr0, temp);
+    /*                        */ log_debug(" ES = %04x  EDX = %08x  CR2 = %08x\n", regs.Get(REG_ES), regs.Get(REG_EDX), regs.Get(REG_CR2));
+    /*                        */ log_debug(" FS = %04x  EBX = %08x  CR3 = %08x\n", regs.Get(REG_FS), regs.Get(REG_EBX), regs.Get(REG_CR3));
+    parseCR4Flags(cr4, temp);    log_debug(" GS = %04x  ESI = %08x  CR4 = %08x  %s\n", regs.Get(REG_GS), regs.Get(REG_ESI), cr4, temp);
+    parseEFlags(eflags, temp);   log_debug(" TR = %04x  EDI = %08x  EFL = %08x  %s\n", regs.Get(REG_TR), regs.Get(REG_EDI), eflags, temp);
 
 
 	uint32_t base;
@@ -221,37 +221,28 @@ int GdbServer::Debug(int signal)
     m_dbg_state.signum = signal;
 
     // Load Registers
-    {
-        CpuReg regs[] = {
-            REG_EAX, REG_ECX, REG_EDX, REG_EBX,
-            REG_ESP, REG_EBP, REG_ESI, REG_EDI,
-            REG_EIP, REG_EFLAGS,
-            REG_CS, REG_SS, REG_DS, REG_ES, REG_FS, REG_GS
-        };
-        uint32_t vals[ARRAY_SIZE(regs)];
-
-        m_cpu->RegRead(regs, vals, ARRAY_SIZE(regs));
-
-        m_dbg_state.registers[DBG_CPU_I386_REG_EAX] = vals[0];
-        m_dbg_state.registers[DBG_CPU_I386_REG_ECX] = vals[1];
-        m_dbg_state.registers[DBG_CPU_I386_REG_EDX] = vals[2];
-        m_dbg_state.registers[DBG_CPU_I386_REG_EBX] = vals[3];
-
-        m_dbg_state.registers[DBG_CPU_I386_REG_ESP] = vals[4];
-        m_dbg_state.registers[DBG_CPU_I386_REG_EBP] = vals[5];
-        m_dbg_state.registers[DBG_CPU_I386_REG_ESI] = vals[6];
-        m_dbg_state.registers[DBG_CPU_I386_REG_EDI] = vals[7];
-
-        m_dbg_state.registers[DBG_CPU_I386_REG_PC] = vals[8];
-        m_dbg_state.registers[DBG_CPU_I386_REG_PS] = vals[9];
-
-        m_dbg_state.registers[DBG_CPU_I386_REG_CS] = vals[10];
-        m_dbg_state.registers[DBG_CPU_I386_REG_SS] = vals[11];
-        m_dbg_state.registers[DBG_CPU_I386_REG_DS] = vals[12];
-        m_dbg_state.registers[DBG_CPU_I386_REG_ES] = vals[13];
-        m_dbg_state.registers[DBG_CPU_I386_REG_FS] = vals[14];
-        m_dbg_state.registers[DBG_CPU_I386_REG_GS] = vals[15];
-    }
+    RegisterFile regs;
+    m_cpu->GetRegisterFile(&regs);
+
+    m_dbg_state.registers[DBG_CPU_I386_REG_EAX] = regs.Get(REG_EAX);
+    m_dbg_state.registers[DBG_CPU_I386_REG_ECX] = regs.Get(REG_ECX);
+    m_dbg_state.registers[DBG_CPU_I386_REG_EDX] = regs.Get(REG_EDX);
+    m_dbg_state.registers[DBG_CPU_I386_REG_EBX] = regs.Get(REG_EBX);
+
+    m_dbg_state.registers[DBG_CPU_I386_REG_ESP] = regs.Get(REG_ESP);
+    m_dbg_state.registers[DBG_CPU_I386_REG_EBP] = regs.Get(REG_EBP);
+    m_dbg_state.registers[DBG_CPU_I386_REG_ESI] = regs.Get(REG_ESI);
+    m_dbg_state.registers[DBG_CPU_I386_REG_EDI] = regs.Get(REG_EDI);
+
+    m_dbg_state.registers[DBG_CPU_I386_REG_PC] = regs.Get(REG_EIP);
+    m_dbg_state.registers[DBG_CPU_I386_REG_PS] = regs.Get(REG_EFLAGS);
+
+    m_dbg_state.registers[DBG_CPU_I386_REG_CS] = regs.Get(REG_CS);
+    m_dbg_state.registers[DBG_CPU_I386_REG_SS] = regs.Get(REG_SS);
+    m_dbg_state.registers[DBG_CPU_I386_REG_DS] = regs.Get(REG_DS);
+    m_dbg_state.registers[DBG_CPU_I386_REG_ES] = regs.Get(REG_ES);
+    m_dbg_state.registers[DBG_CPU_I386_REG_FS] = regs.Get(REG_FS);
+    m_dbg_state.registers[DBG_CPU_I386_REG_GS] = regs.Get(REG_GS);
 
     // If interrupt was caused by a soft breakpoint (int3 = CCh), EIP will point
     // to the instruction *after* the int3 instruction, which is probably in
@@ -269,30 +260,21 @@ int GdbServer::Debug(int signal)
     }
 
 #if 1
-    {
-        // Restore Registers
-        CpuReg regs[] = {
-           REG_EAX, REG_ECX, REG_EDX, REG_EBX,
-           REG_ESP, REG_EBP, REG_ESI, REG_EDI,
-           REG_EIP, REG_EFLAGS
-        };
-        uint32_t vals[] = {
-            m_dbg_state.registers[DBG_CPU_I386_REG_EAX],
-            m_dbg_state.registers[DBG_CPU_I386_REG_ECX],
-            m_dbg_state.registers[DBG_CPU_I386_REG_EDX],
-            m_dbg_state.registers[DBG_CPU_I386_REG_EBX],
-
-            m_dbg_state.registers[DBG_CPU_I386_REG_ESP],
-            m_dbg_state.registers[DBG_CPU_I386_REG_EBP],
-            m_dbg_state.registers[DBG_CPU_I386_REG_ESI],
-            m_dbg_state.registers[DBG_CPU_I386_REG_EDI],
-
-            m_dbg_state.registers[DBG_CPU_I386_REG_PC],
-            m_dbg_state.registers[DBG_CPU_I386_REG_PS]
-        };
-
-        m_cpu->RegWrite(regs, vals, ARRAY_SIZE(regs));
+    // Restore Registers, writing back only the ones that were modified
+    struct { CpuReg reg; int dbgReg; } restore[] = {
+        { REG_EAX, DBG_CPU_I386_REG_EAX }, { REG_ECX, DBG_CPU_I386_REG_ECX },
+        { REG_EDX, DBG_CPU_I386_REG_EDX }, { REG_EBX, DBG_CPU_I386_REG_EBX },
+        { REG_ESP, DBG_CPU_I386_REG_ESP }, { REG_EBP, DBG_CPU_I386_REG_EBP },
+        { REG_ESI, DBG_CPU_I386_REG_ESI }, { REG_EDI, DBG_CPU_I386_REG_EDI },
+        { REG_EIP, DBG_CPU_I386_REG_PC }, { REG_EFLAGS, DBG_CPU_I386_REG_PS },
+    };
+    for (size_t i = 0; i < ARRAY_SIZE(restore); i++) {
+        uint32_t value = m_dbg_state.registers[restore[i].dbgReg];
+        if (value != regs.Get(restore[i].reg)) {
+            regs.Set(restore[i].reg, value);
+        }
     }
+    m_cpu->SetRegisterFile(&regs);
 #endif
 
     return 0;
@@ -38,19 +38,15 @@ bool ImageDVDDriveATADeviceDriver::LoadImageFile(const char *imagePath, bool cop
     //   XISODiskImageProvider
     //   ...
 
-    // TODO: Use memory-mapped I/O
-
     // Try to load the image file
-    m_fpImage = NULL;
-    auto err = fopen_s(&m_fpImage, imagePath, "rb");
-    if (err) {
-        log_fatal("ImageDVDDriveATADeviceDriver::LoadImage:  Could not open image \"%s\": error code 0x%x\n", imagePath, err);
+    m_image = SharedFileImage::Open(imagePath);
+    if (m_image == nullptr) {
+        log_fatal("ImageDVDDriveATADeviceDriver::LoadImage:  Could not open image \"%s\"\n", imagePath);
         return false;
     }
 
     // Determine image file size
-    fseek(m_fpImage, 0, SEEK_END);
-    uint64_t imageSize = _ftelli64(m_fpImage);
+    uint64_t imageSize = m_image->GetSize();
     uint64_t imageSizeInSectors = imageSize / kDVDSectorSize;
     log_info("ImageDVDDriveATADeviceDriver::LoadImage:  Loaded image \"%s\": %llu bytes -> %llu sectors\n", imagePath, imageSize, imageSizeInSectors);
     if (imageSizeInSectors > kMaxSectorsDVDDualLayer) {
@@ -64,14 +60,13 @@ bool ImageDVDDriveATADeviceDriver::LoadImageFile(const char *imagePath, bool cop
 }
 
 bool ImageDVDDriveATADeviceDriver::EjectMedium() {
-    if (m_fpImage == NULL) {
+    if (m_image == nullptr) {
         log_warning("ImageDVDDriveATADeviceDriver::EjectMedium:  No medium to eject\n");
         return false;
     }
 
     log_info("ImageDVDDriveATADeviceDriver::EjectMedium:  Medium ejected\n");
-    fclose(m_fpImage);
-    m_fpImage = NULL;
+    m_image = nullptr;
     // TODO: should we notify media removal?
     return true;
 }
@@ -80,12 +75,12 @@ bool ImageDVDDriveATADeviceDriver::Read(uint64_t byteAddress, uint8_t *buffer, u
     // TODO: maybe handle caching? Could improve performance if accessing real media on supported drives
     // Should also honor the cache flags
     // Image not loaded
-    if (m_fpImage == NULL) {
+    if (m_image == nullptr) {
         return false;
     }
 
-    // Seek address
-    if (_fseeki64(m_fpImage, byteAddress, SEEK_SET)) {
+    // Read is successful if the full size is within the image
+    if (byteAddress > m_image->GetSize() || size > m_image->GetSize() - byteAddress) {
         return false;
     }
 
@@ -93,10 +88,8 @@ bool ImageDVDDriveATADeviceDriver::Read(uint64_t byteAddress, uint8_t *buffer, u
     // TODO: handle copy-on-write
     // If copy-on-write and the sector is copied, read from copy, otherwise read from image file
     // If not copy-on-write, read from image file directly
-    int lenRead = fread(buffer, 1, size, m_fpImage);
-
-    // Read is successful if the full size is read
-    return lenRead == size;
+    memcpy(buffer, m_image->GetData() + byteAddress, size);
+    return true;
 }
 
 }
@@ -12,7 +12,9 @@
 #pragma once
 
 #include <cstdint>
+#include <memory>
 
+#include "vixen/fileimage.h"
 #include "drv_vdvd_base.h"
 
 namespace vixen {
@@ -25,6 +27,9 @@ namespace ata {
  * It can read/write directly to the image file or use write-on-copy, in which
  * case all writes done on a temporary file and subsequent reads to overwritten
  * sectors are redirected to the temporary file.
+ *
+ * The image is memory-mapped and shared with every other drive in the
+ * process that loads the same file.
  */
 class ImageDVDDriveATADeviceDriver : public BaseDVDDriveATADeviceDriver {
 public:
@@ -42,11 +47,11 @@ public:
 
     // ----- Medium -----------------------------------------------------------
 
-    bool HasMedium() override { return m_fpImage != NULL; }
+    bool HasMedium() override { return m_image != nullptr; }
     uint32_t GetMediumCapacitySectors() override { return m_sectorCapacity; }
 
 private:
-    FILE *m_fpImage = NULL;
+    std::shared_ptr<SharedFileImage> m_image;
     bool m_copyOnWrite;
 
     uint64_t m_sectorCapacity;
@@ -27,77 +27,439 @@
  */
 #include "i8254.h"
 
-#include <vixen/thread.h>
+#include "vixen/log.h"
 
 namespace vixen {
 
-// TODO: Refer to QEMU if we ever need to complete this implementation:
-// https://github.com/qemu/qemu/blob/master/hw/timer/i8254_common.c
-// https://github.com/qemu/qemu/blob/master/hw/timer/i8254.c
+// Read/write states of the counter registers
+#define RW_STATE_LSB     1
+#define RW_STATE_MSB     2
+#define RW_STATE_WORD0   3
+#define RW_STATE_WORD1   4
 
+#define NANOSECONDS_PER_SECOND 1000000000ULL
 
-// i8254 timer thread function
-static uint32_t i8254ThreadFunc(void *data) {
-    Thread_SetName("[HW] i8254");
-    i8254 *pit = (i8254 *)data;
-    pit->Run();
-    return 0;
+// Maximum amount of virtual time the IRQ timer may run late before missed
+// output transitions are dropped instead of being replayed
+static const uint64_t kMaxTimerLag = 50 * 1000 * 1000;
+
+static inline uint64_t muldiv64(uint64_t a, uint32_t b, uint32_t c) {
+    union {
+        uint64_t ll;
+        struct {
+            uint32_t low, high;
+        } l;
+    } u, res;
+    uint64_t rl, rh;
+
+    u.ll = a;
+    rl = (uint64_t)u.l.low * (uint64_t)b;
+    rh = (uint64_t)u.l.high * (uint64_t)b;
+    rh += (rl >> 32);
+    res.l.high = rh / c;
+    res.l.low = (((rh % c) << 32) + (rl & 0xffffffff)) / c;
+    return res.ll;
+}
+
+// Converts virtual time elapsed since the count was loaded into PIT ticks
+static inline uint64_t ElapsedTicks(PITChannel& channel, uint64_t now) {
+    if (now <= channel.countLoadTime) {
+        return 0;
+    }
+    return muldiv64(now - channel.countLoadTime, PIT_FREQUENCY, NANOSECONDS_PER_SECOND);
+}
+
+void i8254::TimerCB(void *userData) {
+    i8254 *pit = (i8254 *)userData;
+    std::lock_guard<std::mutex> lk(pit->m_lock);
+
+    // Evaluate the output at the transition itself so that short pulses are
+    // not missed, unless the timer is running so late that it would have to
+    // replay a long series of transitions
+    uint64_t now = pit->m_scheduler.Now();
+    uint64_t time = pit->m_channels[0].nextTransitionTime;
+    if (now > time + kMaxTimerLag) {
+        time = now;
+    }
+    pit->UpdateIRQ(time);
 }
 
-i8254::i8254(IRQHandler& irqHandler, float tickRate)
+i8254::i8254(IRQHandler& irqHandler, Scheduler& scheduler, bool inKernel)
     : m_irqHandler(irqHandler)
-    , m_tickRate(tickRate)
-    , m_running(false)
+    , m_scheduler(scheduler)
+    , m_inKernel(inKernel)
 {
+    // The timer fires on the scheduler thread
+    SetDeviceLock(&m_lock);
+
+    m_timer = new ScheduledTimer(scheduler, TimerCB, this);
 }
 
 i8254::~i8254() {
-    m_running = false;
-    if (m_timerThread.joinable()) {
-        m_timerThread.join();
-    }
+    delete m_timer;
 }
 
 void i8254::Reset() {
-    m_running = false;
+    std::lock_guard<std::mutex> lk(m_lock);
+    m_timer->Cancel();
+
+    uint64_t now = m_scheduler.Now();
+    for (int i = 0; i < PIT_NUM_CHANNELS; i++) {
+        PITChannel& channel = m_channels[i];
+        memset(&channel, 0, sizeof(channel));
+        channel.mode = 3;
+        channel.gate = (i != 2);
+        channel.countLoadTime = now;
+        channel.nextTransitionTime = UINT64_MAX;
+    }
+    m_speakerDataOn = false;
+    m_refreshToggle = false;
+
+    if (!m_inKernel) {
+        m_irqHandler.HandleIRQ(PIT_IRQ, 0);
+    }
 }
 
 bool i8254::MapIO(IOMapper *mapper) {
+    // The in-kernel PIT handles the ports itself, including port 0x61
+    if (m_inKernel) {
+        return true;
+    }
+
     if (!mapper->MapIODevice(PORT_PIT_BASE, PORT_PIT_COUNT, this)) return false;
+    if (!mapper->MapIODevice(PORT_PIT_SPEAKER, 1, this)) return false;
 
     return true;
 }
 
 bool i8254::IORead(uint32_t port, uint32_t *value, uint8_t size) {
-    *value = 0;
+    switch (port) {
+    case PORT_PIT_DATA_0:
+    case PORT_PIT_DATA_1:
+    case PORT_PIT_DATA_2:
+        *value = ReadCount(m_channels[port - PORT_PIT_DATA_0]);
+        break;
+    case PORT_PIT_SPEAKER:
+        *value = ReadSpeakerPort();
+        break;
+    default:
+        // The command register is write-only
+        *value = 0xff;
+        break;
+    }
     return true;
 }
 
 bool i8254::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
-    // HACK: The Xbox always inits the PIT to the same value:
-    //   Timer 0, Mode 2, 1ms interrupt interval.
-    // Rather than fully implement the PIC, we just wait for the command to
-    // start operating, and then simply issue IRQ 0 in a timer thread.
-    if (value == 0x34) {
-        m_running = true;
-        m_timerThread = std::thread(i8254ThreadFunc, this);
+    switch (port) {
+    case PORT_PIT_DATA_0:
+    case PORT_PIT_DATA_1:
+    case PORT_PIT_DATA_2:
+        WriteCount(m_channels[port - PORT_PIT_DATA_0], value);
+        break;
+    case PORT_PIT_COMMAND:
+        WriteCommand(value);
+        break;
+    case PORT_PIT_SPEAKER:
+        WriteSpeakerPort(value);
+        break;
     }
     return true;
 }
 
-void i8254::Run() {
-    using namespace std::chrono;
-    auto nextStop = high_resolution_clock::now();
-    auto interval = duration<long long, std::ratio<1, 1000000>>((long long)(1000000.0f / m_tickRate));
+// ----- Registers ------------------------------------------------------------
+
+void i8254::WriteCommand(uint8_t value) {
+    uint8_t channelNum = value >> 6;
+    if (channelNum == 3) {
+        // Read-back command
+        uint64_t now = m_scheduler.Now();
+        for (int i = 0; i < PIT_NUM_CHANNELS; i++) {
+            PITChannel& channel = m_channels[i];
+            if ((value & (2 << i)) == 0) {
+                continue;
+            }
+            if ((value & 0x20) == 0) {
+                LatchCount(channel);
+            }
+            if ((value & 0x10) == 0 && !channel.statusLatched) {
+                channel.status = (GetOut(channel, now) << 7) | (channel.count == 0) << 6 |
+                    (channel.rwMode << 4) | (channel.mode << 1) | channel.bcd;
+                channel.statusLatched = true;
+            }
+        }
+        return;
+    }
+
+    PITChannel& channel = m_channels[channelNum];
+    uint8_t access = (value >> 4) & 3;
+    if (access == 0) {
+        // Counter latch command
+        LatchCount(channel);
+        return;
+    }
+
+    // Programming a mode stops the counter until a new count is written.
+    // Modes 6 and 7 are aliases of modes 2 and 3.
+    channel.rwMode = access;
+    channel.readState = access;
+    channel.writeState = access;
+    channel.mode = (value >> 1) & 7;
+    if (channel.mode > 5) {
+        channel.mode -= 4;
+    }
+    channel.bcd = value & 1;
+    channel.count = 0;
+    channel.countLatched = 0;
+    channel.statusLatched = false;
+    if (channelNum == 0) {
+        m_timer->Cancel();
+        channel.nextTransitionTime = UINT64_MAX;
+    }
+}
+
+void i8254::WriteCount(PITChannel& channel, uint8_t value) {
+    switch (channel.writeState) {
+    default:
+    case RW_STATE_LSB:
+        LoadCount(channel, value);
+        break;
+    case RW_STATE_MSB:
+        LoadCount(channel, value << 8);
+        break;
+    case RW_STATE_WORD0:
+        channel.writeLatch = value;
+        channel.writeState = RW_STATE_WORD1;
+        break;
+    case RW_STATE_WORD1:
+        LoadCount(channel, channel.writeLatch | (value << 8));
+        channel.writeState = RW_STATE_WORD0;
+        break;
+    }
+}
+
+uint8_t i8254::ReadCount(PITChannel& channel) {
+    if (channel.statusLatched) {
+        channel.statusLatched = false;
+        return channel.status;
+    }
+
+    if (channel.countLatched) {
+        uint8_t value;
+        switch (channel.countLatched) {
+        default:
+        case RW_STATE_LSB:
+            value = channel.latchedCount & 0xff;
+            channel.countLatched = 0;
+            break;
+        case RW_STATE_MSB:
+            value = channel.latchedCount >> 8;
+            channel.countLatched = 0;
+            break;
+        case RW_STATE_WORD0:
+            value = channel.latchedCount & 0xff;
+            channel.countLatched = RW_STATE_MSB;
+            break;
+        }
+        return value;
+    }
+
+    uint16_t count = GetCount(channel, m_scheduler.Now());
+    switch (channel.readState) {
+    default:
+    case RW_STATE_LSB:
+        return count & 0xff;
+    case RW_STATE_MSB:
+        return count >> 8;
+    case RW_STATE_WORD0:
+        channel.readState = RW_STATE_WORD1;
+        return count & 0xff;
+    case RW_STATE_WORD1:
+        channel.readState = RW_STATE_WORD0;
+        return count >> 8;
+    }
+}
+
+uint8_t i8254::ReadSpeakerPort() {
+    // Bit 4 toggles with every DRAM refresh cycle; software only polls it
+    // for changes
+    m_refreshToggle = !m_refreshToggle;
+
+    PITChannel& channel = m_channels[2];
+    return channel.gate
+        | (m_speakerDataOn << 1)
+        | (m_refreshToggle << 4)
+        | (GetOut(channel, m_scheduler.Now()) << 5);
+}
+
+void i8254::WriteSpeakerPort(uint8_t value) {
+    SetGate(m_channels[2], value & 1);
+    m_speakerDataOn = (value >> 1) & 1;
+}
+
+// ----- Counters -------------------------------------------------------------
+
+void i8254::LoadCount(PITChannel& channel, uint32_t value) {
+    if (value == 0) {
+        value = 0x10000;
+    }
+    channel.count = value;
+    channel.countLoadTime = m_scheduler.Now();
+    if (&channel == &m_channels[0]) {
+        UpdateIRQ(channel.countLoadTime);
+    }
+}
+
+void i8254::LatchCount(PITChannel& channel) {
+    if (!channel.countLatched) {
+        channel.latchedCount = GetCount(channel, m_scheduler.Now());
+        channel.countLatched = channel.rwMode;
+    }
+}
+
+void i8254::SetGate(PITChannel& channel, bool gate) {
+    switch (channel.mode) {
+    case 1:
+    case 2:
+    case 3:
+    case 5:
+        // Restart counting on the rising edge
+        if (!channel.gate && gate) {
+            channel.countLoadTime = m_scheduler.Now();
+            if (&channel == &m_channels[0]) {
+                UpdateIRQ(channel.countLoadTime);
+            }
+        }
+        break;
+    default:
+        // Modes 0 and 4 should pause counting while the gate is low
+        break;
+    }
+    channel.gate = gate;
+}
+
+uint16_t i8254::GetCount(PITChannel& channel, uint64_t now) {
+    if (channel.count == 0) {
+        return 0;
+    }
+
+    uint64_t ticks = ElapsedTicks(channel, now);
+    switch (channel.mode) {
+    case 0:
+    case 1:
+    case 4:
+    case 5:
+        return (channel.count - ticks) & 0xffff;
+    case 3:
+        // Square wave counters decrement by two
+        return channel.count - ((2 * ticks) % channel.count);
+    default:
+        return channel.count - (ticks % channel.count);
+    }
+}
+
+bool i8254::GetOut(PITChannel& channel, uint64_t now) {
+    if (channel.count == 0) {
+        return false;
+    }
+
+    uint64_t ticks = ElapsedTicks(channel, now);
+    switch (channel.mode) {
+    default:
+    case 0:
+    case 1:
+        // Low until the terminal count
+        return ticks >= channel.count;
+    case 2:
+        // Low for one clock before reloading
+        return (ticks % channel.count) != channel.count - 1;
+    case 3:
+        // High for the first half of the period, low for the second
+        return (ticks % channel.count) < ((channel.count + 1) >> 1);
+    case 4:
+    case 5:
+        // Low for one clock at the terminal count
+        return ticks != channel.count;
+    }
+}
+
+uint64_t i8254::GetNextTransitionTime(PITChannel& channel, uint64_t now) {
+    if (channel.count == 0) {
+        return UINT64_MAX;
+    }
 
-    m_running = true;
-    while (m_running) {
-        m_irqHandler.HandleIRQ(0, 1);
+    uint64_t ticks = ElapsedTicks(channel, now);
+    uint64_t nextTicks;
+    uint64_t base;
+    switch (channel.mode) {
+    default:
+    case 0:
+    case 1:
+        if (ticks >= channel.count) {
+            return UINT64_MAX;
+        }
+        nextTicks = channel.count;
+        break;
+    case 2:
+        if (channel.count < 2) {
+            return UINT64_MAX;
+        }
+        base = (ticks / channel.count) * channel.count;
+        if (ticks - base < channel.count - 1) {
+            nextTicks = base + channel.count - 1;
+        }
+        else {
+            nextTicks = base + channel.count;
+        }
+        break;
+    case 3:
+    {
+        base = (ticks / channel.count) * channel.count;
+        uint32_t halfPeriod = (channel.count + 1) >> 1;
+        if (ticks - base < halfPeriod) {
+            nextTicks = base + halfPeriod;
+        }
+        else {
+            nextTicks = base + channel.count;
+        }
+        break;
+    }
+    case 4:
+    case 5:
+        if (ticks < channel.count) {
+            nextTicks = channel.count;
+        }
+        else if (ticks == channel.count) {
+            nextTicks = channel.count + 1;
+        }
+        else {
+            return UINT64_MAX;
+        }
+        break;
+    }
 
-        nextStop += interval;
-        std::this_thread::sleep_until(nextStop);
+    // Round up so that the output has changed when the timer expires
+    uint64_t next = channel.countLoadTime + muldiv64(nextTicks, NANOSECONDS_PER_SECOND, PIT_FREQUENCY) + 1;
+    if (next <= now) {
+        next = now + 1;
+    }
+    return next;
+}
 
-        m_irqHandler.HandleIRQ(0, 0);
+// ----- IRQ ------------------------------------------------------------------
+
+void i8254::UpdateIRQ(uint64_t now) {
+    PITChannel& channel = m_channels[0];
+    uint64_t next = GetNextTransitionTime(channel, now);
+
+    m_irqHandler.HandleIRQ(PIT_IRQ, GetOut(channel, now));
+
+    channel.nextTransitionTime = next;
+    if (next != UINT64_MAX) {
+        m_timer->Schedule(next);
+    }
+    else {
+        m_timer->Cancel();
     }
 }
 
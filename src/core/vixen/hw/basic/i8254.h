@@ -1,10 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <thread>
+#include <mutex>
 
 #include "irq.h"
 #include "vixen/io.h"
+#include "vixen/scheduler.h"
 
 namespace vixen {
 
@@ -16,24 +17,94 @@ namespace vixen {
 #define PORT_PIT_BASE       PORT_PIT_DATA_0
 #define PORT_PIT_COUNT      (PORT_PIT_COMMAND - PORT_PIT_DATA_0 + 1)
 
+// System control port B, which controls the channel 2 gate and the speaker
+#define PORT_PIT_SPEAKER    0x61
+
+#define PIT_IRQ             0
+#define PIT_NUM_CHANNELS    3
+
+// PIT input clock frequency in Hz
+#define PIT_FREQUENCY       1193182
+
+struct PITChannel {
+    // Reload value in the range 1..0x10000, or 0 if no count was loaded since
+    // the mode was last programmed
+    uint32_t count;
+
+    // Virtual time at which the count was loaded or the gate was triggered
+    uint64_t countLoadTime;
+
+    // Virtual time of the next change of the output, used by channel 0
+    uint64_t nextTransitionTime;
+
+    uint16_t latchedCount;
+    uint8_t countLatched;  // Access mode of the latched count, 0 if none
+    bool statusLatched;
+    uint8_t status;
+
+    uint8_t readState;
+    uint8_t writeState;
+    uint8_t writeLatch;
+
+    uint8_t rwMode;
+    uint8_t mode;
+    bool bcd;  // BCD counting is not emulated
+    bool gate;
+};
+
+/*!
+ * Intel 8254 programmable interval timer.
+ *
+ * Counters are not ticked; their values and outputs are computed from the
+ * virtual clock whenever they are read. Only the next output transition of
+ * channel 0, which drives IRQ 0, is scheduled on the scheduler.
+ *
+ * When the CPU emulates the PIT in the hypervisor, the device is inert: its
+ * I/O ports are left unmapped and no timers are scheduled.
+ */
 class i8254 : public IODevice {
 public:
-    i8254(IRQHandler& irqHandler, float tickRate = 1000.0f);
+    i8254(IRQHandler& irqHandler, Scheduler& scheduler, bool inKernel = false);
     virtual ~i8254();
     void Reset();
-    
+
     bool MapIO(IOMapper *mapper);
 
     bool IORead(uint32_t port, uint32_t *value, uint8_t size) override;
     bool IOWrite(uint32_t port, uint32_t value, uint8_t size) override;
-    
-    void Run();
+
 private:
+    void WriteCommand(uint8_t value);
+    void WriteCount(PITChannel& channel, uint8_t value);
+    uint8_t ReadCount(PITChannel& channel);
+
+    uint8_t ReadSpeakerPort();
+    void WriteSpeakerPort(uint8_t value);
+
+    void LoadCount(PITChannel& channel, uint32_t value);
+    void LatchCount(PITChannel& channel);
+    void SetGate(PITChannel& channel, bool gate);
+
+    uint16_t GetCount(PITChannel& channel, uint64_t now);
+    bool GetOut(PITChannel& channel, uint64_t now);
+    uint64_t GetNextTransitionTime(PITChannel& channel, uint64_t now);
+
+    void UpdateIRQ(uint64_t now);
+
+    static void TimerCB(void *userData);
+
     IRQHandler& m_irqHandler;
-    float m_tickRate;
-    bool m_running;
+    Scheduler& m_scheduler;
+    bool m_inKernel;
+
+    PITChannel m_channels[PIT_NUM_CHANNELS];
+
+    // System control port B state
+    bool m_speakerDataOn;
+    bool m_refreshToggle;
 
-    std::thread m_timerThread;
+    ScheduledTimer *m_timer;
+    std::mutex m_lock;
 };
 
 }
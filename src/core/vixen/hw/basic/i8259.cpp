@@ -69,6 +69,7 @@ using namespace vixen::cpu;
 i8259::i8259(Cpu& cpu)
     : m_cpu(cpu)
 {
+    SetDeviceLock(&m_lock);
 }
 
 i8259::~i8259() {
@@ -106,6 +107,11 @@ void i8259::Reset(int pic) {
 }
 
 bool i8259::MapIO(IOMapper *mapper) {
+    // The in-kernel PIC handles the ports itself
+    if (m_cpu.HasInKernelIRQChip()) {
+        return true;
+    }
+
     if (!mapper->MapIODevice(PORT_PIC_MASTER_BASE, PORT_PIC_COUNT, this)) return false;
     if (!mapper->MapIODevice(PORT_PIC_SLAVE_BASE, PORT_PIC_COUNT, this)) return false;
     if (!mapper->MapIODevice(PORT_PIC_ELCR_BASE, PORT_PIC_COUNT, this)) return false;
@@ -199,7 +205,12 @@ bool i8259::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
 }
 
 void i8259::HandleIRQ(uint8_t irqNum, bool level) {
-    std::lock_guard<std::mutex> lk(m_handleIRQMutex);
+    if (m_cpu.HasInKernelIRQChip()) {
+        m_cpu.SetIRQLevel(irqNum, level);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lk(m_lock);
 
     if (level) {
         RaiseIRQ(irqNum);
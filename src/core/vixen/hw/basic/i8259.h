@@ -26,6 +26,13 @@ using namespace vixen::cpu;
 #define PIC_MASTER    0
 #define PIC_SLAVE    1
 
+/*!
+ * Intel 8259 programmable interrupt controller pair.
+ *
+ * When the CPU emulates the interrupt controller in the hypervisor, this
+ * class becomes a thin proxy that forwards IRQ levels to the CPU and leaves
+ * its I/O ports unmapped.
+ */
 class i8259 : public IODevice, public IRQHandler {
 public:
     i8259(Cpu& cpu);
@@ -62,7 +69,8 @@ private:
     bool m_AutoEOI[2];
     bool m_IsSpecialFullyNestedMode[2];
 
-    std::mutex m_handleIRQMutex;
+    // Protects the PIC state from IRQs raised by device threads
+    std::mutex m_lock;
 
     uint32_t CommandRead(int pic);
     void CommandWrite(int pic, uint32_t value);
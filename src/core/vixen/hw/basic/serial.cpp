@@ -100,16 +100,16 @@ namespace vixen {
 
 #define SEC_TO_NANO   1000000000ULL
 
-static inline uint64_t GetNanos() {
-    return std::chrono::high_resolution_clock::now().time_since_epoch().count();
-}
-
 int Serial::CanReceiveCB(void *userData) {
-    return ((Serial *)userData)->CanReceive();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_lock);
+    return serial->CanReceive();
 }
 
 void Serial::ReceiveCB(void *userData, const uint8_t *buf, int size) {
-    ((Serial *)userData)->Receive(buf, size);
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_lock);
+    serial->Receive(buf, size);
 }
 
 void Serial::EventCB(void *userData, int event) {
@@ -117,22 +117,30 @@ void Serial::EventCB(void *userData, int event) {
 }
 
 void Serial::UpdateMSLCB(void *userData) {
-    ((Serial *)userData)->UpdateMSL();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_lock);
+    serial->UpdateMSL();
 }
 
 void Serial::FifoTimeoutInterruptCB(void *userData) {
-    ((Serial *)userData)->FifoTimeoutInterrupt();
+    Serial *serial = (Serial *)userData;
+    std::lock_guard<std::mutex> lk(serial->m_lock);
+    serial->FifoTimeoutInterrupt();
 }
 
-Serial::Serial(IRQHandler& irqHandler, uint32_t ioBase)
+Serial::Serial(IRQHandler& irqHandler, Scheduler& scheduler, uint32_t ioBase)
     : m_irqHandler(irqHandler)
+    , m_scheduler(scheduler)
     , m_ioBase(ioBase)
 {
     m_recvFifo = new Fifo<uint8_t>(UART_FIFO_LENGTH);
     m_xmitFifo = new Fifo<uint8_t>(UART_FIFO_LENGTH);
 
-    m_fifoTimeoutTimer = new InvokeLater(UpdateMSLCB, this);
-    m_modemStatusPoll = new InvokeLater(FifoTimeoutInterruptCB, this);
+    // Character driver and timer callbacks run on other threads
+    SetDeviceLock(&m_lock);
+
+    m_fifoTimeoutTimer = new ScheduledTimer(scheduler, FifoTimeoutInterruptCB, this);
+    m_modemStatusPoll = new ScheduledTimer(scheduler, UpdateMSLCB, this);
 
     m_baudbase = 115200;
     m_active = false;
@@ -143,9 +151,6 @@ Serial::Serial(IRQHandler& irqHandler, uint32_t ioBase)
 }
 
 Serial::~Serial() {
-    m_fifoTimeoutTimer->Stop();
-    m_modemStatusPoll->Stop();
-
     delete m_fifoTimeoutTimer;
     delete m_modemStatusPoll;
     delete m_recvFifo;
@@ -164,9 +169,6 @@ bool Serial::Init(CharDriver *chr) {
     m_chr->m_cbReceive = ReceiveCB;
     m_chr->m_cbEvent = EventCB;
     m_chr->m_handler = this;
-    
-    m_fifoTimeoutTimer->Start();
-    m_modemStatusPoll->Start();
 
     return true;
 }
@@ -189,7 +191,7 @@ void Serial::Reset() {
     m_recvFifo->Clear();
     m_xmitFifo->Clear();
 
-    m_lastXmitTs = GetNanos();
+    m_lastXmitTs = m_scheduler.Now();
 
     m_thr_ipending = 0;
     m_lastBreakEnable = 0;
@@ -223,9 +225,7 @@ bool Serial::IORead(uint32_t port, uint32_t *value, uint8_t size) {
                     m_lsr &= ~(UART_LSR_DR | UART_LSR_BI);
                 }
                 else {
-                    auto now = std::chrono::high_resolution_clock::now();
-                    auto target = now + std::chrono::nanoseconds(m_charTransmitTime * 4);
-                    m_fifoTimeoutTimer->Set(target);
+                    m_fifoTimeoutTimer->ScheduleIn(m_charTransmitTime * 4);
                 }
                 m_timeoutIpending = 0;
             }
@@ -444,9 +444,7 @@ bool Serial::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
 
             // Update the modem status after a one-character-send wait-time, since there may be a response
             // from the device/computer at the other end of the serial line
-            auto now = std::chrono::high_resolution_clock::now();
-            auto target = now + std::chrono::nanoseconds(m_charTransmitTime);
-            m_modemStatusPoll->Set(target);
+            m_modemStatusPoll->ScheduleIn(m_charTransmitTime);
         }
     }
     break;
@@ -523,7 +521,7 @@ void Serial::Transmit() {
         m_tsrRetry = 0;
     }
 
-    m_lastXmitTs = GetNanos();
+    m_lastXmitTs = m_scheduler.Now();
 
     if (m_lsr & UART_LSR_THRE) {
         m_lsr |= UART_LSR_TEMT;
@@ -561,9 +559,7 @@ void Serial::Receive(const uint8_t *buf, int size) {
         }
         m_lsr |= UART_LSR_DR;
         // Call the timeout receive callback in 4 char transmit time
-        auto now = std::chrono::high_resolution_clock::now();
-        auto target = now + std::chrono::nanoseconds(m_charTransmitTime * 4);
-        m_fifoTimeoutTimer->Set(target);
+        m_fifoTimeoutTimer->ScheduleIn(m_charTransmitTime * 4);
     }
     else {
         if (m_lsr & UART_LSR_DR) {
@@ -661,7 +657,7 @@ void Serial::UpdateMSL() {
     // The real 16550A apparently has a 250ns response latency to line status changes
     // We'll be lazy and poll only every 10ms, and only poll it at all if MSI interrupts are turned on
     if (m_pollMsl) {
-        m_modemStatusPoll->Set(std::chrono::high_resolution_clock::now() + std::chrono::nanoseconds(SEC_TO_NANO / 100));
+        m_modemStatusPoll->ScheduleIn(SEC_TO_NANO / 100);
     }*/
 }
 
@@ -698,7 +694,7 @@ void Serial::UpdateParameters() {
     params.baudRate = m_baudbase;
     params.divider = m_divider;
     frameSize += params.dataBits + params.stopBits;
-    m_charTransmitTime = (GetNanos() / params.baudRate / m_divider) * frameSize;
+    m_charTransmitTime = (SEC_TO_NANO * m_divider / params.baudRate) * frameSize;
     m_chr->SetSerialParameters(&params);
 }
 
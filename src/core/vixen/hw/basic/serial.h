@@ -4,11 +4,12 @@
 
 #include "vixen/cpu.h"
 #include "vixen/util/fifo.h"
-#include "vixen/util/invoke_later.h"
+#include "vixen/scheduler.h"
 #include "char.h"
 #include "../basic/irq.h"
 
 #include <chrono>
+#include <mutex>
 
 namespace vixen {
 
@@ -22,7 +23,7 @@ namespace vixen {
 
 class Serial : public IODevice {
 public:
-    Serial(IRQHandler& irqHandler, uint32_t ioBase);
+    Serial(IRQHandler& irqHandler, Scheduler& scheduler, uint32_t ioBase);
     virtual ~Serial();
 
     bool Init(CharDriver *chr);
@@ -62,8 +63,12 @@ private:
     static void FifoTimeoutInterruptCB(void *userData);
 
     IRQHandler& m_irqHandler;
+    Scheduler& m_scheduler;
     uint32_t m_ioBase;
 
+    // Serializes register access with the character driver and timer threads
+    std::mutex m_lock;
+
     uint16_t m_divider = 0;
     uint8_t m_rbr = 0; // receive register
     uint8_t m_thr = 0; // transmit holding register
@@ -94,13 +99,13 @@ private:
     // Interrupt trigger level for recv_fifo
     uint8_t m_recvFifoITL;
 
-    InvokeLater *m_fifoTimeoutTimer;
+    ScheduledTimer *m_fifoTimeoutTimer;
     int m_timeoutIpending = 0;  // timeout interrupt pending state
 
     uint64_t m_charTransmitTime = 0; // time to transmit a char in ticks
     int m_pollMsl = 0;
 
-    InvokeLater *m_modemStatusPoll;
+    ScheduledTimer *m_modemStatusPoll;
 
     int lastDir = -1;
 };
@@ -32,7 +32,7 @@ const static uint32_t kSerialPortIOBases[] = {
     PORT_SERIAL_BASE_2
 };
 
-SuperIO::SuperIO(IRQHandler& irqHandler, CharDriver *chrs[SUPERIO_SERIAL_PORT_COUNT]) {
+SuperIO::SuperIO(IRQHandler& irqHandler, Scheduler& scheduler, CharDriver *chrs[SUPERIO_SERIAL_PORT_COUNT]) {
     memset(m_configRegs, 0, sizeof(m_configRegs));
     memset(m_deviceRegs, 0, sizeof(m_deviceRegs));
 
@@ -44,7 +44,7 @@ SuperIO::SuperIO(IRQHandler& irqHandler, CharDriver *chrs[SUPERIO_SERIAL_PORT_CO
 
     // Initialize serial ports
     for (int i = 0; i < SUPERIO_SERIAL_PORT_COUNT; i++) {
-        m_serialPorts[i] = new Serial(irqHandler, kSerialPortIOBases[i]);
+        m_serialPorts[i] = new Serial(irqHandler, scheduler, kSerialPortIOBases[i]);
         m_serialPorts[i]->Init(chrs[i]);
         m_serialPorts[i]->SetBaudBase(115200);
     }
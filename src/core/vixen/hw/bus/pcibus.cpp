@@ -34,6 +34,7 @@ namespace vixen {
 
 PCIBus::PCIBus() {
     m_owner = nullptr;
+    m_ioMapper = nullptr;
     m_irqMapper = new DefaultIRQMapper();
     m_numIRQs = 0;
     m_irqCount = nullptr;
@@ -47,7 +48,12 @@ PCIBus::~PCIBus() {
 bool PCIBus::MapIO(IOMapper *mapper) {
     if (!mapper->MapIODevice(PORT_PCI_CONFIG_ADDRESS, 1, this)) return false;
     if (!mapper->MapIODevice(PORT_PCI_CONFIG_DATA, 4, this)) return false;
-    if (!mapper->AddDevice(this)) return false;
+
+    // Map the BARs of all connected devices
+    m_ioMapper = mapper;
+    for (auto it = m_Devices.begin(); it != m_Devices.end(); ++it) {
+        it->second->UpdateBARMappings();
+    }
 
     return true;
 }
@@ -62,6 +68,7 @@ void PCIBus::ConnectDevice(uint32_t deviceId, PCIDevice *pDevice) {
     pDevice->Init();
     pDevice->m_bus = this;
     *(uint32_t *)(&pDevice->m_addr) = deviceId;
+    pDevice->UpdateBARMappings();
 }
 
 void PCIBus::IOWriteConfigAddress(uint32_t pData) {
@@ -85,6 +92,7 @@ uint32_t PCIBus::IOReadConfigData(uint8_t size, uint8_t regOffset) {
     );
     if (it != m_Devices.end()) {
         uint32_t value = 0;
+        IODeviceLockGuard lk(it->second->GetDeviceLock());
         it->second->ReadConfig((m_configAddressRegister.registerNumber & PCI_CONFIG_REGISTER_MASK) + regOffset, &value, size);
         return value;
     }
@@ -119,6 +127,7 @@ void PCIBus::IOWriteConfigData(uint32_t pData, uint8_t size, uint8_t regOffset)
         )
     );
     if (it != m_Devices.end()) {
+        IODeviceLockGuard lk(it->second->GetDeviceLock());
         it->second->WriteConfig((m_configAddressRegister.registerNumber & PCI_CONFIG_REGISTER_MASK) + regOffset, pData, size);
         return;
     }
@@ -142,15 +151,6 @@ bool PCIBus::IORead(uint32_t port, uint32_t *value, uint8_t size) {
     case PORT_PCI_CONFIG_DATA + 3: // 0xCFF
         *value = IOReadConfigData(size, port - PORT_PCI_CONFIG_DATA);
         return true;
-    default:
-        for (auto it = m_Devices.begin(); it != m_Devices.end(); ++it) {
-            uint8_t barIndex;
-            uint32_t baseAddress;
-            if (it->second->GetIOBar(port, &barIndex, &baseAddress)) {
-                it->second->PCIIORead(barIndex, port - baseAddress, value, size);
-                return true;
-            }
-        }
     }
 
     return false;
@@ -175,42 +175,6 @@ bool PCIBus::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
     case PORT_PCI_CONFIG_DATA + 3: // 0xCFF
         IOWriteConfigData(value, size, port - PORT_PCI_CONFIG_DATA);
         return true; // TODO : Should IOWriteConfigData() success/failure be returned?
-    default:
-        for (auto it = m_Devices.begin(); it != m_Devices.end(); ++it) {
-            uint8_t barIndex;
-            uint32_t baseAddress;
-            if (it->second->GetIOBar(port, &barIndex, &baseAddress)) {
-                it->second->PCIIOWrite(barIndex, port - baseAddress, value, size);
-                return true;
-            }
-        }
-    }
-
-    return false;
-}
-
-bool PCIBus::MMIORead(uint32_t addr, uint32_t *value, uint8_t size) {
-    for (auto it = m_Devices.begin(); it != m_Devices.end(); ++it) {
-        uint8_t barIndex;
-        uint32_t baseAddress;
-        if (it->second->GetMMIOBar(addr, &barIndex, &baseAddress)) {
-            it->second->PCIMMIORead(barIndex, addr - baseAddress, value, size);
-            return true;
-        }
-    }
-
-    return false;
-}
-
-bool PCIBus::MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
-    for (auto it = m_Devices.begin(); it != m_Devices.end(); ++it) {
-        PCIDevice *dev = it->second;
-        uint8_t barIndex;
-        uint32_t baseAddress;
-        if (dev->GetMMIOBar(addr, &barIndex, &baseAddress)) {
-            dev->PCIMMIOWrite(barIndex, addr - baseAddress, value, size);
-            return true;
-        }
     }
 
     return false;
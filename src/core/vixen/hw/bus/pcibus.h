@@ -5,6 +5,7 @@
 #include "vixen/io.h"
 
 #include <map>
+#include <mutex>
 
 namespace vixen {
 
@@ -23,9 +24,6 @@ public:
     bool IORead(uint32_t port, uint32_t *value, uint8_t size) override;
     bool IOWrite(uint32_t port, uint32_t value, uint8_t size) override;
 
-    bool MMIORead(uint32_t addr, uint32_t *value, uint8_t size) override;
-    bool MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) override;
-
     void Reset();
 
     void ConfigureIRQs(IRQMapper *irqMapper, uint8_t numIRQs);
@@ -39,6 +37,7 @@ private:
     friend class PCIBridgeDevice;
     
     PCIDevice *m_owner; // The bridge that owns this bus
+    IOMapper *m_ioMapper; // Where device BARs are mapped
     std::map<uint32_t, PCIDevice*> m_Devices;
     PCIConfigAddressRegister m_configAddressRegister;
 
@@ -46,6 +45,9 @@ private:
     uint32_t *m_irqCount;
     IRQMapper *m_irqMapper;
 
+    // Protects the IRQ counts, which devices update from their own threads
+    std::mutex m_irqLock;
+
     void IOWriteConfigAddress(uint32_t pData);
     void IOWriteConfigData(uint32_t pData, uint8_t size, uint8_t regOffset);
     uint32_t IOReadConfigData(uint8_t size, uint8_t regOffset);
@@ -0,0 +1,514 @@
+#include "combiners.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "vixen/log.h"
+#include "nv2a_int.h"
+
+namespace vixen {
+
+// Registers available to combiner inputs and outputs
+enum CombinerRegister {
+    REG_ZERO = 0x0,
+    REG_C0 = 0x1,
+    REG_C1 = 0x2,
+    REG_FOG = 0x3,
+    REG_V0 = 0x4,
+    REG_V1 = 0x5,
+    REG_T0 = 0x8,
+    REG_T1 = 0x9,
+    REG_T2 = 0xA,
+    REG_T3 = 0xB,
+    REG_R0 = 0xC,
+    REG_R1 = 0xD,
+    REG_V1R0_SUM = 0xE,  // Final combiner only
+    REG_EF_PROD = 0xF,   // Final combiner only
+    REG_COUNT
+};
+
+// Input mappings
+enum CombinerMapping {
+    MAP_UNSIGNED_IDENTITY,
+    MAP_UNSIGNED_INVERT,
+    MAP_EXPAND_NORMAL,
+    MAP_EXPAND_NEGATE,
+    MAP_HALFBIAS_NORMAL,
+    MAP_HALFBIAS_NEGATE,
+    MAP_SIGNED_IDENTITY,
+    MAP_SIGNED_NEGATE,
+};
+
+// Sources of the specialized modulate kernels
+enum ModulateSource {
+    MOD_V0,
+    MOD_V1,
+    MOD_C0,
+    MOD_C1,
+    MOD_ONE,
+    MOD_COUNT
+};
+
+static inline float Clamp(float v, float min, float max) {
+    return (v < min) ? min : (v > max) ? max : v;
+}
+
+static inline float MapValue(unsigned int mapping, float x) {
+    switch (mapping) {
+    case MAP_UNSIGNED_IDENTITY: return std::max(x, 0.0f);
+    case MAP_UNSIGNED_INVERT:   return 1.0f - Clamp(x, 0.0f, 1.0f);
+    case MAP_EXPAND_NORMAL:     return 2.0f * std::max(x, 0.0f) - 1.0f;
+    case MAP_EXPAND_NEGATE:     return -2.0f * std::max(x, 0.0f) + 1.0f;
+    case MAP_HALFBIAS_NORMAL:   return std::max(x, 0.0f) - 0.5f;
+    case MAP_HALFBIAS_NEGATE:   return -std::max(x, 0.0f) + 0.5f;
+    case MAP_SIGNED_IDENTITY:   return x;
+    default:                    return -x;
+    }
+}
+
+template<unsigned int Mapping>
+static void MapSpan(const float *src, float *dst, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = MapValue(Mapping, src[i]);
+    }
+}
+
+// ----- Generic kernel -------------------------------------------------------
+
+namespace {
+
+// The combiner registers of a span. Registers that hold the same value for
+// every pixel are kept as a single value until a stage writes to them.
+struct SpanRegisters {
+    const float *channels[REG_COUNT][4];
+    bool uniform[REG_COUNT];
+    float values[REG_COUNT][4];
+    float work[REG_COUNT][4][COMBINER_MAX_SPAN];
+    uint32_t count;
+
+    void SetUniform(unsigned int reg, const float *rgba) {
+        uniform[reg] = true;
+        memcpy(values[reg], rgba, sizeof(values[reg]));
+    }
+
+    // Reads a channel of a register through an input mapping
+    void Fetch(unsigned int reg, unsigned int channel, unsigned int mapping, float *dst) const {
+        if (uniform[reg]) {
+            std::fill(dst, dst + count, MapValue(mapping, values[reg][channel]));
+            return;
+        }
+
+        const float *src = channels[reg][channel];
+        switch (mapping) {
+        case MAP_UNSIGNED_IDENTITY: MapSpan<MAP_UNSIGNED_IDENTITY>(src, dst, count); break;
+        case MAP_UNSIGNED_INVERT:   MapSpan<MAP_UNSIGNED_INVERT>(src, dst, count); break;
+        case MAP_EXPAND_NORMAL:     MapSpan<MAP_EXPAND_NORMAL>(src, dst, count); break;
+        case MAP_EXPAND_NEGATE:     MapSpan<MAP_EXPAND_NEGATE>(src, dst, count); break;
+        case MAP_HALFBIAS_NORMAL:   MapSpan<MAP_HALFBIAS_NORMAL>(src, dst, count); break;
+        case MAP_HALFBIAS_NEGATE:   MapSpan<MAP_HALFBIAS_NEGATE>(src, dst, count); break;
+        case MAP_SIGNED_IDENTITY:   MapSpan<MAP_SIGNED_IDENTITY>(src, dst, count); break;
+        default:                    MapSpan<MAP_SIGNED_NEGATE>(src, dst, count); break;
+        }
+    }
+
+    // Returns a writable channel of a register
+    float *Writable(unsigned int reg, unsigned int channel) {
+        if (uniform[reg]) {
+            for (int c = 0; c < 4; c++) {
+                std::fill(work[reg][c], work[reg][c] + count, values[reg][c]);
+                channels[reg][c] = work[reg][c];
+            }
+            uniform[reg] = false;
+        }
+        else if (channels[reg][channel] != work[reg][channel]) {
+            channels[reg][channel] = work[reg][channel];
+        }
+        return work[reg][channel];
+    }
+
+    // Writes a result to a channel of a register, which is discarded if the
+    // register is zero or a constant
+    void Store(unsigned int reg, unsigned int channel, const float *src) {
+        if (reg == REG_ZERO || reg == REG_C0 || reg == REG_C1 || reg == REG_FOG) {
+            return;
+        }
+        memcpy(Writable(reg, channel), src, count * sizeof(float));
+    }
+};
+
+// Results of one portion of a stage
+struct PortionResults {
+    float ab[3][COMBINER_MAX_SPAN];
+    float cd[3][COMBINER_MAX_SPAN];
+    float sum[3][COMBINER_MAX_SPAN];
+};
+
+}
+
+// Computes the AB, CD and sum results of a combiner portion with the
+// specified number of channels: 3 for color and 1 for alpha
+static void EvaluatePortion(const SpanRegisters& regs, const CombinerKernel::Input *inputs, const CombinerKernel::Output& output,
+    unsigned int numChannels, const bool *muxSelect, PortionResults& results)
+{
+    uint32_t count = regs.count;
+    float in[4][3][COMBINER_MAX_SPAN];
+    for (int i = 0; i < 4; i++) {
+        for (unsigned int c = 0; c < numChannels; c++) {
+            unsigned int channel = (numChannels == 1 || inputs[i].alpha) ? inputs[i].channel : c;
+            regs.Fetch(inputs[i].reg, channel, inputs[i].mapping, in[i][c]);
+        }
+    }
+
+    auto product = [&](int x, int y, bool dot, float (*dst)[COMBINER_MAX_SPAN]) {
+        if (dot) {
+            for (uint32_t p = 0; p < count; p++) {
+                float value = in[x][0][p] * in[y][0][p] + in[x][1][p] * in[y][1][p] + in[x][2][p] * in[y][2][p];
+                dst[0][p] = dst[1][p] = dst[2][p] = value;
+            }
+            return;
+        }
+        for (unsigned int c = 0; c < numChannels; c++) {
+            for (uint32_t p = 0; p < count; p++) {
+                dst[c][p] = in[x][c][p] * in[y][c][p];
+            }
+        }
+    };
+    product(0, 1, output.abDot && numChannels == 3, results.ab);
+    product(2, 3, output.cdDot && numChannels == 3, results.cd);
+
+    for (unsigned int c = 0; c < numChannels; c++) {
+        if (output.mux) {
+            for (uint32_t p = 0; p < count; p++) {
+                results.sum[c][p] = muxSelect[p] ? results.cd[c][p] : results.ab[c][p];
+            }
+        }
+        else {
+            for (uint32_t p = 0; p < count; p++) {
+                results.sum[c][p] = results.ab[c][p] + results.cd[c][p];
+            }
+        }
+    }
+
+    // Output mapping; registers hold values within [-1, 1]
+    float bias = output.bias;
+    float scale = output.scale;
+    for (unsigned int c = 0; c < numChannels; c++) {
+        for (uint32_t p = 0; p < count; p++) {
+            results.ab[c][p] = Clamp((results.ab[c][p] + bias) * scale, -1.0f, 1.0f);
+            results.cd[c][p] = Clamp((results.cd[c][p] + bias) * scale, -1.0f, 1.0f);
+            results.sum[c][p] = Clamp((results.sum[c][p] + bias) * scale, -1.0f, 1.0f);
+        }
+    }
+}
+
+static void StorePortion(SpanRegisters& regs, const CombinerKernel::Output& output, unsigned int firstChannel, unsigned int numChannels, const PortionResults& results) {
+    for (unsigned int c = 0; c < numChannels; c++) {
+        regs.Store(output.ab, firstChannel + c, results.ab[c]);
+        regs.Store(output.cd, firstChannel + c, results.cd[c]);
+        regs.Store(output.sum, firstChannel + c, results.sum[c]);
+    }
+}
+
+template<unsigned int NumStages>
+void CombinerKernel::RunGeneric(const CombinerKernel& kernel, const CombinerConstants& constants, const CombinerSpan& span) {
+    static const float kZero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+    SpanRegisters regs;
+    regs.count = span.count;
+    for (int reg = 0; reg < REG_COUNT; reg++) {
+        regs.SetUniform(reg, kZero);
+    }
+    regs.SetUniform(REG_FOG, constants.fog);
+    regs.uniform[REG_V0] = regs.uniform[REG_V1] = false;
+    for (int c = 0; c < 4; c++) {
+        regs.channels[REG_V0][c] = span.diffuse[c];
+        regs.channels[REG_V1][c] = span.specular[c];
+    }
+
+    bool muxSelect[COMBINER_MAX_SPAN];
+    PortionResults color, alpha;
+
+    for (unsigned int s = 0; s < NumStages; s++) {
+        const Stage& stage = kernel.m_stages[s];
+        regs.SetUniform(REG_C0, constants.factor0[stage.factor0]);
+        regs.SetUniform(REG_C1, constants.factor1[stage.factor1]);
+
+        // Both portions read their inputs before either writes its results
+        if (stage.colorOutput.mux || stage.alphaOutput.mux) {
+            float r0[COMBINER_MAX_SPAN];
+            regs.Fetch(REG_R0, 3, MAP_SIGNED_IDENTITY, r0);
+            for (uint32_t p = 0; p < span.count; p++) {
+                muxSelect[p] = kernel.m_muxMSB ? (r0[p] >= 0.5f) : (((int)(r0[p] * 255.0f + 0.5f) & 1) != 0);
+            }
+        }
+        EvaluatePortion(regs, stage.color, stage.colorOutput, 3, muxSelect, color);
+        EvaluatePortion(regs, stage.alpha, stage.alphaOutput, 1, muxSelect, alpha);
+
+        StorePortion(regs, stage.colorOutput, 0, 3, color);
+        StorePortion(regs, stage.alphaOutput, 3, 1, alpha);
+        if (stage.colorOutput.abBlueToAlpha) {
+            regs.Store(stage.colorOutput.ab, 3, color.ab[2]);
+        }
+        if (stage.colorOutput.cdBlueToAlpha) {
+            regs.Store(stage.colorOutput.cd, 3, color.cd[2]);
+        }
+    }
+
+    // Final combiner
+    regs.SetUniform(REG_C0, constants.finalFactor0);
+    regs.SetUniform(REG_C1, constants.finalFactor1);
+    const Input *inputs = kernel.m_final;
+    uint32_t count = span.count;
+
+    float e[3][COMBINER_MAX_SPAN], f[3][COMBINER_MAX_SPAN];
+    for (int c = 0; c < 3; c++) {
+        regs.Fetch(inputs[4].reg, inputs[4].alpha ? 3 : c, inputs[4].mapping, e[c]);
+        regs.Fetch(inputs[5].reg, inputs[5].alpha ? 3 : c, inputs[5].mapping, f[c]);
+        float *product = regs.Writable(REG_EF_PROD, c);
+        for (uint32_t p = 0; p < count; p++) {
+            product[p] = e[c][p] * f[c][p];
+        }
+    }
+
+    float v1[COMBINER_MAX_SPAN], r0[COMBINER_MAX_SPAN];
+    unsigned int v1Mapping = kernel.m_complementV1 ? MAP_UNSIGNED_INVERT : MAP_UNSIGNED_IDENTITY;
+    unsigned int r0Mapping = kernel.m_complementR0 ? MAP_UNSIGNED_INVERT : MAP_UNSIGNED_IDENTITY;
+    float maxSum = kernel.m_clampSum ? 1.0f : 2.0f;
+    for (int c = 0; c < 3; c++) {
+        regs.Fetch(REG_V1, c, v1Mapping, v1);
+        regs.Fetch(REG_R0, c, r0Mapping, r0);
+        float *sum = regs.Writable(REG_V1R0_SUM, c);
+        for (uint32_t p = 0; p < count; p++) {
+            sum[p] = std::min(v1[p] + r0[p], maxSum);
+        }
+    }
+
+    // rgb = A * B + (1 - A) * C + D
+    float in[4][COMBINER_MAX_SPAN];
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < 4; i++) {
+            regs.Fetch(inputs[i].reg, inputs[i].alpha ? 3 : c, inputs[i].mapping, in[i]);
+        }
+        float *out = span.color[c];
+        for (uint32_t p = 0; p < count; p++) {
+            out[p] = Clamp(in[0][p] * in[1][p] + (1.0f - in[0][p]) * in[2][p] + in[3][p], 0.0f, 1.0f);
+        }
+    }
+
+    // alpha = G
+    float *out = span.color[3];
+    regs.Fetch(inputs[6].reg, inputs[6].channel, inputs[6].mapping, out);
+    for (uint32_t p = 0; p < count; p++) {
+        out[p] = Clamp(out[p], 0.0f, 1.0f);
+    }
+}
+
+// ----- Modulate kernels -----------------------------------------------------
+
+template<int Source>
+static inline float ModulateValue(const CombinerConstants& constants, const CombinerSpan& span, int channel, uint32_t pixel) {
+    switch (Source) {
+    case MOD_V0: return span.diffuse[channel][pixel];
+    case MOD_V1: return span.specular[channel][pixel];
+    case MOD_C0: return constants.factor0[0][channel];
+    case MOD_C1: return constants.factor1[0][channel];
+    default:     return 1.0f;
+    }
+}
+
+// Every channel is the product of two sources within [0, 1]
+template<int SourceA, int SourceB>
+void CombinerKernel::RunModulate(const CombinerKernel&, const CombinerConstants& constants, const CombinerSpan& span) {
+    for (int c = 0; c < 4; c++) {
+        float *out = span.color[c];
+        for (uint32_t p = 0; p < span.count; p++) {
+            out[p] = ModulateValue<SourceA>(constants, span, c, p) * ModulateValue<SourceB>(constants, span, c, p);
+        }
+    }
+}
+
+// ----- Compilation ----------------------------------------------------------
+
+static CombinerKernel::Input DecodeInput(uint32_t bits, bool alphaPortion) {
+    CombinerKernel::Input input;
+    input.reg = bits & 0xF;
+    input.alpha = bits & 0x10;
+    input.channel = (input.alpha || !alphaPortion) ? 3 : 2;
+    input.mapping = (bits >> 5) & 0x7;
+    return input;
+}
+
+static void DecodeInputs(uint32_t word, bool alphaPortion, CombinerKernel::Input *inputs) {
+    for (int i = 0; i < 4; i++) {
+        inputs[i] = DecodeInput(word >> (24 - i * 8), alphaPortion);
+    }
+}
+
+static CombinerKernel::Output DecodeOutput(uint32_t word, bool alphaPortion) {
+    static const float kScales[4] = { 1.0f, 2.0f, 4.0f, 0.5f };
+
+    CombinerKernel::Output output;
+    output.cd = word & 0xF;
+    output.ab = (word >> 4) & 0xF;
+    output.sum = (word >> 8) & 0xF;
+    output.cdDot = word & (1 << 12);
+    output.abDot = word & (1 << 13);
+    output.mux = word & (1 << 14);
+    unsigned int op = (word >> 15) & 0x7;
+    output.bias = (op & 1) ? -0.5f : 0.0f;
+    output.scale = kScales[op >> 1];
+    output.cdBlueToAlpha = !alphaPortion && (word & (1 << 18));
+    output.abBlueToAlpha = !alphaPortion && (word & (1 << 19));
+    return output;
+}
+
+static bool IsZero(const CombinerKernel::Input& input) {
+    return input.reg == REG_ZERO && input.mapping != MAP_UNSIGNED_INVERT
+        && input.mapping != MAP_EXPAND_NEGATE && input.mapping != MAP_HALFBIAS_NEGATE
+        && input.mapping != MAP_EXPAND_NORMAL && input.mapping != MAP_HALFBIAS_NORMAL;
+}
+
+// Returns the modulate source an input reads without altering it, or -1
+static int GetModulateSource(const CombinerKernel::Input& input, bool alphaPortion) {
+    if (input.reg == REG_ZERO && input.mapping == MAP_UNSIGNED_INVERT) {
+        return MOD_ONE;
+    }
+    bool sameChannel = alphaPortion ? input.channel == 3 : !input.alpha;
+    if (!sameChannel || input.mapping != MAP_UNSIGNED_IDENTITY) {
+        return -1;
+    }
+    switch (input.reg) {
+    case REG_V0: return MOD_V0;
+    case REG_V1: return MOD_V1;
+    case REG_C0: return MOD_C0;
+    case REG_C1: return MOD_C1;
+    default:     return -1;
+    }
+}
+
+// Determines if a portion computes R0 = A * B and nothing else
+static bool IsModulatePortion(const CombinerKernel::Input *inputs, const CombinerKernel::Output& output) {
+    return IsZero(inputs[2]) && IsZero(inputs[3])
+        && output.ab == REG_R0 && output.cd == REG_ZERO && output.sum == REG_ZERO
+        && !output.abDot && output.bias == 0.0f && output.scale == 1.0f
+        && !output.abBlueToAlpha;
+}
+
+// Determines if the final combiner outputs R0 unchanged
+static bool IsPassthroughFinal(const CombinerKernel::Input *final) {
+    auto isR0 = [](const CombinerKernel::Input& input) {
+        return input.reg == REG_R0 && !input.alpha && input.mapping == MAP_UNSIGNED_IDENTITY;
+    };
+    if (!IsZero(final[0])) {
+        return false;
+    }
+    // With A = 0, the color is C + D
+    bool colorIsR0 = (isR0(final[2]) && IsZero(final[3])) || (IsZero(final[2]) && isR0(final[3]));
+    return colorIsR0 && final[6].reg == REG_R0 && final[6].channel == 3 && final[6].mapping == MAP_UNSIGNED_IDENTITY;
+}
+
+#define MODULATE_KERNELS(a) \
+    { &CombinerKernel::RunModulate<a, MOD_V0>, &CombinerKernel::RunModulate<a, MOD_V1>, \
+      &CombinerKernel::RunModulate<a, MOD_C0>, &CombinerKernel::RunModulate<a, MOD_C1>, \
+      &CombinerKernel::RunModulate<a, MOD_ONE> }
+
+std::unique_ptr<CombinerKernel> CombinerCache::Compile(const CombinerSetup& setup) {
+    static const CombinerKernel::SpanFunc kGenericKernels[COMBINER_MAX_STAGES + 1] = {
+        &CombinerKernel::RunGeneric<0>, &CombinerKernel::RunGeneric<1>, &CombinerKernel::RunGeneric<2>,
+        &CombinerKernel::RunGeneric<3>, &CombinerKernel::RunGeneric<4>, &CombinerKernel::RunGeneric<5>,
+        &CombinerKernel::RunGeneric<6>, &CombinerKernel::RunGeneric<7>, &CombinerKernel::RunGeneric<8>,
+    };
+    static const CombinerKernel::SpanFunc kModulateKernels[MOD_COUNT][MOD_COUNT] = {
+        MODULATE_KERNELS(MOD_V0), MODULATE_KERNELS(MOD_V1), MODULATE_KERNELS(MOD_C0),
+        MODULATE_KERNELS(MOD_C1), MODULATE_KERNELS(MOD_ONE),
+    };
+
+    std::unique_ptr<CombinerKernel> kernel(new CombinerKernel());
+    kernel->m_setup = setup;
+
+    kernel->m_numStages = std::min<unsigned int>(setup.control & NV_PGRAPH_COMBINECTL_ITERATION_COUNT, COMBINER_MAX_STAGES);
+    kernel->m_muxMSB = setup.control & NV_PGRAPH_COMBINECTL_MUX_SELECT;
+    bool uniqueFactor0 = setup.control & NV_PGRAPH_COMBINECTL_FACTOR0;
+    bool uniqueFactor1 = setup.control & NV_PGRAPH_COMBINECTL_FACTOR1;
+
+    for (unsigned int s = 0; s < kernel->m_numStages; s++) {
+        CombinerKernel::Stage& stage = kernel->m_stages[s];
+        DecodeInputs(setup.colorInputs[s], false, stage.color);
+        DecodeInputs(setup.alphaInputs[s], true, stage.alpha);
+        stage.colorOutput = DecodeOutput(setup.colorOutputs[s], false);
+        stage.alphaOutput = DecodeOutput(setup.alphaOutputs[s], true);
+        stage.factor0 = uniqueFactor0 ? s : 0;
+        stage.factor1 = uniqueFactor1 ? s : 0;
+    }
+
+    // SPECFOG0 holds inputs A to D; SPECFOG1 holds E to G followed by the
+    // flags byte. G is a single channel input, like alpha portion inputs.
+    DecodeInputs(setup.specularFog[0], false, &kernel->m_final[0]);
+    kernel->m_final[4] = DecodeInput(setup.specularFog[1] >> 24, false);
+    kernel->m_final[5] = DecodeInput(setup.specularFog[1] >> 16, false);
+    kernel->m_final[6] = DecodeInput(setup.specularFog[1] >> 8, true);
+    uint32_t finalFlags = setup.specularFog[1] & 0xFF;
+    kernel->m_clampSum = finalFlags & 0x80;
+    kernel->m_complementV1 = finalFlags & 0x40;
+    kernel->m_complementR0 = finalFlags & 0x20;
+
+    kernel->m_func = kGenericKernels[kernel->m_numStages];
+
+    // Look for R0 = A * B in both portions of a single stage, with the same
+    // sources, followed by a final combiner that outputs R0
+    if (kernel->m_numStages == 1) {
+        const CombinerKernel::Stage& stage = kernel->m_stages[0];
+        int a = GetModulateSource(stage.color[0], false);
+        int b = GetModulateSource(stage.color[1], false);
+        if (a >= 0 && b >= 0
+            && GetModulateSource(stage.alpha[0], true) == a && GetModulateSource(stage.alpha[1], true) == b
+            && IsModulatePortion(stage.color, stage.colorOutput) && IsModulatePortion(stage.alpha, stage.alphaOutput)
+            && IsPassthroughFinal(kernel->m_final)) {
+            kernel->m_func = kModulateKernels[a][b];
+        }
+    }
+
+    return kernel;
+}
+
+static uint64_t HashSetup(const CombinerSetup& setup) {
+    uint32_t words[sizeof(CombinerSetup) / sizeof(uint32_t)];
+    memcpy(words, &setup, sizeof(words));
+
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t word : words) {
+        hash ^= word;
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+const CombinerKernel *CombinerCache::GetKernel(const CombinerSetup& setup) {
+    uint64_t hash = HashSetup(setup);
+
+    auto it = m_index.find(hash);
+    if (it != m_index.end()) {
+        KernelList::iterator entry = it->second;
+        if (memcmp(&(*entry)->m_setup, &setup, sizeof(setup)) == 0) {
+            m_kernels.splice(m_kernels.begin(), m_kernels, entry);
+            return m_kernels.front().get();
+        }
+
+        // Hash collision; the new configuration takes over the entry
+        m_kernels.erase(entry);
+        m_index.erase(it);
+    }
+
+    if (m_kernels.size() >= kCapacity) {
+        m_index.erase(HashSetup(m_kernels.back()->m_setup));
+        m_kernels.pop_back();
+    }
+
+    log_debug("NV2A: Compiling register combiners, %u stages\n", setup.control & NV_PGRAPH_COMBINECTL_ITERATION_COUNT);
+    m_kernels.push_front(Compile(setup));
+    m_index[hash] = m_kernels.begin();
+    return m_kernels.front().get();
+}
+
+}
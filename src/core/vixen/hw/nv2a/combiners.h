@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace vixen {
+
+#define COMBINER_MAX_STAGES 8
+
+// Maximum number of pixels shaded by one kernel call
+#define COMBINER_MAX_SPAN 64
+
+/*!
+ * The register combiner words that determine the operations performed on
+ * each pixel, as programmed in the PGRAPH registers. Words of stages past the
+ * stage count must be zero.
+ */
+struct CombinerSetup {
+    uint32_t control = 0;  // NV_PGRAPH_COMBINECTL
+    uint32_t colorInputs[COMBINER_MAX_STAGES] = { 0 };
+    uint32_t colorOutputs[COMBINER_MAX_STAGES] = { 0 };
+    uint32_t alphaInputs[COMBINER_MAX_STAGES] = { 0 };
+    uint32_t alphaOutputs[COMBINER_MAX_STAGES] = { 0 };
+    uint32_t specularFog[2] = { 0 };  // Final combiner
+};
+
+/*!
+ * Values of the constant registers, in RGBA order. These do not affect the
+ * choice of kernel, so they can change without recompiling anything.
+ */
+struct CombinerConstants {
+    float factor0[COMBINER_MAX_STAGES][4];
+    float factor1[COMBINER_MAX_STAGES][4];
+    float finalFactor0[4];
+    float finalFactor1[4];
+    float fog[4];
+};
+
+/*!
+ * Per-pixel inputs and outputs of a span, with one array per channel in
+ * RGBA order. Inputs must be within [0, 1].
+ */
+struct CombinerSpan {
+    const float *diffuse[4];
+    const float *specular[4];
+    float *color[4];
+    uint32_t count;  // At most COMBINER_MAX_SPAN
+};
+
+/*!
+ * A register combiner configuration compiled for execution on spans.
+ */
+class CombinerKernel {
+public:
+    typedef void(*SpanFunc)(const CombinerKernel& kernel, const CombinerConstants& constants, const CombinerSpan& span);
+
+    /*!
+     * Computes the colors of a span of pixels.
+     */
+    void Run(const CombinerConstants& constants, const CombinerSpan& span) const { m_func(*this, constants, span); }
+
+    // Decoded combiner words
+    struct Input {
+        uint8_t reg;
+        uint8_t channel;  // Channel read by alpha portions and final combiner input G
+        bool alpha;       // Color portions read the alpha channel
+        uint8_t mapping;
+    };
+
+    struct Output {
+        uint8_t ab, cd, sum;  // Destination registers, 0 to discard
+        bool abDot, cdDot;
+        bool mux;
+        float bias, scale;
+        bool abBlueToAlpha, cdBlueToAlpha;
+    };
+
+    struct Stage {
+        Input color[4], alpha[4];
+        Output colorOutput, alphaOutput;
+        uint8_t factor0, factor1;  // Constant sets used by the stage
+    };
+
+private:
+    template<unsigned int NumStages>
+    static void RunGeneric(const CombinerKernel& kernel, const CombinerConstants& constants, const CombinerSpan& span);
+
+    template<int SourceA, int SourceB>
+    static void RunModulate(const CombinerKernel& kernel, const CombinerConstants& constants, const CombinerSpan& span);
+
+    CombinerSetup m_setup;
+    SpanFunc m_func;
+
+    Stage m_stages[COMBINER_MAX_STAGES];
+    unsigned int m_numStages;
+    bool m_muxMSB;
+
+    Input m_final[7];  // Inputs A to G
+    bool m_complementV1, m_complementR0, m_clampSum;
+
+    friend class CombinerCache;
+};
+
+/*!
+ * Compiles register combiner configurations into kernels and keeps the
+ * most recently used ones.
+ *
+ * Configurations are looked up by a hash of their words. Common shapes,
+ * where every channel is the product of two vertex colors or constants, get
+ * fully specialized kernels. Other configurations run on a generic kernel
+ * specialized for their stage count, which evaluates each combiner
+ * operation over the whole span at once so that the pixel loops stay free
+ * of decoding.
+ */
+class CombinerCache {
+public:
+    /*!
+     * Returns the kernel for the specified configuration, compiling it if
+     * necessary. The kernel remains valid until the next call.
+     */
+    const CombinerKernel *GetKernel(const CombinerSetup& setup);
+
+private:
+    std::unique_ptr<CombinerKernel> Compile(const CombinerSetup& setup);
+
+    static const size_t kCapacity = 64;
+
+    // Most recently used first
+    typedef std::list<std::unique_ptr<CombinerKernel>> KernelList;
+    KernelList m_kernels;
+    std::unordered_map<uint64_t, KernelList::iterator> m_index;
+};
+
+}
@@ -1,9 +1,10 @@
 #pragma once
 
+#include <atomic>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
 #include "nv2a_int.h"
+#include "vixen/util/spsc_ring.h"
 
 namespace vixen {
 
@@ -175,6 +176,19 @@ typedef struct SurfaceShape {
     unsigned int anti_aliasing = 0;
 } SurfaceShape;
 
+typedef struct VertexAttribute {
+    // Fetched from DMA_VERTEX_B if set, DMA_VERTEX_A otherwise
+    bool dma_select = false;
+    uint32_t offset = 0;
+
+    unsigned int format = 0;  // NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_*
+    unsigned int size = 0;    // Number of components, 0 if not fetched from memory
+    unsigned int stride = 0;
+
+    // Value used when the attribute is not fetched from memory
+    float inline_value[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+} VertexAttribute;
+
 typedef struct TextureShape {
     bool cubemap = false;
     unsigned int dimensionality = 0;
@@ -269,7 +283,8 @@ typedef struct NV2APGRAPH {
 
     bool enable_vertex_program_write = false;
 
-    //uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
+    uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE] = { { 0 } };
+    bool program_data_dirty = true;
 
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4] = { { 0 } };
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS] = { 0 };
@@ -288,7 +303,7 @@ typedef struct NV2APGRAPH {
     float light_local_position[NV2A_MAX_LIGHTS][3] = { { 0 } };
     float light_local_attenuation[NV2A_MAX_LIGHTS][3] = { { 0 } };
 
-    //VertexAttribute vertex_attributes[NV2A_VERTEXSHADER_ATTRIBUTES];
+    VertexAttribute vertex_attributes[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     unsigned int inline_array_length = 0;
     uint32_t inline_array[NV2A_MAX_BATCH_LENGTH] = { 0 };
@@ -303,15 +318,18 @@ typedef struct NV2APGRAPH {
     unsigned int draw_arrays_length = 0;
     unsigned int draw_arrays_max_count = 0;
 
-    // FIXME: no OpenGL allowed here
     /* FIXME: Unknown size, possibly endless, 1000 will do for now */
-    //GLint gl_draw_arrays_start[1000];
-    //GLsizei gl_draw_arrays_count[1000];
+    uint32_t draw_arrays_start[1000] = { 0 };
+    uint32_t draw_arrays_count[1000] = { 0 };
 
     //GLuint gl_element_buffer;
     //GLuint gl_memory_buffer;
     //GLuint gl_vertex_array;
 
+    // Last method logged and how many times in a row it was repeated
+    unsigned int log_last_method = 0;
+    unsigned int log_method_count = 0;
+
     uint32_t regs[NV_PGRAPH_SIZE] = { 0 }; // TODO : union
 } NV2APGRAPH;
 
@@ -339,11 +357,14 @@ typedef struct {
     uint32_t regs[NV_PRAMDAC_SIZE] = { 0 };
 } NV2APRAMDAC;
 
+// Number of commands buffered between the DMA pusher and the puller
+#define NV2A_CACHE1_RING_SIZE 16384
+
 typedef struct CacheEntry {
-    unsigned int method : 14;
-    unsigned int subchannel : 3;
-    bool nonincreasing = false;
-    uint32_t parameter = 0;
+    uint32_t method : 14;
+    uint32_t subchannel : 3;
+    uint32_t nonincreasing : 1;
+    uint32_t parameter;
 } CacheEntry;
 
 typedef struct Cache1State {
@@ -373,11 +394,13 @@ typedef struct Cache1State {
     enum FIFOEngine bound_engines[NV2A_NUM_SUBCHANNELS] = { ENGINE_SOFTWARE };
     enum FIFOEngine last_engine = ENGINE_SOFTWARE;
 
-    /* The actual command queue */
     std::mutex mutex;
+
+    /* The actual command queue, filled by the pusher and drained by the
+     * puller. cache_cond wakes up the puller when the queue stops being
+     * empty or pulling is enabled. */
     std::condition_variable cache_cond;
-    std::queue<CacheEntry*> cache;
-    std::queue<CacheEntry*> working_cache;
+    SPSCRing<CacheEntry> cache { NV2A_CACHE1_RING_SIZE };
 } Cache1State;
 
 typedef struct {
@@ -386,6 +409,15 @@ typedef struct {
     Cache1State cache1;
     uint32_t regs[NV_PFIFO_SIZE] = { 0 };
     std::thread puller_thread;
+
+    /* The DMA pusher runs on its own thread, kicked by writes to DMA_PUT */
+    std::thread pusher_thread;
+    std::condition_variable pusher_cond;
+    bool pusher_kicked = false;
+
+    /* Set when the pusher stopped because the command queue was full. The
+     * puller kicks the pusher after making room. */
+    std::atomic<bool> pusher_stalled { false };
 } NV2APFIFO;
 
 typedef struct {
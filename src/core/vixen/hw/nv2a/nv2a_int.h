@@ -387,6 +387,10 @@
 #define NV_PGRAPH_COMBINECOLORI0                         0x00001900
 #define NV_PGRAPH_COMBINECOLORO0                         0x00001920
 #define NV_PGRAPH_COMBINECTL                             0x00001940
+#   define NV_PGRAPH_COMBINECTL_ITERATION_COUNT                 0x000000FF
+#   define NV_PGRAPH_COMBINECTL_MUX_SELECT                      0x00000100
+#   define NV_PGRAPH_COMBINECTL_FACTOR0                         0x00001000
+#   define NV_PGRAPH_COMBINECTL_FACTOR1                         0x00010000
 #define NV_PGRAPH_COMBINESPECFOG0                        0x00001944
 #define NV_PGRAPH_COMBINESPECFOG1                        0x00001948
 #define NV_PGRAPH_CONTROL_0                              0x0000194C
@@ -1283,6 +1287,7 @@
 #define NV2A_MAX_TEXTURES 4
 
 #define NV2A_MAX_TRANSFORM_PROGRAM_LENGTH 136
+#define VSH_TOKEN_SIZE 4
 #define NV2A_VERTEXSHADER_CONSTANTS 192
 #define NV2A_MAX_LIGHTS 8
 
@@ -0,0 +1,702 @@
+#include "rasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "vixen/log.h"
+#include "nv2a_int.h"
+
+namespace vixen {
+
+// Vertices with a smaller w are behind the eye and get clipped
+static const float kNearW = 1.0e-5f;
+
+// Rows cleared by each clear task
+static const unsigned int kClearBandHeight = 16;
+
+static_assert(RASTER_TILE_SIZE <= COMBINER_MAX_SPAN, "Tile rows must fit in a combiner span");
+
+// ----- Pixel formats --------------------------------------------------------
+
+unsigned int Rasterizer::ColorBytesPerPixel(unsigned int format) {
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return 1;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+static inline uint32_t Expand5(uint32_t v) { return (v << 3) | (v >> 2); }
+static inline uint32_t Expand6(uint32_t v) { return (v << 2) | (v >> 4); }
+
+// Reads a pixel and converts it to ARGB
+static uint32_t ReadColor(unsigned int format, const uint8_t *p) {
+    uint32_t v;
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        v = *(const uint16_t *)p;
+        return 0xFF000000 | (Expand5((v >> 10) & 0x1F) << 16) | (Expand5((v >> 5) & 0x1F) << 8) | Expand5(v & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        v = *(const uint16_t *)p;
+        return 0xFF000000 | (Expand5(v >> 11) << 16) | (Expand6((v >> 5) & 0x3F) << 8) | Expand5(v & 0x1F);
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+        return 0xFF000000 | *(const uint32_t *)p;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        return 0xFF000000 | *p;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        return 0xFF000000 | *(const uint16_t *)p;
+    default:
+        return *(const uint32_t *)p;
+    }
+}
+
+// Writes the channels of an ARGB color selected by the mask to a pixel
+static void WriteColor(unsigned int format, uint8_t *p, uint32_t argb, uint32_t mask) {
+    if (mask != 0xFFFFFFFF) {
+        argb = (ReadColor(format, p) & ~mask) | (argb & mask);
+    }
+
+    uint32_t r = (argb >> 16) & 0xFF;
+    uint32_t g = (argb >> 8) & 0xFF;
+    uint32_t b = argb & 0xFF;
+    switch (format) {
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_Z1R5G5B5:
+        *(uint16_t *)p = (uint16_t)(((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1R5G5B5_O1R5G5B5:
+        *(uint16_t *)p = (uint16_t)(0x8000 | ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_R5G6B5:
+        *(uint16_t *)p = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_Z8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_Z1A7R8G8B8:
+        *(uint32_t *)p = argb & 0x00FFFFFF;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X8R8G8B8_O8R8G8B8:
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_X1A7R8G8B8_O1A7R8G8B8:
+        *(uint32_t *)p = argb | 0xFF000000;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_B8:
+        *p = (uint8_t)b;
+        break;
+    case NV097_SET_SURFACE_FORMAT_COLOR_LE_G8B8:
+        *(uint16_t *)p = (uint16_t)((g << 8) | b);
+        break;
+    default:
+        *(uint32_t *)p = argb;
+        break;
+    }
+}
+
+static inline float Saturate(float v) {
+    return (v < 0.0f) ? 0.0f : (v > 1.0f) ? 1.0f : v;
+}
+
+static inline uint32_t ToUnorm8(float v) {
+    return (uint32_t)(Saturate(v) * 255.0f + 0.5f);
+}
+
+// Converts an ARGB color to RGBA floats
+static inline void UnpackColor(uint32_t argb, float rgba[4]) {
+    rgba[0] = ((argb >> 16) & 0xFF) / 255.0f;
+    rgba[1] = ((argb >> 8) & 0xFF) / 255.0f;
+    rgba[2] = (argb & 0xFF) / 255.0f;
+    rgba[3] = (argb >> 24) / 255.0f;
+}
+
+static inline uint32_t PackColor(const float rgba[4]) {
+    return (ToUnorm8(rgba[3]) << 24) | (ToUnorm8(rgba[0]) << 16) | (ToUnorm8(rgba[1]) << 8) | ToUnorm8(rgba[2]);
+}
+
+// ----- Fragment operations --------------------------------------------------
+
+static inline bool Compare(unsigned int func, uint32_t value, uint32_t reference) {
+    switch (func) {
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NEVER:    return false;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LESS:     return value < reference;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_EQUAL:    return value == reference;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_LEQUAL:   return value <= reference;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GREATER:  return value > reference;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_NOTEQUAL: return value != reference;
+    case NV_PGRAPH_CONTROL_0_ZFUNC_GEQUAL:   return value >= reference;
+    default:                                 return true;
+    }
+}
+
+static inline uint8_t ApplyStencilOp(unsigned int op, uint8_t value, uint8_t reference) {
+    switch (op) {
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_ZERO:    return 0;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_REPLACE: return reference;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INCRSAT: return (value == 0xFF) ? value : value + 1;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_DECRSAT: return (value == 0) ? value : value - 1;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INVERT:  return ~value;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_INCR:    return value + 1;
+    case NV_PGRAPH_CONTROL_2_STENCIL_OP_V_DECR:    return value - 1;
+    default:                                       return value;
+    }
+}
+
+static inline float BlendFactor(unsigned int factor, int channel, const float *src, const float *dst, const float *constant) {
+    switch (factor) {
+    case NV_PGRAPH_BLEND_SFACTOR_ZERO:                     return 0.0f;
+    case NV_PGRAPH_BLEND_SFACTOR_ONE:                      return 1.0f;
+    case NV_PGRAPH_BLEND_SFACTOR_SRC_COLOR:                return src[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_COLOR:      return 1.0f - src[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA:                return src[3];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_SRC_ALPHA:      return 1.0f - src[3];
+    case NV_PGRAPH_BLEND_SFACTOR_DST_ALPHA:                return dst[3];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_ALPHA:      return 1.0f - dst[3];
+    case NV_PGRAPH_BLEND_SFACTOR_DST_COLOR:                return dst[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_DST_COLOR:      return 1.0f - dst[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_SRC_ALPHA_SATURATE:       return (channel == 3) ? 1.0f : std::min(src[3], 1.0f - dst[3]);
+    case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_COLOR:           return constant[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_COLOR: return 1.0f - constant[channel];
+    case NV_PGRAPH_BLEND_SFACTOR_CONSTANT_ALPHA:           return constant[3];
+    case NV_PGRAPH_BLEND_SFACTOR_ONE_MINUS_CONSTANT_ALPHA: return 1.0f - constant[3];
+    default:                                               return 1.0f;
+    }
+}
+
+// Blends the source color into the destination color
+static void Blend(const RasterState& state, const float *src, float *dst) {
+    float constant[4];
+    UnpackColor(state.blendColor, constant);
+
+    float result[4];
+    for (int c = 0; c < 4; c++) {
+        float s = src[c] * BlendFactor(state.blendSFactor, c, src, dst, constant);
+        float d = dst[c] * BlendFactor(state.blendDFactor, c, src, dst, constant);
+        switch (state.blendEquation) {
+        case 0: result[c] = s - d; break;                   // FUNC_SUBTRACT
+        case 1: result[c] = d - s; break;                   // FUNC_REVERSE_SUBTRACT
+        case 3: result[c] = std::min(src[c], dst[c]); break; // MIN
+        case 4: result[c] = std::max(src[c], dst[c]); break; // MAX
+        case 5: result[c] = d - s + 0.5f; break;            // FUNC_REVERSE_SUBTRACT_SIGNED
+        case 6: result[c] = s + d - 0.5f; break;            // FUNC_ADD_SIGNED
+        default: result[c] = s + d; break;                  // FUNC_ADD
+        }
+    }
+    for (int c = 0; c < 4; c++) {
+        dst[c] = Saturate(result[c]);
+    }
+}
+
+// ----- Span evaluation ------------------------------------------------------
+
+// Computes coverage, depth and perspective-correct varyings for the four
+// pixels starting at (x, y). Returns a bit mask of the covered pixels.
+#ifdef RASTER_USE_SSE2
+
+static inline __m128 EvaluatePlane(const float *plane, __m128 px, __m128 py) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), px), _mm_mul_ps(_mm_set1_ps(plane[1]), py)), _mm_set1_ps(plane[2]));
+}
+
+template<typename Triangle>
+static inline int EvaluateQuad(const Triangle& tri, int x, int y, float *z, float (*varyings)[4]) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+    __m128 py = _mm_set1_ps(y + 0.5f);
+
+    __m128 inside = _mm_cmpeq_ps(zero, zero);
+    for (int e = 0; e < 3; e++) {
+        __m128 value = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.edgeA[e]), px), _mm_mul_ps(_mm_set1_ps(tri.edgeB[e]), py)), _mm_set1_ps(tri.edgeC[e]));
+        __m128 covered = _mm_cmpgt_ps(value, zero);
+        if (tri.edgeInclusive[e]) {
+            covered = _mm_or_ps(covered, _mm_cmpeq_ps(value, zero));
+        }
+        inside = _mm_and_ps(inside, covered);
+    }
+    int mask = _mm_movemask_ps(inside);
+    if (mask == 0) {
+        return 0;
+    }
+
+    _mm_storeu_ps(z, EvaluatePlane(tri.z, px, py));
+    __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), EvaluatePlane(tri.q, px, py));
+    for (int i = 0; i < RASTER_NUM_VARYINGS; i++) {
+        _mm_storeu_ps(varyings[i], _mm_mul_ps(EvaluatePlane(tri.varyings[i], px, py), w));
+    }
+    return mask;
+}
+
+#else
+
+static inline float EvaluatePlane(const float *plane, float px, float py) {
+    return plane[0] * px + plane[1] * py + plane[2];
+}
+
+template<typename Triangle>
+static inline int EvaluateQuad(const Triangle& tri, int x, int y, float *z, float (*varyings)[4]) {
+    float py = y + 0.5f;
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++) {
+        float px = x + lane + 0.5f;
+        bool inside = true;
+        for (int e = 0; e < 3; e++) {
+            float value = tri.edgeA[e] * px + tri.edgeB[e] * py + tri.edgeC[e];
+            inside = inside && (value > 0.0f || (value == 0.0f && tri.edgeInclusive[e]));
+        }
+        if (!inside) {
+            continue;
+        }
+        mask |= 1 << lane;
+
+        z[lane] = EvaluatePlane(tri.z, px, py);
+        float w = 1.0f / EvaluatePlane(tri.q, px, py);
+        for (int i = 0; i < RASTER_NUM_VARYINGS; i++) {
+            varyings[i][lane] = EvaluatePlane(tri.varyings[i], px, py) * w;
+        }
+    }
+    return mask;
+}
+
+#endif
+
+// ----- Rasterizer -----------------------------------------------------------
+
+Rasterizer::Rasterizer(uint32_t numThreads)
+    : m_pool(WorkerPool::Share(numThreads, "[HW] NV2A Raster"))
+{
+}
+
+void Rasterizer::DrawPrimitives(const RasterState& state, unsigned int primitive, const RasterVertex *vertices, uint32_t count) {
+    if (state.clipWidth == 0 || state.clipHeight == 0) {
+        return;
+    }
+
+    m_state = &state;
+    m_zetaMax = (state.zeta.format == NV097_SET_SURFACE_FORMAT_ZETA_Z16) ? 0xFFFF : 0xFFFFFF;
+    m_tilesX = (state.clipWidth + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    m_tilesY = (state.clipHeight + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    uint32_t numTiles = m_tilesX * m_tilesY;
+    if (m_bins.size() < numTiles) {
+        m_bins.resize(numTiles);
+    }
+    for (uint32_t i = 0; i < numTiles; i++) {
+        m_bins[i].clear();
+    }
+    m_triangles.clear();
+
+    const RasterVertex *v = vertices;
+    switch (primitive) {
+    case NV097_SET_BEGIN_END_OP_TRIANGLES:
+        for (uint32_t i = 0; i + 2 < count; i += 3) {
+            DrawTriangle(v[i], v[i + 1], v[i + 2]);
+        }
+        break;
+    case NV097_SET_BEGIN_END_OP_TRIANGLE_STRIP:
+        // Every other triangle is flipped to keep the winding consistent
+        for (uint32_t i = 0; i + 2 < count; i++) {
+            if (i & 1) {
+                DrawTriangle(v[i + 1], v[i], v[i + 2]);
+            }
+            else {
+                DrawTriangle(v[i], v[i + 1], v[i + 2]);
+            }
+        }
+        break;
+    case NV097_SET_BEGIN_END_OP_TRIANGLE_FAN:
+    case NV097_SET_BEGIN_END_OP_POLYGON:
+        for (uint32_t i = 1; i + 1 < count; i++) {
+            DrawTriangle(v[0], v[i], v[i + 1]);
+        }
+        break;
+    case NV097_SET_BEGIN_END_OP_QUADS:
+        for (uint32_t i = 0; i + 3 < count; i += 4) {
+            DrawTriangle(v[i], v[i + 1], v[i + 2]);
+            DrawTriangle(v[i], v[i + 2], v[i + 3]);
+        }
+        break;
+    case NV097_SET_BEGIN_END_OP_QUAD_STRIP:
+        for (uint32_t i = 0; i + 3 < count; i += 2) {
+            DrawTriangle(v[i], v[i + 1], v[i + 3]);
+            DrawTriangle(v[i], v[i + 3], v[i + 2]);
+        }
+        break;
+    default:
+        log_warning("Rasterizer: Unsupported primitive type %u\n", primitive);
+        break;
+    }
+
+    if (!m_triangles.empty()) {
+        m_pool->Run(numTiles, RasterizeTileTask, this);
+    }
+    m_state = nullptr;
+}
+
+void Rasterizer::DrawTriangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2) {
+    bool in0 = v0.pos[3] >= kNearW;
+    bool in1 = v1.pos[3] >= kNearW;
+    bool in2 = v2.pos[3] >= kNearW;
+    if (in0 && in1 && in2) {
+        SetupTriangle(v0, v1, v2);
+        return;
+    }
+    if (!in0 && !in1 && !in2) {
+        return;
+    }
+
+    // Clip against the near plane in homogeneous space, which turns the
+    // triangle into a triangle or a quad
+    const RasterVertex *input[3] = { &v0, &v1, &v2 };
+    RasterVertex output[4];
+    int n = 0;
+    for (int i = 0; i < 3; i++) {
+        const RasterVertex& a = *input[i];
+        const RasterVertex& b = *input[(i + 1) % 3];
+        bool aIn = a.pos[3] >= kNearW;
+        bool bIn = b.pos[3] >= kNearW;
+        if (aIn) {
+            output[n++] = a;
+        }
+        if (aIn != bIn) {
+            float t = (kNearW - a.pos[3]) / (b.pos[3] - a.pos[3]);
+            RasterVertex& v = output[n++];
+            for (int c = 0; c < 4; c++) {
+                v.pos[c] = a.pos[c] + t * (b.pos[c] - a.pos[c]);
+            }
+            for (int c = 0; c < RASTER_NUM_VARYINGS; c++) {
+                v.varyings[c] = a.varyings[c] + t * (b.varyings[c] - a.varyings[c]);
+            }
+        }
+    }
+
+    for (int i = 1; i + 1 < n; i++) {
+        SetupTriangle(output[0], output[i], output[i + 1]);
+    }
+}
+
+void Rasterizer::SetupTriangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2) {
+    const RasterState& state = *m_state;
+
+    const RasterVertex *v[3] = { &v0, &v1, &v2 };
+    float x[3], y[3], q[3];
+    for (int i = 0; i < 3; i++) {
+        q[i] = 1.0f / v[i]->pos[3];
+        x[i] = v[i]->pos[0] * q[i];
+        y[i] = v[i]->pos[1] * q[i];
+    }
+
+    // The area is positive for triangles that are clockwise on screen. This
+    // also rejects degenerate triangles and invalid positions.
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0f || !std::isfinite(area)) {
+        return;
+    }
+
+    bool clockwise = area > 0.0f;
+    if (state.cullEnable) {
+        bool front = state.frontFaceCCW ? !clockwise : clockwise;
+        switch (state.cullFace) {
+        case NV_PGRAPH_SETUPRASTER_CULLCTRL_FRONT: if (front) return; break;
+        case NV_PGRAPH_SETUPRASTER_CULLCTRL_BACK: if (!front) return; break;
+        case NV_PGRAPH_SETUPRASTER_CULLCTRL_FRONT_AND_BACK: return;
+        }
+    }
+
+    // Make the triangle clockwise so that the edge functions are positive
+    // inside of it
+    if (!clockwise) {
+        std::swap(v[1], v[2]);
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(q[1], q[2]);
+        area = -area;
+    }
+
+    Triangle tri;
+
+    float minX = std::floor(std::min(std::min(x[0], x[1]), x[2]));
+    float minY = std::floor(std::min(std::min(y[0], y[1]), y[2]));
+    float maxX = std::ceil(std::max(std::max(x[0], x[1]), x[2]));
+    float maxY = std::ceil(std::max(std::max(y[0], y[1]), y[2]));
+    minX = std::max(minX, (float)state.clipX);
+    minY = std::max(minY, (float)state.clipY);
+    maxX = std::min(maxX, (float)(state.clipX + state.clipWidth - 1));
+    maxY = std::min(maxY, (float)(state.clipY + state.clipHeight - 1));
+    if (minX > maxX || minY > maxY) {
+        return;
+    }
+    tri.minX = (int)minX;
+    tri.minY = (int)minY;
+    tri.maxX = (int)maxX;
+    tri.maxY = (int)maxY;
+
+    for (int i = 0; i < 3; i++) {
+        int j = (i + 1) % 3;
+        float a = y[i] - y[j];
+        float b = x[j] - x[i];
+        tri.edgeA[i] = a;
+        tri.edgeB[i] = b;
+        tri.edgeC[i] = -(a * x[i] + b * y[i]);
+
+        // Shared edges are walked in opposite directions by the two
+        // triangles, so exactly one of them covers the pixels on the edge
+        tri.edgeInclusive[i] = (a > 0.0f) || (a == 0.0f && b > 0.0f);
+    }
+
+    float invArea = 1.0f / area;
+    auto setPlane = [&](float *plane, float f0, float f1, float f2) {
+        float dx = ((f1 - f0) * (y[2] - y[0]) - (f2 - f0) * (y[1] - y[0])) * invArea;
+        float dy = ((f2 - f0) * (x[1] - x[0]) - (f1 - f0) * (x[2] - x[0])) * invArea;
+        plane[0] = dx;
+        plane[1] = dy;
+        plane[2] = f0 - dx * x[0] - dy * y[0];
+    };
+
+    setPlane(tri.z, v[0]->pos[2] * q[0], v[1]->pos[2] * q[1], v[2]->pos[2] * q[2]);
+    setPlane(tri.q, q[0], q[1], q[2]);
+    for (int i = 0; i < RASTER_NUM_VARYINGS; i++) {
+        setPlane(tri.varyings[i], v[0]->varyings[i] * q[0], v[1]->varyings[i] * q[1], v[2]->varyings[i] * q[2]);
+    }
+
+    uint32_t index = (uint32_t)m_triangles.size();
+    m_triangles.push_back(tri);
+
+    uint32_t tx0 = (tri.minX - state.clipX) / RASTER_TILE_SIZE;
+    uint32_t ty0 = (tri.minY - state.clipY) / RASTER_TILE_SIZE;
+    uint32_t tx1 = (tri.maxX - state.clipX) / RASTER_TILE_SIZE;
+    uint32_t ty1 = (tri.maxY - state.clipY) / RASTER_TILE_SIZE;
+    for (uint32_t ty = ty0; ty <= ty1; ty++) {
+        for (uint32_t tx = tx0; tx <= tx1; tx++) {
+            m_bins[ty * m_tilesX + tx].push_back(index);
+        }
+    }
+}
+
+void Rasterizer::RasterizeTileTask(void *userData, uint32_t task) {
+    ((Rasterizer *)userData)->RasterizeTile(task);
+}
+
+void Rasterizer::RasterizeTile(uint32_t tile) {
+    const RasterState& state = *m_state;
+
+    int x0 = state.clipX + (tile % m_tilesX) * RASTER_TILE_SIZE;
+    int y0 = state.clipY + (tile / m_tilesX) * RASTER_TILE_SIZE;
+    int x1 = std::min(x0 + RASTER_TILE_SIZE, (int)(state.clipX + state.clipWidth)) - 1;
+    int y1 = std::min(y0 + RASTER_TILE_SIZE, (int)(state.clipY + state.clipHeight)) - 1;
+
+    for (uint32_t index : m_bins[tile]) {
+        const Triangle& tri = m_triangles[index];
+        RasterizeTriangle(tri,
+            std::max(x0, tri.minX), std::max(y0, tri.minY),
+            std::min(x1, tri.maxX), std::min(y1, tri.maxY));
+    }
+}
+
+void Rasterizer::RasterizeTriangle(const Triangle& tri, int x0, int y0, int x1, int y1) {
+    const RasterState& state = *m_state;
+
+    float z[4];
+    float varyings[RASTER_NUM_VARYINGS][4];
+
+    // Covered pixels of the current row, gathered so that the combiners run
+    // once per row
+    int spanX[RASTER_TILE_SIZE];
+    float spanZ[RASTER_TILE_SIZE];
+    float diffuse[4][RASTER_TILE_SIZE];
+    float specular[4][RASTER_TILE_SIZE];
+    float color[4][RASTER_TILE_SIZE];
+
+    CombinerSpan span;
+    for (int c = 0; c < 4; c++) {
+        span.diffuse[c] = diffuse[c];
+        span.specular[c] = specular[c];
+        span.color[c] = color[c];
+    }
+
+    for (int y = y0; y <= y1; y++) {
+        uint32_t count = 0;
+        for (int x = x0; x <= x1; x += 4) {
+            int mask = EvaluateQuad(tri, x, y, z, varyings);
+            if (x1 - x < 3) {
+                // Drop the pixels past the end of the span
+                mask &= (1 << (x1 - x + 1)) - 1;
+            }
+
+            for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+                if (mask & 1) {
+                    spanX[count] = x + lane;
+                    spanZ[count] = z[lane];
+                    for (int c = 0; c < 4; c++) {
+                        diffuse[c][count] = Saturate(varyings[RASTER_VARYING_DIFFUSE + c][lane]);
+                        specular[c][count] = Saturate(varyings[RASTER_VARYING_SPECULAR + c][lane]);
+                    }
+                    count++;
+                }
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        span.count = count;
+        if (state.combiners != nullptr) {
+            state.combiners->Run(state.combinerConstants, span);
+        }
+        else {
+            for (int c = 0; c < 4; c++) {
+                std::copy(diffuse[c], diffuse[c] + count, color[c]);
+            }
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            float src[4] = { color[0][i], color[1][i], color[2][i], color[3][i] };
+            ShadePixel(spanX[i], y, spanZ[i], src);
+        }
+    }
+}
+
+void Rasterizer::ShadePixel(int x, int y, float z, const float *src) {
+    const RasterState& state = *m_state;
+
+    if (state.alphaTest && !Compare(state.alphaFunc, ToUnorm8(src[3]), state.alphaRef)) {
+        return;
+    }
+
+    // Depth and stencil tests
+    if (state.zeta.data != nullptr && (state.depthTest || state.stencilTest)) {
+        bool z24s8 = state.zeta.format == NV097_SET_SURFACE_FORMAT_ZETA_Z24S8;
+        uint8_t *zp = state.zeta.data + y * state.zeta.pitch + x * (z24s8 ? 4 : 2);
+        uint32_t stored = z24s8 ? *(uint32_t *)zp : *(uint16_t *)zp;
+        uint32_t storedDepth = z24s8 ? (stored >> 8) : stored;
+        uint8_t stencil = z24s8 ? (uint8_t)stored : 0;
+
+        uint32_t depth = (uint32_t)std::min(std::max(z, 0.0f), (float)m_zetaMax);
+        bool depthPass = !state.depthTest || Compare(state.depthFunc, depth, storedDepth);
+
+        bool stencilPass = true;
+        if (state.stencilTest && z24s8) {
+            stencilPass = Compare(state.stencilFunc, state.stencilRef & state.stencilReadMask,
+                stencil & state.stencilReadMask);
+            unsigned int op = !stencilPass ? state.stencilOpFail
+                : !depthPass ? state.stencilOpZFail
+                : state.stencilOpZPass;
+            uint8_t updated = ApplyStencilOp(op, stencil, state.stencilRef);
+            stencil = (stencil & ~state.stencilWriteMask) | (updated & state.stencilWriteMask);
+        }
+
+        uint32_t newDepth = storedDepth;
+        if (stencilPass && depthPass && state.depthTest && state.depthWrite) {
+            newDepth = depth;
+        }
+
+        if (z24s8) {
+            uint32_t value = (newDepth << 8) | stencil;
+            if (value != stored) {
+                *(uint32_t *)zp = value;
+            }
+        }
+        else if (newDepth != stored) {
+            *(uint16_t *)zp = (uint16_t)newDepth;
+        }
+
+        if (!stencilPass || !depthPass) {
+            return;
+        }
+    }
+
+    if (state.color.data == nullptr || state.colorWriteMask == 0) {
+        return;
+    }
+
+    uint8_t *cp = state.color.data + y * state.color.pitch + x * ColorBytesPerPixel(state.color.format);
+    if (state.blend) {
+        float dst[4];
+        UnpackColor(ReadColor(state.color.format, cp), dst);
+        Blend(state, src, dst);
+        WriteColor(state.color.format, cp, PackColor(dst), state.colorWriteMask);
+    }
+    else {
+        WriteColor(state.color.format, cp, PackColor(src), state.colorWriteMask);
+    }
+}
+
+// ----- Clears ---------------------------------------------------------------
+
+void Rasterizer::Clear(const RasterState& state, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+    uint32_t colorMask, uint32_t color, bool clearDepth, bool clearStencil, uint32_t zeta)
+{
+    if (state.clipWidth == 0 || state.clipHeight == 0) {
+        return;
+    }
+
+    m_clear.x0 = std::max(x0, state.clipX);
+    m_clear.y0 = std::max(y0, state.clipY);
+    m_clear.x1 = std::min(x1, state.clipX + state.clipWidth - 1);
+    m_clear.y1 = std::min(y1, state.clipY + state.clipHeight - 1);
+    if (m_clear.x0 > m_clear.x1 || m_clear.y0 > m_clear.y1) {
+        return;
+    }
+
+    m_clear.colorMask = (state.color.data != nullptr) ? colorMask : 0;
+    m_clear.colorValue = color;
+    m_clear.zetaMask = 0;
+    if (state.zeta.data != nullptr) {
+        if (state.zeta.format == NV097_SET_SURFACE_FORMAT_ZETA_Z24S8) {
+            m_clear.zetaMask = (clearDepth ? 0xFFFFFF00 : 0) | (clearStencil ? 0xFF : 0);
+        }
+        else if (clearDepth) {
+            m_clear.zetaMask = 0xFFFF;
+        }
+    }
+    m_clear.zetaValue = zeta;
+    if (m_clear.colorMask == 0 && m_clear.zetaMask == 0) {
+        return;
+    }
+
+    m_state = &state;
+    uint32_t numBands = (m_clear.y1 - m_clear.y0) / kClearBandHeight + 1;
+    m_pool->Run(numBands, ClearTask, this);
+    m_state = nullptr;
+}
+
+void Rasterizer::ClearTask(void *userData, uint32_t task) {
+    Rasterizer *rasterizer = (Rasterizer *)userData;
+    const RasterState& state = *rasterizer->m_state;
+    auto& clear = rasterizer->m_clear;
+
+    unsigned int y0 = clear.y0 + task * kClearBandHeight;
+    unsigned int y1 = std::min(y0 + kClearBandHeight - 1, clear.y1);
+    unsigned int colorBpp = Rasterizer::ColorBytesPerPixel(state.color.format);
+    bool z24s8 = state.zeta.format == NV097_SET_SURFACE_FORMAT_ZETA_Z24S8;
+
+    for (unsigned int y = y0; y <= y1; y++) {
+        if (clear.colorMask != 0) {
+            uint8_t *row = state.color.data + y * state.color.pitch;
+            for (unsigned int x = clear.x0; x <= clear.x1; x++) {
+                WriteColor(state.color.format, row + x * colorBpp, clear.colorValue, clear.colorMask);
+            }
+        }
+        if (clear.zetaMask != 0) {
+            uint8_t *row = state.zeta.data + y * state.zeta.pitch;
+            for (unsigned int x = clear.x0; x <= clear.x1; x++) {
+                if (z24s8) {
+                    uint32_t *p = (uint32_t *)(row + x * 4);
+                    *p = (*p & ~clear.zetaMask) | (clear.zetaValue & clear.zetaMask);
+                }
+                else {
+                    *(uint16_t *)(row + x * 2) = (uint16_t)clear.zetaValue;
+                }
+            }
+        }
+    }
+}
+
+}
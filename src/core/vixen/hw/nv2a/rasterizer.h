@@ -0,0 +1,184 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "vixen/util/worker_pool.h"
+#include "combiners.h"
+
+namespace vixen {
+
+// Vertex outputs interpolated across primitives, as RGBA quadruplets
+#define RASTER_VARYING_DIFFUSE   0
+#define RASTER_VARYING_SPECULAR  4
+#define RASTER_NUM_VARYINGS      8
+
+// Width and height of the screen tiles rasterized in parallel, in pixels
+#define RASTER_TILE_SIZE 64
+
+/*!
+ * A transformed vertex ready for rasterization.
+ */
+struct RasterVertex {
+    // Homogeneous screen space position: x and y in pixels and z in depth
+    // buffer units, all multiplied by w
+    float pos[4];
+
+    // Colors in the range [0, 1]
+    float varyings[RASTER_NUM_VARYINGS];
+};
+
+/*!
+ * A color or zeta surface in guest memory.
+ */
+struct RasterSurface {
+    uint8_t *data = nullptr;  // First byte of the surface, null if not bound
+    uint32_t pitch = 0;
+    unsigned int format = 0;  // NV097_SET_SURFACE_FORMAT_COLOR_* or _ZETA_*
+};
+
+/*!
+ * The render state used to draw primitives, captured from PGRAPH.
+ * Comparison functions, stencil operations, blend factors and equations use
+ * the NV_PGRAPH_* register encodings.
+ */
+struct RasterState {
+    RasterSurface color;
+    RasterSurface zeta;
+
+    // Pixels outside this rectangle are never touched
+    unsigned int clipX = 0, clipY = 0;
+    unsigned int clipWidth = 0, clipHeight = 0;
+
+    bool cullEnable = false;
+    unsigned int cullFace = 0;
+    bool frontFaceCCW = false;
+
+    bool depthTest = false;
+    unsigned int depthFunc = 0;
+    bool depthWrite = false;
+
+    bool stencilTest = false;
+    unsigned int stencilFunc = 0;
+    uint8_t stencilRef = 0;
+    uint8_t stencilReadMask = 0;
+    uint8_t stencilWriteMask = 0;
+    unsigned int stencilOpFail = 0;
+    unsigned int stencilOpZFail = 0;
+    unsigned int stencilOpZPass = 0;
+
+    bool alphaTest = false;
+    unsigned int alphaFunc = 0;
+    uint8_t alphaRef = 0;
+
+    bool blend = false;
+    unsigned int blendSFactor = 0;
+    unsigned int blendDFactor = 0;
+    unsigned int blendEquation = 0;
+    uint32_t blendColor = 0;  // ARGB
+
+    // ARGB channels written to the color surface
+    uint32_t colorWriteMask = 0;
+
+    // Register combiners computing the color of each pixel from its diffuse
+    // and specular colors. Without them, pixels take the diffuse color.
+    const CombinerKernel *combiners = nullptr;
+    CombinerConstants combinerConstants;
+};
+
+/*!
+ * Software rasterizer for the Kelvin 3D pipeline.
+ *
+ * Primitives are assembled into triangles, clipped against the w = 0 plane
+ * and set up once on the calling thread. The triangles are then binned into
+ * screen tiles of RASTER_TILE_SIZE pixels, and tiles are rasterized in
+ * parallel on a worker pool. Each tile draws its triangles in submission
+ * order, so blending and depth testing behave as if drawn sequentially.
+ *
+ * Rows are evaluated four pixels at a time with SSE2 where available:
+ * coverage, depth and perspective-correct colors are computed for all four
+ * pixels together. The covered pixels of a row then go through the register
+ * combiners as one span, before each goes through the depth, stencil, alpha
+ * and blending stages.
+ *
+ * Draw calls return once the surfaces have been updated.
+ */
+class Rasterizer {
+public:
+    /*!
+     * Creates a rasterizer with the specified number of worker threads in
+     * addition to the calling thread. Rasterizers with the same number of
+     * threads share them.
+     */
+    Rasterizer(uint32_t numThreads);
+
+    /*!
+     * Draws primitives of the specified type (NV097_SET_BEGIN_END_OP_*) from
+     * an array of vertices. Points and lines are not supported.
+     */
+    void DrawPrimitives(const RasterState& state, unsigned int primitive, const RasterVertex *vertices, uint32_t count);
+
+    /*!
+     * Fills the rectangle from (x0, y0) to (x1, y1), inclusive and limited to
+     * the clip rectangle, with the specified values.
+     *
+     * The color value is in ARGB format; only the channels in colorMask are
+     * cleared. The zeta value holds the depth in the upper 24 bits and the
+     * stencil value in the lower 8 bits for Z24S8 surfaces, or the depth in
+     * the lower 16 bits for Z16 surfaces.
+     */
+    void Clear(const RasterState& state, unsigned int x0, unsigned int y0, unsigned int x1, unsigned int y1,
+        uint32_t colorMask, uint32_t color, bool clearDepth, bool clearStencil, uint32_t zeta);
+
+    /*!
+     * Returns the size of a pixel of the specified color surface format.
+     */
+    static unsigned int ColorBytesPerPixel(unsigned int format);
+
+private:
+    struct Triangle {
+        // Bounding box in pixels, inclusive and within the clip rectangle
+        int minX, minY, maxX, maxY;
+
+        // Edge functions a * x + b * y + c, positive inside the triangle.
+        // Pixels exactly on inclusive edges are covered.
+        float edgeA[3], edgeB[3], edgeC[3];
+        bool edgeInclusive[3];
+
+        // Plane equations dx * x + dy * y + c of screen depth, 1 / w and
+        // varyings divided by w
+        float z[3];
+        float q[3];
+        float varyings[RASTER_NUM_VARYINGS][3];
+    };
+
+    void DrawTriangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2);
+    void SetupTriangle(const RasterVertex& v0, const RasterVertex& v1, const RasterVertex& v2);
+    void RasterizeTile(uint32_t tile);
+    void RasterizeTriangle(const Triangle& tri, int x0, int y0, int x1, int y1);
+    void ShadePixel(int x, int y, float z, const float *color);
+
+    static void RasterizeTileTask(void *userData, uint32_t task);
+    static void ClearTask(void *userData, uint32_t task);
+
+    std::shared_ptr<WorkerPool> m_pool;
+
+    // State of the current draw
+    const RasterState *m_state = nullptr;
+    uint32_t m_zetaMax = 0;
+    uint32_t m_tilesX = 0, m_tilesY = 0;
+
+    // Triangles set up for the current draw and the triangles overlapping
+    // each tile, kept between draws to avoid reallocating them
+    std::vector<Triangle> m_triangles;
+    std::vector<std::vector<uint32_t>> m_bins;
+
+    // Parameters of the current clear
+    struct {
+        unsigned int x0, y0, x1, y1;
+        uint32_t colorMask, colorValue;
+        uint32_t zetaMask, zetaValue;
+    } m_clear;
+};
+
+}
@@ -0,0 +1,604 @@
+#include "vsh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VSH_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "vixen/log.h"
+#include "vixen/util.h"
+
+namespace vixen {
+
+// ----- Lane vectors ---------------------------------------------------------
+
+// One component of VSH_LANES vertices
+#if defined(__AVX__)
+
+typedef __m256 VshFloat;
+
+static inline VshFloat VLoad(const float *p) { return _mm256_loadu_ps(p); }
+static inline void VStore(float *p, VshFloat v) { _mm256_storeu_ps(p, v); }
+static inline VshFloat VSplat(float f) { return _mm256_set1_ps(f); }
+static inline VshFloat VAdd(VshFloat a, VshFloat b) { return _mm256_add_ps(a, b); }
+static inline VshFloat VMul(VshFloat a, VshFloat b) { return _mm256_mul_ps(a, b); }
+static inline VshFloat VMin(VshFloat a, VshFloat b) { return _mm256_min_ps(a, b); }
+static inline VshFloat VMax(VshFloat a, VshFloat b) { return _mm256_max_ps(a, b); }
+static inline VshFloat VNeg(VshFloat a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+static inline VshFloat VLess(VshFloat a, VshFloat b) {
+    return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ), _mm256_set1_ps(1.0f));
+}
+static inline VshFloat VGreaterEqual(VshFloat a, VshFloat b) {
+    return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ), _mm256_set1_ps(1.0f));
+}
+
+#elif defined(VSH_USE_SSE2)
+
+typedef __m128 VshFloat;
+
+static inline VshFloat VLoad(const float *p) { return _mm_loadu_ps(p); }
+static inline void VStore(float *p, VshFloat v) { _mm_storeu_ps(p, v); }
+static inline VshFloat VSplat(float f) { return _mm_set1_ps(f); }
+static inline VshFloat VAdd(VshFloat a, VshFloat b) { return _mm_add_ps(a, b); }
+static inline VshFloat VMul(VshFloat a, VshFloat b) { return _mm_mul_ps(a, b); }
+static inline VshFloat VMin(VshFloat a, VshFloat b) { return _mm_min_ps(a, b); }
+static inline VshFloat VMax(VshFloat a, VshFloat b) { return _mm_max_ps(a, b); }
+static inline VshFloat VNeg(VshFloat a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+static inline VshFloat VLess(VshFloat a, VshFloat b) { return _mm_and_ps(_mm_cmplt_ps(a, b), _mm_set1_ps(1.0f)); }
+static inline VshFloat VGreaterEqual(VshFloat a, VshFloat b) { return _mm_and_ps(_mm_cmpge_ps(a, b), _mm_set1_ps(1.0f)); }
+
+#else
+
+struct VshFloat {
+    float v[VSH_LANES];
+};
+
+#define VSH_LANEWISE(expr) VshFloat r; for (int i = 0; i < VSH_LANES; i++) { r.v[i] = (expr); } return r
+
+static inline VshFloat VLoad(const float *p) { VSH_LANEWISE(p[i]); }
+static inline void VStore(float *p, VshFloat v) { memcpy(p, v.v, sizeof(v.v)); }
+static inline VshFloat VSplat(float f) { VSH_LANEWISE(f); }
+static inline VshFloat VAdd(VshFloat a, VshFloat b) { VSH_LANEWISE(a.v[i] + b.v[i]); }
+static inline VshFloat VMul(VshFloat a, VshFloat b) { VSH_LANEWISE(a.v[i] * b.v[i]); }
+static inline VshFloat VMin(VshFloat a, VshFloat b) { VSH_LANEWISE(std::min(a.v[i], b.v[i])); }
+static inline VshFloat VMax(VshFloat a, VshFloat b) { VSH_LANEWISE(std::max(a.v[i], b.v[i])); }
+static inline VshFloat VNeg(VshFloat a) { VSH_LANEWISE(-a.v[i]); }
+static inline VshFloat VLess(VshFloat a, VshFloat b) { VSH_LANEWISE((a.v[i] < b.v[i]) ? 1.0f : 0.0f); }
+static inline VshFloat VGreaterEqual(VshFloat a, VshFloat b) { VSH_LANEWISE((a.v[i] >= b.v[i]) ? 1.0f : 0.0f); }
+
+#undef VSH_LANEWISE
+
+#endif
+
+static inline VshFloat VDot3(const VshFloat *a, const VshFloat *b) {
+    return VAdd(VAdd(VMul(a[0], b[0]), VMul(a[1], b[1])), VMul(a[2], b[2]));
+}
+
+// ----- Microcode ------------------------------------------------------------
+
+// Each instruction token holds its fields in dwords 1 to 3
+static inline uint32_t GetField(const uint32_t *token, int dword, int shift, int bits) {
+    return (token[dword] >> shift) & ((1u << bits) - 1);
+}
+
+static inline void SetField(uint32_t *token, int dword, int shift, int bits, uint32_t value) {
+    token[dword] |= (value & ((1u << bits) - 1)) << shift;
+}
+
+// Operands are encoded as a negate bit followed by four 2-bit swizzle fields
+static VshInstruction::Source DecodeSource(uint32_t negateSwizzle, uint32_t reg, uint32_t mux) {
+    VshInstruction::Source source;
+    source.mux = (uint8_t)mux;
+    source.reg = (uint8_t)reg;
+    source.negate = negateSwizzle & 0x100;
+    for (int i = 0; i < 4; i++) {
+        source.swizzle[i] = (negateSwizzle >> (6 - i * 2)) & 3;
+    }
+    return source;
+}
+
+static uint32_t EncodeSource(const VshInstruction::Source& source) {
+    uint32_t bits = source.negate ? 0x100 : 0;
+    for (int i = 0; i < 4; i++) {
+        bits |= (source.swizzle[i] & 3) << (6 - i * 2);
+    }
+    return bits;
+}
+
+static VshInstruction DecodeInstruction(const uint32_t *token) {
+    VshInstruction inst;
+    inst.ilu = GetField(token, 1, 25, 3);
+    inst.mac = GetField(token, 1, 21, 4);
+    inst.constant = GetField(token, 1, 13, 8);
+    inst.input = GetField(token, 1, 9, 4);
+    inst.a = DecodeSource(GetField(token, 1, 0, 9), GetField(token, 2, 28, 4), GetField(token, 2, 26, 2));
+    inst.b = DecodeSource(GetField(token, 2, 17, 9), GetField(token, 2, 13, 4), GetField(token, 2, 11, 2));
+    inst.c = DecodeSource(GetField(token, 2, 2, 9),
+        (GetField(token, 2, 0, 2) << 2) | GetField(token, 3, 30, 2), GetField(token, 3, 28, 2));
+    inst.macMask = GetField(token, 3, 24, 4);
+    inst.temp = GetField(token, 3, 20, 4);
+    inst.iluMask = GetField(token, 3, 16, 4);
+    inst.outMask = GetField(token, 3, 12, 4);
+    inst.outConstant = !GetField(token, 3, 11, 1);
+    inst.outAddress = GetField(token, 3, 3, 8);
+    inst.outIlu = GetField(token, 3, 2, 1);
+    inst.relative = GetField(token, 3, 1, 1);
+
+    // When both units are busy, the ILU can only write to R1
+    inst.iluTemp = (inst.mac != MAC_NOP) ? 1 : inst.temp;
+    return inst;
+}
+
+static void EncodeInstruction(const VshInstruction& inst, bool final, uint32_t *token) {
+    memset(token, 0, VSH_TOKEN_SIZE * sizeof(uint32_t));
+    SetField(token, 1, 25, 3, inst.ilu);
+    SetField(token, 1, 21, 4, inst.mac);
+    SetField(token, 1, 13, 8, inst.constant);
+    SetField(token, 1, 9, 4, inst.input);
+    SetField(token, 1, 0, 9, EncodeSource(inst.a));
+    SetField(token, 2, 28, 4, inst.a.reg);
+    SetField(token, 2, 26, 2, inst.a.mux);
+    SetField(token, 2, 17, 9, EncodeSource(inst.b));
+    SetField(token, 2, 13, 4, inst.b.reg);
+    SetField(token, 2, 11, 2, inst.b.mux);
+    SetField(token, 2, 2, 9, EncodeSource(inst.c));
+    SetField(token, 2, 0, 2, inst.c.reg >> 2);
+    SetField(token, 3, 30, 2, inst.c.reg);
+    SetField(token, 3, 28, 2, inst.c.mux);
+    SetField(token, 3, 24, 4, inst.macMask);
+    SetField(token, 3, 20, 4, inst.temp);
+    SetField(token, 3, 16, 4, inst.iluMask);
+    SetField(token, 3, 12, 4, inst.outMask);
+    SetField(token, 3, 11, 1, !inst.outConstant);
+    SetField(token, 3, 3, 8, inst.outAddress);
+    SetField(token, 3, 2, 1, inst.outIlu);
+    SetField(token, 3, 1, 1, inst.relative);
+    SetField(token, 3, 0, 1, final);
+}
+
+// Operands used by each MAC operation
+static const uint8_t kMacUsesA = 1, kMacUsesB = 2, kMacUsesC = 4;
+static const uint8_t kMacOperands[] = {
+    0,                                  // NOP
+    kMacUsesA,                          // MOV
+    kMacUsesA | kMacUsesB,              // MUL
+    kMacUsesA | kMacUsesC,              // ADD
+    kMacUsesA | kMacUsesB | kMacUsesC,  // MAD
+    kMacUsesA | kMacUsesB,              // DP3
+    kMacUsesA | kMacUsesB,              // DPH
+    kMacUsesA | kMacUsesB,              // DP4
+    kMacUsesA | kMacUsesB,              // DST
+    kMacUsesA | kMacUsesB,              // MIN
+    kMacUsesA | kMacUsesB,              // MAX
+    kMacUsesA | kMacUsesB,              // SLT
+    kMacUsesA | kMacUsesB,              // SGE
+    kMacUsesA,                          // ARL
+};
+
+static uint64_t HashTokens(const uint32_t *words, size_t count) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < count; i++) {
+        hash ^= words[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static std::unique_ptr<VshProgram> DecodeProgram(const uint32_t *words, size_t numTokens) {
+    std::unique_ptr<VshProgram> program(new VshProgram());
+    program->tokens.assign(words, words + numTokens * VSH_TOKEN_SIZE);
+
+    for (size_t i = 0; i < numTokens; i++) {
+        VshInstruction inst = DecodeInstruction(&words[i * VSH_TOKEN_SIZE]);
+        if (inst.mac >= ARRAY_SIZE(kMacOperands)) {
+            log_warning("VSH: Invalid MAC operation %u at instruction %u\n", inst.mac, (unsigned)i);
+            inst.mac = MAC_NOP;
+        }
+
+        // Track the inputs read by the operands in use
+        uint8_t operands = kMacOperands[inst.mac] | ((inst.ilu != ILU_NOP) ? kMacUsesC : 0);
+        if (((operands & kMacUsesA) && inst.a.mux == PARAM_V)
+            || ((operands & kMacUsesB) && inst.b.mux == PARAM_V)
+            || ((operands & kMacUsesC) && inst.c.mux == PARAM_V)) {
+            program->inputMask |= 1 << inst.input;
+        }
+        program->writesConstants |= inst.outConstant && inst.outMask != 0;
+        program->instructions.push_back(inst);
+    }
+    return program;
+}
+
+// ----- Fixed function -------------------------------------------------------
+
+static VshInstruction::Source MakeSource(VshParam mux, unsigned int reg, const char *swizzle) {
+    VshInstruction::Source source;
+    source.mux = mux;
+    source.reg = reg;
+    source.negate = false;
+    for (int i = 0; i < 4; i++) {
+        source.swizzle[i] = (uint8_t)(strchr("xyzw", swizzle[i]) - "xyzw");
+    }
+    return source;
+}
+
+static VshInstruction MakeInstruction(VshMacOp mac, VshIluOp ilu) {
+    VshInstruction inst;
+    memset(&inst, 0, sizeof(inst));
+    inst.mac = mac;
+    inst.ilu = ilu;
+    inst.a = inst.b = inst.c = MakeSource(PARAM_UNKNOWN, 0, "xyzw");
+    inst.outConstant = false;
+    return inst;
+}
+
+// Builds the program equivalent to the fixed function transform:
+//
+//   dp4 r12.x, v0, c[CMAT0]  (and so on for y, z and w)
+//   rcc r1.x, r12.w
+//   mul oPos.xyz, r12, r1.x
+//   mov oD0, v3
+//   mov oD1, v4
+//
+// The composite matrix maps to screen space, and the division by w matches
+// the epilogue of vertex programs so that both kinds of output are treated
+// alike.
+static std::unique_ptr<VshProgram> BuildFixedFunctionProgram() {
+    std::vector<VshInstruction> insts;
+
+    for (unsigned int i = 0; i < 4; i++) {
+        VshInstruction dp4 = MakeInstruction(MAC_DP4, ILU_NOP);
+        dp4.a = MakeSource(PARAM_V, 0, "xyzw");
+        dp4.b = MakeSource(PARAM_C, 0, "xyzw");
+        dp4.input = NV2A_VERTEX_ATTR_POSITION;
+        dp4.constant = NV_IGRAPH_XF_XFCTX_CMAT0 + i;
+        dp4.temp = 12;
+        dp4.macMask = 8 >> i;
+        insts.push_back(dp4);
+    }
+
+    VshInstruction rcc = MakeInstruction(MAC_NOP, ILU_RCC);
+    rcc.c = MakeSource(PARAM_R, 12, "wwww");
+    rcc.temp = 1;
+    rcc.iluMask = 8;
+    insts.push_back(rcc);
+
+    VshInstruction mul = MakeInstruction(MAC_MUL, ILU_NOP);
+    mul.a = MakeSource(PARAM_R, 12, "xyzw");
+    mul.b = MakeSource(PARAM_R, 1, "xxxx");
+    mul.outMask = 0xE;
+    mul.outAddress = VSH_OUTPUT_POSITION;
+    insts.push_back(mul);
+
+    VshInstruction diffuse = MakeInstruction(MAC_MOV, ILU_NOP);
+    diffuse.a = MakeSource(PARAM_V, 0, "xyzw");
+    diffuse.input = NV2A_VERTEX_ATTR_DIFFUSE;
+    diffuse.outMask = 0xF;
+    diffuse.outAddress = VSH_OUTPUT_DIFFUSE;
+    insts.push_back(diffuse);
+
+    VshInstruction specular = diffuse;
+    specular.input = NV2A_VERTEX_ATTR_SPECULAR;
+    specular.outAddress = VSH_OUTPUT_SPECULAR;
+    insts.push_back(specular);
+
+    std::vector<uint32_t> words(insts.size() * VSH_TOKEN_SIZE);
+    for (size_t i = 0; i < insts.size(); i++) {
+        EncodeInstruction(insts[i], i == insts.size() - 1, &words[i * VSH_TOKEN_SIZE]);
+    }
+    return DecodeProgram(words.data(), insts.size());
+}
+
+// ----- Engine ---------------------------------------------------------------
+
+VshEngine::VshEngine()
+    : m_fixedFunction(BuildFixedFunctionProgram())
+{
+    memset(m_constants, 0, sizeof(m_constants));
+}
+
+const VshProgram *VshEngine::LoadProgram(const uint32_t tokens[][VSH_TOKEN_SIZE], unsigned int start) {
+    unsigned int end = start;
+    while (end < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH) {
+        bool final = tokens[end][3] & 1;
+        end++;
+        if (final) {
+            break;
+        }
+    }
+
+    const uint32_t *words = tokens[start];
+    size_t numWords = (end - start) * VSH_TOKEN_SIZE;
+    uint64_t hash = HashTokens(words, numWords);
+
+    auto it = m_programs.find(hash);
+    if (it != m_programs.end()) {
+        const std::vector<uint32_t>& cached = it->second->tokens;
+        if (cached.size() == numWords && memcmp(cached.data(), words, numWords * sizeof(uint32_t)) == 0) {
+            return it->second.get();
+        }
+    }
+
+    if (m_programs.size() >= kMaxCachedPrograms) {
+        m_programs.clear();
+    }
+    std::unique_ptr<VshProgram>& program = m_programs[hash];
+    program = DecodeProgram(words, end - start);
+    return program.get();
+}
+
+void VshEngine::UpdateConstants(const uint32_t constants[NV2A_VERTEXSHADER_CONSTANTS][4], bool dirty[NV2A_VERTEXSHADER_CONSTANTS]) {
+    for (int row = 0; row < NV2A_VERTEXSHADER_CONSTANTS; row++) {
+        if (!dirty[row]) {
+            continue;
+        }
+        dirty[row] = false;
+
+        for (int i = 0; i < 4; i++) {
+            float value;
+            memcpy(&value, &constants[row][i], sizeof(value));
+            VStore(m_constants[row][i], VSplat(value));
+        }
+    }
+}
+
+void VshEngine::Run(const VshProgram& program, const VshInputs *inputs, VshOutputs *outputs, uint32_t count, uint32_t (*writableConstants)[4]) {
+    for (uint32_t first = 0; first < count; first += VSH_LANES) {
+        uint32_t lanes = std::min<uint32_t>(count - first, VSH_LANES);
+
+        // Transpose the attributes read by the program. Idle lanes repeat the
+        // last vertex so that they compute harmless values.
+        for (int attr = 0; attr < NV2A_VERTEXSHADER_ATTRIBUTES; attr++) {
+            if (!(program.inputMask & (1 << attr))) {
+                continue;
+            }
+            for (uint32_t lane = 0; lane < VSH_LANES; lane++) {
+                const float *value = inputs[first + std::min(lane, lanes - 1)][attr];
+                for (int i = 0; i < 4; i++) {
+                    m_inputs[attr][i][lane] = value[i];
+                }
+            }
+        }
+
+        RunBatch(program, lanes, writableConstants);
+
+        for (uint32_t lane = 0; lane < lanes; lane++) {
+            float (*out)[4] = outputs[first + lane];
+            for (int reg = 0; reg < VSH_NUM_OUTPUTS; reg++) {
+                for (int i = 0; i < 4; i++) {
+                    out[reg][i] = m_outputs[reg][i][lane];
+                }
+            }
+        }
+    }
+}
+
+float (*VshEngine::GetTemp(unsigned int reg))[VSH_LANES] {
+    if (reg == 12) {
+        return m_outputs[VSH_OUTPUT_POSITION];
+    }
+    return m_temps[(reg < VSH_NUM_TEMPS) ? reg : 0];
+}
+
+void VshEngine::RunBatch(const VshProgram& program, uint32_t count, uint32_t (*writableConstants)[4]) {
+    memset(m_temps, 0, sizeof(m_temps));
+    memset(m_addressReg, 0, sizeof(m_addressReg));
+    for (int reg = 0; reg < VSH_NUM_OUTPUTS; reg++) {
+        for (int i = 0; i < 4; i++) {
+            VStore(m_outputs[reg][i], VSplat((i == 3) ? 1.0f : 0.0f));
+        }
+    }
+
+    static const float kZero[4][VSH_LANES] = { { 0 } };
+    float gathered[4][VSH_LANES];
+
+    // Reads an operand with its swizzle and negation applied
+    auto fetch = [&](const VshInstruction& inst, const VshInstruction::Source& source, VshFloat *out) {
+        const float (*reg)[VSH_LANES];
+        switch (source.mux) {
+        case PARAM_R:
+            reg = GetTemp(source.reg);
+            break;
+        case PARAM_V:
+            reg = m_inputs[inst.input];
+            break;
+        case PARAM_C:
+            if (!inst.relative) {
+                reg = m_constants[inst.constant];
+                break;
+            }
+            // Every lane may read a different constant
+            for (int lane = 0; lane < VSH_LANES; lane++) {
+                int row = m_addressReg[lane] + inst.constant;
+                bool valid = row >= 0 && row < NV2A_VERTEXSHADER_CONSTANTS;
+                for (int i = 0; i < 4; i++) {
+                    gathered[i][lane] = valid ? m_constants[row][i][0] : 0.0f;
+                }
+            }
+            reg = gathered;
+            break;
+        default:
+            reg = kZero;
+            break;
+        }
+
+        for (int i = 0; i < 4; i++) {
+            out[i] = VLoad(reg[source.swizzle[i]]);
+            if (source.negate) {
+                out[i] = VNeg(out[i]);
+            }
+        }
+    };
+
+    auto write = [](float (*reg)[VSH_LANES], unsigned int mask, const VshFloat *value) {
+        for (int i = 0; i < 4; i++) {
+            if (mask & (8 >> i)) {
+                VStore(reg[i], value[i]);
+            }
+        }
+    };
+
+    for (const VshInstruction& inst : program.instructions) {
+        VshFloat a[4], b[4], c[4];
+        VshFloat macResult[4], iluResult[4];
+
+        // All operands are read before any result is written
+        uint8_t operands = kMacOperands[inst.mac];
+        if (operands & kMacUsesA) fetch(inst, inst.a, a);
+        if (operands & kMacUsesB) fetch(inst, inst.b, b);
+        if ((operands & kMacUsesC) || inst.ilu != ILU_NOP) fetch(inst, inst.c, c);
+
+        switch (inst.mac) {
+        case MAC_MOV:
+            std::copy(a, a + 4, macResult);
+            break;
+        case MAC_MUL:
+            for (int i = 0; i < 4; i++) macResult[i] = VMul(a[i], b[i]);
+            break;
+        case MAC_ADD:
+            for (int i = 0; i < 4; i++) macResult[i] = VAdd(a[i], c[i]);
+            break;
+        case MAC_MAD:
+            for (int i = 0; i < 4; i++) macResult[i] = VAdd(VMul(a[i], b[i]), c[i]);
+            break;
+        case MAC_DP3:
+            std::fill(macResult, macResult + 4, VDot3(a, b));
+            break;
+        case MAC_DPH:
+            std::fill(macResult, macResult + 4, VAdd(VDot3(a, b), b[3]));
+            break;
+        case MAC_DP4:
+            std::fill(macResult, macResult + 4, VAdd(VDot3(a, b), VMul(a[3], b[3])));
+            break;
+        case MAC_DST:
+            macResult[0] = VSplat(1.0f);
+            macResult[1] = VMul(a[1], b[1]);
+            macResult[2] = a[2];
+            macResult[3] = b[3];
+            break;
+        case MAC_MIN:
+            for (int i = 0; i < 4; i++) macResult[i] = VMin(a[i], b[i]);
+            break;
+        case MAC_MAX:
+            for (int i = 0; i < 4; i++) macResult[i] = VMax(a[i], b[i]);
+            break;
+        case MAC_SLT:
+            for (int i = 0; i < 4; i++) macResult[i] = VLess(a[i], b[i]);
+            break;
+        case MAC_SGE:
+            for (int i = 0; i < 4; i++) macResult[i] = VGreaterEqual(a[i], b[i]);
+            break;
+        case MAC_ARL: {
+            float x[VSH_LANES];
+            VStore(x, a[0]);
+            for (int lane = 0; lane < VSH_LANES; lane++) {
+                m_addressReg[lane] = (int32_t)floorf(x[lane]);
+            }
+            break;
+        }
+        default:
+            break;
+        }
+
+        if (inst.ilu == ILU_MOV) {
+            std::copy(c, c + 4, iluResult);
+        }
+        else if (inst.ilu != ILU_NOP) {
+            // The remaining operations are scalar; evaluate them lane by lane
+            float in[4][VSH_LANES], out[4][VSH_LANES];
+            for (int i = 0; i < 4; i++) {
+                VStore(in[i], c[i]);
+            }
+            for (int lane = 0; lane < VSH_LANES; lane++) {
+                float x = in[0][lane];
+                float r[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+                switch (inst.ilu) {
+                case ILU_RCP:
+                    r[0] = r[1] = r[2] = r[3] = 1.0f / x;
+                    break;
+                case ILU_RCC: {
+                    // Reciprocal clamped away from zero and infinity
+                    float rcp = 1.0f / x;
+                    float magnitude = std::min(std::max(fabsf(rcp), 5.42101e-20f), 1.884467e+19f);
+                    r[0] = r[1] = r[2] = r[3] = copysignf(magnitude, rcp);
+                    break;
+                }
+                case ILU_RSQ:
+                    r[0] = r[1] = r[2] = r[3] = 1.0f / sqrtf(fabsf(x));
+                    break;
+                case ILU_EXP: {
+                    float whole = floorf(x);
+                    r[0] = exp2f(whole);
+                    r[1] = x - whole;
+                    r[2] = exp2f(x);
+                    break;
+                }
+                case ILU_LOG: {
+                    x = fabsf(x);
+                    if (x == 0.0f) {
+                        r[0] = r[2] = -INFINITY;
+                        r[1] = 1.0f;
+                        break;
+                    }
+                    float exponent = floorf(log2f(x));
+                    r[0] = exponent;
+                    r[1] = x / exp2f(exponent);
+                    r[2] = log2f(x);
+                    break;
+                }
+                case ILU_LIT: {
+                    float y = in[1][lane];
+                    float power = std::min(std::max(in[3][lane], -128.0f), 128.0f);
+                    r[0] = 1.0f;
+                    r[1] = std::max(x, 0.0f);
+                    r[2] = (x > 0.0f && y > 0.0f) ? powf(y, power) : 0.0f;
+                    break;
+                }
+                default:
+                    break;
+                }
+                for (int i = 0; i < 4; i++) {
+                    out[i][lane] = r[i];
+                }
+            }
+            for (int i = 0; i < 4; i++) {
+                iluResult[i] = VLoad(out[i]);
+            }
+        }
+
+        if (inst.mac != MAC_NOP && inst.mac != MAC_ARL && inst.macMask != 0) {
+            write(GetTemp(inst.temp), inst.macMask, macResult);
+        }
+        if (inst.ilu != ILU_NOP && inst.iluMask != 0) {
+            write(GetTemp(inst.iluTemp), inst.iluMask, iluResult);
+        }
+
+        if (inst.outMask != 0) {
+            const VshFloat *result = inst.outIlu ? iluResult : macResult;
+            if (!inst.outConstant) {
+                write(m_outputs[inst.outAddress & (VSH_NUM_OUTPUTS - 1)], inst.outMask, result);
+            }
+            else if (writableConstants != nullptr) {
+                int row = inst.outAddress + (inst.relative ? m_addressReg[count - 1] : 0);
+                if (row >= 0 && row < NV2A_VERTEXSHADER_CONSTANTS) {
+                    for (int i = 0; i < 4; i++) {
+                        if (inst.outMask & (8 >> i)) {
+                            float value[VSH_LANES];
+                            VStore(value, result[i]);
+                            VStore(m_constants[row][i], VSplat(value[count - 1]));
+                            memcpy(&writableConstants[row][i], &value[count - 1], sizeof(uint32_t));
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "nv2a_int.h"
+
+namespace vixen {
+
+// Number of vertices transformed together by each pass through a program
+#if defined(__AVX__)
+#define VSH_LANES 8
+#else
+#define VSH_LANES 4
+#endif
+
+// Output registers
+#define VSH_OUTPUT_POSITION       0
+#define VSH_OUTPUT_DIFFUSE        3
+#define VSH_OUTPUT_SPECULAR       4
+#define VSH_OUTPUT_FOG            5
+#define VSH_OUTPUT_POINT_SIZE     6
+#define VSH_OUTPUT_BACK_DIFFUSE   7
+#define VSH_OUTPUT_BACK_SPECULAR  8
+#define VSH_OUTPUT_TEXTURE0       9
+#define VSH_NUM_OUTPUTS           16
+
+// Temporary registers R0 to R11. R12 is an alias of the position output.
+#define VSH_NUM_TEMPS 12
+
+enum VshMacOp {
+    MAC_NOP, MAC_MOV, MAC_MUL, MAC_ADD, MAC_MAD, MAC_DP3, MAC_DPH, MAC_DP4,
+    MAC_DST, MAC_MIN, MAC_MAX, MAC_SLT, MAC_SGE, MAC_ARL,
+};
+
+enum VshIluOp {
+    ILU_NOP, ILU_MOV, ILU_RCP, ILU_RCC, ILU_RSQ, ILU_EXP, ILU_LOG, ILU_LIT,
+};
+
+// Register files operands are read from
+enum VshParam {
+    PARAM_UNKNOWN, PARAM_R, PARAM_V, PARAM_C,
+};
+
+typedef float VshInputs[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+typedef float VshOutputs[VSH_NUM_OUTPUTS][4];
+
+/*!
+ * A vertex program instruction, decoded from its microcode token.
+ */
+struct VshInstruction {
+    struct Source {
+        uint8_t mux;         // PARAM_*: register file the operand is read from
+        uint8_t reg;         // Temporary register index
+        uint8_t swizzle[4];  // Source component of each operand component
+        bool negate;
+    };
+
+    uint8_t mac;  // MAC_* operation
+    uint8_t ilu;  // ILU_* operation
+    Source a, b, c;
+
+    uint8_t input;       // Input attribute read by PARAM_V operands
+    uint8_t constant;    // Constant row read by PARAM_C operands
+    bool relative;       // Constant reads and writes are offset by A0
+
+    uint8_t temp;        // Temporary register written by the MAC
+    uint8_t iluTemp;     // Temporary register written by the ILU
+    uint8_t macMask;     // Components written to the temporary registers by
+    uint8_t iluMask;     //   each unit, as a bit mask of xyzw = 8421
+    uint8_t outMask;     // Components written to the output register
+    bool outConstant;    // Output goes to a constant instead of an output register
+    uint8_t outAddress;
+    bool outIlu;         // Output takes the ILU result instead of the MAC result
+};
+
+/*!
+ * A decoded vertex program.
+ */
+struct VshProgram {
+    std::vector<VshInstruction> instructions;
+
+    // Tokens the program was decoded from, to tell apart programs with the
+    // same hash
+    std::vector<uint32_t> tokens;
+
+    uint32_t inputMask = 0;      // Input attributes read by the program
+    bool writesConstants = false;
+};
+
+/*!
+ * NV2A vertex program engine.
+ *
+ * Programs are decoded once and cached by a hash of their microcode, so that
+ * uploading the same program again costs one pass over its tokens. The
+ * fixed function pipeline is expressed as a generated program that runs on
+ * the same executor.
+ *
+ * Vertices go through programs VSH_LANES at a time, in a structure of arrays
+ * layout where each SIMD lane holds one vertex. Constants are kept broadcast
+ * to all lanes and only refreshed for rows that changed since the last draw.
+ */
+class VshEngine {
+public:
+    VshEngine();
+
+    /*!
+     * Returns the decoded program that starts at the specified token and
+     * runs until the first token marked final.
+     */
+    const VshProgram *LoadProgram(const uint32_t tokens[][VSH_TOKEN_SIZE], unsigned int start);
+
+    /*!
+     * Returns the program that implements the fixed function transform.
+     */
+    const VshProgram *GetFixedFunctionProgram() const { return m_fixedFunction.get(); }
+
+    /*!
+     * Copies the constant rows flagged as dirty and clears their flags.
+     */
+    void UpdateConstants(const uint32_t constants[NV2A_VERTEXSHADER_CONSTANTS][4], bool dirty[NV2A_VERTEXSHADER_CONSTANTS]);
+
+    /*!
+     * Runs a program over an array of vertices. Outputs not written by the
+     * program are (0, 0, 0, 1).
+     *
+     * Constant writes are only performed if writableConstants is not null.
+     * They are stored to that array as well, so that it keeps matching the
+     * constants the programs see. Since VSH_LANES vertices run together, they
+     * store the value computed for the last vertex of each group.
+     */
+    void Run(const VshProgram& program, const VshInputs *inputs, VshOutputs *outputs, uint32_t count, uint32_t (*writableConstants)[4]);
+
+private:
+    void RunBatch(const VshProgram& program, uint32_t count, uint32_t (*writableConstants)[4]);
+    float (*GetTemp(unsigned int reg))[VSH_LANES];
+
+    // The cache is flushed when it grows past this many programs
+    static const size_t kMaxCachedPrograms = 256;
+
+    std::unordered_map<uint64_t, std::unique_ptr<VshProgram>> m_programs;
+    std::unique_ptr<VshProgram> m_fixedFunction;
+
+    // Constants broadcast to all lanes: [row][component][lane]
+    float m_constants[NV2A_VERTEXSHADER_CONSTANTS][4][VSH_LANES];
+
+    // Registers of the batch being run: [register][component][lane]
+    float m_inputs[NV2A_VERTEXSHADER_ATTRIBUTES][4][VSH_LANES];
+    float m_outputs[VSH_NUM_OUTPUTS][4][VSH_LANES];
+    float m_temps[VSH_NUM_TEMPS][4][VSH_LANES];
+    int32_t m_addressReg[VSH_LANES];
+};
+
+}
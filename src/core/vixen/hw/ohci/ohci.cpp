@@ -211,11 +211,15 @@ static inline uint64_t Muldiv64(uint64_t a, uint32_t b, uint32_t c) {
 
 #define USUB(a, b) ((int16_t)((uint16_t)(a) - (uint16_t)(b)))
 
+// How much slower the virtual USB time runs compared to real time
+#define OHCI_TIME_SLOWDOWN 50
+
 #define OHCI_PAGE_MASK    0xFFFFF000
 #define OHCI_OFFSET_MASK  0xFFF
 
-OHCI::OHCI(Cpu& cpu, int Irq, USBPCIDevice* UsbObj)
+OHCI::OHCI(Cpu& cpu, Scheduler& scheduler, int Irq, USBPCIDevice* UsbObj)
     : m_cpu(cpu)
+    , m_scheduler(scheduler)
 {
     int offset = 0;
     USBPortOps* ops;
@@ -246,13 +250,29 @@ OHCI::OHCI(Cpu& cpu, int Irq, USBPCIDevice* UsbObj)
 	m_UsbFrameTime = 1000000ULL; // 1 ms expressed in ns
 	m_TicksPerUsbTick = 1000000000ULL / USB_HZ; // 83
 
+	// Create the EOF timer
+	m_pEOFtimer = new ScheduledTimer(scheduler, OHCI_FrameBoundaryWrapper, this);
+
 	// Do a hardware reset
 	OHCI_StateReset();
 }
 
+OHCI::~OHCI()
+{
+	delete m_pEOFtimer;
+}
+
+// Returns the current virtual time in ns. Let's try a factor of 50 (1 virtual ms -> 50 real ms)
+uint64_t OHCI::OHCI_GetTime()
+{
+	return m_scheduler.Now() / OHCI_TIME_SLOWDOWN;
+}
+
 void OHCI::OHCI_FrameBoundaryWrapper(void* pVoid)
 {
-	static_cast<OHCI*>(pVoid)->OHCI_FrameBoundaryWorker();
+	OHCI *ohci = static_cast<OHCI*>(pVoid);
+	IODeviceLockGuard lk(ohci->m_UsbDevice->GetDeviceLock());
+	ohci->OHCI_FrameBoundaryWorker();
 }
 
 void OHCI::OHCI_FrameBoundaryWorker()
@@ -330,7 +350,7 @@ void OHCI::OHCI_FrameBoundaryWorker()
 	}
 
 	// Do SOF stuff here
-	OHCI_SOF(false);
+	OHCI_SOF();
 
 	// Writeback HCCA
 	if (OHCI_WriteHCCA(m_Registers.HcHCCA, &hcca)) {
@@ -353,18 +373,10 @@ void OHCI::OHCI_FatalError()
 
 bool OHCI::OHCI_ReadHCCA(uint32_t Paddr, OHCI_HCCA* Hcca)
 {
-	// ergo720: there could be a peculiar problem if the shared memory between HCD and HC is allocated by the
-	// VMManager with VirtualAlloc: the physical allocation would not reside in memory.bin and if we tried to
-	// access the physical address of it, we would access an empty page. In practice, I disassembled various
-	// xbe's of my games and discovered that this shared memory is allocated with MmAllocateContiguousMemory
-	// which means we can access it from the contiguous region just fine (lucky)
-	// ... provided that XDK revisions didn't alter this
-
 	// NOTE: this shared memory contains the HCCA + EDs and TDs
 
 	if (Paddr != 0) {
-		memcpy(Hcca, reinterpret_cast<void*>(Paddr + CONTIGUOUS_MEMORY_BASE), sizeof(OHCI_HCCA));
-		return false;
+		return OHCI_CopyFromGuest(Paddr, Hcca, sizeof(OHCI_HCCA));
 	}
 
 	return true; // error
@@ -376,9 +388,7 @@ bool OHCI::OHCI_WriteHCCA(uint32_t Paddr, OHCI_HCCA* Hcca)
 		// We need to calculate the offset of the HccaFrameNumber member to avoid overwriting HccaInterrruptTable
 		size_t OffsetOfFrameNumber = offsetof(OHCI_HCCA, HccaFrameNumber);
 
-		memcpy(reinterpret_cast<void*>(Paddr + OffsetOfFrameNumber + CONTIGUOUS_MEMORY_BASE),
-			reinterpret_cast<uint8_t*>(Hcca) + OffsetOfFrameNumber, 8);
-		return false;
+		return OHCI_CopyToGuest(Paddr + OffsetOfFrameNumber, reinterpret_cast<uint8_t*>(Hcca) + OffsetOfFrameNumber, 8);
 	}
 
 	return true; // error
@@ -387,8 +397,7 @@ bool OHCI::OHCI_WriteHCCA(uint32_t Paddr, OHCI_HCCA* Hcca)
 bool OHCI::OHCI_ReadED(uint32_t Paddr, OHCI_ED* Ed)
 {
 	if (Paddr != 0) {
-        m_cpu.VMemRead(Paddr, sizeof(*Ed), Ed);
-		return false;
+		return OHCI_CopyFromGuest(Paddr, Ed, sizeof(*Ed));
 	}
 	return true; // error
 }
@@ -398,8 +407,7 @@ bool OHCI::OHCI_WriteED(uint32_t Paddr, OHCI_ED* Ed)
 	if (Paddr != 0) {
 		// According to the standard, only the HeadP field is writable by the HC, so we'll write just that
 		size_t OffsetOfHeadP = offsetof(OHCI_ED, HeadP);
-        m_cpu.VMemWrite(Paddr, 4, Ed + OffsetOfHeadP);
-		return false;
+		return OHCI_CopyToGuest(Paddr + OffsetOfHeadP, reinterpret_cast<uint8_t*>(Ed) + OffsetOfHeadP, 4);
 	}
 	return true; // error
 }
@@ -407,8 +415,7 @@ bool OHCI::OHCI_WriteED(uint32_t Paddr, OHCI_ED* Ed)
 bool OHCI::OHCI_ReadTD(uint32_t Paddr, OHCI_TD* Td)
 {
 	if (Paddr != 0) {
-        m_cpu.VMemRead(Paddr, sizeof(*Td), Td);
-		return false;
+		return OHCI_CopyFromGuest(Paddr, Td, sizeof(*Td));
 	}
 	return true; // error
 }
@@ -416,24 +423,21 @@ bool OHCI::OHCI_ReadTD(uint32_t Paddr, OHCI_TD* Td)
 bool OHCI::OHCI_WriteTD(uint32_t Paddr, OHCI_TD* Td)
 {
 	if (Paddr != 0) {
-        m_cpu.VMemWrite(Paddr, sizeof(*Td), Td);
-		return false;
+		return OHCI_CopyToGuest(Paddr, Td, sizeof(*Td));
 	}
 	return true; // error
 }
 
 bool OHCI::OHCI_ReadIsoTD(uint32_t Paddr, OHCI_ISO_TD* td) {
     if (Paddr != 0) {
-        m_cpu.VMemRead(Paddr, sizeof(*td), td);
-        return false;
+        return OHCI_CopyFromGuest(Paddr, td, sizeof(*td));
     }
     return true; // error
 }
 
 bool OHCI::OHCI_WriteIsoTD(uint32_t Paddr, OHCI_ISO_TD* td) {
     if (Paddr != 0) {
-        m_cpu.VMemWrite(Paddr, sizeof(*td), td);
-        return false;
+        return OHCI_CopyToGuest(Paddr, td, sizeof(*td));
     }
     return true; // error
 }
@@ -493,38 +497,39 @@ bool OHCI::OHCI_CopyIsoTD(uint32_t start_addr, uint32_t end_addr, uint8_t* Buffe
 
 bool OHCI::OHCI_FindAndCopyTD(uint32_t Paddr, uint8_t* Buffer, int Length, bool bIsWrite)
 {
-	// ergo720: the buffer pointed to by Paddr can be anywhere in memory (it depends on how the xbe has
-	// allocated it) so, sadly, we cannot make any assumptions here regarding its location like we did
-	// in OHCI_ReadHCCA and the problem with VirtualAlloc can arise this time. Because of the hack in
-	// TranslateVAddrToPAddr, VirtualAlloc allocations are identity mapped and addresses below 0x4000000
-	// (Xbox) or 0x8000000 (Chihiro, Devkit) cannot be used by the VMManager for anything but to allocate
-	// xbe sections. This means that if Paddr is higher than the maximum possible physical address, then
-	// we know it's an identity mapped address, otherwise it's a contiguous address
-
-	int offset = 0;
-
 	if (Paddr == 0) {
 		return true; // error
 	}
 
-	//if (g_bIsRetail) {
-		if (Paddr < XBOX_MEMORY_SIZE) {
-			offset = CONTIGUOUS_MEMORY_BASE;
-		}
-	/*}
-	else {
-		if (Paddr < CHIHIRO_MEMORY_SIZE) {
-			offset = CONTIGUOUS_MEMORY_BASE;
-		}
-	}*/
-
 	if (bIsWrite) {
-		memcpy(reinterpret_cast<void*>(Paddr + offset), Buffer, Length);
+		return OHCI_CopyToGuest(Paddr, Buffer, Length);
 	}
-	else {
-		memcpy(Buffer, reinterpret_cast<void*>(Paddr + offset), Length);
+	return OHCI_CopyFromGuest(Paddr, Buffer, Length);
+}
+
+bool OHCI::OHCI_CopyFromGuest(uint32_t Paddr, void* Buffer, uint32_t Length)
+{
+	if (Length == 0) {
+		return false;
 	}
+	void* src = m_cpu.GetHostPointer(Paddr, Length, CPU_MEM_ACCESS_READ);
+	if (src == nullptr) {
+		return true; // error
+	}
+	memcpy(Buffer, src, Length);
+	return false;
+}
 
+bool OHCI::OHCI_CopyToGuest(uint32_t Paddr, const void* Buffer, uint32_t Length)
+{
+	if (Length == 0) {
+		return false;
+	}
+	void* dst = m_cpu.GetHostPointer(Paddr, Length, CPU_MEM_ACCESS_WRITE);
+	if (dst == nullptr) {
+		return true; // error
+	}
+	memcpy(dst, Buffer, Length);
 	return false;
 }
 
@@ -930,33 +935,25 @@ void OHCI::OHCI_StateReset()
 
 void OHCI::OHCI_BusStart()
 {
-	// Create the EOF timer. Let's try a factor of 50 (1 virtual ms -> 50 real ms)
-	m_pEOFtimer = Timer_Create(OHCI_FrameBoundaryWrapper, this, 50);
-
     log_debug("OHCI: Operational mode event\n");
 
 	// SOF event
-	OHCI_SOF(true);
+	OHCI_SOF();
 }
 
 void OHCI::OHCI_BusStop()
 {
-	if (m_pEOFtimer) {
-		// Delete existing EOF timer
-		Timer_Exit(m_pEOFtimer);
-	}
-	m_pEOFtimer = nullptr;
+	// Stop the EOF timer
+	m_pEOFtimer->Cancel();
 }
 
-void OHCI::OHCI_SOF(bool bCreate)
+void OHCI::OHCI_SOF()
 {
 	// set current SOF time
-	m_SOFtime = GetTime_NS(m_pEOFtimer);
+	m_SOFtime = OHCI_GetTime();
 
-	// make timer expire at SOF + 1 virtual ms from now
-	if (bCreate) {
-		Timer_Start(m_pEOFtimer, m_UsbFrameTime);
-	}
+	// make timer expire at SOF + 1 virtual ms
+	m_pEOFtimer->Schedule((m_SOFtime + m_UsbFrameTime) * OHCI_TIME_SLOWDOWN);
 
 	OHCI_SetInterrupt(OHCI_INTR_SF);
 }
@@ -1284,8 +1281,8 @@ uint32_t OHCI::OHCI_GetFrameRemaining()
 		return m_Registers.HcFmRemaining & OHCI_FMR_FRT;
 	}
 
-	// Being in USB operational state guarantees that m_pEOFtimer and m_SOFtime were set already
-	ticks = GetTime_NS(m_pEOFtimer) - m_SOFtime;
+	// Being in USB operational state guarantees that m_SOFtime was set already
+	ticks = OHCI_GetTime() - m_SOFtime;
 
 	// Avoid Muldiv64 if possible
 	if (ticks >= m_UsbFrameTime) {
@@ -41,7 +41,7 @@
 #pragma once
 
 #include "../pci/usb_pci.h"
-#include "vixen/cxbxtimer.h"
+#include "vixen/scheduler.h"
 #include "vixen/cpu.h"
 
 namespace vixen {
@@ -148,9 +148,9 @@ public:
     std::atomic_bool m_bFrameTime;
 
     // constructor
-    OHCI(Cpu& cpu, int Irqn, USBPCIDevice* UsbObj);
+    OHCI(Cpu& cpu, Scheduler& scheduler, int Irqn, USBPCIDevice* UsbObj);
     // destructor
-    ~OHCI() {}
+    ~OHCI();
     // read a register
     uint32_t OHCI_ReadRegister(uint32_t Addr);
     // write a register
@@ -158,12 +158,14 @@ public:
 
 private:
     Cpu& m_cpu;
+    // scheduler servicing the EOF timer
+    Scheduler& m_scheduler;
     // pointer to g_USB0 or g_USB1
     USBPCIDevice* m_UsbDevice = nullptr;
     // all the registers available in the OHCI standard
     OHCI_Registers m_Registers;
     // end-of-frame timer
-    TimerObject* m_pEOFtimer = nullptr;
+    ScheduledTimer* m_pEOFtimer = nullptr;
     // time at which a SOF was sent
     uint64_t m_SOFtime;
     // the duration of a usb frame
@@ -202,7 +204,9 @@ private:
     // stop sending SOF tokens across the usb bus
     void OHCI_BusStop();
     // generate a SOF event, and start a timer for EOF
-    void OHCI_SOF(bool bCreate);
+    void OHCI_SOF();
+    // get the current virtual usb time
+    uint64_t OHCI_GetTime();
     // change interrupt status
     void OHCI_UpdateInterrupt();
     // fire an interrupt
@@ -242,6 +246,9 @@ private:
     bool OHCI_CopyIsoTD(uint32_t start_addr, uint32_t end_addr, uint8_t* Buffer, int Length, bool bIsWrite);
     // find a TD buffer in memory and copy it
     bool OHCI_FindAndCopyTD(uint32_t Paddr, uint8_t* Buffer, int Length, bool bIsWrite);
+    // copy a buffer from/to guest physical memory. Returns true on error
+    bool OHCI_CopyFromGuest(uint32_t Paddr, void* Buffer, uint32_t Length);
+    bool OHCI_CopyToGuest(uint32_t Paddr, const void* Buffer, uint32_t Length);
     // process an ED list. Returns nonzero if active TD was found
     int OHCI_ServiceEDlist(uint32_t Head, int Completion);
     // process a TD. Returns nonzero to terminate processing of this endpoint
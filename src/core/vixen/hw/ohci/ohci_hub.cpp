@@ -47,8 +47,6 @@
 
 namespace vixen {
 
-Hub* g_HubObjArray[4] = { nullptr };
-
 static const USBDescEndpoint desc_endp_hub = {
     USB_DIR_IN | 0x01,        // bEndpointAddress;
     USB_ENDPOINT_XFER_INT,    // bmAttributes;
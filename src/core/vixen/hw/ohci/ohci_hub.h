@@ -137,6 +137,4 @@ private:
     void HubCleanUp();
 };
 
-extern Hub* g_HubObjArray[4];
-
 }
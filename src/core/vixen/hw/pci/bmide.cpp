@@ -16,12 +16,12 @@ namespace bmide {
 using namespace hw::bmide;
 using namespace hw::ata;
 
-BMIDEDevice::BMIDEDevice(uint8_t *ram, uint32_t ramSize, ATA& ata)
+BMIDEDevice::BMIDEDevice(cpu::Cpu& cpu, ATA& ata)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, PCI_VENDOR_ID_NVIDIA, 0x01BC, 0xD2,
         0x01, 0x01, 0x8A) // IDE controller
 {
-    m_channels[ChanPrimary] = new BMIDEChannel(ChanPrimary, ata.GetChannel(ChanPrimary), ram, ramSize);
-    m_channels[ChanSecondary] = new BMIDEChannel(ChanSecondary, ata.GetChannel(ChanSecondary), ram, ramSize);
+    m_channels[ChanPrimary] = new BMIDEChannel(ChanPrimary, ata.GetChannel(ChanPrimary), cpu);
+    m_channels[ChanSecondary] = new BMIDEChannel(ChanSecondary, ata.GetChannel(ChanSecondary), cpu);
 }
 
 BMIDEDevice::~BMIDEDevice() {
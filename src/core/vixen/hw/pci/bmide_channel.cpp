@@ -17,11 +17,10 @@ using namespace hw;
 using namespace hw::bmide;
 using namespace hw::ata;
 
-BMIDEChannel::BMIDEChannel(Channel channel, ATAChannel& ataChannel, uint8_t *ram, uint32_t ramSize)
+BMIDEChannel::BMIDEChannel(Channel channel, ATAChannel& ataChannel, cpu::Cpu& cpu)
     : m_channel(channel)
     , m_ataChannel(ataChannel)
-    , m_ram(ram)
-    , m_ramSize(ramSize) 
+    , m_cpu(cpu)
     , m_intrHook(IntrHook(*this))
 {
     ataChannel.RegisterInterruptHook(&m_intrHook);
@@ -34,8 +33,11 @@ BMIDEChannel::BMIDEChannel(Channel channel, ATAChannel& ataChannel, uint8_t *ram
 BMIDEChannel::~BMIDEChannel() {
     if (m_workerThread.joinable()) {
         // Tell the worker to stop running and notify it immediately
-        m_worker_running = false;
-        m_job_running = false;
+        {
+            std::lock_guard<std::mutex> lock(m_jobMutex);
+            m_worker_running = false;
+            m_job_running = false;
+        }
         m_jobCond.notify_one();
 
         // Wait for the worker thread to stop
@@ -64,7 +66,10 @@ void BMIDEChannel::ReadPRDTableAddress(uint32_t *value, uint8_t size) {
 }
 
 void BMIDEChannel::WriteCommand(uint32_t value, uint8_t size) {
-    m_command = value;
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_command = value;
+    }
     if (value & CmdStartStopBusMaster) {
         StartWork();
     }
@@ -92,6 +97,7 @@ void BMIDEChannel::WritePRDTableAddress(uint32_t value, uint8_t size) {
     }
 
     // Update register value
+    std::lock_guard<std::mutex> lock(m_jobMutex);
     if (size == 1) {
         m_prdTableAddr = (uint8_t)value;
     }
@@ -107,11 +113,13 @@ void BMIDEChannel::WritePRDTableAddress(uint32_t value, uint8_t size) {
 void BMIDEChannel::StartWork() {
     //log_spew("BMIDEChannel::StartWork:  Starting operation on channel %d\n", m_channel);
 
-    m_status |= StActive;
-
     // Prepare job and notify worker
-    m_job_running = true;
-    m_job_cancel = false;
+    {
+        std::lock_guard<std::mutex> lock(m_jobMutex);
+        m_status |= StActive;
+        m_job_running = true;
+        m_job_cancel = false;
+    }
     m_jobCond.notify_one();
 }
 
@@ -135,27 +143,39 @@ uint32_t BMIDEChannel::WorkerThreadFunc(void *data) {
 }
 
 struct PRDHelper {
-    uint8_t *m_ram;
-    uint32_t m_ramSize;
+    cpu::Cpu& m_cpu;
+    cpu::CPUMemAccess m_access;
+    uint32_t m_prdAddr;
     PhysicalRegionDescriptor *m_currPRD;
     uint32_t m_currByte;
     uint32_t physAddr;
     uint8_t *bufPtr;
     uint32_t bufLen;
 
-    PRDHelper(uint8_t *ram, uint32_t ramSize, uint32_t prdTableAddress)
-        : m_ram(ram)
-        , m_ramSize(ramSize)
+    // Set when a PRD or a buffer lies outside of RAM
+    bool invalid;
+
+    PRDHelper(cpu::Cpu& cpu, uint32_t prdTableAddress, cpu::CPUMemAccess access)
+        : m_cpu(cpu)
+        , m_access(access)
+        , m_prdAddr(prdTableAddress)
     {
-        // TODO: validate against ramSize to prevent buffer overflows
-        m_currPRD = reinterpret_cast<PhysicalRegionDescriptor*>(m_ram + prdTableAddress);
+        m_currPRD = LoadPRD();
         m_currByte = 0;
         physAddr = 0;
         bufPtr = nullptr;
         bufLen = 0;
+        invalid = m_currPRD == nullptr;
+    }
+
+    PhysicalRegionDescriptor *LoadPRD() {
+        return reinterpret_cast<PhysicalRegionDescriptor*>(m_cpu.GetHostPointer(m_prdAddr, sizeof(PhysicalRegionDescriptor), cpu::CPU_MEM_ACCESS_READ));
     }
 
     bool NextSector() {
+        if (invalid) {
+            return false;
+        }
         for (;;) {
             // Get byte count from the PRD
             uint32_t byteCount = m_currPRD->byteCount;
@@ -175,7 +195,12 @@ struct PRDHelper {
                     return false;
                 }
 
-                m_currPRD++;
+                m_prdAddr += sizeof(PhysicalRegionDescriptor);
+                m_currPRD = LoadPRD();
+                if (m_currPRD == nullptr) {
+                    invalid = true;
+                    return false;
+                }
                 m_currByte = 0;
                 //log_spew("BM IDE:  Next block: 0x%x bytes\n", (m_currPRD->byteCount == 0 ? 65536 : m_currPRD->byteCount));
                 continue;
@@ -183,11 +208,15 @@ struct PRDHelper {
 
             // Prepare the pointer to the next block
             physAddr = m_currPRD->basePhysicalAddress + m_currByte;
-            bufPtr = m_ram + physAddr;
             bufLen = kSectorSize;
             if (bufLen > byteCount - m_currByte) {
                 bufLen = byteCount - m_currByte;
             }
+            bufPtr = reinterpret_cast<uint8_t*>(m_cpu.GetHostPointer(physAddr, bufLen, m_access));
+            if (bufPtr == nullptr) {
+                invalid = true;
+                return false;
+            }
             m_currByte += bufLen;
             return true;
         }
@@ -208,23 +237,29 @@ struct PRDHelper {
 };
 
 void BMIDEChannel::RunWorker() {
-    while (m_worker_running) {
-        // Wait for work
+    for (;;) {
+        // Wait for work and take the registers written by the CPU
+        bool isWrite;
+        uint32_t prdTableAddr;
         {
             std::unique_lock<std::mutex> lock(m_jobMutex);
-            m_jobCond.wait(lock);
+            m_jobCond.wait(lock, [this] { return m_job_running || !m_worker_running; });
+            if (!m_worker_running) {
+                break;
+            }
+
+            // The manual says that 1 means Bus Master write and 0 means Bus Master read,
+            // which is true from the perspective of the bus itself, but confusing to a programmer.
+            // From the programmer's perspective, 0 means write to device and 1 means read from device.
+            // See https://wiki.osdev.org/ATA/ATAPI_using_DMA#The_Command_Byte
+            isWrite = (m_command & CmdReadWriteControl) == 0;
+            prdTableAddr = m_prdTableAddr;
         }
 
         // Do work
-        PRDHelper helper(m_ram, m_ramSize, m_prdTableAddr);
+        PRDHelper helper(m_cpu, prdTableAddr, isWrite ? cpu::CPU_MEM_ACCESS_READ : cpu::CPU_MEM_ACCESS_WRITE);
 
-        // The manual says that 1 means Bus Master write and 0 means Bus Master read,
-        // which is true from the perspective of the bus itself, but confusing to a programmer.
-        // From the programmer's perspective, 0 means write to device and 1 means read from device.
-        // See https://wiki.osdev.org/ATA/ATAPI_using_DMA#The_Command_Byte
-        bool isWrite = (m_command & CmdReadWriteControl) == 0;
-
-        while (m_job_running) {
+        while (m_job_running && !m_job_cancel) {
             // Try to get the next sector from the PRD table
             if (helper.NextSector()) {
                 DMATransferResult result;
@@ -253,15 +288,22 @@ void BMIDEChannel::RunWorker() {
             }
             else {
                 //log_spew("BM IDE channel %d:  Ran out of PRDs\n", m_channel);
+                if (helper.invalid) {
+                    log_warning("BM IDE channel %d:  PRD at 0x%x or its buffer is not in RAM\n", m_channel, helper.m_prdAddr);
+                    m_status |= StError;
+                }
                 m_status &= ~StActive;
                 m_job_running = false;
             }
         }
 
+        // The CPU may have restarted the transfer since it was cancelled
+        std::lock_guard<std::mutex> lock(m_jobMutex);
         if (m_job_cancel) {
             //log_spew("BM IDE channel %d:  Transfer cancelled\n", m_channel);
             // Clear Active flag if the job was cancelled
             m_status &= ~StActive;
+            m_job_running = false;
             m_job_cancel = false;
         }
     }
@@ -7,12 +7,16 @@
 // https://parisc.wiki.kernel.org/images-parisc/0/0a/PC87415.pdf
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <mutex>
+#include <thread>
 
 #include "bmide/bmide_defs.h"
 #include "vixen/hw/ata/ata_common.h"
 #include "vixen/hw/ata/ata.h"
+#include "vixen/cpu.h"
 
 namespace vixen {
 namespace hw {
@@ -20,7 +24,7 @@ namespace bmide {
 
 class BMIDEChannel {
 public:
-    BMIDEChannel(hw::ata::Channel channel, hw::ata::ATAChannel& ataChannel, uint8_t *ram, uint32_t ramSize);
+    BMIDEChannel(hw::ata::Channel channel, hw::ata::ATAChannel& ataChannel, cpu::Cpu& cpu);
     ~BMIDEChannel();
 private:
     friend class BMIDEDevice;
@@ -30,14 +34,16 @@ private:
 
     // ----- System memory ----------------------------------------------------
 
-    uint8_t *m_ram = nullptr;
-    uint32_t m_ramSize = 0;
+    cpu::Cpu& m_cpu;
 
     // ----- Registers --------------------------------------------------------
 
+    // Written by the CPU with the job mutex held; read by the worker thread
+    // when it starts a job
     uint8_t m_command = 0;
-    uint8_t m_status = 0;
     uint32_t m_prdTableAddr = 0;
+    // Updated by both the CPU and the worker thread
+    std::atomic<uint8_t> m_status { 0 };
 
     // ----- Operations -------------------------------------------------------
 
@@ -57,9 +63,9 @@ private:
 
     std::mutex m_jobMutex;
     std::condition_variable m_jobCond;
-    bool m_worker_running;
-    bool m_job_running;
-    bool m_job_cancel;
+    std::atomic<bool> m_worker_running;
+    std::atomic<bool> m_job_running;
+    std::atomic<bool> m_job_cancel;
 
     void StartWork();
     void StopWork();
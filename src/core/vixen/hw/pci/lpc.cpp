@@ -28,7 +28,7 @@
 
 namespace vixen {
 
-LPCDevice::LPCDevice(IRQ *irqs, uint8_t *rom, uint8_t *bios, uint32_t biosSize, uint8_t *mcpxROM, bool initMcpxROM)
+LPCDevice::LPCDevice(IRQ *irqs, uint8_t *rom, const uint8_t *bios, uint32_t biosSize, const uint8_t *mcpxROM, bool initMcpxROM)
     : PCIDevice(PCI_HEADER_TYPE_BRIDGE, PCI_VENDOR_ID_NVIDIA, 0x01B2, 0xD4,
         0x06, 0x01, 0x00, // ISA bridge
         /*TODO: subsystemVendorID*/0x00, /*TODO: subsystemID*/0x00)
@@ -67,12 +67,14 @@ void LPCDevice::Init() {
 
 void LPCDevice::Reset() {
     // TODO: move to an MCPX component
-    // Load BIOS ROM image
-    memcpy(m_rom, m_bios, m_biosSize);
-
-    // Replicate BIOS ROM image across the entire 16 MiB range
-    for (uint32_t addr = m_biosSize; addr < MiB(16); addr += m_biosSize) {
-        memcpy(m_rom + addr, m_rom, m_biosSize);
+    // Load BIOS ROM image, replicated across the entire 16 MiB range. Pages
+    // that already hold the image are not written to, so that they remain
+    // shared with other machines if the ROM was mapped copy-on-write.
+    for (uint32_t addr = 0; addr < MiB(16); addr += KiB(4)) {
+        const uint8_t *src = m_bios + (addr % m_biosSize);
+        if (memcmp(m_rom + addr, src, KiB(4)) != 0) {
+            memcpy(m_rom + addr, src, KiB(4));
+        }
     }
 
     if (m_initMcpxROM) {
@@ -22,7 +22,7 @@ namespace vixen {
 class LPCDevice : public PCIDevice, public IRQHandler {
 public:
     // constructor
-    LPCDevice(IRQ *irqs, uint8_t *rom, uint8_t *bios, uint32_t biosSize, uint8_t *mcpxROM, bool initMcpxROM);
+    LPCDevice(IRQ *irqs, uint8_t *rom, const uint8_t *bios, uint32_t biosSize, const uint8_t *mcpxROM, bool initMcpxROM);
     virtual ~LPCDevice();
 
     void HandleIRQ(uint8_t irqNum, bool level) override;
@@ -43,9 +43,9 @@ private:
     ISABus *m_isaBus;
 
     uint8_t *m_rom;
-    uint8_t *m_bios;
+    const uint8_t *m_bios;
     uint32_t m_biosSize;
-    uint8_t *m_mcpxROM;
+    const uint8_t *m_mcpxROM;
     bool m_initMcpxROM;
 
     friend class LPCIRQMapper;
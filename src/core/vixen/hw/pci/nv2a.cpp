@@ -54,6 +54,9 @@ namespace vixen {
 static inline uint32_t ldl_le_p(const void *p) {
     return *(uint32_t*)p;
 }
+
+// Time between vertical blanks at 60 Hz, in nanoseconds
+static const uint64_t kVBlankInterval = 1000000000ULL / 60;
 #define CASE_4(v, step) \
     case (v): \
 	case (v)+(step): \
@@ -61,22 +64,41 @@ static inline uint32_t ldl_le_p(const void *p) {
 	case (v)+(step) * 3
 
 
-NV2ADevice::NV2ADevice(uint8_t *pSystemRAM, uint32_t systemRAMSize, IRQHandler& irqHandler)
+NV2ADevice::NV2ADevice(cpu::Cpu& cpu, uint8_t *pSystemRAM, uint32_t systemRAMSize, IRQHandler& irqHandler, Scheduler& scheduler, uint32_t rasterThreads)
 	: PCIDevice(PCI_HEADER_TYPE_NORMAL, PCI_VENDOR_ID_NVIDIA, 0x02A0, 0xA1,
 		0x03, 0x00, 0x00) // VGA-compatible controller
+    , m_cpu(cpu)
     , m_pSystemRAM(pSystemRAM)
     , m_systemRAMSize(systemRAMSize)
     , m_irqHandler(irqHandler)
+    , m_scheduler(scheduler)
+    , m_rasterizer(rasterThreads)
 {
+    // The VBlank timer and PFIFO puller thread raise interrupts concurrently
+    // with the CPU
+    EnableDeviceLock();
+
+    m_vblankTimer = new ScheduledTimer(scheduler, VBlankTimerCB, this);
 }
 
 NV2ADevice::~NV2ADevice() {
+    delete m_vblankTimer;
+
     m_running = false;
 
-    m_PFIFO.cache1.cache_cond.notify_all();
+    {
+        std::lock_guard<std::mutex> lk(m_PFIFO.cache1.mutex);
+        m_PFIFO.cache1.cache_cond.notify_all();
+    }
+    {
+        std::lock_guard<std::mutex> lk(m_deviceLock);
+        m_PFIFO.pusher_cond.notify_all();
+    }
 
     m_PFIFO.puller_thread.join();
-    m_VblankThread.join();
+    if (m_PFIFO.pusher_thread.joinable()) {
+        m_PFIFO.pusher_thread.join();
+    }
 }
 
 // PCI Device functions
@@ -93,7 +115,9 @@ void NV2ADevice::Init() {
  
     m_running = true;
 
-    m_VblankThread = std::thread(VBlankThread, this);
+    m_PFIFO.pusher_thread = std::thread(PFIFO_Pusher_Thread, this);
+
+    m_vblankTimer->ScheduleIn(kVBlankInterval);
 
     m_MemoryRegions.clear();
     m_MemoryRegions.push_back({ NV_PMC_ADDR, NV_PMC_SIZE, PMCRead, PMCWrite });
@@ -116,6 +140,13 @@ void NV2ADevice::Init() {
     m_MemoryRegions.push_back({ NV_PRMDIO_ADDR, NV_PRMDIO_SIZE, PRMDIORead, PRMDIOWrite });
     m_MemoryRegions.push_back({ NV_PRAMIN_ADDR, NV_PRAMIN_SIZE, PRAMINRead, PRAMINWrite });
     m_MemoryRegions.push_back({ NV_USER_ADDR, NV_USER_SIZE, USERRead, USERWrite });
+
+    // The guest only writes to the channel control registers to submit work
+    // and polls DMA_GET to track progress, so writes to them can be posted
+    SetBARPostedWrites(0, NV_USER_ADDR, NV_USER_SIZE);
+
+    // The framebuffer aperture is system RAM; let the CPU map it directly
+    SetBARRAMAlias(1, m_pSystemRAM, std::min<uint32_t>(m_systemRAMSize, 128 * 1024 * 1024));
 }
 
 void NV2ADevice::Reset() {
@@ -165,6 +196,8 @@ void NV2ADevice::PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8
     //log_spew("NV2ADevice::MMIORead:   bar = %d,  addr = 0x%x,  size = %u\n", barIndex, addr, size);
 
     if (barIndex == 1) {
+        // The aperture mirrors system RAM when it is smaller than the BAR
+        addr &= m_systemRAMSize - 1;
         switch (size) {
         case 1:
             *value = m_VRAM[addr];
@@ -197,6 +230,7 @@ void NV2ADevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8
     //log_spew("NV2ADevice::MMIOWrite:  bar = %d,  addr = 0x%x,  size = %u,  value = 0x%x\n", barIndex, addr, size, value);
 
     if (barIndex == 1) {
+        addr &= m_systemRAMSize - 1;
         switch (size) {
         case 1:
             m_VRAM[addr] = value;
@@ -324,14 +358,10 @@ void NV2ADevice::PFIFORead(NV2ADevice *nv2a, uint32_t addr, uint32_t *value, uin
         SET_MASK(*value, NV_PFIFO_CACHE1_PUSH1_MODE, nv2a->m_PFIFO.cache1.mode);
         break;
     case NV_PFIFO_CACHE1_STATUS:
-    {
-        std::lock_guard<std::mutex> lk(nv2a->m_PFIFO.cache1.mutex);
-
-        if (nv2a->m_PFIFO.cache1.cache.empty()) {
+        if (nv2a->m_PFIFO.cache1.cache.IsEmpty()) {
             *value |= NV_PFIFO_CACHE1_STATUS_LOW_MARK; /* low mark empty */
         }
-
-    }	break;
+        break;
     case NV_PFIFO_CACHE1_DMA_PUSH:
         SET_MASK(*value, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS,
             nv2a->m_PFIFO.cache1.dma_push_enabled);
@@ -420,7 +450,7 @@ void NV2ADevice::PFIFOWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, uin
         nv2a->m_PFIFO.cache1.dma_push_enabled = GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS);
         if (nv2a->m_PFIFO.cache1.dma_push_suspended && !GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_STATUS)) {
             nv2a->m_PFIFO.cache1.dma_push_suspended = false;
-            nv2a->pfifo_run_pusher();
+            nv2a->pfifo_kick_pusher();
         }
         nv2a->m_PFIFO.cache1.dma_push_suspended = GET_MASK(value, NV_PFIFO_CACHE1_DMA_PUSH_STATUS);
         break;
@@ -543,7 +573,7 @@ static inline uint64_t muldiv64(uint64_t a, uint32_t b, uint32_t c) {
 
 uint32_t NV2ADevice::ptimer_get_clock() {
     // Get time in nanoseconds
-    long int time = static_cast<long int>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count());
+    uint64_t time = m_scheduler.Now();
     return muldiv64(time, m_PRAMDAC.core_clock_freq * m_PTIMER.numerator, CLOCKS_PER_SEC * m_PTIMER.denominator);
 }
 
@@ -1053,7 +1083,7 @@ void NV2ADevice::USERWrite(NV2ADevice *nv2a, uint32_t addr, uint32_t value, uint
             control->dma_put = value;
 
             if (nv2a->m_PFIFO.cache1.push_enabled) {
-                nv2a->pfifo_run_pusher();
+                nv2a->pfifo_kick_pusher();
             }
             break;
         case NV_USER_DMA_GET:
@@ -1138,12 +1168,12 @@ void NV2ADevice::pgraph_context_switch(unsigned int channel_id) {
     if (!valid) {
         log_debug("puller needs to switch to ch %d\n", channel_id);
 
-        //qemu_mutex_lock_iothread();
+        std::unique_lock<std::mutex> devLk(m_deviceLock);
         m_PGRAPH.pending_interrupts |= NV_PGRAPH_INTR_CONTEXT_SWITCH;
         UpdateIRQ();
 
         std::unique_lock<std::mutex> lk(m_PGRAPH.mutex);
-        //qemu_mutex_unlock_iothread();
+        devLk.unlock();
 
         while (m_PGRAPH.pending_interrupts & NV_PGRAPH_INTR_CONTEXT_SWITCH) {
             m_PGRAPH.interrupt_cond.wait(lk);
@@ -1211,7 +1241,8 @@ DMAObject NV2ADevice::nv_dma_load(uint32_t dma_obj_address) {
     return object;
 }
 
-void *NV2ADevice::nv_dma_map(uint32_t dma_obj_address, uint32_t *len) {
+// Returns nullptr if the object does not point to system RAM
+void *NV2ADevice::nv_dma_map(uint32_t dma_obj_address, uint32_t *len, cpu::CPUMemAccess access) {
     assert(dma_obj_address < NV_PRAMIN_SIZE);
 
     DMAObject dma = nv_dma_load(dma_obj_address);
@@ -1222,9 +1253,35 @@ void *NV2ADevice::nv_dma_map(uint32_t dma_obj_address, uint32_t *len) {
 
     dma.address &= 0x07FFFFFF;
 
-    // assert(dma.address + dma.limit < memory_region_size(d->vram));
-    *len = dma.limit;
-    return (void*)(m_VRAM + dma.address);
+    // Objects commonly span the largest possible amount of memory; only the
+    // part backed by RAM is accessible
+    if (dma.address >= m_systemRAMSize) {
+        *len = 0;
+        return nullptr;
+    }
+    *len = std::min(dma.limit, m_systemRAMSize - dma.address);
+    if (*len == 0) {
+        return nullptr;
+    }
+    return m_cpu.GetHostPointer(dma.address, *len, access);
+}
+
+// Maps part of a DMA object. Returns nullptr if the range is empty or not
+// entirely within the part of the object backed by RAM. Writers should map
+// only what they write, since the CPU treats the whole range as modified.
+void *NV2ADevice::nv_dma_map_range(uint32_t dma_obj_address, uint64_t offset, uint64_t size, cpu::CPUMemAccess access) {
+    assert(dma_obj_address < NV_PRAMIN_SIZE);
+
+    DMAObject dma = nv_dma_load(dma_obj_address);
+    uint32_t address = dma.address & 0x07FFFFFF;
+    if (address >= m_systemRAMSize) {
+        return nullptr;
+    }
+    uint32_t len = std::min(dma.limit, m_systemRAMSize - address);
+    if (size == 0 || offset + size > len) {
+        return nullptr;
+    }
+    return m_cpu.GetHostPointer(address + (uint32_t)offset, (uint32_t)size, access);
 }
 
 bool NV2ADevice::pgraph_color_write_enabled() {
@@ -1241,6 +1298,374 @@ bool NV2ADevice::pgraph_zeta_write_enabled() {
         | NV_PGRAPH_CONTROL_0_STENCIL_WRITE_ENABLE);
 }
 
+// ----- Drawing --------------------------------------------------------------
+
+// Returns the number of bytes an attribute takes in a vertex
+static unsigned int vertex_attribute_size(const VertexAttribute& attribute) {
+    switch (attribute.format) {
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D:
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL:
+        return attribute.size;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1:
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K:
+        return attribute.size * 2;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_CMP:
+        return 4;
+    default:
+        return attribute.size * 4;
+    }
+}
+
+// Converts an attribute from its memory format to four floats. Components
+// missing from memory default to (0, 0, 0, 1).
+static void convert_vertex_attribute(const VertexAttribute& attribute, const uint8_t *data, float out[4]) {
+    out[0] = out[1] = out[2] = 0.0f;
+    out[3] = 1.0f;
+
+    unsigned int size = std::min(attribute.size, 4u);
+    switch (attribute.format) {
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D:
+        if (size == 4) {
+            // D3DCOLOR, stored as BGRA
+            out[0] = data[2] / 255.0f;
+            out[1] = data[1] / 255.0f;
+            out[2] = data[0] / 255.0f;
+            out[3] = data[3] / 255.0f;
+            break;
+        }
+        // fall through
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL:
+        for (unsigned int i = 0; i < size; i++) {
+            out[i] = data[i] / 255.0f;
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1:
+        for (unsigned int i = 0; i < size; i++) {
+            int16_t value;
+            memcpy(&value, data + i * 2, sizeof(value));
+            out[i] = std::max(value / 32767.0f, -1.0f);
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K:
+        for (unsigned int i = 0; i < size; i++) {
+            int16_t value;
+            memcpy(&value, data + i * 2, sizeof(value));
+            out[i] = (float)value;
+        }
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_CMP: {
+        // Signed 11:11:10 normal packed in a dword
+        uint32_t packed;
+        memcpy(&packed, data, sizeof(packed));
+        out[0] = ((int32_t)(packed << 21) >> 21) / 1023.0f;
+        out[1] = ((int32_t)(packed << 10) >> 21) / 1023.0f;
+        out[2] = ((int32_t)packed >> 22) / 511.0f;
+        break;
+    }
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_F:
+        memcpy(out, data, size * sizeof(float));
+        break;
+    default:
+        log_warning("EmuNV2A: Unknown vertex attribute format %u\n", attribute.format);
+        break;
+    }
+}
+
+// Captures the render state from the PGRAPH registers and maps the surfaces.
+// Returns false if there is nothing to draw to.
+bool NV2ADevice::pgraph_get_raster_state(RasterState *state) {
+    const SurfaceShape& shape = m_PGRAPH.surface_shape;
+    const uint32_t *regs = m_PGRAPH.regs;
+
+    if (shape.clip_width == 0 || shape.clip_height == 0) {
+        return false;
+    }
+    if (m_PGRAPH.surface_type == NV097_SET_SURFACE_FORMAT_TYPE_SWIZZLE) {
+        log_warning("EmuNV2A: Swizzled surfaces are not supported\n");
+        return false;
+    }
+
+    state->clipX = shape.clip_x;
+    state->clipY = shape.clip_y;
+    state->clipWidth = shape.clip_width;
+    state->clipHeight = shape.clip_height;
+
+    // Both surfaces must hold the whole clip rectangle
+    uint32_t lastX = shape.clip_x + shape.clip_width;
+    uint32_t lastY = shape.clip_y + shape.clip_height - 1;
+
+    if (shape.color_format != 0) {
+        const Surface& surface = m_PGRAPH.surface_color;
+        unsigned int bpp = Rasterizer::ColorBytesPerPixel(shape.color_format);
+        uint64_t size = (uint64_t)lastY * surface.pitch + (uint64_t)lastX * bpp;
+        uint8_t *data = (uint8_t *)nv_dma_map_range(m_PGRAPH.dma_color, surface.offset, size, cpu::CPU_MEM_ACCESS_WRITE);
+        if (data != nullptr) {
+            state->color.data = data;
+            state->color.pitch = surface.pitch;
+            state->color.format = shape.color_format;
+        }
+        else {
+            log_warning("EmuNV2A: Color surface at 0x%x is out of bounds\n", surface.offset);
+        }
+    }
+
+    if (shape.zeta_format != 0) {
+        const Surface& surface = m_PGRAPH.surface_zeta;
+        unsigned int bpp = (shape.zeta_format == NV097_SET_SURFACE_FORMAT_ZETA_Z16) ? 2 : 4;
+        uint64_t size = (uint64_t)lastY * surface.pitch + (uint64_t)lastX * bpp;
+        uint8_t *data = (uint8_t *)nv_dma_map_range(m_PGRAPH.dma_zeta, surface.offset, size, cpu::CPU_MEM_ACCESS_WRITE);
+        if (data != nullptr) {
+            state->zeta.data = data;
+            state->zeta.pitch = surface.pitch;
+            state->zeta.format = shape.zeta_format;
+        }
+        else {
+            log_warning("EmuNV2A: Zeta surface at 0x%x is out of bounds\n", surface.offset);
+        }
+    }
+
+    if (state->color.data == nullptr && state->zeta.data == nullptr) {
+        return false;
+    }
+
+    uint32_t setupraster = regs[NV_PGRAPH_SETUPRASTER];
+    state->cullEnable = setupraster & NV_PGRAPH_SETUPRASTER_CULLENABLE;
+    state->cullFace = GET_MASK(setupraster, NV_PGRAPH_SETUPRASTER_CULLCTRL);
+    state->frontFaceCCW = setupraster & NV_PGRAPH_SETUPRASTER_FRONTFACE;
+
+    uint32_t control0 = regs[NV_PGRAPH_CONTROL_0];
+    state->depthTest = control0 & NV_PGRAPH_CONTROL_0_ZENABLE;
+    state->depthFunc = GET_MASK(control0, NV_PGRAPH_CONTROL_0_ZFUNC);
+    state->depthWrite = control0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE;
+
+    state->alphaTest = control0 & NV_PGRAPH_CONTROL_0_ALPHATESTENABLE;
+    state->alphaFunc = GET_MASK(control0, NV_PGRAPH_CONTROL_0_ALPHAFUNC);
+    state->alphaRef = GET_MASK(control0, NV_PGRAPH_CONTROL_0_ALPHAREF);
+
+    state->colorWriteMask = 0;
+    if (control0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE) state->colorWriteMask |= 0xFF000000;
+    if (control0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE) state->colorWriteMask |= 0x00FF0000;
+    if (control0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE) state->colorWriteMask |= 0x0000FF00;
+    if (control0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE) state->colorWriteMask |= 0x000000FF;
+
+    uint32_t control1 = regs[NV_PGRAPH_CONTROL_1];
+    uint32_t control2 = regs[NV_PGRAPH_CONTROL_2];
+    state->stencilTest = control1 & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
+    state->stencilFunc = GET_MASK(control1, NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
+    state->stencilRef = GET_MASK(control1, NV_PGRAPH_CONTROL_1_STENCIL_REF);
+    state->stencilReadMask = GET_MASK(control1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
+    state->stencilWriteMask = (control0 & NV_PGRAPH_CONTROL_0_STENCIL_WRITE_ENABLE)
+        ? GET_MASK(control1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE) : 0;
+    state->stencilOpFail = GET_MASK(control2, NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
+    state->stencilOpZFail = GET_MASK(control2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
+    state->stencilOpZPass = GET_MASK(control2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
+
+    uint32_t blend = regs[NV_PGRAPH_BLEND];
+    state->blend = blend & NV_PGRAPH_BLEND_EN;
+    state->blendSFactor = GET_MASK(blend, NV_PGRAPH_BLEND_SFACTOR);
+    state->blendDFactor = GET_MASK(blend, NV_PGRAPH_BLEND_DFACTOR);
+    state->blendEquation = GET_MASK(blend, NV_PGRAPH_BLEND_EQN);
+    state->blendColor = regs[NV_PGRAPH_BLENDCOLOR];
+
+    return true;
+}
+
+// Converts an ARGB register value to RGBA floats
+static void convert_combiner_color(uint32_t argb, float out[4]) {
+    out[0] = ((argb >> 16) & 0xFF) / 255.0f;
+    out[1] = ((argb >> 8) & 0xFF) / 255.0f;
+    out[2] = (argb & 0xFF) / 255.0f;
+    out[3] = (argb >> 24) / 255.0f;
+}
+
+// Looks up the kernel for the current register combiner setup and captures
+// the combiner constants
+void NV2ADevice::pgraph_get_combiners(RasterState *state) {
+    const uint32_t *regs = m_PGRAPH.regs;
+
+    CombinerSetup setup;
+    setup.control = regs[NV_PGRAPH_COMBINECTL];
+    unsigned int numStages = std::min<unsigned int>(GET_MASK(setup.control, NV_PGRAPH_COMBINECTL_ITERATION_COUNT), COMBINER_MAX_STAGES);
+    for (unsigned int i = 0; i < numStages; i++) {
+        setup.colorInputs[i] = regs[NV_PGRAPH_COMBINECOLORI0 + i * 4];
+        setup.colorOutputs[i] = regs[NV_PGRAPH_COMBINECOLORO0 + i * 4];
+        setup.alphaInputs[i] = regs[NV_PGRAPH_COMBINEALPHAI0 + i * 4];
+        setup.alphaOutputs[i] = regs[NV_PGRAPH_COMBINEALPHAO0 + i * 4];
+    }
+    setup.specularFog[0] = regs[NV_PGRAPH_COMBINESPECFOG0];
+    setup.specularFog[1] = regs[NV_PGRAPH_COMBINESPECFOG1];
+    state->combiners = m_combiners.GetKernel(setup);
+
+    CombinerConstants& constants = state->combinerConstants;
+    for (unsigned int i = 0; i < COMBINER_MAX_STAGES; i++) {
+        convert_combiner_color(regs[NV_PGRAPH_COMBINEFACTOR0 + i * 4], constants.factor0[i]);
+        convert_combiner_color(regs[NV_PGRAPH_COMBINEFACTOR1 + i * 4], constants.factor1[i]);
+    }
+    convert_combiner_color(regs[NV_PGRAPH_SPECFOGFACTOR0], constants.finalFactor0);
+    convert_combiner_color(regs[NV_PGRAPH_SPECFOGFACTOR1], constants.finalFactor1);
+
+    // No fog coordinate is computed, so the fog factor is always 1
+    convert_combiner_color(regs[NV_PGRAPH_FOGCOLOR], constants.fog);
+    constants.fog[3] = 1.0f;
+}
+
+// Queues a vertex for the vertex program, running the program once enough
+// vertices are queued
+void NV2ADevice::pgraph_queue_vertex(const float attributes[NV2A_VERTEXSHADER_ATTRIBUTES][4]) {
+    memcpy(m_vshInputs[m_vshQueued++], attributes, sizeof(VshInputs));
+    if (m_vshQueued == ARRAY_SIZE(m_vshInputs)) {
+        pgraph_flush_vertices();
+    }
+}
+
+// Runs the vertex program over the queued vertices and appends the results
+// to the vertices to rasterize
+void NV2ADevice::pgraph_flush_vertices() {
+    if (m_vshQueued == 0) {
+        return;
+    }
+    // Constant writes go back to the constant registers, so that later loads
+    // of the same rows are compared against what the program stored
+    m_vsh.Run(*m_vshProgram, m_vshInputs, m_vshOutputs, m_vshQueued, m_PGRAPH.enable_vertex_program_write ? m_PGRAPH.vsh_constants : nullptr);
+
+    for (uint32_t i = 0; i < m_vshQueued; i++) {
+        const float (*outputs)[4] = m_vshOutputs[i];
+        m_drawVertices.emplace_back();
+        RasterVertex& vertex = m_drawVertices.back();
+
+        // Programs output screen space positions, already divided by w
+        const float *position = outputs[VSH_OUTPUT_POSITION];
+        vertex.pos[0] = position[0] * position[3];
+        vertex.pos[1] = position[1] * position[3];
+        vertex.pos[2] = position[2] * position[3];
+        vertex.pos[3] = position[3];
+
+        memcpy(&vertex.varyings[RASTER_VARYING_DIFFUSE], outputs[VSH_OUTPUT_DIFFUSE], 4 * sizeof(float));
+        memcpy(&vertex.varyings[RASTER_VARYING_SPECULAR], outputs[VSH_OUTPUT_SPECULAR], 4 * sizeof(float));
+    }
+    m_vshQueued = 0;
+}
+
+// Assembles and draws the vertices submitted since NV097_SET_BEGIN_END, from
+// the inline array, inline elements or draw arrays, in that order of priority
+void NV2ADevice::pgraph_draw() {
+    RasterState state;
+    if (!pgraph_get_raster_state(&state)) {
+        return;
+    }
+
+    // Programs are only decoded again after they change
+    if (GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_MODE) == 2) {
+        if (m_PGRAPH.program_data_dirty || m_vshProgram == nullptr || m_vshProgram == m_vsh.GetFixedFunctionProgram()) {
+            unsigned int start = GET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C], NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START);
+            m_vshProgram = m_vsh.LoadProgram(m_PGRAPH.program_data, start);
+            m_PGRAPH.program_data_dirty = false;
+        }
+    }
+    else {
+        m_vshProgram = m_vsh.GetFixedFunctionProgram();
+    }
+    m_vsh.UpdateConstants(m_PGRAPH.vsh_constants, m_PGRAPH.vsh_constants_dirty);
+    pgraph_get_combiners(&state);
+
+    float attributes[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        memcpy(attributes[i], m_PGRAPH.vertex_attributes[i].inline_value, sizeof(attributes[i]));
+    }
+
+    m_drawVertices.clear();
+
+    if (m_PGRAPH.inline_array_length > 0) {
+        // Vertices hold the enabled attributes packed in slot order
+        unsigned int vertex_size = 0;
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            if (m_PGRAPH.vertex_attributes[i].size > 0) {
+                vertex_size += vertex_attribute_size(m_PGRAPH.vertex_attributes[i]);
+            }
+        }
+        if (vertex_size == 0) {
+            return;
+        }
+
+        const uint8_t *data = (const uint8_t *)m_PGRAPH.inline_array;
+        uint32_t length = m_PGRAPH.inline_array_length * sizeof(uint32_t);
+        for (uint32_t offset = 0; offset + vertex_size <= length; offset += vertex_size) {
+            const uint8_t *p = data + offset;
+            for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+                const VertexAttribute& attribute = m_PGRAPH.vertex_attributes[i];
+                if (attribute.size > 0) {
+                    convert_vertex_attribute(attribute, p, attributes[i]);
+                    p += vertex_attribute_size(attribute);
+                }
+            }
+            pgraph_queue_vertex(attributes);
+        }
+    }
+    else {
+        uint8_t *dma[2];
+        uint32_t dma_len[2];
+        dma[0] = (uint8_t *)nv_dma_map(m_PGRAPH.dma_vertex_a, &dma_len[0], cpu::CPU_MEM_ACCESS_READ);
+        dma[1] = (uint8_t *)nv_dma_map(m_PGRAPH.dma_vertex_b, &dma_len[1], cpu::CPU_MEM_ACCESS_READ);
+
+        auto fetch = [&](uint32_t index) {
+            for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+                const VertexAttribute& attribute = m_PGRAPH.vertex_attributes[i];
+                if (attribute.size == 0) {
+                    continue;
+                }
+                unsigned int select = attribute.dma_select ? 1 : 0;
+                uint64_t offset = attribute.offset + (uint64_t)index * attribute.stride;
+                if (dma[select] == nullptr || offset + vertex_attribute_size(attribute) > dma_len[select]) {
+                    log_debug("EmuNV2A: Vertex %u attribute %d is out of bounds\n", index, i);
+                    continue;
+                }
+                convert_vertex_attribute(attribute, dma[select] + offset, attributes[i]);
+            }
+            pgraph_queue_vertex(attributes);
+        };
+
+        if (m_PGRAPH.inline_elements_length > 0) {
+            for (unsigned int i = 0; i < m_PGRAPH.inline_elements_length; i++) {
+                fetch(m_PGRAPH.inline_elements[i]);
+            }
+        }
+        else {
+            for (unsigned int i = 0; i < m_PGRAPH.draw_arrays_length; i++) {
+                for (uint32_t j = 0; j < m_PGRAPH.draw_arrays_count[i]; j++) {
+                    fetch(m_PGRAPH.draw_arrays_start[i] + j);
+                }
+            }
+        }
+    }
+
+    pgraph_flush_vertices();
+    m_rasterizer.DrawPrimitives(state, m_PGRAPH.primitive_mode, m_drawVertices.data(), (uint32_t)m_drawVertices.size());
+}
+
+// Clears the clear rectangle of the surfaces selected by an
+// NV097_CLEAR_SURFACE parameter
+void NV2ADevice::pgraph_clear_surface(uint32_t parameter) {
+    RasterState state;
+    if (!pgraph_get_raster_state(&state)) {
+        return;
+    }
+
+    uint32_t colorMask = 0;
+    if (parameter & NV097_CLEAR_SURFACE_A) colorMask |= 0xFF000000;
+    if (parameter & NV097_CLEAR_SURFACE_R) colorMask |= 0x00FF0000;
+    if (parameter & NV097_CLEAR_SURFACE_G) colorMask |= 0x0000FF00;
+    if (parameter & NV097_CLEAR_SURFACE_B) colorMask |= 0x000000FF;
+
+    uint32_t rectX = m_PGRAPH.regs[NV_PGRAPH_CLEARRECTX];
+    uint32_t rectY = m_PGRAPH.regs[NV_PGRAPH_CLEARRECTY];
+    m_rasterizer.Clear(state,
+        GET_MASK(rectX, NV_PGRAPH_CLEARRECTX_XMIN), GET_MASK(rectY, NV_PGRAPH_CLEARRECTY_YMIN),
+        GET_MASK(rectX, NV_PGRAPH_CLEARRECTX_XMAX), GET_MASK(rectY, NV_PGRAPH_CLEARRECTY_YMAX),
+        colorMask, m_PGRAPH.regs[NV_PGRAPH_COLORCLEARVALUE],
+        parameter & NV097_CLEAR_SURFACE_Z, parameter & NV097_CLEAR_SURFACE_STENCIL,
+        m_PGRAPH.regs[NV_PGRAPH_ZSTENCILCLEARVALUE]);
+}
+
 unsigned int NV2ADevice::kelvin_map_stencil_op(uint32_t parameter) {
     unsigned int op;
     switch (parameter) {
@@ -1309,12 +1734,12 @@ unsigned int NV2ADevice::kelvin_map_texgen(uint32_t parameter, unsigned int chan
     return texgen;
 }
 
-void NV2ADevice::pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter) {
-    static unsigned int last = 0;
-    static unsigned int count = 0;
+void NV2ADevice::pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter, uint32_t count) {
+    unsigned int& last = m_PGRAPH.log_last_method;
+    unsigned int& repeats = m_PGRAPH.log_method_count;
 
     if (last == 0x1800 && method != last) {
-        log_debug("pgraph method (%d) 0x%08X * %d", subchannel, last, count);
+        log_debug("pgraph method (%d) 0x%08X * %d", subchannel, last, repeats);
     }
     if (method != 0x1800) {
         /*const char* method_name = NULL;
@@ -1339,25 +1764,225 @@ void NV2ADevice::pgraph_method_log(unsigned int subchannel, unsigned int graphic
         }
         else {
         */
-        log_debug("pgraph method (%d): 0x%x -> 0x%04x (0x%x)\n",
-            subchannel, graphics_class, method, parameter);
+        if (count > 1) {
+            log_debug("pgraph method (%d): 0x%x -> 0x%04x (0x%x) + %u more\n",
+                subchannel, graphics_class, method, parameter, count - 1);
+        }
+        else {
+            log_debug("pgraph method (%d): 0x%x -> 0x%04x (0x%x)\n",
+                subchannel, graphics_class, method, parameter);
+        }
         //}
 
     }
-    if (method == last) { count++; }
-    else { count = 0; }
+    if (method == last) { repeats += count; }
+    else { repeats = count - 1; }
     last = method;
 }
 
 void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uint32_t parameter) {
+    pgraph_methods(subchannel, method, &parameter, 1, false);
+}
+
+// Processes a run of parameters sent to consecutive methods, or repeatedly to
+// the same method if nonincreasing is set. The lock is taken and the run is
+// logged once for the whole run, and blocks of Kelvin data are copied in bulk.
+void NV2ADevice::pgraph_methods(unsigned int subchannel, unsigned int method, const uint32_t *parameters, uint32_t count, bool nonincreasing) {
     std::lock_guard<std::mutex> lk(m_PGRAPH.mutex);
 
+    assert(m_PGRAPH.channel_valid);
+    GraphicsObject *object = &m_PGRAPH.subchannel_data[subchannel].object;
+
+    pgraph_method_log(subchannel, object->graphics_class, method, parameters[0], count);
+
+    while (count > 0) {
+        uint32_t done = 0;
+        if (object->graphics_class == NV_KELVIN_PRIMITIVE) {
+            done = pgraph_kelvin_methods(method, parameters, count, nonincreasing);
+        }
+        if (done == 0) {
+            pgraph_method_locked(subchannel, method, *parameters);
+            done = 1;
+        }
+
+        parameters += done;
+        count -= done;
+        if (!nonincreasing) {
+            method += done * 4;
+        }
+    }
+}
+
+// Returns how many parameters of a run starting at the specified method fall
+// within the method range [base, base + size)
+static inline uint32_t kelvin_span_length(unsigned int method, unsigned int base, unsigned int size, uint32_t count, bool nonincreasing) {
+    if (method < base || method >= base + size) {
+        return 0;
+    }
+    if (nonincreasing) {
+        return count;
+    }
+    uint32_t remaining = (base + size - method) / 4;
+    return (count < remaining) ? count : remaining;
+}
+
+// Kelvin methods that load 4x4 matrices into the transform constants
+static const struct {
+    unsigned int method;
+    unsigned int size;
+    unsigned int row;
+} kKelvinMatrixMethods[] = {
+    { NV097_SET_PROJECTION_MATRIX, 0x40, NV_IGRAPH_XF_XFCTX_PMAT0 },
+    { NV097_SET_MODEL_VIEW_MATRIX, 0x100, NV_IGRAPH_XF_XFCTX_MMAT0 },
+    { NV097_SET_INVERSE_MODEL_VIEW_MATRIX, 0x100, NV_IGRAPH_XF_XFCTX_IMMAT0 },
+    { NV097_SET_COMPOSITE_MATRIX, 0x40, NV_IGRAPH_XF_XFCTX_CMAT0 },
+    { NV097_SET_TEXTURE_MATRIX, 0x100, NV_IGRAPH_XF_XFCTX_T0MAT },
+    /* Handles NV097_SET_TEXGEN_PLANE_S,T,R,Q */
+    { NV097_SET_TEXGEN_PLANE_S, 0x100, NV_IGRAPH_XF_XFCTX_TG0MAT },
+};
+
+// Handles runs of the Kelvin methods that upload blocks of data. Returns the
+// number of parameters consumed, or 0 if the first method has to go through
+// pgraph_method_locked.
+uint32_t NV2ADevice::pgraph_kelvin_methods(unsigned int method, const uint32_t *parameters, uint32_t count, bool nonincreasing) {
+    uint32_t n;
+
+    if (method == NV097_INLINE_ARRAY) {
+        n = nonincreasing ? count : 1;
+        uint32_t copied = n;
+        uint32_t room = NV2A_MAX_BATCH_LENGTH - m_PGRAPH.inline_array_length;
+        if (copied > room) {
+            log_warning("EmuNV2A: Inline array is too long, dropping %u words\n", copied - room);
+            copied = room;
+        }
+        memcpy(&m_PGRAPH.inline_array[m_PGRAPH.inline_array_length], parameters, copied * sizeof(uint32_t));
+        m_PGRAPH.inline_array_length += copied;
+        return n;
+    }
+
+    if (method == NV097_ARRAY_ELEMENT16 || method == NV097_ARRAY_ELEMENT32) {
+        n = nonincreasing ? count : 1;
+        for (uint32_t i = 0; i < n; i++) {
+            pgraph_push_array_elements(method, parameters[i]);
+        }
+        return n;
+    }
+
+    n = kelvin_span_length(method, NV097_SET_TRANSFORM_CONSTANT, 0x80, count, nonincreasing);
+    if (n > 0) {
+        return pgraph_load_transform_constants((method - NV097_SET_TRANSFORM_CONSTANT) / 4, parameters, n, nonincreasing);
+    }
+
+    n = kelvin_span_length(method, NV097_SET_TRANSFORM_PROGRAM, 0x80, count, nonincreasing);
+    if (n > 0) {
+        return pgraph_load_transform_program((method - NV097_SET_TRANSFORM_PROGRAM) / 4, parameters, n, nonincreasing);
+    }
+
+    for (auto& matrix : kKelvinMatrixMethods) {
+        n = kelvin_span_length(method, matrix.method, matrix.size, count, nonincreasing);
+        if (n > 0) {
+            return pgraph_load_matrices(matrix.row, (method - matrix.method) / 4, parameters, n, nonincreasing);
+        }
+    }
+
+    return 0;
+}
+
+// Appends the vertex indices of an NV097_ARRAY_ELEMENT16/32 parameter to the
+// inline elements. ARRAY_ELEMENT16 packs two indices, low half first.
+void NV2ADevice::pgraph_push_array_elements(unsigned int method, uint32_t parameter) {
+    unsigned int count = (method == NV097_ARRAY_ELEMENT16) ? 2 : 1;
+    if (m_PGRAPH.inline_elements_length + count > NV2A_MAX_BATCH_LENGTH) {
+        log_warning("EmuNV2A: Inline elements are too long, dropping %u indices\n", count);
+        return;
+    }
+    if (count == 2) {
+        m_PGRAPH.inline_elements[m_PGRAPH.inline_elements_length++] = parameter & 0xFFFF;
+        m_PGRAPH.inline_elements[m_PGRAPH.inline_elements_length++] = parameter >> 16;
+    }
+    else {
+        m_PGRAPH.inline_elements[m_PGRAPH.inline_elements_length++] = parameter;
+    }
+}
+
+// Loads parameters into consecutive matrix entries starting at the specified
+// slot. Each matrix takes 16 slots and 8 constant rows, starting at the
+// specified row.
+uint32_t NV2ADevice::pgraph_load_matrices(unsigned int row, unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing) {
+    uint32_t consumed = count;
+    if (nonincreasing) {
+        // Every parameter overwrites the same entry
+        parameters += count - 1;
+        count = 1;
+    }
+
+    for (uint32_t i = 0; i < count; i++, slot++) {
+        unsigned int entry_row = row + (slot / 16) * 8 + (slot % 16) / 4;
+        m_PGRAPH.vsh_constants[entry_row][slot % 4] = parameters[i];
+        m_PGRAPH.vsh_constants_dirty[entry_row] = true;
+    }
+    return consumed;
+}
+
+// Writes NV097_SET_TRANSFORM_PROGRAM parameters to the program token at the
+// program load pointer, which moves to the next token after every fourth word
+uint32_t NV2ADevice::pgraph_load_transform_program(unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing) {
+    uint32_t& cheops = m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET];
+    unsigned int load = GET_MASK(cheops, NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (load >= NV2A_MAX_TRANSFORM_PROGRAM_LENGTH) {
+            log_warning("EmuNV2A: Transform program is too long, dropping %u words\n", count - i);
+            break;
+        }
+        m_PGRAPH.program_data[load][slot % 4] = parameters[i];
+        m_PGRAPH.program_data_dirty = true;
+        if (slot % 4 == 3) {
+            load++;
+        }
+        if (!nonincreasing) {
+            slot++;
+        }
+    }
+
+    SET_MASK(cheops, NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, load);
+    return count;
+}
+
+// Writes NV097_SET_TRANSFORM_CONSTANT parameters to the constant at the
+// constant load pointer, which moves to the next constant after every fourth
+// word. Only constants that actually change are marked dirty.
+uint32_t NV2ADevice::pgraph_load_transform_constants(unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing) {
+    uint32_t& cheops = m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET];
+    unsigned int load = GET_MASK(cheops, NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (load >= NV2A_VERTEXSHADER_CONSTANTS) {
+            log_warning("EmuNV2A: Transform constants overflow, dropping %u words\n", count - i);
+            break;
+        }
+        uint32_t *constant = m_PGRAPH.vsh_constants[load];
+        m_PGRAPH.vsh_constants_dirty[load] |= (constant[slot % 4] != parameters[i]);
+        constant[slot % 4] = parameters[i];
+        if (slot % 4 == 3) {
+            load++;
+        }
+        if (!nonincreasing) {
+            slot++;
+        }
+    }
+
+    SET_MASK(cheops, NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, load);
+    return count;
+}
+
+// Must be called with the PGRAPH lock held
+void NV2ADevice::pgraph_method_locked(unsigned int subchannel, unsigned int method, uint32_t parameter) {
     GraphicsSubchannel *subchannel_data;
     GraphicsObject *object;
 
     unsigned int slot;
 
-    assert(m_PGRAPH.channel_valid);
     subchannel_data = &m_PGRAPH.subchannel_data[subchannel];
     object = &subchannel_data->object;
 
@@ -1365,8 +1990,6 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
     ImageBlitState *image_blit = &object->data.image_blit;
     KelvinState *kelvin = &object->data.kelvin;
 
-    pgraph_method_log(subchannel, object->graphics_class, method, parameter);
-
     if (method == NV_SET_OBJECT) {
         subchannel_data->object_instance = parameter;
 
@@ -1455,27 +2078,35 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                     break;
                 }
 
-                uint32_t source_dma_len, dest_dma_len;
-                uint8_t *source, *dest;
-
-                source = (uint8_t*)nv_dma_map(context_surfaces->dma_image_source, &source_dma_len);
-                assert(context_surfaces->source_offset < source_dma_len);
-                source += context_surfaces->source_offset;
+                if (image_blit->height == 0 || image_blit->width == 0) {
+                    break;
+                }
 
-                dest = (uint8_t*)nv_dma_map(context_surfaces->dma_image_dest, &dest_dma_len);
-                assert(context_surfaces->dest_offset < dest_dma_len);
-                dest += context_surfaces->dest_offset;
+                // Map the rectangles being copied, which must lie within
+                // the surfaces
+                uint64_t source_start = context_surfaces->source_offset
+                    + (uint64_t)image_blit->in_y * context_surfaces->source_pitch
+                    + (uint64_t)image_blit->in_x * bytes_per_pixel;
+                uint64_t source_size = (uint64_t)(image_blit->height - 1) * context_surfaces->source_pitch
+                    + (uint64_t)image_blit->width * bytes_per_pixel;
+                uint64_t dest_start = context_surfaces->dest_offset
+                    + (uint64_t)image_blit->out_y * context_surfaces->dest_pitch
+                    + (uint64_t)image_blit->out_x * bytes_per_pixel;
+                uint64_t dest_size = (uint64_t)(image_blit->height - 1) * context_surfaces->dest_pitch
+                    + (uint64_t)image_blit->width * bytes_per_pixel;
+
+                uint8_t *source = (uint8_t*)nv_dma_map_range(context_surfaces->dma_image_source, source_start, source_size, cpu::CPU_MEM_ACCESS_READ);
+                uint8_t *dest = (uint8_t*)nv_dma_map_range(context_surfaces->dma_image_dest, dest_start, dest_size, cpu::CPU_MEM_ACCESS_WRITE);
+                if (source == nullptr || dest == nullptr) {
+                    log_warning("EmuNV2A: Image blit exceeds its surfaces\n");
+                    break;
+                }
 
                 log_debug("  - 0x%tx -> 0x%tx\n", source - m_VRAM, dest - m_VRAM);
 
                 for (unsigned int y = 0; y<image_blit->height; y++) {
-                    uint8_t *source_row = source
-                        + (image_blit->in_y + y) * context_surfaces->source_pitch
-                        + image_blit->in_x * bytes_per_pixel;
-
-                    uint8_t *dest_row = dest
-                        + (image_blit->out_y + y) * context_surfaces->dest_pitch
-                        + image_blit->out_x * bytes_per_pixel;
+                    uint8_t *source_row = source + y * context_surfaces->source_pitch;
+                    uint8_t *dest_row = dest + y * context_surfaces->dest_pitch;
 
                     memmove(dest_row, source_row,
                         image_blit->width * bytes_per_pixel);
@@ -1591,6 +2222,9 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
         case NV097_SET_COMBINER_SPECULAR_FOG_CW1:
             m_PGRAPH.regs[NV_PGRAPH_COMBINESPECFOG1] = parameter;
             break;
+        case NV097_SET_COMBINER_CONTROL:
+            m_PGRAPH.regs[NV_PGRAPH_COMBINECTL] = parameter;
+            break;
             CASE_4(NV097_SET_TEXTURE_ADDRESS, 64) :
                 slot = (method - NV097_SET_TEXTURE_ADDRESS) / 64;
             m_PGRAPH.regs[NV_PGRAPH_TEXADDRESS0 + slot * 4] = parameter;
@@ -2033,57 +2667,117 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
         case NV097_SET_TEXGEN_VIEW_MODEL:
             SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_TEXGEN_REF, parameter);
             break;
-        default:
-            if (method >= NV097_SET_COMBINER_ALPHA_ICW && method <= NV097_SET_COMBINER_ALPHA_ICW + 28) {
-                slot = (method - NV097_SET_COMBINER_ALPHA_ICW) / 4;
-                m_PGRAPH.regs[NV_PGRAPH_COMBINEALPHAI0 + slot * 4] = parameter;
-                break;
+
+        case NV097_SET_TRANSFORM_PROGRAM_LOAD:
+            assert(parameter < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                NV_PGRAPH_CHEOPS_OFFSET_PROG_LD_PTR, parameter);
+            break;
+        case NV097_SET_TRANSFORM_PROGRAM_START:
+            assert(parameter < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_C],
+                NV_PGRAPH_CSV0_C_CHEOPS_PROGRAM_START, parameter);
+            m_PGRAPH.program_data_dirty = true;
+            break;
+        case NV097_SET_TRANSFORM_CONSTANT_LOAD:
+            assert(parameter < NV2A_VERTEXSHADER_CONSTANTS);
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CHEOPS_OFFSET],
+                NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, parameter);
+            break;
+        case NV097_SET_TRANSFORM_EXECUTION_MODE:
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_MODE,
+                GET_MASK(parameter, NV097_SET_TRANSFORM_EXECUTION_MODE_MODE));
+            SET_MASK(m_PGRAPH.regs[NV_PGRAPH_CSV0_D], NV_PGRAPH_CSV0_D_RANGE_MODE,
+                GET_MASK(parameter, NV097_SET_TRANSFORM_EXECUTION_MODE_RANGE_MODE));
+            break;
+        case NV097_SET_TRANSFORM_PROGRAM_CXT_WRITE_EN:
+            m_PGRAPH.enable_vertex_program_write = parameter;
+            break;
+
+        case NV097_SET_BEGIN_END:
+            if (parameter == NV097_SET_BEGIN_END_OP_END) {
+                pgraph_draw();
+            }
+            else {
+                m_PGRAPH.primitive_mode = parameter;
+                m_PGRAPH.inline_array_length = 0;
+                m_PGRAPH.inline_elements_length = 0;
+                m_PGRAPH.inline_buffer_length = 0;
+                m_PGRAPH.draw_arrays_length = 0;
+                m_PGRAPH.draw_arrays_max_count = 0;
             }
+            break;
+        case NV097_ARRAY_ELEMENT16:
+        case NV097_ARRAY_ELEMENT32:
+            pgraph_push_array_elements(method, parameter);
+            break;
+        case NV097_DRAW_ARRAYS:
+        {
+            unsigned int start = GET_MASK(parameter, NV097_DRAW_ARRAYS_START_INDEX);
+            unsigned int count = GET_MASK(parameter, NV097_DRAW_ARRAYS_COUNT) + 1;
+            unsigned int length = m_PGRAPH.draw_arrays_length;
 
-            if (method >= NV097_SET_PROJECTION_MATRIX && method <= NV097_SET_PROJECTION_MATRIX + 0x3c) {
-                slot = (method - NV097_SET_PROJECTION_MATRIX) / 4;
-                // pg->projection_matrix[slot] = *(float*)&parameter;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_PMAT0 + slot / 4;
-                m_PGRAPH.vsh_constants[row][slot % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
-                break;
+            // Merge ranges that continue the previous one
+            if (length > 0 && m_PGRAPH.draw_arrays_start[length - 1] + m_PGRAPH.draw_arrays_count[length - 1] == start) {
+                m_PGRAPH.draw_arrays_count[length - 1] += count;
             }
+            else if (length < ARRAY_SIZE(m_PGRAPH.draw_arrays_start)) {
+                m_PGRAPH.draw_arrays_start[length] = start;
+                m_PGRAPH.draw_arrays_count[length] = count;
+                m_PGRAPH.draw_arrays_length++;
+            }
+            else {
+                log_warning("EmuNV2A: Too many draw arrays, dropping %u vertices\n", count);
+            }
+            m_PGRAPH.draw_arrays_max_count = std::max(m_PGRAPH.draw_arrays_max_count, start + count);
+            break;
+        }
 
-            if (method >= NV097_SET_MODEL_VIEW_MATRIX && method <= NV097_SET_MODEL_VIEW_MATRIX + 0xfc) {
-                slot = (method - NV097_SET_MODEL_VIEW_MATRIX) / 4;
-                unsigned int matnum = slot / 16;
-                unsigned int entry = slot % 16;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_MMAT0 + matnum * 8 + entry / 4;
-                m_PGRAPH.vsh_constants[row][entry % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
+        case NV097_SET_ZSTENCIL_CLEAR_VALUE:
+            m_PGRAPH.regs[NV_PGRAPH_ZSTENCILCLEARVALUE] = parameter;
+            break;
+        case NV097_SET_COLOR_CLEAR_VALUE:
+            m_PGRAPH.regs[NV_PGRAPH_COLORCLEARVALUE] = parameter;
+            break;
+        case NV097_SET_CLEAR_RECT_HORIZONTAL:
+            m_PGRAPH.regs[NV_PGRAPH_CLEARRECTX] = parameter;
+            break;
+        case NV097_SET_CLEAR_RECT_VERTICAL:
+            m_PGRAPH.regs[NV_PGRAPH_CLEARRECTY] = parameter;
+            break;
+        case NV097_CLEAR_SURFACE:
+            pgraph_clear_surface(parameter);
+            break;
+        default:
+            if (method >= NV097_SET_VERTEX_DATA_ARRAY_OFFSET && method <= NV097_SET_VERTEX_DATA_ARRAY_OFFSET + 60) {
+                slot = (method - NV097_SET_VERTEX_DATA_ARRAY_OFFSET) / 4;
+                VertexAttribute& attribute = m_PGRAPH.vertex_attributes[slot];
+                attribute.dma_select = parameter & 0x80000000;
+                attribute.offset = parameter & 0x7FFFFFFF;
                 break;
             }
 
-            if (method >= NV097_SET_INVERSE_MODEL_VIEW_MATRIX && method <= NV097_SET_INVERSE_MODEL_VIEW_MATRIX + 0xfc) {
-                slot = (method - NV097_SET_INVERSE_MODEL_VIEW_MATRIX) / 4;
-                unsigned int matnum = slot / 16;
-                unsigned int entry = slot % 16;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_IMMAT0 + matnum * 8 + entry / 4;
-                m_PGRAPH.vsh_constants[row][entry % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
+            if (method >= NV097_SET_VERTEX_DATA_ARRAY_FORMAT && method <= NV097_SET_VERTEX_DATA_ARRAY_FORMAT + 60) {
+                slot = (method - NV097_SET_VERTEX_DATA_ARRAY_FORMAT) / 4;
+                VertexAttribute& attribute = m_PGRAPH.vertex_attributes[slot];
+                attribute.format = GET_MASK(parameter, NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE);
+                attribute.size = GET_MASK(parameter, NV097_SET_VERTEX_DATA_ARRAY_FORMAT_SIZE);
+                attribute.stride = GET_MASK(parameter, NV097_SET_VERTEX_DATA_ARRAY_FORMAT_STRIDE);
                 break;
             }
 
-            if (method >= NV097_SET_COMPOSITE_MATRIX && method <= NV097_SET_COMPOSITE_MATRIX + 0x3c) {
-                slot = (method - NV097_SET_COMPOSITE_MATRIX) / 4;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_CMAT0 + slot / 4;
-                m_PGRAPH.vsh_constants[row][slot % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
+            if (method >= NV097_SET_VERTEX_DATA4UB && method <= NV097_SET_VERTEX_DATA4UB + 60) {
+                slot = (method - NV097_SET_VERTEX_DATA4UB) / 4;
+                float *value = m_PGRAPH.vertex_attributes[slot].inline_value;
+                for (int i = 0; i < 4; i++) {
+                    value[i] = ((parameter >> (i * 8)) & 0xFF) / 255.0f;
+                }
                 break;
             }
 
-            if (method >= NV097_SET_TEXTURE_MATRIX && method <= NV097_SET_TEXTURE_MATRIX + 0xfc) {
-                slot = (method - NV097_SET_TEXTURE_MATRIX) / 4;
-                unsigned int tex = slot / 16;
-                unsigned int entry = slot % 16;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_T0MAT + tex * 8 + entry / 4;
-                m_PGRAPH.vsh_constants[row][entry % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
+            if (method >= NV097_SET_COMBINER_ALPHA_ICW && method <= NV097_SET_COMBINER_ALPHA_ICW + 28) {
+                slot = (method - NV097_SET_COMBINER_ALPHA_ICW) / 4;
+                m_PGRAPH.regs[NV_PGRAPH_COMBINEALPHAI0 + slot * 4] = parameter;
                 break;
             }
 
@@ -2101,17 +2795,6 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 break;
             }
 
-            /* Handles NV097_SET_TEXGEN_PLANE_S,T,R,Q */
-            if (method >= NV097_SET_TEXGEN_PLANE_S && method <= NV097_SET_TEXGEN_PLANE_S + 0xfc) {
-                slot = (method - NV097_SET_TEXGEN_PLANE_S) / 4;
-                unsigned int tex = slot / 16;
-                unsigned int entry = slot % 16;
-                unsigned int row = NV_IGRAPH_XF_XFCTX_TG0MAT + tex * 8 + entry / 4;
-                m_PGRAPH.vsh_constants[row][entry % 4] = parameter;
-                m_PGRAPH.vsh_constants_dirty[row] = true;
-                break;
-            }
-
             if (method >= NV097_SET_FOG_PLANE && method <= NV097_SET_FOG_PLANE + 12) {
                 slot = (method - NV097_SET_FOG_PLANE) / 4;
                 m_PGRAPH.vsh_constants[NV_IGRAPH_XF_XFCTX_FOG][slot] = parameter;
@@ -2165,6 +2848,18 @@ void NV2ADevice::pgraph_method(unsigned int subchannel, unsigned int method, uin
                 break;
             }
 
+            if (method >= NV097_SET_COMBINER_COLOR_OCW && method <= NV097_SET_COMBINER_COLOR_OCW + 28) {
+                slot = (method - NV097_SET_COMBINER_COLOR_OCW) / 4;
+                m_PGRAPH.regs[NV_PGRAPH_COMBINECOLORO0 + slot * 4] = parameter;
+                break;
+            }
+
+            if (method >= NV097_SET_SPECULAR_FOG_FACTOR && method <= NV097_SET_SPECULAR_FOG_FACTOR + 4) {
+                slot = (method - NV097_SET_SPECULAR_FOG_FACTOR) / 4;
+                m_PGRAPH.regs[NV_PGRAPH_SPECFOGFACTOR0 + slot * 4] = parameter;
+                break;
+            }
+
             if (method >= NV097_SET_VIEWPORT_SCALE && method <= NV097_SET_VIEWPORT_SCALE + 12) {
                 slot = (method - NV097_SET_VIEWPORT_SCALE) / 4;
                 m_PGRAPH.vsh_constants[NV_IGRAPH_XF_XFCTX_VPSCL][slot] = parameter;
@@ -2187,7 +2882,7 @@ void NV2ADevice::pfifo_run_pusher() {
     uint8_t channel_id;
     ChannelControl *control;
     Cache1State *state;
-    //CacheEntry *command;
+    CacheEntry command;
     uint8_t *dma;
     uint32_t dma_len;
     uint32_t word;
@@ -2212,7 +2907,10 @@ void NV2ADevice::pfifo_run_pusher() {
     /* We're running so there should be no pending errors... */
     assert(state->error == NV_PFIFO_CACHE1_DMA_STATE_ERROR_NONE);
 
-    dma = (uint8_t*)nv_dma_map(state->dma_instance, &dma_len);
+    dma = (uint8_t*)nv_dma_map(state->dma_instance, &dma_len, cpu::CPU_MEM_ACCESS_READ);
+    if (dma == nullptr) {
+        dma_len = 0;
+    }
 
     log_debug("DMA pusher: max 0x%08X, 0x%08X - 0x%08X\n",
         dma_len, control->dma_get, control->dma_put);
@@ -2226,22 +2924,29 @@ void NV2ADevice::pfifo_run_pusher() {
         }
 
         word = ldl_le_p((uint32_t*)(dma + control->dma_get));
-        control->dma_get += 4;
 
         if (state->method_count) {
             /* data word of methods command */
+            command.method = state->method;
+            command.subchannel = state->subchannel;
+            command.nonincreasing = state->method_nonincreasing;
+            command.parameter = word;
+
+            if (!state->cache.Stage(command)) {
+                // Hand the full queue over to the puller and resume from this
+                // word once it makes room. The queue is checked again after
+                // flagging the stall in case the puller drained it meanwhile.
+                pfifo_publish_commands();
+                m_PFIFO.pusher_stalled = true;
+                if (state->cache.IsFull()) {
+                    break;
+                }
+                m_PFIFO.pusher_stalled = false;
+                continue;
+            }
+            control->dma_get += 4;
             state->data_shadow = word;
 
-            CacheEntry* command = (CacheEntry*)calloc(1, sizeof(CacheEntry));
-            command->method = state->method;
-            command->subchannel = state->subchannel;
-            command->nonincreasing = state->method_nonincreasing;
-            command->parameter = word;
-
-            std::lock_guard<std::mutex> lk(state->mutex);
-            state->cache.push(command);
-            state->cache_cond.notify_all();
-
             if (!state->method_nonincreasing) {
                 state->method += 4;
             }
@@ -2251,6 +2956,7 @@ void NV2ADevice::pfifo_run_pusher() {
         }
         else {
             /* no command active - this is the first word of a new one */
+            control->dma_get += 4;
             state->rsvd_shadow = word;
             /* match all forms */
             if ((word & 0xe0000003) == 0x20000000) {
@@ -2311,6 +3017,8 @@ void NV2ADevice::pfifo_run_pusher() {
         }
     }
 
+    pfifo_publish_commands();
+
     log_debug("DMA pusher done: max 0x%08X, 0x%08X - 0x%08X\n",
         dma_len, control->dma_get, control->dma_put);
 
@@ -2325,40 +3033,112 @@ void NV2ADevice::pfifo_run_pusher() {
     }
 }
 
+// Makes the commands fetched by the pusher visible to the puller, waking it
+// up if it ran out of commands
+void NV2ADevice::pfifo_publish_commands() {
+    Cache1State *state = &m_PFIFO.cache1;
+    if (state->cache.Publish()) {
+        std::lock_guard<std::mutex> lk(state->mutex);
+        state->cache_cond.notify_one();
+    }
+}
+
+// Must be called with the device lock held
+void NV2ADevice::pfifo_kick_pusher() {
+    m_PFIFO.pusher_kicked = true;
+    m_PFIFO.pusher_cond.notify_one();
+}
+
+void NV2ADevice::PFIFO_Pusher_Thread(NV2ADevice *nv2a) {
+    Thread_SetName("[HW] NV2A PFIFO Pusher");
+
+    std::unique_lock<std::mutex> lk(nv2a->m_deviceLock);
+    while (nv2a->m_running) {
+        nv2a->m_PFIFO.pusher_cond.wait(lk, [nv2a] { return nv2a->m_PFIFO.pusher_kicked || !nv2a->m_running; });
+        if (!nv2a->m_running) {
+            break;
+        }
+
+        // Kicks received while the pusher runs are covered by this run, since
+        // it fetches commands until DMA_GET reaches the latest DMA_PUT
+        nv2a->m_PFIFO.pusher_kicked = false;
+        nv2a->pfifo_run_pusher();
+    }
+}
+
 void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
     Thread_SetName("[HW] NV2A PFIFO Puller");
 
     Cache1State *state = &nv2a->m_PFIFO.cache1;
+    CacheEntry commands[256];
+    uint32_t parameters[256];
     while (nv2a->m_running) {
         // Scope the lock so that it automatically unlocks at tne end of this block
         {
             std::unique_lock<std::mutex> lk(state->mutex);
+            state->cache_cond.wait(lk, [nv2a, state] {
+                return !nv2a->m_running || (!state->cache.IsEmpty() && state->pull_enabled);
+            });
+            if (!nv2a->m_running) {
+                break;
+            }
+        }
 
-            while (state->cache.empty() || !state->pull_enabled) {
-                state->cache_cond.wait(lk);
-                if (!nv2a->m_running) {
+        uint32_t count = state->cache.PopBulk(commands, sizeof(commands) / sizeof(commands[0]));
+
+        // Let the pusher resume if it was waiting for room in the queue
+        if (nv2a->m_PFIFO.pusher_stalled.exchange(false)) {
+            std::lock_guard<std::mutex> devLk(nv2a->m_deviceLock);
+            nv2a->pfifo_kick_pusher();
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            CacheEntry *command = &commands[i];
+
+            // Gather the parameters of a run of methods on the same
+            // subchannel, as produced by a single method header. Methods that
+            // take objects are translated one at a time below.
+            if (command->method >= 0x200) {
+                uint32_t length = 1;
+                parameters[0] = command->parameter;
+                for (uint32_t j = i + 1; j < count; j++) {
+                    CacheEntry *next = &commands[j];
+                    uint32_t expected = command->nonincreasing ? command->method
+                        : command->method + length * 4;
+                    if (next->subchannel != command->subchannel
+                        || next->nonincreasing != command->nonincreasing
+                        || next->method != expected) {
+                        break;
+                    }
+                    parameters[length++] = next->parameter;
+                }
+
+                enum FIFOEngine engine = state->bound_engines[command->subchannel];
+                switch (engine) {
+                case ENGINE_GRAPHICS:
+                    nv2a->pgraph_wait_fifo_access();
+                    nv2a->pgraph_methods(command->subchannel, command->method,
+                        parameters, length, command->nonincreasing);
+                    break;
+                default:
+                    assert(false);
                     break;
                 }
-            }
 
-            // Copy cache to working_cache
-            while (!state->cache.empty()) {
-                state->working_cache.push(state->cache.front());
-                state->cache.pop();
+                state->last_engine = engine;
+                i += length - 1;
+                continue;
             }
-        }
-
-        while (!state->working_cache.empty()) {
-            CacheEntry* command = state->working_cache.front();
-            state->working_cache.pop();
 
             if (command->method == 0) {
-                // qemu_mutex_lock_iothread();
-                RAMHTEntry entry = nv2a->ramht_lookup(command->parameter);
+                RAMHTEntry entry;
+                {
+                    std::lock_guard<std::mutex> devLk(nv2a->m_deviceLock);
+                    entry = nv2a->ramht_lookup(command->parameter);
+                }
                 assert(entry.valid);
 
                 assert(entry.channel_id == state->channel_id);
-                // qemu_mutex_unlock_iothread();
 
                 switch (entry.engine) {
                 case ENGINE_GRAPHICS:
@@ -2384,12 +3164,14 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
                 /* methods that take objects.
                 * TODO: Check this range is correct for the nv2a */
                 if (command->method >= 0x180 && command->method < 0x200) {
-                    //qemu_mutex_lock_iothread();
-                    RAMHTEntry entry = nv2a->ramht_lookup(parameter);
+                    RAMHTEntry entry;
+                    {
+                        std::lock_guard<std::mutex> devLk(nv2a->m_deviceLock);
+                        entry = nv2a->ramht_lookup(parameter);
+                    }
                     assert(entry.valid);
                     assert(entry.channel_id == state->channel_id);
                     parameter = entry.instance;
-                    //qemu_mutex_unlock_iothread();
                 }
 
                 // qemu_mutex_lock(&state->cache_lock);
@@ -2410,8 +3192,6 @@ void NV2ADevice::PFIFO_Puller_Thread(NV2ADevice *nv2a) {
                 state->last_engine = state->bound_engines[command->subchannel];
                 // qemu_mutex_unlock(&state->cache_lock);
             }
-
-            free(command);
         }
     }
 }
@@ -2453,23 +3233,26 @@ void NV2ADevice::UpdateIRQ() {
     }
 }
 
-void NV2ADevice::VBlankThread(NV2ADevice *nv2a) {
-    Thread_SetName("[HW] NV2A VBlank");
-
-    using namespace std::chrono;
-    auto nextStop = high_resolution_clock::now();
-    auto interval = duration<long long, std::ratio<1, 1000000>>((long long)(1000000.0f / 60.0f));
+void NV2ADevice::VBlankTimerCB(void *userData) {
+    NV2ADevice *nv2a = (NV2ADevice *)userData;
+    std::lock_guard<std::mutex> lk(nv2a->m_deviceLock);
+    nv2a->VBlank();
+}
 
-    while (nv2a->m_running) {
-        // TODO: wait for a condition variable instead of checking like this
-        if (nv2a->m_PCRTC.enabledInterrupts & NV_PCRTC_INTR_0_VBLANK) {
-            nv2a->m_PCRTC.pendingInterrupts |= NV_PCRTC_INTR_0_VBLANK;
-            nv2a->UpdateIRQ();
-        }
+void NV2ADevice::VBlank() {
+    if (m_PCRTC.enabledInterrupts & NV_PCRTC_INTR_0_VBLANK) {
+        m_PCRTC.pendingInterrupts |= NV_PCRTC_INTR_0_VBLANK;
+        UpdateIRQ();
+    }
 
-        nextStop += interval;
-        std::this_thread::sleep_until(nextStop);
+    // Keep a steady refresh rate, but don't try to catch up if the host fell
+    // behind
+    uint64_t now = m_scheduler.Now();
+    uint64_t deadline = m_vblankTimer->GetDeadline() + kVBlankInterval;
+    if (deadline <= now) {
+        deadline = now + kVBlankInterval;
     }
+    m_vblankTimer->Schedule(deadline);
 }
 
 }
@@ -1,18 +1,23 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 
 #include "../defs.h"
 #include "pci.h"
 #include "../nv2a/defs.h"
+#include "../nv2a/rasterizer.h"
+#include "../nv2a/vsh.h"
 #include "../nv2a/vga.h"
 #include "../basic/irq.h"
+#include "vixen/cpu.h"
+#include "vixen/scheduler.h"
 
 namespace vixen {
 
 class NV2ADevice : public PCIDevice {
 public:
-    NV2ADevice(uint8_t *pSystemRAM, uint32_t systemRAMSize, IRQHandler& irqHandler);
+    NV2ADevice(cpu::Cpu& cpu, uint8_t *pSystemRAM, uint32_t systemRAMSize, IRQHandler& irqHandler, Scheduler& scheduler, uint32_t rasterThreads);
     
     virtual ~NV2ADevice();
 
@@ -96,10 +101,23 @@ private:
     void pgraph_set_context_user(uint32_t value);
     void pgraph_context_switch(unsigned int channel_id);
     void pgraph_wait_fifo_access();
-    void pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter);
+    void pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter, uint32_t count);
     void pgraph_method(unsigned int subchannel, unsigned int method, uint32_t parameter);
+    void pgraph_methods(unsigned int subchannel, unsigned int method, const uint32_t *parameters, uint32_t count, bool nonincreasing);
+    void pgraph_method_locked(unsigned int subchannel, unsigned int method, uint32_t parameter);
+    uint32_t pgraph_kelvin_methods(unsigned int method, const uint32_t *parameters, uint32_t count, bool nonincreasing);
+    void pgraph_push_array_elements(unsigned int method, uint32_t parameter);
+    uint32_t pgraph_load_matrices(unsigned int row, unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing);
+    uint32_t pgraph_load_transform_program(unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing);
+    uint32_t pgraph_load_transform_constants(unsigned int slot, const uint32_t *parameters, uint32_t count, bool nonincreasing);
     bool pgraph_color_write_enabled();
     bool pgraph_zeta_write_enabled();
+    bool pgraph_get_raster_state(RasterState *state);
+    void pgraph_get_combiners(RasterState *state);
+    void pgraph_queue_vertex(const float attributes[NV2A_VERTEXSHADER_ATTRIBUTES][4]);
+    void pgraph_flush_vertices();
+    void pgraph_draw();
+    void pgraph_clear_surface(uint32_t parameter);
 
     unsigned int kelvin_map_stencil_op(uint32_t parameter);
     unsigned int kelvin_map_polygon_mode(uint32_t parameter);
@@ -109,18 +127,25 @@ private:
     GraphicsObject* lookup_graphics_object(uint32_t instance_address);
 
     DMAObject nv_dma_load(uint32_t dma_obj_address);
-    void *nv_dma_map(uint32_t dma_obj_address, uint32_t *len);
+    void *nv_dma_map(uint32_t dma_obj_address, uint32_t *len, cpu::CPUMemAccess access);
+    void *nv_dma_map_range(uint32_t dma_obj_address, uint64_t offset, uint64_t size, cpu::CPUMemAccess access);
 
     void pfifo_run_pusher();
+    void pfifo_publish_commands();
+    void pfifo_kick_pusher();
 
     static void PFIFO_Puller_Thread(NV2ADevice* pNV2a);
-    static void VBlankThread(NV2ADevice* pNV2A);
+    static void PFIFO_Pusher_Thread(NV2ADevice* pNV2a);
+    static void VBlankTimerCB(void *userData);
+    void VBlank();
 
     void UpdateIRQ();
 
+    cpu::Cpu& m_cpu;
     uint8_t *m_pSystemRAM;
     uint32_t m_systemRAMSize;
     IRQHandler& m_irqHandler;
+    Scheduler& m_scheduler;
 
     uint8_t* m_pRAMIN = nullptr;
     uint8_t* m_VRAM = nullptr;
@@ -137,9 +162,25 @@ private:
 
     VGACommonState m_VGAState;
 
-    bool m_running;
+    // Renders PGRAPH's 3D primitives. Only used with the PGRAPH lock held.
+    Rasterizer m_rasterizer;
+    std::vector<RasterVertex> m_drawVertices;
+
+    // Transforms vertices for the rasterizer, a batch at a time. Only used
+    // with the PGRAPH lock held.
+    VshEngine m_vsh;
+    const VshProgram *m_vshProgram = nullptr;
+    VshInputs m_vshInputs[64];
+    VshOutputs m_vshOutputs[64];
+    uint32_t m_vshQueued = 0;
+
+    // Register combiner kernels for the rasterizer. Only used with the PGRAPH
+    // lock held.
+    CombinerCache m_combiners;
+
+    std::atomic<bool> m_running;
     std::vector<NV2ABlockInfo> m_MemoryRegions;
-    std::thread m_VblankThread;
+    ScheduledTimer *m_vblankTimer;
 };
 
 }
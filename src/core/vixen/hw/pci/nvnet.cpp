@@ -262,7 +262,7 @@ struct NvNetState {
     uint8_t      txrx_dma_buf[RX_ALLOC_BUFSIZE];
     FILE         *packet_dump_file;
     char         *packet_dump_path;
-} NvNetState;
+};
 
 struct RingDesc {
     uint32_t packet_buffer;
@@ -329,36 +329,36 @@ const char* EmuNVNet_GetMiiRegisterName(uint8_t reg) {
     }
 }
 
-uint32_t EmuNVNet_GetRegister(uint32_t addr, unsigned int size) {
+uint32_t NVNetDevice::GetRegister(uint32_t addr, unsigned int size) {
     switch (size) {
     case sizeof(uint32_t) :
-        return ((uint32_t *)NvNetState.regs)[addr >> 2];
+        return ((uint32_t *)m_state->regs)[addr >> 2];
     case sizeof(uint16_t) :
-        return ((uint16_t *)NvNetState.regs)[addr >> 1];
+        return ((uint16_t *)m_state->regs)[addr >> 1];
     case sizeof(uint8_t) :
-        return NvNetState.regs[addr];
+        return m_state->regs[addr];
     }
 
     return 0;
 }
 
-void EmuNVNet_SetRegister(uint32_t addr, uint32_t value, unsigned int size) {
+void NVNetDevice::SetRegister(uint32_t addr, uint32_t value, unsigned int size) {
     switch (size) {
     case sizeof(uint32_t) :
-        ((uint32_t *)NvNetState.regs)[addr >> 2] = value;
+        ((uint32_t *)m_state->regs)[addr >> 2] = value;
         break;
     case sizeof(uint16_t) :
-        ((uint16_t *)NvNetState.regs)[addr >> 1] = (uint16_t)value;
+        ((uint16_t *)m_state->regs)[addr >> 1] = (uint16_t)value;
         break;
     case sizeof(uint8_t) :
-        NvNetState.regs[addr] = (uint8_t)value;
+        m_state->regs[addr] = (uint8_t)value;
         break;
     }
 }
 
-void EmuNVNet_UpdateIRQ() {
-    if (EmuNVNet_GetRegister(NvRegIrqMask, 4) &&
-        EmuNVNet_GetRegister(NvRegIrqStatus, 4)) {
+void NVNetDevice::UpdateIRQ() {
+    if (GetRegister(NvRegIrqMask, 4) &&
+        GetRegister(NvRegIrqStatus, 4)) {
         log_debug("EmuNVNet: Asserting IRQ\n");
         // TODO: HalSystemInterrupts[4].Assert(true);
     }
@@ -367,12 +367,12 @@ void EmuNVNet_UpdateIRQ() {
     }
 }
 
-int EmuNVNet_MiiReadWrite(uint64_t val) {
+int NVNetDevice::MiiReadWrite(uint64_t val) {
     uint32_t mii_ctl;
     int write, retval, phy_addr, reg;
 
     retval = 0;
-    mii_ctl = EmuNVNet_GetRegister(NvRegMIIControl, 4);
+    mii_ctl = GetRegister(NvRegMIIControl, 4);
 
     phy_addr = (mii_ctl >> NVREG_MIICTL_ADDRSHIFT) & 0x1f;
     reg = mii_ctl & ((1 << NVREG_MIICTL_ADDRSHIFT) - 1);
@@ -407,30 +407,30 @@ int EmuNVNet_MiiReadWrite(uint64_t val) {
     return retval;
 }
 
-uint32_t EmuNVNet_Read(uint32_t addr, int size) {
+uint32_t NVNetDevice::Read(uint32_t addr, int size) {
     //log_debug("NET : Read%d: %s (0x%.8X)\n", size, EmuNVNet_GetRegisterName(addr), addr);
 
     switch (addr) {
     case NvRegMIIData:
-        return EmuNVNet_MiiReadWrite(MII_READ);
+        return MiiReadWrite(MII_READ);
     case NvRegMIIControl:
-        return EmuNVNet_GetRegister(addr, size) & ~NVREG_MIICTL_INUSE;
+        return GetRegister(addr, size) & ~NVREG_MIICTL_INUSE;
     case NvRegMIIStatus:
         return 0;
     }
 
-    return EmuNVNet_GetRegister(addr, size);
+    return GetRegister(addr, size);
 }
 
-void EmuNVNet_Write(uint32_t addr, uint32_t value, int size) {
+void NVNetDevice::Write(uint32_t addr, uint32_t value, int size) {
     switch (addr) {
     case NvRegRingSizes:
-        EmuNVNet_SetRegister(addr, value, size);
-        NvNetState.rx_ring_size = ((value >> NVREG_RINGSZ_RXSHIFT) & 0xffff) + 1;
-        NvNetState.tx_ring_size = ((value >> NVREG_RINGSZ_TXSHIFT) & 0xffff) + 1;
+        SetRegister(addr, value, size);
+        m_state->rx_ring_size = ((value >> NVREG_RINGSZ_RXSHIFT) & 0xffff) + 1;
+        m_state->tx_ring_size = ((value >> NVREG_RINGSZ_TXSHIFT) & 0xffff) + 1;
         break;
     case NvRegMIIData:
-        EmuNVNet_MiiReadWrite(value);
+        MiiReadWrite(value);
         break;
     case NvRegTxRxControl:
         if (value == NVREG_TXRXCTL_KICK) {
@@ -440,35 +440,35 @@ void EmuNVNet_Write(uint32_t addr, uint32_t value, int size) {
         }
 
         if (value & NVREG_TXRXCTL_BIT2) {
-            EmuNVNet_SetRegister(NvRegTxRxControl, NVREG_TXRXCTL_IDLE, 4);
+            SetRegister(NvRegTxRxControl, NVREG_TXRXCTL_IDLE, 4);
             break;
         }
 
         if (value & NVREG_TXRXCTL_BIT1) {
-            EmuNVNet_SetRegister(NvRegIrqStatus, 0, 4);
+            SetRegister(NvRegIrqStatus, 0, 4);
             break;
         }
         else if (value == 0) {
-            uint32_t temp = EmuNVNet_GetRegister(NvRegUnknownSetupReg3, 4);
+            uint32_t temp = GetRegister(NvRegUnknownSetupReg3, 4);
             if (temp == NVREG_UNKSETUP3_VAL1) {
                 /* forcedeth waits for this bit to be set... */
-                EmuNVNet_SetRegister(NvRegUnknownSetupReg5,
+                SetRegister(NvRegUnknownSetupReg5,
                     NVREG_UNKSETUP5_BIT31, 4);
                 break;
             }
         }
-        EmuNVNet_SetRegister(NvRegTxRxControl, value, size);
+        SetRegister(NvRegTxRxControl, value, size);
         break;
     case NvRegIrqMask:
-        EmuNVNet_SetRegister(addr, value, size);
-        EmuNVNet_UpdateIRQ();
+        SetRegister(addr, value, size);
+        UpdateIRQ();
         break;
     case NvRegIrqStatus:
-        EmuNVNet_SetRegister(addr, EmuNVNet_GetRegister(addr, size) & ~value, size);
-        EmuNVNet_UpdateIRQ();
+        SetRegister(addr, GetRegister(addr, size) & ~value, size);
+        UpdateIRQ();
         break;
     default:
-        EmuNVNet_SetRegister(addr, value, size);
+        SetRegister(addr, value, size);
         break;
     }
 
@@ -481,9 +481,11 @@ NVNetDevice::NVNetDevice()
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, PCI_VENDOR_ID_NVIDIA, 0x01C3, 0xD2,
         0x02, 0x00, 0x00) // Ethernet controller
 {
+    m_state = new NvNetState();
 }
 
 NVNetDevice::~NVNetDevice() {
+    delete m_state;
 }
 
 // PCI Device functions
@@ -526,7 +528,7 @@ void NVNetDevice::PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint
         return;
     }
 
-    *value = EmuNVNet_Read(addr, size * 8); // For now, forward
+    *value = Read(addr, size * 8); // For now, forward
     return;
 }
 
@@ -537,7 +539,7 @@ void NVNetDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint
         return;
     }
 
-    EmuNVNet_Write(addr, value, size * 8); // For now, forward
+    Write(addr, value, size * 8); // For now, forward
 }
 
 }
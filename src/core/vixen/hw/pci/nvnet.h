@@ -4,6 +4,8 @@
 
 namespace vixen {
 
+struct NvNetState;
+
 #define NVNET_ADDR  0xFEF00000 
 #define NVNET_SIZE  0x00000400
 
@@ -20,6 +22,17 @@ public:
     void PCIIOWrite(int barIndex, uint32_t port, uint32_t value, uint8_t size) override;
     void PCIMMIORead(int barIndex, uint32_t addr, uint32_t *value, uint8_t size) override;
     void PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_t size) override;
+
+private:
+    uint32_t GetRegister(uint32_t addr, unsigned int size);
+    void SetRegister(uint32_t addr, uint32_t value, unsigned int size);
+    void UpdateIRQ();
+    int MiiReadWrite(uint64_t val);
+
+    uint32_t Read(uint32_t addr, int size);
+    void Write(uint32_t addr, uint32_t value, int size);
+
+    NvNetState *m_state;
 };
 
 }
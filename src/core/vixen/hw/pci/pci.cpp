@@ -27,6 +27,7 @@
  */
 #include "pci.h"
 #include "../bus/pcibus.h"
+#include "../utils.h"
 #include "vixen/log.h"
 
 #include <cassert>
@@ -45,6 +46,12 @@ PCIDevice::PCIDevice(uint8_t type, uint16_t vendorID, uint16_t deviceID,
 
     m_bus = nullptr;
     m_irqState = 0;
+    m_deviceLockEnabled = false;
+
+    for (uint8_t i = 0; i < PCI_NUM_BARS_DEVICE; i++) {
+        m_BARDevices[i].m_device = this;
+        m_BARDevices[i].m_index = i;
+    }
 
     Write8(m_configSpace, PCI_HEADER_TYPE, type);
     Write16(m_configSpace, PCI_VENDOR_ID, vendorID);
@@ -129,88 +136,144 @@ PCIDevice::PCIDevice(uint8_t type, uint16_t vendorID, uint16_t deviceID,
 PCIDevice::~PCIDevice() {
 }
 
-bool PCIDevice::GetIOBar(uint32_t port, uint8_t* barIndex, uint32_t *baseAddress) {
-    uint8_t headerType = m_configSpace[PCI_HEADER_TYPE];
-    uint8_t numBARs;
+uint8_t PCIDevice::GetNumBARs() {
+    uint8_t headerType = Read8(m_configSpace, PCI_HEADER_TYPE);
 
     switch (headerType) {
-    case PCI_HEADER_TYPE_NORMAL: {
-        numBARs = PCI_NUM_BARS_DEVICE;
-        break;
+    case PCI_HEADER_TYPE_NORMAL: return PCI_NUM_BARS_DEVICE;
+    case PCI_HEADER_TYPE_BRIDGE: return PCI_NUM_BARS_PCI_BRIDGE;
+    default:
+        log_warning("PCIDevice::GetNumBARs: Invalid device type 0x%x\n", headerType);
+        return 0;
     }
-    case PCI_HEADER_TYPE_BRIDGE: {
-        numBARs = PCI_NUM_BARS_PCI_BRIDGE;
-        break;
+}
+
+uint32_t PCIDevice::GetBARAddress(int index) {
+    uint32_t size = m_BARSizes[index];
+    if (size == 0) {
+        return PCI_BAR_UNMAPPED;
     }
-    default: {
-        log_warning("PCIDevice::GetIOBar: Invalid device type 0x%x\n", headerType);
-        return false;
+
+    uint32_t barValue = Read32(m_configSpace, PCI_BASE_ADDRESS_0 + index * sizeof(PCIBarRegister));
+    PCIBarRegister *bar = reinterpret_cast<PCIBarRegister *>(&barValue);
+
+    uint32_t barAddr;
+    uint64_t limit;
+    if ((bar->Raw.type & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_IO) {
+        barAddr = bar->IO.address << 2;
+        limit = IO_PORT_COUNT - 1;
+    }
+    else {
+        barAddr = bar->Memory.address << 4;
+        // Treat BARs that reach the top of the address space as unmapped.
+        // Guests write all ones to BARs in order to size them.
+        limit = 0xFFFFFFFEULL;
+    }
+
+    // Address 0 means the BAR has not been assigned yet
+    if (barAddr == 0 || (uint64_t)barAddr + size - 1 > limit) {
+        return PCI_BAR_UNMAPPED;
     }
+    return barAddr;
+}
+
+void PCIDevice::UpdateBARMappings() {
+    if (m_bus == nullptr || m_bus->m_ioMapper == nullptr) {
+        return;
     }
+    IOMapper *mapper = m_bus->m_ioMapper;
 
+    uint8_t numBARs = GetNumBARs();
     for (uint8_t i = 0; i < numBARs; i++) {
-        if (m_BARSizes[i] == 0) {
+        PCIBarIODevice& barDev = m_BARDevices[i];
+        uint32_t newAddr = GetBARAddress(i);
+        bool isIO = (Read32(m_configSpace, PCI_BASE_ADDRESS_0 + i * sizeof(PCIBarRegister)) & PCI_BAR_TYPE_MASK) == PCI_BAR_TYPE_IO;
+        if (newAddr == barDev.m_baseAddress && isIO == barDev.m_isIO) {
             continue;
         }
-        
-        uint32_t barValue = Read32(m_configSpace, PCI_BASE_ADDRESS_0 + i * sizeof(PCIBarRegister));
-        PCIBarRegister *bar = reinterpret_cast<PCIBarRegister *>(&barValue);
-        if ((bar->Raw.type & PCI_BAR_TYPE_MASK) != PCI_BAR_TYPE_IO) {
-            // BAR is not I/O
-            continue;
+
+        // Remove the old mapping
+        if (barDev.m_baseAddress != PCI_BAR_UNMAPPED) {
+            if (barDev.m_isIO) {
+                mapper->UnmapIODevice(barDev.m_baseAddress);
+            }
+            else {
+                mapper->UnmapMMIODevice(barDev.m_baseAddress);
+            }
         }
-        
-        uint32_t barAddr = bar->IO.address << 2;
-        if (port >= barAddr && port < barAddr + m_BARSizes[i]) {
-            *barIndex = i;
-            *baseAddress = barAddr;
-            return true;
+
+        barDev.m_baseAddress = newAddr;
+        barDev.m_isIO = isIO;
+        barDev.m_size = m_BARSizes[i];
+
+        // Map the BAR to its new address
+        if (newAddr != PCI_BAR_UNMAPPED && !barDev.MapIO(mapper)) {
+            barDev.m_baseAddress = PCI_BAR_UNMAPPED;
         }
-    }
 
-    return false;
+        // Unmapping removed the posted write range and the RAM alias along
+        // with the old mapping
+        if (barDev.m_baseAddress != PCI_BAR_UNMAPPED && !barDev.m_isIO) {
+            if (barDev.m_postedSize != 0) {
+                mapper->AddPostedWriteRange(barDev.m_baseAddress + barDev.m_postedOffset, barDev.m_postedSize);
+            }
+            if (barDev.m_ramAlias != nullptr) {
+                mapper->AddRAMAlias(barDev.m_baseAddress, barDev.m_ramAliasSize, barDev.m_ramAlias);
+            }
+        }
+    }
 }
 
-bool PCIDevice::GetMMIOBar(uint32_t addr, uint8_t* barIndex, uint32_t *baseAddress) {
-    uint8_t headerType = m_configSpace[PCI_HEADER_TYPE];
-    uint8_t numBARs;
+void PCIDevice::SetBARPostedWrites(int index, uint32_t offset, uint32_t size) {
+    if (index < 0 || index >= GetNumBARs()) {
+        log_warning("PCIDevice::SetBARPostedWrites: BAR index out of bounds (%d >= %d)\n", index, GetNumBARs());
+        return;
+    }
 
-    switch (headerType) {
-    case PCI_HEADER_TYPE_NORMAL: {
-        numBARs = PCI_NUM_BARS_DEVICE;
-        break;
+    PCIBarIODevice& barDev = m_BARDevices[index];
+    if (offset + size > m_BARSizes[index] || offset + size < offset) {
+        log_warning("PCIDevice::SetBARPostedWrites: Range 0x%x+0x%x exceeds BAR %d\n", offset, size, index);
+        return;
     }
-    case PCI_HEADER_TYPE_BRIDGE: {
-        numBARs = PCI_NUM_BARS_PCI_BRIDGE;
-        break;
+
+    IOMapper *mapper = (m_bus != nullptr) ? m_bus->m_ioMapper : nullptr;
+    bool mapped = mapper != nullptr && barDev.m_baseAddress != PCI_BAR_UNMAPPED && !barDev.m_isIO;
+    if (mapped && barDev.m_postedSize != 0) {
+        mapper->RemovePostedWriteRange(barDev.m_baseAddress + barDev.m_postedOffset);
     }
-    default: {
-        log_warning("PCIDevice::GetMMIOBar: Invalid device type 0x%x\n", headerType);
-        return false;
+
+    barDev.m_postedOffset = offset;
+    barDev.m_postedSize = size;
+
+    if (mapped && size != 0) {
+        mapper->AddPostedWriteRange(barDev.m_baseAddress + offset, size);
     }
+}
+
+void PCIDevice::SetBARRAMAlias(int index, void *hostMemory, uint32_t size) {
+    if (index < 0 || index >= GetNumBARs()) {
+        log_warning("PCIDevice::SetBARRAMAlias: BAR index out of bounds (%d >= %d)\n", index, GetNumBARs());
+        return;
     }
 
-    for (uint8_t i = 0; i < numBARs; i++) {
-        if (m_BARSizes[i] == 0) {
-            continue;
-        }
-        
-        uint32_t barValue = Read32(m_configSpace, PCI_BASE_ADDRESS_0 + i * sizeof(PCIBarRegister));
-        PCIBarRegister *bar = reinterpret_cast<PCIBarRegister *>(&barValue);
-        if ((bar->Raw.type & PCI_BAR_TYPE_MASK) != PCI_BAR_TYPE_MEMORY) {
-            // BAR is not memory
-            continue;
-        }
+    PCIBarIODevice& barDev = m_BARDevices[index];
+    if (hostMemory != nullptr && (size == 0 || size > m_BARSizes[index])) {
+        log_warning("PCIDevice::SetBARRAMAlias: Size 0x%x exceeds BAR %d\n", size, index);
+        return;
+    }
 
-        uint32_t barAddr = bar->Memory.address << 4;
-        if (addr >= barAddr && addr < barAddr + m_BARSizes[i]) {
-            *barIndex = i;
-            *baseAddress = barAddr;
-            return true;
-        }
+    IOMapper *mapper = (m_bus != nullptr) ? m_bus->m_ioMapper : nullptr;
+    bool mapped = mapper != nullptr && barDev.m_baseAddress != PCI_BAR_UNMAPPED && !barDev.m_isIO;
+    if (mapped && barDev.m_ramAlias != nullptr) {
+        mapper->RemoveRAMAlias(barDev.m_baseAddress);
     }
 
-    return false;
+    barDev.m_ramAlias = hostMemory;
+    barDev.m_ramAliasSize = (hostMemory != nullptr) ? size : 0;
+
+    if (mapped && hostMemory != nullptr) {
+        mapper->AddRAMAlias(barDev.m_baseAddress, size, hostMemory);
+    }
 }
 
 bool PCIDevice::RegisterBAR(int index, uint32_t size, uint32_t type) {
@@ -268,7 +331,10 @@ void PCIDevice::WriteConfig(uint32_t reg, uint32_t value, uint8_t size) {
         m_configSpace[reg + i] &= ~(value & w1cmask); // W1C: Write 1 to Clear
     }
 
-    // TODO: handle memory mapping changes
+    if (RangesOverlap(reg, size, PCI_BASE_ADDRESS_0, GetNumBARs() * sizeof(PCIBarRegister))) {
+        UpdateBARMappings();
+    }
+
     // TODO: handle Message Signalled Interrupts
 }
 
@@ -284,6 +350,7 @@ void PCIDevice::ChangeIRQLevel(uint8_t irqNum, int change) {
         }
         dev = bus->m_owner;
     }
+    std::lock_guard<std::mutex> lk(bus->m_irqLock);
     bus->m_irqCount[irqNum] += change;
     bus->SetIRQ(irqNum, bus->m_irqCount[irqNum] != 0);
 }
@@ -315,4 +382,53 @@ void PCIDevice::PCIMMIOWrite(int barIndex, uint32_t addr, uint32_t value, uint8_
     log_spew("PCIDevice::PCIMMIOWrite: bar = %d,  address = 0x%x,  value = 0x%x,  size = %u\n", barIndex, addr, value, size);
 }
 
+void PCIDevice::EnableDeviceLock() {
+    m_deviceLockEnabled = true;
+    for (uint8_t i = 0; i < PCI_NUM_BARS_DEVICE; i++) {
+        m_BARDevices[i].SetDeviceLock(&m_deviceLock);
+    }
+}
+
+// ----- PCI BAR I/O device ---------------------------------------------------
+
+PCIBarIODevice::PCIBarIODevice()
+    : m_device(nullptr)
+    , m_index(0)
+    , m_isIO(false)
+    , m_baseAddress(PCI_BAR_UNMAPPED)
+    , m_size(0)
+    , m_postedOffset(0)
+    , m_postedSize(0)
+    , m_ramAlias(nullptr)
+    , m_ramAliasSize(0)
+{
+}
+
+bool PCIBarIODevice::MapIO(IOMapper *mapper) {
+    if (m_isIO) {
+        return mapper->MapIODevice(m_baseAddress, m_size, this);
+    }
+    return mapper->MapMMIODevice(m_baseAddress, m_size, this);
+}
+
+bool PCIBarIODevice::IORead(uint32_t port, uint32_t *value, uint8_t size) {
+    m_device->PCIIORead(m_index, port - m_baseAddress, value, size);
+    return true;
+}
+
+bool PCIBarIODevice::IOWrite(uint32_t port, uint32_t value, uint8_t size) {
+    m_device->PCIIOWrite(m_index, port - m_baseAddress, value, size);
+    return true;
+}
+
+bool PCIBarIODevice::MMIORead(uint32_t addr, uint32_t *value, uint8_t size) {
+    m_device->PCIMMIORead(m_index, addr - m_baseAddress, value, size);
+    return true;
+}
+
+bool PCIBarIODevice::MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) {
+    m_device->PCIMMIOWrite(m_index, addr - m_baseAddress, value, size);
+    return true;
+}
+
 }
@@ -1,9 +1,11 @@
 #pragma once
 
 #include <cstdint>
+#include <mutex>
 
 #include "pci_regs.h"
 #include "pci_common.h"
+#include "vixen/io.h"
 
 namespace vixen {
 
@@ -18,6 +20,8 @@ namespace vixen {
 
 #define PCI_VENDOR_ID_NVIDIA     0x10DE
 
+#define PCI_BAR_UNMAPPED         0xFFFFFFFF
+
 class PCIDevice;
 class PCIBus;
 
@@ -46,6 +50,44 @@ typedef struct {
 
 } PCIBarRegister;
 
+/*!
+ * Forwards I/O and MMIO accesses within the range decoded by one of a PCI
+ * device's Base Address Registers to the device, translating the address
+ * into an offset from the start of the BAR.
+ *
+ * PCI devices own one of these per BAR and keep them mapped in the I/O mapper
+ * as the guest reprograms the BARs.
+ */
+class PCIBarIODevice : public IODevice {
+public:
+    PCIBarIODevice();
+
+    bool MapIO(IOMapper *mapper) override;
+
+    bool IORead(uint32_t port, uint32_t *value, uint8_t size) override;
+    bool IOWrite(uint32_t port, uint32_t value, uint8_t size) override;
+
+    bool MMIORead(uint32_t addr, uint32_t *value, uint8_t size) override;
+    bool MMIOWrite(uint32_t addr, uint32_t value, uint8_t size) override;
+
+private:
+    friend class PCIDevice;
+
+    PCIDevice *m_device;
+    uint8_t m_index;
+    bool m_isIO;
+    uint32_t m_baseAddress;
+    uint32_t m_size;
+
+    // Range of the BAR that accepts posted writes, relative to its base
+    uint32_t m_postedOffset;
+    uint32_t m_postedSize;
+
+    // Host memory backing the start of the BAR, if it is a RAM alias
+    void *m_ramAlias;
+    uint32_t m_ramAliasSize;
+};
+
 class PCIDevice {
     // PCI Device Interface
 public:
@@ -65,10 +107,48 @@ public:
 
     virtual ~PCIDevice();
 
-    bool GetIOBar(uint32_t port, uint8_t* barIndex, uint32_t *baseAddress);
-    bool GetMMIOBar(uint32_t addr, uint8_t* barIndex, uint32_t *baseAddress);
     bool RegisterBAR(int index, uint32_t size, uint32_t type);
 
+    /*!
+     * Retrieves the address currently decoded by the specified BAR, or
+     * PCI_BAR_UNMAPPED if the BAR is unused or not programmed to a valid
+     * address.
+     */
+    uint32_t GetBARAddress(int index);
+
+    /*!
+     * Synchronizes the I/O and MMIO mappings of all BARs with their current
+     * values in configuration space.
+     */
+    void UpdateBARMappings();
+
+    /*!
+     * Marks a range of an MMIO BAR as accepting posted writes, which the CPU
+     * may buffer and deliver later. See IOMapper::AddPostedWriteRange for the
+     * restrictions. The range follows the BAR as it is remapped.
+     */
+    void SetBARPostedWrites(int index, uint32_t offset, uint32_t size);
+
+    /*!
+     * Declares that the first size bytes of an MMIO BAR are backed by the
+     * specified host memory, so that the CPU may let the guest access them
+     * directly. The device must still handle accesses to the BAR for CPUs
+     * that cannot map the memory. The alias follows the BAR as it is
+     * remapped. Pass nullptr to remove the alias.
+     */
+    void SetBARRAMAlias(int index, void *hostMemory, uint32_t size);
+
+    /*!
+     * Retrieves the I/O device that handles accesses to the specified BAR.
+     */
+    IODevice *GetBARDevice(int index) { return &m_BARDevices[index]; }
+
+    /*!
+     * Retrieves the lock that protects the device's state, or nullptr if the
+     * device is only accessed from the CPU thread.
+     */
+    std::mutex *GetDeviceLock() { return m_deviceLockEnabled ? &m_deviceLock : nullptr; }
+
     inline PCIConfigAddressRegister GetPCIAddress() { return m_addr; }
 
     void ReadConfig(uint32_t reg, void *value, uint8_t size);
@@ -76,10 +156,22 @@ public:
 protected:
     friend class PCIBus;
 
+    /*!
+     * Gives the device a lock shared by all of its BARs and its configuration
+     * space. Devices that run work on other threads must call this during
+     * construction and hold the lock while accessing their state from those
+     * threads.
+     */
+    void EnableDeviceLock();
+
     PCIBus *m_bus;
     PCIConfigAddressRegister m_addr;
 
+    std::mutex m_deviceLock;
+    bool m_deviceLockEnabled;
+
     uint32_t m_BARSizes[PCI_NUM_BARS_DEVICE];
+    PCIBarIODevice m_BARDevices[PCI_NUM_BARS_DEVICE];
 
     uint8_t m_configSpace[256];
     uint8_t m_writeMask[256];
@@ -98,6 +190,8 @@ protected:
 
     void UpdateIRQStatus();
 
+    uint8_t GetNumBARs();
+
     inline uint8_t  Read8 (uint8_t *buf, uint32_t reg) { return buf[reg]; }
     inline uint16_t Read16(uint8_t *buf, uint32_t reg) { return *reinterpret_cast<uint16_t *>(&buf[reg]); }
     inline uint32_t Read32(uint8_t *buf, uint32_t reg) { return *reinterpret_cast<uint32_t *>(&buf[reg]); }
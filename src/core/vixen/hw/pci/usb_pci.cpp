@@ -57,15 +57,19 @@ using namespace vixen::cpu;
 #define SETUP_STATE_ACK     3
 #define SETUP_STATE_PARAM   4
 
-USBPCIDevice::USBPCIDevice(uint8_t irqn, Cpu& cpu)
+USBPCIDevice::USBPCIDevice(uint8_t irqn, Cpu& cpu, Scheduler& scheduler)
     : PCIDevice(PCI_HEADER_TYPE_NORMAL, PCI_VENDOR_ID_NVIDIA, 0x02A5, 0xA1,
         0x0c, 0x03, 0x10) // USB OHCI
     , m_irqn(irqn)
     , m_cpu(cpu)
+    , m_scheduler(scheduler)
 {
+    // The OHCI frame timer fires on the scheduler thread
+    EnableDeviceLock();
 }
 
 USBPCIDevice::~USBPCIDevice() {
+    delete m_HostController;
 }
 
 // PCI Device functions
@@ -80,7 +84,7 @@ void USBPCIDevice::Init() {
         m_PciPath = "pci.0:03.0";
     }
 
-    m_HostController = new OHCI(m_cpu, m_irqn, this);
+    m_HostController = new OHCI(m_cpu, m_scheduler, m_irqn, this);
 }
 
 void USBPCIDevice::Reset() {
@@ -46,6 +46,7 @@
 #include "pci.h"
 #include "../ohci/ohci_common.h"
 #include "vixen/cpu.h"
+#include "vixen/scheduler.h"
 
 namespace vixen {
 
@@ -66,7 +67,7 @@ class OHCI;
 class USBPCIDevice : public PCIDevice {
 public:
     // constructor
-    USBPCIDevice(uint8_t irqn, Cpu& cpu);
+    USBPCIDevice(uint8_t irqn, Cpu& cpu, Scheduler& scheduler);
     virtual ~USBPCIDevice();
 
     // PCI Device functions
@@ -80,7 +81,7 @@ public:
 
     // USBDevice-specific functions/variables
     // pointer to the host controller this device refers to
-    OHCI* m_HostController;
+    OHCI* m_HostController = nullptr;
     // PCI path of this usb device
     const char* m_PciPath;
     // free usb ports on this device (hubs included)
@@ -208,6 +209,7 @@ public:
 private:
     uint8_t m_irqn;
     Cpu& m_cpu;
+    Scheduler& m_scheduler;
 };
 
 }
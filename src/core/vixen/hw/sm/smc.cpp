@@ -180,8 +180,11 @@ void SMCDevice::WriteByte(uint8_t command, uint8_t value) {
     // TODO: case SMCRegister::TrayEject:
     case SMCRegister::ErrorCode:
         log_warning("SMCDevice::WriteByte: Wrote fatal error code %d\n", value);
-        
-        break;
+        m_buffer[command] = value;
+        if (m_errorCodeCallback != nullptr) {
+            m_errorCodeCallback(value, m_errorCodeUserData);
+        }
+        return;
     // TODO: case SMCRegister::ResetOnEject:
     // TODO: case SMCRegister::InterruptEnable:
     case SMCRegister::Scratch:
@@ -200,6 +203,11 @@ void SMCDevice::WriteByte(uint8_t command, uint8_t value) {
     m_buffer[command] = value;
 }
 
+void SMCDevice::SetErrorCodeCallback(SMCErrorCodeFunc callback, void *userData) {
+    m_errorCodeCallback = callback;
+    m_errorCodeUserData = userData;
+}
+
 void SMCDevice::WriteWord(uint8_t command, uint16_t value) {
     log_spew("SMCDevice::WriteWord:  Unimplemented!  command = 0x%x,  value = 0x%x\n", command, value);
 
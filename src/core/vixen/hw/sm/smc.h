@@ -84,6 +84,11 @@ const uint8_t kSMC_AVPack_None = 7;      // = AV_PACK_NONE      0
 
 SMCRevision SMCRevisionFromHardwareModel(HardwareModel hardwareModel);
 
+/*!
+ * Function invoked when the system writes a fatal error code to the SMC.
+ */
+typedef void (*SMCErrorCodeFunc)(uint8_t errorCode, void *userData);
+
 
 class SMCDevice : public SMDevice {
 public:
@@ -108,10 +113,16 @@ public:
     void WriteWord(uint8_t command, uint16_t value);
     void WriteBlock(uint8_t command, uint8_t* data, int length);
 
+    // Registers a function to be called whenever a fatal error code is written
+    void SetErrorCodeCallback(SMCErrorCodeFunc callback, void *userData);
+
 private:
     SMCRevision m_revision;
     int m_PICVersionStringIndex = 0;
     uint8_t m_buffer[256] = {};
+
+    SMCErrorCodeFunc m_errorCodeCallback = nullptr;
+    void *m_errorCodeUserData = nullptr;
 };
 
 
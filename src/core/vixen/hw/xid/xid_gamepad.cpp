@@ -46,8 +46,6 @@
 
 namespace vixen {
 
-XidGamepad* g_XidControllerObjArray[4];
-
 #define USB_CLASS_XID  0x58
 #define USB_DT_XID     0x42
 
@@ -183,11 +181,11 @@ static const XIDDesc desc_xid_xbox_gamepad = {
     { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF }  // wAlternateProductIds
 };
 
-int XidGamepad::Init(int port) {
+int XidGamepad::Init(Hub* hubs[4], int port) {
     if (port > 4 || port < 1) { return -1; }
 
     XboxDeviceState* dev = ClassInitFn();
-    int rc = UsbXidClaimPort(dev, port);
+    int rc = UsbXidClaimPort(hubs, dev, port);
     if (rc != 0) {
         m_UsbDev->m_HostController->m_bFrameTime = false;
         return rc;
@@ -225,18 +223,18 @@ XboxDeviceState* XidGamepad::ClassInitFn() {
     return dev;
 }
 
-int XidGamepad::UsbXidClaimPort(XboxDeviceState* dev, int port) {
+int XidGamepad::UsbXidClaimPort(Hub* hubs[4], XboxDeviceState* dev, int port) {
     int i;
     std::vector<USBPort*>::iterator it;
 
     assert(dev->Port == nullptr);
 
     for (int j = 0; j < 4; j++) {
-        if (g_HubObjArray[j]) {
+        if (hubs[j]) {
             i = 0;
-            for (auto usb_port : g_HubObjArray[j]->m_UsbDev->m_FreePorts) {
+            for (auto usb_port : hubs[j]->m_UsbDev->m_FreePorts) {
                 if (usb_port->Path == (std::to_string(port) + ".2")) {
-                    m_UsbDev = g_HubObjArray[j]->m_UsbDev;
+                    m_UsbDev = hubs[j]->m_UsbDev;
                     break;
                 }
                 i++;
@@ -49,8 +49,9 @@ struct USBXIDState; // forward declare
 /* Class which implements an xbox gamepad */
 class XidGamepad {
 public:
-    // initialize this peripheral
-    int Init(int port);
+    // initialize this peripheral, attaching it to the hub plugged into the
+    // given port among the hubs of the machine it belongs to
+    int Init(Hub* hubs[4], int port);
     // destroy gamepad resources
     void XidCleanUp();
 
@@ -68,7 +69,7 @@ private:
     // initialize various member variables/functions
     XboxDeviceState* ClassInitFn();
     // reserve a usb port for this gamepad
-    int UsbXidClaimPort(XboxDeviceState* dev, int port);
+    int UsbXidClaimPort(Hub* hubs[4], XboxDeviceState* dev, int port);
     // free the usb port used by this gamepad
     void UsbXidReleasePort(XboxDeviceState* dev);
     // see USBDeviceClass for comments about these functions
@@ -84,6 +85,4 @@ private:
     void UpdateForceFeedback();
 };
 
-extern XidGamepad* g_XidControllerObjArray[4];
-
 }
@@ -74,6 +74,7 @@ void ModuleRepository::Enumerate(std::wstring modulePath) {
                     if (moduleCaps != nullptr) {
                         log_debug("Capabilities:\n");
                         log_debug("  Guest debugging: %s\n", ((moduleCaps->guestDebugging) ? "yes" : "no"));
+                        log_debug("  In-kernel IRQ chip: %s\n", ((moduleCaps->inKernelIRQChip) ? "yes" : "no"));
                     }
                 }
                 else {
@@ -124,6 +125,10 @@ ModuleLoadStatus LoadCPUModule(std::wstring libraryPath, CPUModuleInstance *inst
         return kModuleInstantiationFailed;
     }
 
+    // Modules without the capabilities export support none of them
+    auto moduleCaps = (vixen::modules::cpu::Capabilities *)library->GetExport("vxnModuleCaps");
+    instance->caps = (moduleCaps != nullptr) ? *moduleCaps : vixen::modules::cpu::Capabilities();
+
     instance->library = library;
     instance->cpuModule = moduleInstance;
     return kModuleLoadSuccess;
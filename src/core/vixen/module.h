@@ -40,6 +40,7 @@ const ModuleLoadStatus kModuleInvalidType = 0xF0000003;
 struct CPUModuleInstance {
 	SharedLibrary *library;
 	vixen::modules::cpu::ICPUModule *cpuModule;
+	vixen::modules::cpu::Capabilities caps;
 	~CPUModuleInstance();
 };
 
@@ -0,0 +1,200 @@
+#include "scheduler.h"
+
+#include <chrono>
+
+#include "vixen/thread.h"
+
+namespace vixen {
+
+void SchedulerThreadFunc(void *data) {
+    Thread_SetName("[HW] Scheduler");
+    ((Scheduler *)data)->Run();
+}
+
+Scheduler::Scheduler(VirtualClock& clock)
+    : m_clock(clock)
+    , m_wheel(clock.Now())
+{
+}
+
+Scheduler::~Scheduler() {
+    Stop();
+}
+
+void Scheduler::Start() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    if (m_thread != nullptr) {
+        return;
+    }
+
+    m_running = true;
+    m_thread = new std::thread(SchedulerThreadFunc, this);
+}
+
+void Scheduler::Stop() {
+    std::thread *thread;
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        if (m_thread == nullptr) {
+            return;
+        }
+        m_running = false;
+        m_cond.notify_one();
+        m_callbackCond.notify_all();
+        thread = m_thread;
+    }
+
+    thread->join();
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+void Scheduler::Schedule(ScheduledTimer *timer, uint64_t deadline) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    timer->m_entry.deadline = deadline;
+    m_wheel.Insert(&timer->m_entry);
+
+    // Only wake up the scheduler thread if it would oversleep
+    if (deadline < m_wakeTime) {
+        m_wakeTime = deadline;
+        m_cond.notify_one();
+    }
+}
+
+void Scheduler::Cancel(ScheduledTimer *timer) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_wheel.Remove(&timer->m_entry);
+}
+
+bool Scheduler::IsPending(ScheduledTimer *timer) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return m_wheel.IsQueued(&timer->m_entry);
+}
+
+void Scheduler::Unregister(ScheduledTimer *timer) {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_wheel.Remove(&timer->m_entry);
+
+    // Wait for the callback to finish, unless the timer is being destroyed
+    // from its own callback
+    if (m_currentTimer == timer && std::this_thread::get_id() == m_callbackThread) {
+        return;
+    }
+    m_callbackCond.wait(lk, [this, timer] { return m_currentTimer != timer; });
+}
+
+void Scheduler::RunExpired() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    RunExpiredLocked(lk);
+}
+
+void Scheduler::RunExpiredLocked(std::unique_lock<std::mutex>& lk) {
+    m_wheel.Advance(Now());
+
+    TimerWheelEntry *entry;
+    while ((entry = m_wheel.PopExpired()) != nullptr) {
+        ScheduledTimer *timer = (ScheduledTimer *)entry->userData;
+        m_currentTimer = timer;
+        m_callbackThread = std::this_thread::get_id();
+        lk.unlock();
+        timer->m_func(timer->m_userData);
+        lk.lock();
+        m_currentTimer = nullptr;
+        m_callbackCond.notify_all();
+    }
+
+    m_servicedTime = m_wheel.GetTime();
+    m_callbackCond.notify_all();
+}
+
+bool Scheduler::SkipToNextDeadline() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_wheel.Advance(Now());
+
+    // The wheel may need to be advanced several times before the earliest
+    // timer reaches the lowest level and expires
+    uint64_t timeout;
+    while ((timeout = m_wheel.NextTimeout()) != 0) {
+        if (timeout == UINT64_MAX) {
+            return false;
+        }
+        m_wheel.Advance(m_wheel.GetTime() + timeout);
+    }
+    m_clock.SkipTo(m_wheel.GetTime());
+
+    // Let the scheduler thread know that time has moved
+    m_cond.notify_one();
+    return true;
+}
+
+void Scheduler::WaitForExpired() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    uint64_t target = m_wheel.GetTime();
+    m_callbackCond.wait(lk, [this, target] { return !m_running || m_servicedTime >= target; });
+}
+
+void Scheduler::Run() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (m_running) {
+        RunExpiredLocked(lk);
+        if (!m_running) {
+            break;
+        }
+
+        // Sleep until the wheel needs to be advanced again or an earlier
+        // timer is scheduled. The wheel may ask to be advanced before the
+        // actual deadline when timers need to move down to a lower level.
+        uint64_t timeout = m_wheel.NextTimeout();
+        if (timeout == 0) {
+            continue;
+        }
+        if (timeout == UINT64_MAX) {
+            m_wakeTime = UINT64_MAX;
+            m_cond.wait(lk);
+        }
+        else {
+            uint64_t now = Now();
+            m_wakeTime = m_wheel.GetTime() + timeout;
+            if (m_wakeTime > now) {
+                uint64_t hostInterval = m_clock.ToHostInterval(m_wakeTime - now);
+                if (hostInterval == UINT64_MAX) {
+                    m_cond.wait(lk);
+                }
+                else {
+                    m_cond.wait_for(lk, std::chrono::nanoseconds(hostInterval));
+                }
+            }
+        }
+        m_wakeTime = 0;
+    }
+}
+
+// ----- Scheduled timer ------------------------------------------------------
+
+ScheduledTimer::ScheduledTimer(Scheduler& scheduler, TimerFunc func, void *userData)
+    : m_scheduler(scheduler)
+    , m_func(func)
+    , m_userData(userData)
+{
+    m_entry.userData = this;
+}
+
+ScheduledTimer::~ScheduledTimer() {
+    m_scheduler.Unregister(this);
+}
+
+void ScheduledTimer::Schedule(uint64_t deadline) {
+    m_scheduler.Schedule(this, deadline);
+}
+
+void ScheduledTimer::Cancel() {
+    m_scheduler.Cancel(this);
+}
+
+bool ScheduledTimer::IsPending() {
+    return m_scheduler.IsPending(this);
+}
+
+}
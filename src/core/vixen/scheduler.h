@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "vixen/virtual_clock.h"
+#include "vixen/util/timer_wheel.h"
+
+namespace vixen {
+
+/*!
+ * Function invoked when a timer expires.
+ */
+typedef void (*TimerFunc)(void *userData);
+
+class ScheduledTimer;
+
+/*!
+ * Services all emulated hardware timers from a single thread.
+ *
+ * Timers are kept in a hierarchical timer wheel keyed by absolute deadlines
+ * in nanoseconds of virtual time. The scheduler thread sleeps until the next
+ * deadline and is only woken up early when a timer is scheduled to expire
+ * before that, so host CPU usage scales with the number of timer events
+ * rather than with the number of timers.
+ *
+ * Deterministic clocks are not driven by the host, so the thread that
+ * advances the clock must also service the timers with RunExpired() instead
+ * of starting the scheduler thread. Timers must only ever be serviced by one
+ * thread: RunExpired() must not be used while the scheduler thread runs.
+ *
+ * Timer callbacks are invoked on the scheduler thread without holding any
+ * scheduler locks. Callbacks may reschedule or cancel any timer, including
+ * their own, and must take their device's lock before accessing its state.
+ */
+class Scheduler {
+public:
+    Scheduler(VirtualClock& clock);
+    ~Scheduler();
+
+    /*!
+     * Starts the scheduler thread. Timers may be scheduled before the
+     * scheduler is started; they will expire once it starts.
+     */
+    void Start();
+
+    /*!
+     * Stops the scheduler thread. Pending timers are kept.
+     */
+    void Stop();
+
+    /*!
+     * Runs the callbacks of all expired timers on the calling thread.
+     */
+    void RunExpired();
+
+    /*!
+     * Jumps the clock forward to the earliest timer deadline, so that the
+     * timer expires immediately. Used to skip time while the guest is idle.
+     *
+     * Returns false if there are no pending timers.
+     */
+    bool SkipToNextDeadline();
+
+    /*!
+     * Waits until the scheduler thread has run the callbacks of all timers
+     * that expired up to the current time of the wheel, such as after a call
+     * to SkipToNextDeadline(). Returns immediately if the thread is stopped.
+     */
+    void WaitForExpired();
+
+    /*!
+     * Returns the current virtual time in nanoseconds.
+     */
+    uint64_t Now() { return m_clock.Now(); }
+
+    VirtualClock& GetClock() { return m_clock; }
+
+private:
+    void Schedule(ScheduledTimer *timer, uint64_t deadline);
+    void Cancel(ScheduledTimer *timer);
+    bool IsPending(ScheduledTimer *timer);
+    void Unregister(ScheduledTimer *timer);
+
+    void Run();
+    void RunExpiredLocked(std::unique_lock<std::mutex>& lk);
+
+    VirtualClock& m_clock;
+    TimerWheel m_wheel;
+
+    std::thread *m_thread = nullptr;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running = false;
+
+    // Time at which the scheduler thread will wake up on its own
+    uint64_t m_wakeTime = UINT64_MAX;
+
+    // Timer whose callback is currently running, the thread running it, and
+    // a condition signaled when it returns
+    ScheduledTimer *m_currentTimer = nullptr;
+    std::thread::id m_callbackThread;
+    std::condition_variable m_callbackCond;
+
+    // Wheel time up to which all expired callbacks have been run, signaled
+    // through m_callbackCond
+    uint64_t m_servicedTime = 0;
+
+    friend class ScheduledTimer;
+    friend void SchedulerThreadFunc(void *data);
+};
+
+/*!
+ * A one-shot timer serviced by a Scheduler. Periodic timers are implemented
+ * by rescheduling the timer from its callback, preferably relative to the
+ * previous deadline to avoid drift.
+ */
+class ScheduledTimer {
+public:
+    ScheduledTimer(Scheduler& scheduler, TimerFunc func, void *userData);
+
+    /*!
+     * Cancels the timer and waits for its callback to return if it is
+     * running on the scheduler thread. The callback must not be blocked on
+     * locks held by the caller.
+     */
+    ~ScheduledTimer();
+
+    /*!
+     * Schedules the timer to expire at the specified absolute deadline,
+     * replacing any previously scheduled deadline.
+     */
+    void Schedule(uint64_t deadline);
+
+    /*!
+     * Schedules the timer to expire after the specified number of
+     * nanoseconds from now.
+     */
+    void ScheduleIn(uint64_t delay) { Schedule(m_scheduler.Now() + delay); }
+
+    /*!
+     * Cancels a pending expiration. The callback may still be running on the
+     * scheduler thread when this function returns.
+     */
+    void Cancel();
+
+    /*!
+     * Determines if the timer is scheduled to expire.
+     */
+    bool IsPending();
+
+    /*!
+     * Returns the last deadline the timer was scheduled for.
+     */
+    uint64_t GetDeadline() const { return m_entry.deadline; }
+
+private:
+    Scheduler& m_scheduler;
+    TimerFunc m_func;
+    void *m_userData;
+
+    TimerWheelEntry m_entry;
+
+    friend class Scheduler;
+};
+
+}
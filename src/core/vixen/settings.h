@@ -24,15 +24,46 @@ enum VirtualDVDDriveType {
     // TODO: VDVD_HostDirectory   // Virtual DVD drive mapped to a directory on the host
 };
 
+enum VirtualClockMode {
+    VCM_RealTime,        // Guest time follows host time
+    VCM_Scaled,          // Guest time follows host time scaled by a factor
+    VCM_Deterministic,   // Guest time advances with guest execution
+};
+
+enum RAMBackingType {
+    RAMB_Default,              // Regular host pages
+    RAMB_TransparentHugePages, // Regular pages, collapsed into transparent huge pages by the host
+    RAMB_HugeTLB,              // Huge pages reserved from the host's hugetlbfs pool
+};
+
 struct viXenSettings {
     // false: the CPU emulator will execute until interrupted
     // true: the CPU emulator will execute one instruction at a time
     bool cpu_singleStep = false;
 
+    // true: let the CPU module emulate the interrupt controller and the
+    // interval timer in the hypervisor, if it supports doing so.
+    // Only used with the VCM_RealTime clock mode.
+    bool cpu_inKernelIRQChip = false;
+
     // false: use standard 64 MiB RAM
     // true: expand RAM to 128 MiB
     bool ram_expanded = false;
 
+    // How guest RAM is backed by host memory. Huge pages reduce TLB misses
+    // on the host and, with hardware virtualization, on the nested page
+    // tables. Falls back to regular pages if the host cannot provide them.
+    // Only supported on Linux.
+    RAMBackingType ram_backing = RAMB_Default;
+
+    // Host NUMA node to allocate guest RAM from, or -1 to let the host
+    // decide. Only supported on Linux.
+    int ram_numaNode = -1;
+
+    // true: allocate and zero all of guest RAM up front
+    // false: let the host allocate pages on first access
+    bool ram_prefault = false;
+
     // true: the emulator will stop on a fatal error
     bool emu_stopOnSMCFatalErrors = false;
 
@@ -40,6 +71,28 @@ struct viXenSettings {
     // (only applies to original or modified Microsoft kernels)
     bool emu_stopOnBugChecks = false;
 
+    // How often to check for kernel bug checks, in milliseconds
+    uint32_t emu_bugCheckPollInterval = 100;
+
+    // How guest time advances
+    VirtualClockMode emu_clockMode = VCM_RealTime;
+
+    // Guest time elapsed per unit of host time in VCM_Scaled mode
+    float emu_clockScale = 1.0f;
+
+    // Guest time elapsed per CPU exit in VCM_Deterministic mode, in nanoseconds
+    uint32_t emu_clockQuantum = 10000;
+
+    // true: when the CPU halts waiting for an interrupt, advance guest time
+    // straight to the next timer deadline instead of waiting for it
+    // (always done in VCM_Deterministic mode)
+    bool emu_skipIdle = false;
+
+    // Number of host threads rendering 3D graphics, in addition to the NV2A's
+    // command processing thread. -1 uses one less than the number of host
+    // cores. Machines using the same number share the threads.
+    int gpu_rasterThreads = -1;
+
     // true: enables the GDB server, allowing the guest to be debugged
     bool gdb_enable = false;
 
@@ -61,12 +114,15 @@ struct viXenSettings {
     // The number of instructions to disassemble
     uint32_t debug_dumpDisassembly_length = 15;
 
+    // true: collect per-device I/O and MMIO access statistics and dump them on exit
+    bool debug_ioStatistics = false;
+
+    // Path to the JSON file where I/O statistics are written
+    const char *debug_ioStatistics_path = "iostats.json";
+
     // The Xbox hardware revision to use
     HardwareModel hw_revision = DebugKit;
 
-    // The system clock tick rate
-    float hw_sysclock_tickRate = 1000.0f;
-
     // Enable Super I/O hardware on retail systems
     // Always enabled on DebugKit models
     bool hw_enableSuperIO = true;
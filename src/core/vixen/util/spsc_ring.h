@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace vixen {
+
+/*!
+ * A fixed-capacity ring buffer for one producer thread and one consumer
+ * thread, which never allocates memory after construction.
+ *
+ * The producer stages entries in free slots and then publishes all staged
+ * entries at once, so a batch of any size costs a single store to the shared
+ * write index. The consumer pops published entries in bulk.
+ *
+ * Publish() reports whether the ring was empty, so that a consumer sleeping
+ * on a condition variable only needs to be woken up when entries become
+ * available. For this to be free of lost wakeups, the consumer must check
+ * IsEmpty() under the same lock the producer holds to notify it. Both sides
+ * access the indices with sequentially consistent operations for this
+ * reason.
+ *
+ * T must be trivially copyable.
+ */
+template<typename T>
+class SPSCRing {
+public:
+    /*!
+     * Creates a ring that holds at least the specified number of entries.
+     * The capacity is rounded up to a power of two.
+     */
+    SPSCRing(uint32_t capacity);
+    ~SPSCRing();
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    // ----- Producer ---------------------------------------------------------
+
+    /*!
+     * Copies the entry into the next free slot without making it visible to
+     * the consumer. Returns false if the ring is full.
+     */
+    bool Stage(const T& entry);
+
+    /*!
+     * Makes all staged entries visible to the consumer.
+     * Returns true if the consumer had emptied the ring before the entries
+     * were published, in which case it may be waiting for them.
+     */
+    bool Publish();
+
+    /*!
+     * Determines if there is no room left to stage entries.
+     */
+    bool IsFull() const { return m_stagedTail - m_head.load() > m_mask; }
+
+    // ----- Consumer ---------------------------------------------------------
+
+    /*!
+     * Moves up to maxCount published entries into the specified array.
+     * Returns the number of entries moved.
+     */
+    uint32_t PopBulk(T *entries, uint32_t maxCount);
+
+    // ----- Either thread ----------------------------------------------------
+
+    /*!
+     * Determines if there are no published entries left to consume.
+     */
+    bool IsEmpty() const { return m_head.load() == m_tail.load(); }
+
+    uint32_t Capacity() const { return m_mask + 1; }
+
+private:
+    T *m_data;
+    uint32_t m_mask;
+
+    // Index of the next entry to consume, written by the consumer. Padded
+    // to keep it on a separate cache line from the producer's index; alignas
+    // is avoided since C++11 does not honor it for objects created with new.
+    std::atomic<uint32_t> m_head { 0 };
+    char m_headPadding[64];
+
+    // Index past the last published entry, written by the producer
+    std::atomic<uint32_t> m_tail { 0 };
+
+    // Index past the last staged entry, private to the producer
+    uint32_t m_stagedTail = 0;
+};
+
+template<typename T>
+SPSCRing<T>::SPSCRing(uint32_t capacity) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    m_data = new T[size];
+    m_mask = size - 1;
+}
+
+template<typename T>
+SPSCRing<T>::~SPSCRing() {
+    delete[] m_data;
+}
+
+template<typename T>
+bool SPSCRing<T>::Stage(const T& entry) {
+    // Indices wrap around freely; only their difference matters
+    if (IsFull()) {
+        return false;
+    }
+    m_data[m_stagedTail & m_mask] = entry;
+    m_stagedTail++;
+    return true;
+}
+
+template<typename T>
+bool SPSCRing<T>::Publish() {
+    uint32_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_stagedTail) {
+        return false;
+    }
+    m_tail.store(m_stagedTail);
+    return m_head.load() == tail;
+}
+
+template<typename T>
+uint32_t SPSCRing<T>::PopBulk(T *entries, uint32_t maxCount) {
+    uint32_t head = m_head.load(std::memory_order_relaxed);
+    uint32_t count = m_tail.load(std::memory_order_acquire) - head;
+    if (count > maxCount) {
+        count = maxCount;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i] = m_data[(head + i) & m_mask];
+    }
+    m_head.store(head + count);
+    return count;
+}
+
+}
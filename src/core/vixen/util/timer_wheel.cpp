@@ -0,0 +1,176 @@
+#include "timer_wheel.h"
+
+#include <algorithm>
+
+namespace vixen {
+
+// Level index used for entries in the expired list
+#define TIMER_WHEEL_EXPIRED   TIMER_WHEEL_LEVELS
+
+static inline void InitList(TimerWheelEntry *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+static inline bool IsListEmpty(const TimerWheelEntry *head) {
+    return head->next == head;
+}
+
+TimerWheel::TimerWheel(uint64_t now)
+    : m_now(now)
+{
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            InitList(&m_slots[level][slot]);
+        }
+        m_pending[level] = 0;
+    }
+    InitList(&m_expired);
+}
+
+void TimerWheel::Link(TimerWheelEntry *head, TimerWheelEntry *entry) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+void TimerWheel::MoveAll(TimerWheelEntry *from, TimerWheelEntry *to) {
+    if (IsListEmpty(from)) {
+        return;
+    }
+    from->next->prev = to->prev;
+    from->prev->next = to;
+    to->prev->next = from->next;
+    to->prev = from->prev;
+    InitList(from);
+}
+
+void TimerWheel::Insert(TimerWheelEntry *entry) {
+    Remove(entry);
+
+    if (entry->deadline <= m_now) {
+        entry->level = TIMER_WHEEL_EXPIRED;
+        Link(&m_expired, entry);
+        return;
+    }
+
+    // Pick the level from the most significant bit of the remaining time.
+    // On upper levels the entry goes one slot early, so that it is moved
+    // down to a lower level before its deadline comes by.
+    uint64_t remaining = std::min<uint64_t>(entry->deadline - m_now, TIMER_WHEEL_MAX_TIMEOUT);
+    int level = Bitmap64FindLastSet(remaining) / TIMER_WHEEL_BITS;
+    int shift = level * TIMER_WHEEL_BITS;
+    int slot = ((entry->deadline >> shift) - (level ? 1 : 0)) & TIMER_WHEEL_MASK;
+
+    entry->level = level;
+    entry->slot = slot;
+    Link(&m_slots[level][slot], entry);
+    Bitmap64Set(&m_pending[level], slot);
+}
+
+void TimerWheel::Remove(TimerWheelEntry *entry) {
+    if (!IsQueued(entry)) {
+        return;
+    }
+
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    if (entry->level != TIMER_WHEEL_EXPIRED && IsListEmpty(&m_slots[entry->level][entry->slot])) {
+        Bitmap64Clear(&m_pending[entry->level], entry->slot);
+    }
+    entry->prev = nullptr;
+    entry->next = nullptr;
+    entry->level = -1;
+}
+
+void TimerWheel::Advance(uint64_t now) {
+    if (now <= m_now) {
+        return;
+    }
+
+    TimerWheelEntry todo;
+    InitList(&todo);
+
+    // Collect the contents of every slot that the clock hand passes over on
+    // each level. Higher levels only need to be looked at if the lower level
+    // wrapped around.
+    uint64_t elapsed = now - m_now;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = level * TIMER_WHEEL_BITS;
+        Bitmap64 passed;
+        if ((elapsed >> shift) > TIMER_WHEEL_MASK) {
+            passed = ~0ULL;
+        }
+        else {
+            uint8_t ticks = (elapsed >> shift) & TIMER_WHEEL_MASK;
+            uint8_t oldSlot = (m_now >> shift) & TIMER_WHEEL_MASK;
+            uint8_t newSlot = (now >> shift) & TIMER_WHEEL_MASK;
+            Bitmap64 span = (1ULL << ticks) - 1;
+            passed = Bitmap64RotateLeft(span, oldSlot);
+            passed |= Bitmap64RotateRight(Bitmap64RotateLeft(span, newSlot), ticks);
+            passed |= BITMASK64(newSlot);
+        }
+
+        Bitmap64 due = passed & m_pending[level];
+        while (due) {
+            int slot = Bitmap64FindFirstSet(due);
+            MoveAll(&m_slots[level][slot], &todo);
+            Bitmap64Clear(&due, slot);
+            Bitmap64Clear(&m_pending[level], slot);
+        }
+
+        if (!Bitmap64IsSet(passed, 0)) {
+            break;
+        }
+
+        // The next level must tick at least once
+        elapsed = std::max(elapsed, (uint64_t)TIMER_WHEEL_SLOTS << shift);
+    }
+
+    m_now = now;
+
+    // Expire or move the collected entries down the wheel
+    while (!IsListEmpty(&todo)) {
+        TimerWheelEntry *entry = todo.next;
+        todo.next = entry->next;
+        entry->next->prev = &todo;
+        entry->level = -1;
+        Insert(entry);
+    }
+}
+
+TimerWheelEntry *TimerWheel::PopExpired() {
+    if (IsListEmpty(&m_expired)) {
+        return nullptr;
+    }
+
+    TimerWheelEntry *entry = m_expired.next;
+    Remove(entry);
+    return entry;
+}
+
+uint64_t TimerWheel::NextTimeout() const {
+    if (!IsListEmpty(&m_expired)) {
+        return 0;
+    }
+
+    uint64_t timeout = UINT64_MAX;
+    uint64_t progressMask = 0;
+    for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        int shift = level * TIMER_WHEEL_BITS;
+        if (m_pending[level]) {
+            // Entries on upper levels are one rotation of the level below in
+            // the future; otherwise they would be on a lower level already.
+            // Discount the progress made by the lower levels.
+            uint8_t slot = (m_now >> shift) & TIMER_WHEEL_MASK;
+            uint64_t levelTimeout = (uint64_t)(Bitmap64FindFirstSet(Bitmap64RotateRight(m_pending[level], slot)) + (level ? 1 : 0)) << shift;
+            levelTimeout -= progressMask & m_now;
+            timeout = std::min(timeout, levelTimeout);
+        }
+        progressMask = (progressMask << TIMER_WHEEL_BITS) | TIMER_WHEEL_MASK;
+    }
+    return timeout;
+}
+
+}
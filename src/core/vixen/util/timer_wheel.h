@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+
+#include "vixen/bitmap.h"
+
+namespace vixen {
+
+#define TIMER_WHEEL_BITS      6
+#define TIMER_WHEEL_SLOTS     (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK      (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS    8
+
+// Longest timeout that fits the wheel (about 78 hours with nanosecond ticks).
+// Longer timeouts are parked on the top level and requeued as time advances.
+#define TIMER_WHEEL_MAX_TIMEOUT   ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+/*!
+ * An entry in the timer wheel. Entries are linked intrusively into the wheel
+ * slots, so scheduling and canceling never allocate memory.
+ */
+struct TimerWheelEntry {
+    uint64_t deadline = 0;
+    void *userData = nullptr;
+
+    // Position in the wheel, managed by TimerWheel
+    TimerWheelEntry *prev = nullptr;
+    TimerWheelEntry *next = nullptr;
+    int level = -1;
+    int slot = 0;
+};
+
+/*!
+ * A hierarchical timer wheel with absolute deadlines.
+ *
+ * Each level has 64 slots and covers 64 times the range of the level below.
+ * Entries are placed on the level matching the distance to their deadline
+ * and trickle down to lower levels as the wheel advances, until they expire.
+ * Occupied slots are tracked in one bitmap per level, so advancing the wheel
+ * by an arbitrary amount of time and finding the next deadline cost a
+ * handful of bit operations per level, regardless of the number of entries.
+ *
+ * Time is measured in ticks of an arbitrary unit, and must never go back.
+ *
+ * This class is not thread-safe.
+ */
+class TimerWheel {
+public:
+    TimerWheel(uint64_t now);
+
+    /*!
+     * Queues the entry to expire at its deadline, requeuing it if it was
+     * already in the wheel. Entries whose deadline has passed expire on the
+     * next call to PopExpired.
+     */
+    void Insert(TimerWheelEntry *entry);
+
+    /*!
+     * Removes the entry from the wheel, if it is queued.
+     */
+    void Remove(TimerWheelEntry *entry);
+
+    /*!
+     * Determines if the entry is queued in the wheel.
+     */
+    bool IsQueued(const TimerWheelEntry *entry) const { return entry->level >= 0; }
+
+    /*!
+     * Advances the wheel to the specified time, collecting expired entries.
+     */
+    void Advance(uint64_t now);
+
+    /*!
+     * Removes and returns the next expired entry, or nullptr if there are no
+     * more expired entries.
+     */
+    TimerWheelEntry *PopExpired();
+
+    /*!
+     * Returns the number of ticks from the current time until the wheel
+     * needs to be advanced again, or UINT64_MAX if the wheel is empty.
+     * This is never later than the earliest deadline in the wheel.
+     */
+    uint64_t NextTimeout() const;
+
+    uint64_t GetTime() const { return m_now; }
+
+private:
+    void Link(TimerWheelEntry *head, TimerWheelEntry *entry);
+    void MoveAll(TimerWheelEntry *from, TimerWheelEntry *to);
+
+    uint64_t m_now;
+
+    // Circular lists with sentinel heads, one per slot
+    TimerWheelEntry m_slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    Bitmap64 m_pending[TIMER_WHEEL_LEVELS];
+
+    TimerWheelEntry m_expired;
+};
+
+}
@@ -0,0 +1,118 @@
+#include "worker_pool.h"
+
+#include "vixen/thread.h"
+
+#include <map>
+#include <string>
+#include <utility>
+
+namespace vixen {
+
+void WorkerPoolThreadFunc(void *data) {
+    WorkerPool *pool = (WorkerPool *)data;
+    Thread_SetName(pool->m_name);
+    pool->WorkerLoop();
+}
+
+WorkerPool::WorkerPool(uint32_t numThreads, const char *name)
+    : m_name(name)
+{
+    for (uint32_t i = 0; i < numThreads; i++) {
+        m_threads.emplace_back(WorkerPoolThreadFunc, this);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+        m_startCond.notify_all();
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+std::shared_ptr<WorkerPool> WorkerPool::Share(uint32_t numThreads, const char *name) {
+    // Pools outlive their users only as long as another user needs them
+    static std::mutex s_mutex;
+    static std::map<std::pair<std::string, uint32_t>, std::weak_ptr<WorkerPool>> s_pools;
+
+    std::lock_guard<std::mutex> lk(s_mutex);
+    auto key = std::make_pair(std::string(name), numThreads);
+    auto it = s_pools.find(key);
+    if (it != s_pools.end()) {
+        auto pool = it->second.lock();
+        if (pool != nullptr) {
+            return pool;
+        }
+        s_pools.erase(it);
+    }
+
+    auto pool = std::make_shared<WorkerPool>(numThreads, name);
+    s_pools[key] = pool;
+    return pool;
+}
+
+void WorkerPool::Run(uint32_t numTasks, TaskFunc func, void *userData) {
+    if (numTasks == 0) {
+        return;
+    }
+
+    // Not worth waking up the workers for a single task. If another user of
+    // the pool has the workers, run the tasks here instead of waiting for
+    // them, which would leave this thread idle.
+    std::unique_lock<std::mutex> batch(m_batchMutex, std::defer_lock);
+    if (numTasks == 1 || m_threads.empty() || !batch.try_lock()) {
+        for (uint32_t i = 0; i < numTasks; i++) {
+            func(userData, i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_func = func;
+        m_userData = userData;
+        m_numTasks = numTasks;
+        m_nextTask = 0;
+        m_activeWorkers = (uint32_t)m_threads.size();
+        m_generation++;
+        m_startCond.notify_all();
+    }
+
+    RunTasks();
+
+    // Workers may still be running the last tasks they took
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_doneCond.wait(lk, [this] { return m_activeWorkers == 0; });
+}
+
+void WorkerPool::RunTasks() {
+    uint32_t task;
+    while ((task = m_nextTask.fetch_add(1)) < m_numTasks) {
+        m_func(m_userData, task);
+    }
+}
+
+void WorkerPool::WorkerLoop() {
+    uint64_t generation = 0;
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true) {
+        m_startCond.wait(lk, [this, generation] { return !m_running || m_generation != generation; });
+        if (!m_running) {
+            break;
+        }
+        generation = m_generation;
+
+        lk.unlock();
+        RunTasks();
+        lk.lock();
+
+        if (--m_activeWorkers == 0) {
+            m_doneCond.notify_one();
+        }
+    }
+}
+
+}
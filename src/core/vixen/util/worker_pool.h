@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vixen {
+
+/*!
+ * A fixed set of worker threads that split batches of independent tasks
+ * among themselves.
+ *
+ * Run() hands out the tasks of a batch one at a time through an atomic
+ * counter, so that threads that finish early pick up the remaining tasks.
+ * The calling thread works on the batch as well and returns once every task
+ * has completed. Only one batch runs at a time; callers that find the
+ * workers busy with another batch run their tasks by themselves.
+ */
+class WorkerPool {
+public:
+    typedef void(*TaskFunc)(void *userData, uint32_t task);
+
+    /*!
+     * Creates a pool with the specified number of worker threads, in
+     * addition to the thread calling Run(). The threads are given the
+     * specified name.
+     */
+    WorkerPool(uint32_t numThreads, const char *name);
+    ~WorkerPool();
+
+    /*!
+     * Returns the pool with the specified name and number of threads,
+     * creating it if no one else holds it. Pools are shared between all
+     * users in the process, so that each machine does not bring its own set
+     * of threads for every core.
+     */
+    static std::shared_ptr<WorkerPool> Share(uint32_t numThreads, const char *name);
+
+    /*!
+     * Calls func for every task number in [0, numTasks) and waits for all
+     * calls to return. Calls are made concurrently and in no particular
+     * order.
+     */
+    void Run(uint32_t numTasks, TaskFunc func, void *userData);
+
+    uint32_t GetNumThreads() const { return (uint32_t)m_threads.size() + 1; }
+
+private:
+    void WorkerLoop();
+    void RunTasks();
+
+    const char *m_name;
+    std::vector<std::thread> m_threads;
+
+    // Held by the thread running the current batch
+    std::mutex m_batchMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_startCond;
+    std::condition_variable m_doneCond;
+    bool m_running = true;
+
+    // Current batch. The generation changes with every batch so that workers
+    // join each batch exactly once.
+    uint64_t m_generation = 0;
+    TaskFunc m_func = nullptr;
+    void *m_userData = nullptr;
+    uint32_t m_numTasks = 0;
+    std::atomic<uint32_t> m_nextTask { 0 };
+    uint32_t m_activeWorkers = 0;
+
+    friend void WorkerPoolThreadFunc(void *data);
+};
+
+}
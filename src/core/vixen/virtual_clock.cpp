@@ -0,0 +1,86 @@
+#include "virtual_clock.h"
+
+#include <chrono>
+
+namespace vixen {
+
+VirtualClock::VirtualClock()
+    : m_hostBase(HostNow())
+{
+}
+
+uint64_t VirtualClock::HostNow() {
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+void VirtualClock::SetMode(VirtualClockMode mode, float scale) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    uint64_t now = NowLocked();
+
+    m_mode = mode;
+    m_scale = (mode == VCM_Scaled && scale > 0.0f) ? scale : 1.0;
+    m_hostBase = HostNow();
+    m_virtualBase = now;
+    m_ticks = now;
+}
+
+uint64_t VirtualClock::Now() {
+    if (m_mode == VCM_Deterministic) {
+        return m_ticks.load(std::memory_order_acquire);
+    }
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    return NowLocked();
+}
+
+uint64_t VirtualClock::NowLocked() {
+    uint64_t hostElapsed = HostNow() - m_hostBase;
+    switch (m_mode) {
+    case VCM_RealTime:      return m_virtualBase + hostElapsed;
+    case VCM_Scaled:        return m_virtualBase + (uint64_t)(hostElapsed * m_scale);
+    case VCM_Deterministic: return m_ticks.load(std::memory_order_acquire);
+    }
+    return m_virtualBase;
+}
+
+void VirtualClock::Advance(uint64_t delta) {
+    if (m_mode == VCM_Deterministic) {
+        m_ticks.fetch_add(delta, std::memory_order_acq_rel);
+    }
+}
+
+void VirtualClock::SkipTo(uint64_t time) {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    uint64_t now = NowLocked();
+    if (time <= now) {
+        return;
+    }
+
+    if (m_mode == VCM_Deterministic) {
+        m_ticks.store(time, std::memory_order_release);
+    }
+    else {
+        m_virtualBase += time - now;
+    }
+}
+
+uint64_t VirtualClock::ToHostInterval(uint64_t delta) {
+    switch (m_mode) {
+    case VCM_RealTime:      return delta;
+    case VCM_Scaled:        return (uint64_t)(delta / m_scale);
+    case VCM_Deterministic: return UINT64_MAX;
+    }
+    return delta;
+}
+
+uint64_t VirtualClock::ToVirtualInterval(uint64_t hostDelta) {
+    switch (m_mode) {
+    case VCM_RealTime:      return hostDelta;
+    case VCM_Scaled:        return (uint64_t)(hostDelta * m_scale);
+    case VCM_Deterministic: return UINT64_MAX;
+    }
+    return hostDelta;
+}
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+#include "vixen/settings.h"
+
+namespace vixen {
+
+/*!
+ * The source of guest time for all emulated hardware.
+ *
+ * Virtual time is measured in nanoseconds since the clock was created and
+ * advances according to the clock mode:
+ * - VCM_RealTime: follows the host's monotonic clock.
+ * - VCM_Scaled: follows the host's monotonic clock multiplied by a scale
+ *   factor.
+ * - VCM_Deterministic: only advances when the emulator calls Advance(),
+ *   independently of the host's speed. Given the same sequence of guest
+ *   events, devices observe the same sequence of timestamps on every run.
+ *
+ * Now() may be called from any thread. Advance() must only be called from
+ * the thread driving the clock.
+ */
+class VirtualClock {
+public:
+    VirtualClock();
+
+    /*!
+     * Changes the clock mode. The virtual time is preserved across changes.
+     * Must not be called while devices are using the clock.
+     */
+    void SetMode(VirtualClockMode mode, float scale = 1.0f);
+
+    VirtualClockMode GetMode() const { return m_mode; }
+    bool IsDeterministic() const { return m_mode == VCM_Deterministic; }
+
+    /*!
+     * Returns the current virtual time in nanoseconds.
+     */
+    uint64_t Now();
+
+    /*!
+     * Advances the virtual time by the specified number of nanoseconds.
+     * Only affects deterministic clocks.
+     */
+    void Advance(uint64_t delta);
+
+    /*!
+     * Jumps the virtual time forward to the specified time, if it is in the
+     * future. Works in all modes; clocks driven by the host carry on from
+     * the new time.
+     */
+    void SkipTo(uint64_t time);
+
+    /*!
+     * Converts an interval of virtual time into the host time it takes to
+     * elapse, in nanoseconds. Returns UINT64_MAX for deterministic clocks,
+     * which are not driven by the host's clock.
+     */
+    uint64_t ToHostInterval(uint64_t delta);
+
+    /*!
+     * Converts an interval of host time, in nanoseconds, into the virtual
+     * time that elapses during it. Returns UINT64_MAX for deterministic
+     * clocks.
+     */
+    uint64_t ToVirtualInterval(uint64_t hostDelta);
+
+    /*!
+     * Returns the current time of the host's monotonic clock in nanoseconds.
+     */
+    static uint64_t HostNow();
+
+private:
+    uint64_t NowLocked();
+
+    std::mutex m_mutex;
+    VirtualClockMode m_mode = VCM_RealTime;
+    double m_scale = 1.0;
+
+    // Host and virtual times at the last mode change, used as the reference
+    // for the real-time and scaled modes
+    uint64_t m_hostBase;
+    uint64_t m_virtualBase = 0;
+
+    // Virtual time in deterministic mode
+    std::atomic<uint64_t> m_ticks { 0 };
+};
+
+}
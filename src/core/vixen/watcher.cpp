@@ -0,0 +1,220 @@
+#include "watcher.h"
+
+#include "vixen/log.h"
+#include "vixen/thread.h"
+
+namespace vixen {
+
+// Microsoft kernels map physical memory starting at this virtual address
+static const uint32_t kKernelPhysicalMapBase = 0x80000000;
+
+void SMCErrorCodeCallback(uint8_t errorCode, void *userData) {
+    ((SystemWatcher *)userData)->HandleSMCErrorCode(errorCode);
+}
+
+void WatcherThreadFunc(void *data) {
+    Thread_SetName("[HW] Watcher");
+    ((SystemWatcher *)data)->PollThread();
+}
+
+SystemWatcher::SystemWatcher(Cpu *cpu, uint32_t ramSize, viXenSettings *settings, WatcherStopFunc stopFunc, void *stopUserData)
+    : m_cpu(cpu)
+    , m_ramSize(ramSize)
+    , m_settings(settings)
+    , m_stopFunc(stopFunc)
+    , m_stopUserData(stopUserData)
+{
+}
+
+SystemWatcher::~SystemWatcher() {
+    Stop();
+}
+
+void SystemWatcher::WatchSMC(SMCDevice *smc) {
+    smc->SetErrorCodeCallback(SMCErrorCodeCallback, this);
+}
+
+void SystemWatcher::Start() {
+    if (!m_settings->emu_stopOnBugChecks || m_thread != nullptr) {
+        return;
+    }
+
+    m_running = true;
+    m_thread = new std::thread(WatcherThreadFunc, this);
+}
+
+void SystemWatcher::Stop() {
+    if (m_thread == nullptr) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+        m_cond.notify_one();
+    }
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
+// ----- SMC fatal errors -----------------------------------------------------
+
+void SystemWatcher::HandleSMCErrorCode(uint8_t smcErrorCode) {
+    // Display fatal error code and description
+    // See http://xboxdevwiki.net/Fatal_Error
+    // See https://assemblergames.com/threads/xbox-error-codes-repair-reference-tips.62966/
+    if (smcErrorCode == 0 || m_lastSMCErrorCode == smcErrorCode) {
+        return;
+    }
+
+    log_error("/!\\ --------------------------------- /!\\\n");
+    log_fatal("/!\\    System issued a Fatal Error    /!\\\n");
+    log_fatal("/!\\                                   /!\\\n");
+    log_fatal("/!\\        Fatal error code %02d        /!\\\n", smcErrorCode);
+    switch (smcErrorCode) {
+    case  2: log_fatal("/!\\      Invalid EEPROM checksum      /!\\\n"); break;
+    case  4: log_fatal("/!\\         RAM check failure         /!\\\n"); break;
+    case  5: log_fatal("/!\\       Hard drive not locked       /!\\\n"); break;
+    case  6: log_fatal("/!\\    Unable to unlock hard drive    /!\\\n"); break;
+    case  7: log_fatal("/!\\        Hard drive timeout         /!\\\n"); break;
+    case  8: log_fatal("/!\\        No hard drive found        /!\\\n"); break;
+    case  9: log_fatal("/!\\  Hard drive configuration failed  /!\\\n"); break;
+    case 10: log_fatal("/!\\         DVD drive timeout         /!\\\n"); break;
+    case 11: log_fatal("/!\\        No DVD drive found         /!\\\n"); break;
+    case 12: log_fatal("/!\\  DVD drive configuration failed   /!\\\n"); break;
+    case 13: log_fatal("/!\\    Dashboard failed to launch     /!\\\n"); break;
+    case 14: log_fatal("/!\\    Unspecified dashboard error    /!\\\n"); break;
+    case 16: log_fatal("/!\\     Dashboard settings error      /!\\\n"); break;
+    case 20: log_fatal("/!\\    Dashboard failed to launch     /!\\\n"); /* */
+        /**/ log_fatal("/!\\    (DVD authentication passed)    /!\\\n"); break;
+    case 21: log_fatal("/!\\         Unspecified error         /!\\\n"); break;
+    default: log_fatal("/!\\              Unknown              /!\\\n"); break;
+    }
+    log_fatal("/!\\                                   /!\\\n");
+    log_fatal("/!\\ --------------------------------- /!\\\n");
+
+    // Stop emulation on fatal errors if configured to do so
+    if (m_settings->emu_stopOnSMCFatalErrors) {
+        log_fatal("Received fatal error %02d; stopping.\n", smcErrorCode);
+        m_stopFunc(m_stopUserData);
+        return;
+    }
+    m_lastSMCErrorCode = smcErrorCode;
+}
+
+// ----- Kernel bug checks ----------------------------------------------------
+
+void SystemWatcher::PollThread() {
+    auto interval = std::chrono::milliseconds(m_settings->emu_bugCheckPollInterval);
+
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (m_running) {
+        m_cond.wait_for(lk, interval, [this] { return !m_running; });
+        if (!m_running) {
+            break;
+        }
+
+        lk.unlock();
+        CheckBugCheck();
+        lk.lock();
+    }
+}
+
+void SystemWatcher::CheckBugCheck() {
+    // Print kernel bugchecks
+    if (!LocateKernelData()) {
+        return;
+    }
+
+    uint32_t bugCheckCode[5] = { 0 };
+    if (!KernelRead(m_kExp_KiBugCheckData, 5 * sizeof(uint32_t), &bugCheckCode)) {
+        return;
+    }
+
+    if (bugCheckCode[0] != 0 && m_lastBugCheckCode != bugCheckCode[0]) {
+        log_fatal("/!\\ ---------------------------- /!\\\n");
+        log_fatal("/!\\   System issued a BugCheck   /!\\\n");
+        log_fatal("/!\\                              /!\\\n");
+        log_fatal("/!\\  BugCheck code   0x%08x  /!\\\n", bugCheckCode[0]);
+        log_fatal("/!\\  Parameter 1     0x%08x  /!\\\n", bugCheckCode[1]);
+        log_fatal("/!\\  Parameter 2     0x%08x  /!\\\n", bugCheckCode[2]);
+        log_fatal("/!\\  Parameter 3     0x%08x  /!\\\n", bugCheckCode[3]);
+        log_fatal("/!\\  Parameter 4     0x%08x  /!\\\n", bugCheckCode[4]);
+        log_fatal("/!\\                              /!\\\n");
+        log_fatal("/!\\ ---------------------------- /!\\\n");
+        m_lastBugCheckCode = bugCheckCode[0];
+    }
+}
+
+bool SystemWatcher::KernelRead(uint32_t vaddr, uint32_t size, void *value) {
+    if (vaddr < kKernelPhysicalMapBase) {
+        return false;
+    }
+    uint32_t paddr = vaddr - kKernelPhysicalMapBase;
+    if (paddr >= m_ramSize || size > m_ramSize - paddr) {
+        return false;
+    }
+    return m_cpu->MemRead(paddr, size, value) == CPUS_OP_OK;
+}
+
+bool SystemWatcher::LocateKernelData() {
+    // Return immediately if the kernel data has already been found
+    if (m_kernelDataFound) {
+        return true;
+    }
+
+    // Check if the kernel has been extracted and decrypted
+    uint16_t mzMagic = 0;
+    if (!KernelRead(0x80010000, sizeof(uint16_t), &mzMagic)) return false;
+    if (mzMagic != 0x5a4d) {
+        return false;
+    }
+
+    uint32_t peHeaderAddress = 0x00000000;
+    uint32_t baseOfCode = 0x00000000;
+    uint32_t exportsTableAddress = 0x00000000;
+
+    // Find PE header position and ensure it matches the magic value
+    if (!KernelRead(0x8001003c, sizeof(uint32_t), &peHeaderAddress)) return false;
+    peHeaderAddress += 0x80010000;
+    uint16_t peMagic = 0;
+    if (!KernelRead(peHeaderAddress, sizeof(uint16_t), &peMagic)) return false;
+    if (peMagic != 0x4550) {
+        return false;
+    }
+
+    // Find base of code and address of functions to locate the exports table
+    if (!KernelRead(peHeaderAddress + 0x2c, sizeof(uint32_t), &baseOfCode)) return false;
+    baseOfCode += 0x80010000;
+
+    // Find exports table
+    if (!KernelRead(baseOfCode + 0x1c, sizeof(uint32_t), &exportsTableAddress)) return false;
+    exportsTableAddress += 0x80010000;
+
+    // Get addresses of relevant exports
+    uint32_t kiBugCheckData;
+    uint32_t xboxKrnlVersion;
+    if (!KernelRead(exportsTableAddress + (162 - 1) * sizeof(uint32_t), sizeof(uint32_t), &kiBugCheckData)) return false;
+    if (!KernelRead(exportsTableAddress + (324 - 1) * sizeof(uint32_t), sizeof(uint32_t), &xboxKrnlVersion)) return false;
+    kiBugCheckData += 0x80010000;
+    xboxKrnlVersion += 0x80010000;
+
+    if (!KernelRead(xboxKrnlVersion, sizeof(XboxKernelVersion), &m_kernelVersion)) return false;
+
+    m_kExp_KiBugCheckData = kiBugCheckData;
+    m_kExp_XboxKrnlVersion = xboxKrnlVersion;
+
+    log_info("Microsoft Xbox Kernel detected\n");
+    log_info("  PE header           0x%08x  ->  0x%08x\n", peHeaderAddress, peHeaderAddress - kKernelPhysicalMapBase);
+    log_info("  Base of code        0x%08x  ->  0x%08x\n", baseOfCode, baseOfCode - kKernelPhysicalMapBase);
+    log_info("  Exports table       0x%08x  ->  0x%08x\n", exportsTableAddress, exportsTableAddress - kKernelPhysicalMapBase);
+    log_info("    KiBugCheckData    0x%08x  ->  0x%08x\n", m_kExp_KiBugCheckData, m_kExp_KiBugCheckData - kKernelPhysicalMapBase);
+    log_info("    XboxKrnlVersion   0x%08x  ->  0x%08x\n", m_kExp_XboxKrnlVersion, m_kExp_XboxKrnlVersion - kKernelPhysicalMapBase);
+    log_info("Xbox kernel version: %d.%d.%d.%d\n", m_kernelVersion.major, m_kernelVersion.minor, m_kernelVersion.build, m_kernelVersion.rev);
+    m_kernelDataFound = true;
+
+    return true;
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "vixen/cpu.h"
+#include "vixen/settings.h"
+#include "vixen/hw/sm/smc.h"
+
+namespace vixen {
+
+using namespace vixen::cpu;
+
+/*!
+ * Xbox kernel version data structure exported by Microsoft kernels.
+ */
+struct XboxKernelVersion {
+    uint16_t major;
+    uint16_t minor;
+    uint16_t build;
+    uint16_t rev;
+};
+
+/*!
+ * Function invoked when the watcher requests emulation to stop.
+ */
+typedef void (*WatcherStopFunc)(void *userData);
+
+/*!
+ * Watches the system for fatal conditions reported by the guest, keeping
+ * these checks off the CPU run loop.
+ *
+ * SMC fatal error codes are reported by the SMC as soon as they are written.
+ * Kernel bug checks are detected by polling the kernel's KiBugCheckData
+ * structure from a separate thread at a low frequency. Since the CPU state
+ * cannot be accessed outside of the CPU thread, the kernel is located and
+ * read through physical memory, relying on the fixed mapping of the Microsoft
+ * kernel at 0x80000000.
+ */
+class SystemWatcher {
+public:
+    SystemWatcher(Cpu *cpu, uint32_t ramSize, viXenSettings *settings, WatcherStopFunc stopFunc, void *stopUserData);
+    ~SystemWatcher();
+
+    /*!
+     * Registers the SMC fatal error code handler.
+     */
+    void WatchSMC(SMCDevice *smc);
+
+    /*!
+     * Starts polling for kernel bug checks, if enabled in the settings.
+     */
+    void Start();
+
+    /*!
+     * Stops the polling thread.
+     */
+    void Stop();
+
+private:
+    void HandleSMCErrorCode(uint8_t errorCode);
+    void PollThread();
+    void CheckBugCheck();
+    bool LocateKernelData();
+
+    /*!
+     * Reads from the kernel's virtual address space through physical memory.
+     */
+    bool KernelRead(uint32_t vaddr, uint32_t size, void *value);
+
+    Cpu *m_cpu;
+    uint32_t m_ramSize;
+    viXenSettings *m_settings;
+
+    WatcherStopFunc m_stopFunc;
+    void *m_stopUserData;
+
+    uint8_t  m_lastSMCErrorCode = 0;
+    uint32_t m_lastBugCheckCode = 0x00000000;
+
+    XboxKernelVersion m_kernelVersion = { 0 };
+
+    bool     m_kernelDataFound = false;
+    uint32_t m_kExp_KiBugCheckData = 0x00000000;
+    uint32_t m_kExp_XboxKrnlVersion = 0x00000000;
+
+    std::thread *m_thread = nullptr;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_running = false;
+
+    friend void SMCErrorCodeCallback(uint8_t errorCode, void *userData);
+    friend void WatcherThreadFunc(void *data);
+};
+
+}
@@ -21,6 +21,8 @@
 
 #ifdef __linux__
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 #endif
 
 #include "Zydis/Zydis.h"
@@ -69,8 +71,10 @@ const static uint8_t kDefaultEEPROM[] = {
 /*!
  * Constructor
  */
-Xbox::Xbox(vixen::modules::cpu::ICPUModule *cpuModule)
+Xbox::Xbox(vixen::modules::cpu::ICPUModule *cpuModule, vixen::modules::cpu::Capabilities cpuModuleCaps)
     : m_cpuModule(cpuModule)
+    , m_cpuModuleCaps(cpuModuleCaps)
+    , m_scheduler(m_clock)
 {
 }
 
@@ -78,6 +82,10 @@ Xbox::Xbox(vixen::modules::cpu::ICPUModule *cpuModule)
  * Destructor
  */
 Xbox::~Xbox() {
+    m_scheduler.Stop();
+    if (m_postedWriteTimer != nullptr) delete m_postedWriteTimer;
+    if (m_sliceTimer != nullptr) delete m_sliceTimer;
+    if (m_watcher != nullptr) delete m_watcher;
     if (m_cpu) m_cpuModule->FreeCPU(m_cpu);
     if (m_ram) {
 #ifdef _WIN32
@@ -95,8 +103,6 @@ Xbox::~Xbox() {
         munmap(m_rom, XBOX_ROM_AREA_SIZE);
 #endif
     }
-    if (m_bios != nullptr) delete[] m_bios;
-    if (m_mcpxROM != nullptr) delete[] m_mcpxROM;
     if (m_memRegion) delete m_memRegion;
 
     if (m_SMC != nullptr) delete m_SMC;
@@ -142,13 +148,11 @@ void Xbox::CopySettings(viXenSettings *settings) {
 }
 
 EmulatorStatus Xbox::Run() {
-    EmulatorStatus status = Initialize();
+    EmulatorStatus status = Start();
     if (status != EMUS_OK) {
         return status;
     }
 
-    m_should_run = true;
-
     // Start CPU emulation on a new thread
     uint32_t result;
     std::thread cpuIdleThread([&] { result = EmuCpuThreadFunc(this); });
@@ -156,11 +160,61 @@ EmulatorStatus Xbox::Run() {
     // Wait for the thread to exit
     cpuIdleThread.join();
 
-    Cleanup();
+    Finish();
+
+    return EMUS_OK;
+}
+
+EmulatorStatus Xbox::Start() {
+    EmulatorStatus status = Initialize();
+    if (status != EMUS_OK) {
+        return status;
+    }
+
+    m_should_run = true;
+
+    // Start servicing hardware timers. Deterministic clocks are advanced and
+    // serviced by the CPU thread.
+    if (!m_clock.IsDeterministic()) {
+        m_scheduler.Start();
+    }
+
+    // Start watching for kernel bug checks
+    m_watcher->Start();
 
     return EMUS_OK;
 }
 
+bool Xbox::RunSlice(uint64_t hostTimeNs) {
+    uint64_t deadline = UINT64_MAX;
+    uint64_t sliceLength = UINT64_MAX;
+    if (hostTimeNs != UINT64_MAX) {
+        deadline = VirtualClock::HostNow() + hostTimeNs;
+        sliceLength = m_clock.ToVirtualInterval(hostTimeNs);
+    }
+
+    // The deadline is only checked when the CPU exits, so kick this
+    // machine's CPU when the slice ends in case the guest keeps running
+    // without exits. Deterministic clocks advance on exits and cannot be
+    // used to preempt the CPU.
+    bool preempt = sliceLength != UINT64_MAX && m_sliceTimer != nullptr;
+    if (preempt) {
+        m_sliceTimer->ScheduleIn(sliceLength);
+    }
+    RunCpuUntil(deadline);
+    if (preempt) {
+        m_sliceTimer->Cancel();
+    }
+    return m_should_run;
+}
+
+void Xbox::Finish() {
+    m_watcher->Stop();
+    m_scheduler.Stop();
+
+    Cleanup();
+}
+
 void Xbox::Stop() {
     if (m_i8254 != nullptr) {
         m_i8254->Reset();
@@ -190,8 +244,10 @@ EmulatorStatus Xbox::Initialize() {
     result = InitFixupSettings(); if (result != EMUS_OK) return result;
     result = InitMemory(); if (result != EMUS_OK) return result;
     result = InitCPU(); if (result != EMUS_OK) return result;
+    result = InitClock(); if (result != EMUS_OK) return result;
     result = InitHardware(); if (result != EMUS_OK) return result;
     result = InitDebugger(); if (result != EMUS_OK) return result;
+    result = InitWatcher(); if (result != EMUS_OK) return result;
 
     log_info("Initialization completed\n");
 
@@ -221,24 +277,92 @@ EmulatorStatus Xbox::InitMemory() {
     return EMUS_OK;
 }
 
+#ifdef __linux__
+// Memory policy mode for mbind(), from <numaif.h>. The system call is invoked
+// directly to avoid depending on libnuma.
+#define VIXEN_MPOL_BIND  2
+
+static bool BindToNUMANode(void *addr, size_t size, int node) {
+    const size_t kBitsPerWord = sizeof(unsigned long) * 8;
+    unsigned long nodeMask[1024 / kBitsPerWord] = { 0 };
+    if (node < 0 || (size_t)node >= sizeof(nodeMask) * 8) {
+        return false;
+    }
+    nodeMask[node / kBitsPerWord] = 1ul << (node % kBitsPerWord);
+
+    // The kernel reads one bit less than the given maximum node count
+    return syscall(SYS_mbind, addr, size, VIXEN_MPOL_BIND, nodeMask, sizeof(nodeMask) * 8 + 1, 0) == 0;
+}
+
+static uint8_t *AllocateGuestRAM(uint32_t size, const viXenSettings& settings) {
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *ram = MAP_FAILED;
+
+    // Pages must be bound to the NUMA node before they are touched, so they
+    // can only be populated by mmap() if no binding is requested
+    bool populateOnMap = settings.ram_prefault && settings.ram_numaNode < 0;
+    if (populateOnMap) {
+        flags |= MAP_POPULATE;
+    }
+
+    // Huge pages are reserved on allocation, so that running out of them
+    // makes mmap() fail instead of crashing on a later page fault
+    if (settings.ram_backing == RAMB_HugeTLB) {
+        ram = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (ram == MAP_FAILED) {
+            log_warning("Could not allocate guest RAM from huge pages; falling back to regular pages\n");
+        }
+    }
+    if (ram == MAP_FAILED) {
+        ram = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags | MAP_NORESERVE, -1, 0);
+        if (ram == MAP_FAILED) {
+            return nullptr;
+        }
+        if (settings.ram_backing == RAMB_TransparentHugePages && madvise(ram, size, MADV_HUGEPAGE) != 0) {
+            log_warning("Transparent huge pages are not available for guest RAM\n");
+        }
+    }
+
+    if (settings.ram_numaNode >= 0) {
+        if (!BindToNUMANode(ram, size, settings.ram_numaNode)) {
+            log_warning("Could not bind guest RAM to NUMA node %d\n", settings.ram_numaNode);
+        }
+    }
+
+    if (settings.ram_prefault && !populateOnMap) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        for (uint32_t offset = 0; offset < size; offset += pageSize) {
+            ((volatile uint8_t *)ram)[offset] = 0;
+        }
+    }
+
+    // Anonymous pages are zero-filled by the host, no need to clear them
+    return (uint8_t *)ram;
+}
+#endif
+
 EmulatorStatus Xbox::InitRAM() {
     // Create RAM region
     m_ramSize = m_settings.ram_expanded ? XBOX_RAM_SIZE_DEBUG : XBOX_RAM_SIZE_RETAIL;
     log_debug("Allocating RAM (%d MiB)\n", m_ramSize >> 20);
 
 #ifdef _WIN32
+    if (m_settings.ram_backing != RAMB_Default || m_settings.ram_numaNode >= 0) {
+        log_warning("Guest RAM backing options are not supported on this platform\n");
+    }
     m_ram = (uint8_t *)valloc(m_ramSize);
+    if (m_ram == NULL) {
+        return EMUS_INIT_ALLOC_RAM_FAILED;
+    }
+    memset(m_ram, 0, m_ramSize);
 #endif
 
 #ifdef __linux__
-    m_ram = (uint8_t *)mmap(nullptr, m_ramSize, PROT_READ | PROT_WRITE,
-        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-#endif
-
-    if (m_ram == NULL) {
+    m_ram = AllocateGuestRAM(m_ramSize, m_settings);
+    if (m_ram == nullptr) {
         return EMUS_INIT_ALLOC_RAM_FAILED;
     }
-    memset(m_ram, 0, m_ramSize);
+#endif
 
     // Map RAM at address 0x00000000
     MemoryRegion *rgn = new MemoryRegion(MEM_REGION_RAM, 0x00000000, m_ramSize, m_ram);
@@ -256,17 +380,20 @@ EmulatorStatus Xbox::InitROM() {
 
 #ifdef _WIN32
     m_rom = (uint8_t *)valloc(XBOX_ROM_AREA_SIZE);
+    if (m_rom == NULL) {
+        return EMUS_INIT_ALLOC_ROM_FAILED;
+    }
+    memset(m_rom, 0, XBOX_ROM_AREA_SIZE);
 #endif
 
 #ifdef __linux__
     m_rom = (uint8_t *)mmap(nullptr, XBOX_ROM_AREA_SIZE, PROT_READ | PROT_WRITE,
         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
-#endif
-
-    if (m_rom == NULL) {
+    if (m_rom == MAP_FAILED) {
+        m_rom = nullptr;
         return EMUS_INIT_ALLOC_ROM_FAILED;
     }
-    memset(m_rom, 0, XBOX_ROM_AREA_SIZE);
+#endif
 
     // Map ROM to address 0xFF000000
     MemoryRegion *rgn = new MemoryRegion(MEM_REGION_ROM, 0xFF000000, XBOX_ROM_AREA_SIZE, m_rom);
@@ -275,53 +402,49 @@ EmulatorStatus Xbox::InitROM() {
     }
     m_memRegion->AddSubRegion(rgn);
 
-    // Load ROM files
-    FILE *fp;
-    long sz;
-
-    // Load MCPX ROM
+    // Load ROM files. The images are shared with other machines in the
+    // process that use the same files.
     log_debug("Loading MCPX ROM %s... ", m_settings.rom_mcpx);
-    fp = fopen(m_settings.rom_mcpx, "rb");
-    if (fp == NULL) {
+    m_mcpxROM = SharedFileImage::Open(m_settings.rom_mcpx);
+    if (m_mcpxROM == nullptr) {
         log_debug("file %s could not be opened\n", m_settings.rom_mcpx);
         return EMUS_INIT_MCPX_ROM_NOT_FOUND;
     }
-    fseek(fp, 0, SEEK_END);
-    sz = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    if (sz != 512) {
-        log_debug("incorrect file size: %d (must be 512 bytes)\n", sz);
+    if (m_mcpxROM->GetSize() != 512) {
+        log_debug("incorrect file size: %llu (must be 512 bytes)\n", (unsigned long long)m_mcpxROM->GetSize());
         return EMUS_INIT_MCPX_ROM_INVALID_SIZE;
     }
-    m_mcpxROM = new uint8_t[sz];
-    fread(m_mcpxROM, 1, sz, fp);
-    fclose(fp);
     log_debug("OK\n");
 
-    // Load BIOS ROM
     log_debug("Loading BIOS ROM %s... ", m_settings.rom_bios);
-    fp = fopen(m_settings.rom_bios, "rb");
-    if (fp == NULL) {
+    m_bios = SharedFileImage::Open(m_settings.rom_bios);
+    if (m_bios == nullptr) {
         log_debug("file %s could not be opened\n", m_settings.rom_bios);
         return EMUS_INIT_BIOS_ROM_NOT_FOUND;
     }
-    fseek(fp, 0, SEEK_END);
-    sz = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
+    uint64_t sz = m_bios->GetSize();
     if (sz != KiB(256) && sz != MiB(1)) {
-        log_debug("incorrect file size: %d (must be 256 KiB or 1024 KiB)\n", sz);
+        log_debug("incorrect file size: %llu (must be 256 KiB or 1024 KiB)\n", (unsigned long long)sz);
         return EMUS_INIT_BIOS_ROM_INVALID_SIZE;
     }
-    m_bios = new uint8_t[sz];
-    fread(m_bios, 1, sz, fp);
-    fclose(fp);
-    log_debug("OK (%d KiB)\n", sz >> 10);
-
-    m_biosSize = sz;
+    log_debug("OK (%d KiB)\n", (uint32_t)(sz >> 10));
+
+    // Mirror the BIOS ROM across the ROM area with copy-on-write views of the
+    // file, so that only the pages overlaid by the MCPX ROM become private to
+    // this machine. The LPC device copies the image into any mirror that
+    // could not be mapped.
+    for (uint32_t addr = 0; addr < XBOX_ROM_AREA_SIZE; addr += sz) {
+        if (!m_bios->MapCopyOnWrite(m_rom + addr, sz)) {
+            break;
+        }
+    }
 
     return EMUS_OK;
 }
 
+// Interval between deliveries of posted writes, in nanoseconds
+static const uint64_t kPostedWriteFlushInterval = 1000000;
+
 EmulatorStatus Xbox::InitCPU() {
     log_debug("Initializing CPU\n");
     if (m_cpuModule == nullptr) {
@@ -333,11 +456,37 @@ EmulatorStatus Xbox::InitCPU() {
         log_fatal("CPU instantiation failed\n");
         return EMUS_INIT_CPU_CREATE_FAILED;
     }
+
+    // The in-kernel PIT follows the host's clock, so it can only be used if
+    // the guest clock does the same
+    if (m_settings.cpu_inKernelIRQChip) {
+        if (!m_cpuModuleCaps.inKernelIRQChip) {
+            log_warning("The CPU module does not support an in-kernel IRQ chip\n");
+        }
+        else if (m_settings.emu_clockMode != VCM_RealTime) {
+            log_warning("The in-kernel IRQ chip requires the real time clock mode\n");
+        }
+        else {
+            log_info("Using the in-kernel IRQ chip\n");
+            m_cpu->UseInKernelIRQChip(true);
+        }
+    }
+
     if (m_cpu->Initialize(&m_ioMapper)) {
         log_fatal("CPU initialization failed\n");
         return EMUS_INIT_CPU_INIT_FAILED;
     }
 
+    // Posted writes are delivered whenever the CPU exits to user space. With
+    // the interrupt controllers in the kernel, timer interrupts no longer
+    // cause exits, so devices polled through RAM could starve.
+    if (m_cpu->HasInKernelIRQChip()) {
+        m_postedWriteTimer = new ScheduledTimer(m_scheduler, PostedWriteTimerCB, this);
+        m_postedWriteTimer->ScheduleIn(kPostedWriteFlushInterval);
+    }
+
+    m_sliceTimer = new ScheduledTimer(m_scheduler, SliceTimerCB, this);
+
     // Allow CPU to update memory map
     auto result = m_cpu->MemMap(m_memRegion);
     if (result != CPUS_MMAP_OK) {
@@ -347,6 +496,29 @@ EmulatorStatus Xbox::InitCPU() {
     return EMUS_OK;
 }
 
+void Xbox::PostedWriteTimerCB(void *userData) {
+    Xbox *xbox = (Xbox *)userData;
+    xbox->m_cpu->FlushPostedWrites();
+    xbox->m_postedWriteTimer->Schedule(xbox->m_postedWriteTimer->GetDeadline() + kPostedWriteFlushInterval);
+}
+
+void Xbox::SliceTimerCB(void *userData) {
+    Xbox *xbox = (Xbox *)userData;
+    xbox->m_cpu->RequestExit();
+}
+
+EmulatorStatus Xbox::InitClock() {
+    m_clock.SetMode(m_settings.emu_clockMode, m_settings.emu_clockScale);
+
+    switch (m_settings.emu_clockMode) {
+    case VCM_RealTime: log_info("Clock: real time\n"); break;
+    case VCM_Scaled: log_info("Clock: scaled by %.3f\n", m_settings.emu_clockScale); break;
+    case VCM_Deterministic: log_info("Clock: deterministic, %u ns per CPU exit\n", m_settings.emu_clockQuantum); break;
+    }
+
+    return EMUS_OK;
+}
+
 EmulatorStatus Xbox::InitHardware() {
     // Determine which revisions of which components should be used for the
     // specified hardware model
@@ -362,7 +534,7 @@ EmulatorStatus Xbox::InitHardware() {
 
     // Create basic system devices
     m_i8259 = new i8259(*m_cpu);
-    m_i8254 = new i8254(*m_i8259, m_settings.hw_sysclock_tickRate);
+    m_i8254 = new i8254(*m_i8259, m_scheduler, m_cpu->HasInKernelIRQChip());
     m_CMOS = new CMOS();
 
     // Create ATA devices
@@ -434,7 +606,7 @@ EmulatorStatus Xbox::InitHardware() {
             }
             m_CharDrivers[i]->Init();
         }
-        m_SuperIO = new SuperIO(*m_i8259, m_CharDrivers);
+        m_SuperIO = new SuperIO(*m_i8259, m_scheduler, m_CharDrivers);
         m_SuperIO->Init();
     }
     else {
@@ -457,16 +629,22 @@ EmulatorStatus Xbox::InitHardware() {
     m_ADM1032 = new ADM1032Device();
     m_HostBridge = new HostBridgeDevice();
     m_MCPXRAM = new MCPXRAMDevice(mcpxRevision);
-    m_LPC = new LPCDevice(m_IRQs, m_rom, m_bios, m_biosSize, m_mcpxROM, m_settings.hw_revision != DebugKit);
-    m_USB1 = new USBPCIDevice(1, *m_cpu);
-    m_USB2 = new USBPCIDevice(9, *m_cpu);
+    m_LPC = new LPCDevice(m_IRQs, m_rom, m_bios->GetData(), (uint32_t)m_bios->GetSize(), m_mcpxROM->GetData(), m_settings.hw_revision != DebugKit);
+    m_USB1 = new USBPCIDevice(1, *m_cpu, m_scheduler);
+    m_USB2 = new USBPCIDevice(9, *m_cpu, m_scheduler);
     m_NVNet = new NVNetDevice();
     m_NVAPU = new NVAPUDevice();
     m_AC97 = new AC97Device();
     m_PCIBridge = new PCIBridgeDevice();
-    m_BMIDE = new hw::bmide::BMIDEDevice(m_ram, m_ramSize, *m_ATA);
+    m_BMIDE = new hw::bmide::BMIDEDevice(*m_cpu, *m_ATA);
     m_AGPBridge = new AGPBridgeDevice();
-    m_NV2A = new NV2ADevice(m_ram, m_ramSize, *m_i8259);
+    // The raster threads are shared by all machines in the process
+    uint32_t rasterThreads = (uint32_t)m_settings.gpu_rasterThreads;
+    if (m_settings.gpu_rasterThreads < 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        rasterThreads = (cores > 1) ? cores - 1 : 0;
+    }
+    m_NV2A = new NV2ADevice(*m_cpu, m_ram, m_ramSize, *m_i8259, m_scheduler, rasterThreads);
 
     // Configure IRQs
     m_acpiIRQs = AllocateIRQs(m_LPC, 2);
@@ -530,6 +708,31 @@ EmulatorStatus Xbox::InitHardware() {
         m_SuperIO->MapIO(&m_ioMapper);
     }
 
+    // Name devices for I/O statistics reports
+    m_ioStats.SetDeviceName(m_i8259, "i8259");
+    m_ioStats.SetDeviceName(m_i8254, "i8254");
+    m_ioStats.SetDeviceName(m_CMOS, "CMOS");
+    m_ioStats.SetDeviceName(m_ATA, "ATA");
+    m_ioStats.SetDeviceName(m_PCIBus, "PCI bus");
+    if (m_settings.hw_enableSuperIO) {
+        m_ioStats.SetDeviceName(m_SuperIO, "SuperIO");
+    }
+    NamePCIDeviceBARs(m_HostBridge, "Host bridge");
+    NamePCIDeviceBARs(m_MCPXRAM, "MCPX RAM");
+    NamePCIDeviceBARs(m_LPC, "LPC");
+    NamePCIDeviceBARs(m_SMBus, "SMBus");
+    NamePCIDeviceBARs(m_USB1, "USB1");
+    NamePCIDeviceBARs(m_USB2, "USB2");
+    NamePCIDeviceBARs(m_NVNet, "NVNet");
+    NamePCIDeviceBARs(m_NVAPU, "NVAPU");
+    NamePCIDeviceBARs(m_AC97, "AC97");
+    NamePCIDeviceBARs(m_PCIBridge, "PCI bridge");
+    NamePCIDeviceBARs(m_BMIDE, "BMIDE");
+    NamePCIDeviceBARs(m_AGPBridge, "AGP bridge");
+    NamePCIDeviceBARs(m_NV2A, "NV2A");
+
+    EnableIOStatistics(m_settings.debug_ioStatistics);
+
     // TODO: Handle other SMBUS Addresses, like PIC_ADDRESS, XCALIBUR_ADDRESS
     // Resources:
     // http://pablot.com/misc/fancontroller.cpp
@@ -570,15 +773,35 @@ EmulatorStatus Xbox::InitDebugger() {
     return EMUS_OK;
 }
 
+static void WatcherStop(void *userData) {
+    ((Xbox *)userData)->Stop();
+}
+
+EmulatorStatus Xbox::InitWatcher() {
+    m_watcher = new SystemWatcher(m_cpu, m_ramSize, &m_settings, WatcherStop, this);
+    m_watcher->WatchSMC(m_SMC);
+
+    return EMUS_OK;
+}
+
 /*!
  * Advances the CPU emulation state.
  */
-int Xbox::RunCpu()
+int Xbox::RunCpu() {
+    return RunCpuUntil(UINT64_MAX);
+}
+
+/*!
+ * Advances the CPU emulation state until the emulator stops or the host's
+ * clock reaches the deadline, in nanoseconds. The deadline is only checked
+ * when the CPU exits.
+ */
+int Xbox::RunCpuUntil(uint64_t deadline)
 {
 #if defined(_DEBUG) && 0
     Timer t;
 #endif
-    int result;
+    int result = 0;
     struct CpuExitInfo *exit_info;
 
     if (!m_should_run) {
@@ -586,6 +809,19 @@ int Xbox::RunCpu()
     }
 
     while (m_should_run) {
+        // Wait for an interrupt if the CPU executed HLT, giving up the rest
+        // of the slice if none arrives in time
+        if (m_cpuHalted) {
+            if (!IdleCpu(deadline)) {
+                log_info("CPU halted\n");
+                Stop();
+                break;
+            }
+            if (m_cpuHalted) {
+                break;
+            }
+        }
+
         // Run CPU emulation
 #if defined(_DEBUG) && 0
         t.Start();
@@ -656,72 +892,10 @@ int Xbox::RunCpu()
             break;
         }
 
-        // Parse fatal error code
-        uint8_t smcErrorCode = m_SMC->GetRegister(SMCRegister::ErrorCode);
-
-        // Display fatal error code and description
-        // See http://xboxdevwiki.net/Fatal_Error
-        // See https://assemblergames.com/threads/xbox-error-codes-repair-reference-tips.62966/
-        if (smcErrorCode != 0 && m_lastSMCErrorCode != smcErrorCode) {
-            log_error("/!\\ --------------------------------- /!\\\n");
-            log_fatal("/!\\    System issued a Fatal Error    /!\\\n");
-            log_fatal("/!\\                                   /!\\\n");
-            log_fatal("/!\\        Fatal error code %02d        /!\\\n", smcErrorCode);
-            switch (smcErrorCode) {
-            case  2: log_fatal("/!\\      Invalid EEPROM checksum      /!\\\n"); break;
-            case  4: log_fatal("/!\\         RAM check failure         /!\\\n"); break;
-            case  5: log_fatal("/!\\       Hard drive not locked       /!\\\n"); break;
-            case  6: log_fatal("/!\\    Unable to unlock hard drive    /!\\\n"); break;
-            case  7: log_fatal("/!\\        Hard drive timeout         /!\\\n"); break;
-            case  8: log_fatal("/!\\        No hard drive found        /!\\\n"); break;
-            case  9: log_fatal("/!\\  Hard drive configuration failed  /!\\\n"); break;
-            case 10: log_fatal("/!\\         DVD drive timeout         /!\\\n"); break;
-            case 11: log_fatal("/!\\        No DVD drive found         /!\\\n"); break;
-            case 12: log_fatal("/!\\  DVD drive configuration failed   /!\\\n"); break;
-            case 13: log_fatal("/!\\    Dashboard failed to launch     /!\\\n"); break;
-            case 14: log_fatal("/!\\    Unspecified dashboard error    /!\\\n"); break;
-            case 16: log_fatal("/!\\     Dashboard settings error      /!\\\n"); break;
-            case 20: log_fatal("/!\\    Dashboard failed to launch     /!\\\n"); /* */
-                /**/ log_fatal("/!\\    (DVD authentication passed)    /!\\\n"); break;
-            case 21: log_fatal("/!\\         Unspecified error         /!\\\n"); break;
-            default: log_fatal("/!\\              Unknown              /!\\\n"); break;
-            }
-            log_fatal("/!\\                                   /!\\\n");
-            log_fatal("/!\\ --------------------------------- /!\\\n");
-
-            // Stop emulation on fatal errors if configured to do so
-            if (m_settings.emu_stopOnSMCFatalErrors) {
-                log_fatal("Received fatal error %02d; stopping.\n", smcErrorCode);
-                Stop();
-                break;
-            }
-            m_lastSMCErrorCode = smcErrorCode;
-        }
-
-        // Print kernel bugchecks and wait for input
-        if (m_settings.emu_stopOnBugChecks && LocateKernelData()) {
-            uint32_t bugCheckCode[5] = { 0 };
-            if (m_cpu->VMemRead(m_kExp_KiBugCheckData, 5 * sizeof(uint32_t), &bugCheckCode) == 0) {
-                if (bugCheckCode[0] != 0 && m_lastBugCheckCode != bugCheckCode[0]) {
-                    log_fatal("/!\\ ---------------------------- /!\\\n");
-                    log_fatal("/!\\   System issued a BugCheck   /!\\\n");
-                    log_fatal("/!\\                              /!\\\n");
-                    log_fatal("/!\\  BugCheck code   0x%08x  /!\\\n", bugCheckCode[0]);
-                    log_fatal("/!\\  Parameter 1     0x%08x  /!\\\n", bugCheckCode[1]);
-                    log_fatal("/!\\  Parameter 2     0x%08x  /!\\\n", bugCheckCode[2]);
-                    log_fatal("/!\\  Parameter 3     0x%08x  /!\\\n", bugCheckCode[3]);
-                    log_fatal("/!\\  Parameter 4     0x%08x  /!\\\n", bugCheckCode[4]);
-                    log_fatal("/!\\                              /!\\\n");
-                    log_fatal("/!\\ ---------------------------- /!\\\n");
-                    m_lastBugCheckCode = bugCheckCode[0];
-                }
-            }
-        }
-
         // Handle reason for the CPU to exit
         exit_info = m_cpu->GetExitInfo();
         switch (exit_info->reason) {
-        case CPU_EXIT_HLT:      log_info("CPU halted\n");          Stop(); break;
+        case CPU_EXIT_HLT: m_cpuHalted = true; break;
         case CPU_EXIT_SHUTDOWN: log_info("VM is shutting down\n"); Stop(); break;
         case CPU_EXIT_HW_BREAKPOINT:
         case CPU_EXIT_SW_BREAKPOINT:
@@ -750,11 +924,69 @@ int Xbox::RunCpu()
         }
         default: break;
         }
+
+        // Advance deterministic clocks by a fixed amount on every exit and
+        // service the timers that expired
+        if (m_clock.IsDeterministic()) {
+            m_clock.Advance(m_settings.emu_clockQuantum);
+            m_scheduler.RunExpired();
+        }
+
+        if (deadline != UINT64_MAX && VirtualClock::HostNow() >= deadline) {
+            break;
+        }
     }
 
     return result;
 }
 
+// Maximum amount of time to wait for an interrupt while idle before checking
+// if the emulator is still running
+static const uint32_t kIdleWaitTimeoutMs = 10;
+
+/*!
+ * Waits for an interrupt to wake up the CPU after it executed HLT. Clears
+ * m_cpuHalted once the CPU is woken up; the CPU stays halted if the emulator
+ * is stopped or the host's clock reaches the deadline first.
+ *
+ * When idle skipping is enabled or the clock is deterministic, the virtual
+ * clock is fast-forwarded to the next timer deadline instead of waiting for
+ * it to come by, and the timer is serviced on this thread.
+ *
+ * Returns false if the CPU cannot be woken up by an interrupt.
+ */
+bool Xbox::IdleCpu(uint64_t deadline) {
+    // HLT with interrupts disabled halts the CPU for good
+    uint32_t eflags;
+    if (m_cpu->RegRead(REG_EFLAGS, &eflags) != CPUS_OP_OK || (eflags & IF_MASK) == 0) {
+        return false;
+    }
+
+    bool skipIdle = m_settings.emu_skipIdle || m_clock.IsDeterministic();
+    while (m_should_run) {
+        bool skipped = skipIdle && m_scheduler.SkipToNextDeadline();
+        if (skipped) {
+            // Only deterministic clocks have their timers serviced on this
+            // thread; otherwise the scheduler thread runs them, and skipping
+            // again before it does would race ahead of the callbacks
+            if (m_clock.IsDeterministic()) {
+                m_scheduler.RunExpired();
+            }
+            else {
+                m_scheduler.WaitForExpired();
+            }
+        }
+        if (m_cpu->WaitForInterrupt(skipped ? 0 : kIdleWaitTimeoutMs)) {
+            m_cpuHalted = false;
+            return true;
+        }
+        if (deadline != UINT64_MAX && VirtualClock::HostNow() >= deadline) {
+            break;
+        }
+    }
+    return true;
+}
+
 void Xbox::Cleanup() {
     if (LOG_LEVEL >= LOG_LEVEL_DEBUG) {
         log_debug("CPU state at the end of execution:\n");
@@ -863,81 +1095,30 @@ void Xbox::Cleanup() {
     if (m_settings.gdb_enable) {
         m_gdb->Shutdown();
     }
-}
 
-// CPU emulation thread function
-uint32_t Xbox::EmuCpuThreadFunc(void *data) {
-    Thread_SetName("[HW] CPU");
-    Xbox *xbox = (Xbox *)data;
-    return xbox->RunCpu();
-}
-
-bool Xbox::LocateKernelData() {
-    // Return immediately if the kernel data has already been found
-    if (m_kernelDataFound) {
-        return true;
-    }
-
-    // Check if the kernel has been extracted and decrypted
-    uint32_t eip;
-    m_cpu->RegRead(REG_EIP, &eip);
-    if (eip >= 0x80000000) {
-        uint16_t mzMagic = 0;
-        if (m_cpu->VMemRead(0x80010000, sizeof(uint16_t), &mzMagic)) return false;
-        if (mzMagic != 0x5a4d) {
-            return false;
+    if (m_ioMapper.GetStatistics() != nullptr) {
+        if (m_ioStats.DumpJSON(m_settings.debug_ioStatistics_path)) {
+            log_info("I/O statistics written to %s\n", m_settings.debug_ioStatistics_path);
         }
     }
+}
 
-    uint32_t peHeaderAddress = 0x00000000;
-    uint32_t baseOfCode = 0x00000000;
-    uint32_t exportsTableAddress = 0x00000000;
+void Xbox::EnableIOStatistics(bool enable) {
+    m_ioMapper.SetStatistics(enable ? &m_ioStats : nullptr);
+}
 
-    // Find PE header position and ensure it matches the magic value
-    if (m_cpu->VMemRead(0x8001003c, sizeof(uint32_t), &peHeaderAddress)) return false;
-    peHeaderAddress += 0x80010000;
-    uint16_t peMagic = 0;
-    if (m_cpu->VMemRead(peHeaderAddress, sizeof(uint16_t), &peMagic)) return false;
-    if (peMagic != 0x4550) {
-        peHeaderAddress = 0x00000000;
-        return false;
+void Xbox::NamePCIDeviceBARs(PCIDevice *device, const char *name) {
+    char barName[64];
+    for (int i = 0; i < PCI_NUM_BARS_DEVICE; i++) {
+        snprintf(barName, sizeof(barName), "%s BAR%d", name, i);
+        m_ioStats.SetDeviceName(device->GetBARDevice(i), barName);
     }
+}
 
-    // Find base of code and address of functions to locate the exports table
-    if (m_cpu->VMemRead(peHeaderAddress + 0x2c, sizeof(uint32_t), &baseOfCode)) return false;
-    baseOfCode += 0x80010000;
-
-    // Find exports table
-    if (m_cpu->VMemRead(baseOfCode + 0x1c, sizeof(uint32_t), &exportsTableAddress)) return false;
-    exportsTableAddress += 0x80010000;
-
-    // Get addresses of relevant exports
-#define GET_EXPORT(name, num) do { if (m_cpu->VMemRead(exportsTableAddress + ((num - 1) * sizeof(uint32_t)), sizeof(uint32_t), &m_kExp_##name)) { return false; } m_kExp_##name += 0x80010000; } while (0)
-    GET_EXPORT(KiBugCheckData, 162);
-    GET_EXPORT(XboxKrnlVersion, 324);
-#undef GET_EXPORT
-
-    uint32_t pKernelPEHeaderPos;
-    uint32_t pKernelBaseOfCode;
-    uint32_t pKernelExportsTableAddress;
-    uint32_t pKiBugCheckData;
-    uint32_t pXboxKrnlVersion;
-    m_cpu->VirtualToPhysical(peHeaderAddress, &pKernelPEHeaderPos);
-    m_cpu->VirtualToPhysical(baseOfCode, &pKernelBaseOfCode);
-    m_cpu->VirtualToPhysical(exportsTableAddress, &pKernelExportsTableAddress);
-    m_cpu->VirtualToPhysical(m_kExp_KiBugCheckData, &pKiBugCheckData);
-    m_cpu->VirtualToPhysical(m_kExp_XboxKrnlVersion, &pXboxKrnlVersion);
-    log_info("Microsoft Xbox Kernel detected\n");
-    log_info("  PE header           0x%08x  ->  0x%p\n", peHeaderAddress, m_ram + pKernelPEHeaderPos);
-    log_info("  Base of code        0x%08x  ->  0x%p\n", baseOfCode, m_ram + pKernelBaseOfCode);
-    log_info("  Exports table       0x%08x  ->  0x%p\n", exportsTableAddress, m_ram + pKernelExportsTableAddress);
-    log_info("    KiBugCheckData    0x%08x  ->  0x%p\n", m_kExp_KiBugCheckData, m_ram + pKiBugCheckData);
-    log_info("    XboxKrnlVersion   0x%08x  ->  0x%p\n", m_kExp_XboxKrnlVersion, m_ram + pXboxKrnlVersion);
-    m_kernelDataFound = true;
-
-    m_cpu->VMemRead(m_kExp_XboxKrnlVersion, sizeof(XboxKernelVersion), &m_kernelVersion);
-    log_info("Xbox kernel version: %d.%d.%d.%d\n", m_kernelVersion.major, m_kernelVersion.minor, m_kernelVersion.build, m_kernelVersion.rev);
-
-    return true;
+// CPU emulation thread function
+uint32_t Xbox::EmuCpuThreadFunc(void *data) {
+    Thread_SetName("[HW] CPU");
+    Xbox *xbox = (Xbox *)data;
+    return xbox->RunCpu();
 }
 }
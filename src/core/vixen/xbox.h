@@ -8,18 +8,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <memory>
 #include <vector>
 
 #include "vixen/cpu.h"
 #include "vixen/dev.h"
 #include "vixen/emulator.h"
+#include "vixen/fileimage.h"
 #include "vixen/gdbserver.h"
 #include "vixen/log.h"
 #include "vixen/mem.h"
+#include "vixen/virtual_clock.h"
+#include "vixen/scheduler.h"
 #include "vixen/util.h"
 #include "vixen/thread.h"
 #include "vixen/settings.h"
 #include "vixen/status.h"
+#include "vixen/watcher.h"
 
 #include "vixen/hw/basic/irq.h"
 #include "vixen/hw/basic/gsi.h"
@@ -54,16 +59,6 @@
 
 namespace vixen {
 
-/*!
- * Xbox kernel version data structure exported by Microsoft kernels.
- */
-struct XboxKernelVersion {
-    uint16_t major;
-    uint16_t minor;
-    uint16_t build;
-    uint16_t rev;
-};
-
 /*!
  * Top-level Xbox machine class
  *
@@ -72,7 +67,7 @@ struct XboxKernelVersion {
  */
 class Xbox : Emulator {
 public:
-    Xbox(vixen::modules::cpu::ICPUModule *cpuModule);
+    Xbox(vixen::modules::cpu::ICPUModule *cpuModule, vixen::modules::cpu::Capabilities cpuModuleCaps);
     virtual ~Xbox();
 
     viXenSettings *GetSettings() { return &m_settings; }
@@ -81,6 +76,34 @@ public:
     EmulatorStatus Run();
     void Stop();
 
+    /*!
+     * Initializes the machine and starts its hardware without running the
+     * CPU, which is then driven by calling RunSlice() until it returns false,
+     * followed by Finish(). Run() does all of this on a dedicated thread.
+     */
+    EmulatorStatus Start();
+
+    /*!
+     * Runs the CPU on the calling thread for the specified amount of host
+     * time, in nanoseconds, or until the emulator stops. The slice may overrun
+     * since it can only end when the CPU exits to the emulator.
+     *
+     * Returns false once the emulator has stopped.
+     */
+    bool RunSlice(uint64_t hostTimeNs);
+
+    /*!
+     * Stops the hardware and cleans up after the emulator has stopped.
+     */
+    void Finish();
+
+    /*!
+     * Enables or disables collection of I/O and MMIO access statistics.
+     * Collection starts enabled if debug_ioStatistics is set.
+     */
+    void EnableIOStatistics(bool enable);
+    IOStatistics *GetIOStatistics() { return &m_ioStats; }
+
 protected:
     // ----- Initialization and cleanup ---------------------------------------
     EmulatorStatus Initialize();
@@ -89,83 +112,97 @@ protected:
     EmulatorStatus InitRAM();
     EmulatorStatus InitROM();
     EmulatorStatus InitCPU();
+    EmulatorStatus InitClock();
     EmulatorStatus InitHardware();
     EmulatorStatus InitDebugger();
+    EmulatorStatus InitWatcher();
 
     void Cleanup();
 
+    void NamePCIDeviceBARs(PCIDevice *device, const char *name);
+
     // ----- Thread functions -------------------------------------------------
     int RunCpu();
+    int RunCpuUntil(uint64_t deadline);
+    bool IdleCpu(uint64_t deadline);
 
     // ----- Friends ----------------------------------------------------------
     static uint32_t EmuCpuThreadFunc(void *data);
+    static void PostedWriteTimerCB(void *userData);
+    static void SliceTimerCB(void *userData);
 
     // ----- Modules ----------------------------------------------------------
     vixen::modules::cpu::ICPUModule *m_cpuModule;
+    vixen::modules::cpu::Capabilities m_cpuModuleCaps;
 
     // ----- Hardware ---------------------------------------------------------
-    Cpu              *m_cpu;
-    uint32_t          m_ramSize;
-    uint8_t          *m_ram;
-    uint8_t          *m_rom;
-    uint8_t          *m_bios;
-    uint32_t          m_biosSize;
-    uint8_t          *m_mcpxROM;
-    MemoryRegion     *m_memRegion;
+    Cpu              *m_cpu = nullptr;
+    uint32_t          m_ramSize = 0;
+    uint8_t          *m_ram = nullptr;
+    uint8_t          *m_rom = nullptr;
+    MemoryRegion     *m_memRegion = nullptr;
+
+    // ROM images, shared with other machines using the same files
+    std::shared_ptr<SharedFileImage> m_bios;
+    std::shared_ptr<SharedFileImage> m_mcpxROM;
+
     IOMapper          m_ioMapper;
+    IOStatistics      m_ioStats;
+    VirtualClock      m_clock;
+    Scheduler         m_scheduler;
+
+    // Delivers posted writes when the CPU rarely exits to user space
+    ScheduledTimer   *m_postedWriteTimer = nullptr;
+
+    // Preempts the CPU at the end of a slice when it rarely exits
+    ScheduledTimer   *m_sliceTimer = nullptr;
     
-    GSI              *m_GSI;
-    IRQ              *m_IRQs;
-    IRQ              *m_acpiIRQs;
-    IRQ              *m_i8259IRQs;
-
-    i8254            *m_i8254;
-    i8259            *m_i8259;
-    CMOS             *m_CMOS;
-    hw::ata::ATA     *m_ATA;
-    hw::ata::IATADeviceDriver *m_ataDrivers[2][2];
-    CharDriver       *m_CharDrivers[SUPERIO_SERIAL_PORT_COUNT];
-    SuperIO          *m_SuperIO;
-
-    SMBus            *m_SMBus;
-    SMCDevice        *m_SMC;
-    EEPROMDevice     *m_EEPROM;
-    TVEncoderDevice  *m_TVEncoder;
-    ADM1032Device    *m_ADM1032;
-
-    PCIBus           *m_PCIBus;
-    HostBridgeDevice *m_HostBridge;
-    MCPXRAMDevice    *m_MCPXRAM;
-    LPCDevice        *m_LPC;
-    USBPCIDevice     *m_USB1;
-    USBPCIDevice     *m_USB2;
-    NVNetDevice      *m_NVNet;
-    NVAPUDevice      *m_NVAPU;
-    AC97Device       *m_AC97;
-    PCIBridgeDevice  *m_PCIBridge;
-    hw::bmide::BMIDEDevice *m_BMIDE;
-    AGPBridgeDevice  *m_AGPBridge;
-    NV2ADevice       *m_NV2A;
+    GSI              *m_GSI = nullptr;
+    IRQ              *m_IRQs = nullptr;
+    IRQ              *m_acpiIRQs = nullptr;
+    IRQ              *m_i8259IRQs = nullptr;
+
+    i8254            *m_i8254 = nullptr;
+    i8259            *m_i8259 = nullptr;
+    CMOS             *m_CMOS = nullptr;
+    hw::ata::ATA     *m_ATA = nullptr;
+    hw::ata::IATADeviceDriver *m_ataDrivers[2][2] = { { nullptr } };
+    CharDriver       *m_CharDrivers[SUPERIO_SERIAL_PORT_COUNT] = { nullptr };
+    SuperIO          *m_SuperIO = nullptr;
+
+    SMBus            *m_SMBus = nullptr;
+    SMCDevice        *m_SMC = nullptr;
+    EEPROMDevice     *m_EEPROM = nullptr;
+    TVEncoderDevice  *m_TVEncoder = nullptr;
+    ADM1032Device    *m_ADM1032 = nullptr;
+
+    PCIBus           *m_PCIBus = nullptr;
+    HostBridgeDevice *m_HostBridge = nullptr;
+    MCPXRAMDevice    *m_MCPXRAM = nullptr;
+    LPCDevice        *m_LPC = nullptr;
+    USBPCIDevice     *m_USB1 = nullptr;
+    USBPCIDevice     *m_USB2 = nullptr;
+    NVNetDevice      *m_NVNet = nullptr;
+    NVAPUDevice      *m_NVAPU = nullptr;
+    AC97Device       *m_AC97 = nullptr;
+    PCIBridgeDevice  *m_PCIBridge = nullptr;
+    hw::bmide::BMIDEDevice *m_BMIDE = nullptr;
+    AGPBridgeDevice  *m_AGPBridge = nullptr;
+    NV2ADevice       *m_NV2A = nullptr;
 
     // ----- Configuration ----------------------------------------------------
     viXenSettings     m_settings;
 
     // ----- State ------------------------------------------------------------
-    bool     m_should_run;
-
-    uint8_t  m_lastSMCErrorCode = 0;
-    uint32_t m_lastBugCheckCode = 0x00000000;
-    
-    XboxKernelVersion m_kernelVersion = { 0 };
+    bool     m_should_run = false;
 
-    bool     m_kernelDataFound = false;
-    uint32_t m_kExp_KiBugCheckData = 0x00000000;
-    uint32_t m_kExp_XboxKrnlVersion = 0x00000000;
+    // true: the CPU executed HLT and is waiting for an interrupt
+    bool     m_cpuHalted = false;
 
-    bool LocateKernelData();
+    SystemWatcher *m_watcher = nullptr;
 
     // ----- Debugger ---------------------------------------------------------
-    GdbServer *m_gdb;
+    GdbServer *m_gdb = nullptr;
 };
 
 }
@@ -0,0 +1,90 @@
+#include "xbox_pool.h"
+
+#include <algorithm>
+
+#include "vixen/thread.h"
+
+namespace vixen {
+
+void XboxPoolThreadFunc(void *data) {
+    Thread_SetName("[HW] CPU Pool");
+    ((XboxPool *)data)->Run();
+}
+
+XboxPool::XboxPool(uint32_t numThreads, uint64_t sliceLength)
+    : m_sliceLength(sliceLength)
+{
+    for (uint32_t i = 0; i < std::max(numThreads, 1u); i++) {
+        m_threads.emplace_back(XboxPoolThreadFunc, this);
+    }
+}
+
+XboxPool::~XboxPool() {
+    StopAll();
+    Wait();
+
+    {
+        std::lock_guard<std::mutex> lk(m_mutex);
+        m_running = false;
+        m_queueCond.notify_all();
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+EmulatorStatus XboxPool::Add(Xbox *xbox) {
+    EmulatorStatus status = xbox->Start();
+    if (status != EMUS_OK) {
+        return status;
+    }
+
+    std::lock_guard<std::mutex> lk(m_mutex);
+    m_machines.push_back(xbox);
+    m_queue.push_back(xbox);
+    m_queueCond.notify_one();
+    return EMUS_OK;
+}
+
+void XboxPool::StopAll() {
+    std::lock_guard<std::mutex> lk(m_mutex);
+    for (auto xbox : m_machines) {
+        xbox->Stop();
+    }
+}
+
+void XboxPool::Wait() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    m_finishedCond.wait(lk, [this] { return m_machines.empty(); });
+}
+
+void XboxPool::Run() {
+    std::unique_lock<std::mutex> lk(m_mutex);
+    while (true) {
+        m_queueCond.wait(lk, [this] { return !m_running || !m_queue.empty(); });
+        if (!m_running) {
+            break;
+        }
+
+        Xbox *xbox = m_queue.front();
+        m_queue.pop_front();
+
+        lk.unlock();
+        bool keepRunning = xbox->RunSlice(m_sliceLength);
+        if (!keepRunning) {
+            xbox->Finish();
+        }
+        lk.lock();
+
+        if (keepRunning) {
+            m_queue.push_back(xbox);
+            m_queueCond.notify_one();
+        }
+        else {
+            m_machines.erase(std::find(m_machines.begin(), m_machines.end(), xbox));
+            m_finishedCond.notify_all();
+        }
+    }
+}
+
+}
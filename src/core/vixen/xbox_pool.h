@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vixen/xbox.h"
+
+namespace vixen {
+
+/*!
+ * Runs several independent Xbox machines on a bounded number of host threads.
+ *
+ * Machines are queued in round-robin order. Each worker thread takes the
+ * machine at the front of the queue, runs its CPU for a time slice and puts
+ * it back at the end, so that any number of machines can share a fixed
+ * number of threads. Machines whose CPU is halted give up the rest of their
+ * slice. Hardware timers and device threads still belong to each machine.
+ */
+class XboxPool {
+public:
+    /*!
+     * Creates a pool with the specified number of worker threads and slice
+     * length in nanoseconds of host time.
+     */
+    XboxPool(uint32_t numThreads, uint64_t sliceLength = kDefaultSliceLength);
+
+    /*!
+     * Stops all machines still running and waits for them to finish.
+     */
+    ~XboxPool();
+
+    /*!
+     * Initializes the machine and queues it for execution. The machine must
+     * outlive the pool or be finished before it is destroyed.
+     */
+    EmulatorStatus Add(Xbox *xbox);
+
+    /*!
+     * Stops all machines. Wait() returns once they have been finished.
+     */
+    void StopAll();
+
+    /*!
+     * Blocks until all machines added to the pool have stopped and finished.
+     */
+    void Wait();
+
+    static const uint64_t kDefaultSliceLength = 10000000;
+
+private:
+    void Run();
+
+    uint64_t m_sliceLength;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queueCond;
+    std::condition_variable m_finishedCond;
+    bool m_running = true;
+
+    // Machines waiting for a worker, and all machines that have not finished
+    std::deque<Xbox *> m_queue;
+    std::vector<Xbox *> m_machines;
+
+    friend void XboxPoolThreadFunc(void *data);
+};
+
+}
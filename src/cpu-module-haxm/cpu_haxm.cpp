@@ -89,6 +89,9 @@ CPUStatus HaxmCpu::HandleExecResult(HaxmVCPUStatus status) {
     m_regsDirty = true;
     m_fpuRegsDirty = true;
 
+    // The guest may have changed its page tables
+    FlushTranslationCache();
+
     // Check VM exit status
     if (status == HXVCPUS_FAILED) {
         return CPUS_FAILED;
@@ -229,6 +232,7 @@ CPUOperationStatus HaxmCpu::RegWrite(enum CpuReg reg, uint32_t value) {
     default:                                                             return CPUS_OP_INVALID_REGISTER;
     }
 
+    FlushTranslationCacheOnWrite(reg);
     m_regsChanged = true;
 
     return CPUS_OP_OK;
@@ -295,6 +299,7 @@ CPUOperationStatus HaxmCpu::RegWrite(CpuReg regs[], uint32_t values[], uint8_t n
         case REG_CR4:    m_regs._cr4 = values[i];                      break;
         default:                                                       return CPUS_OP_INVALID_REGISTER;
         }
+        FlushTranslationCacheOnWrite(regs[i]);
     }
 
     m_regsChanged = true;
@@ -0,0 +1,1058 @@
+#include "cpu_interp.h"
+#include "vixen/log.h"
+
+#include <cassert>
+
+namespace vixen {
+namespace cpu {
+
+// Page table entry bits
+#define PTE_PRESENT   0x001
+#define PTE_WRITE     0x002
+#define PTE_USER      0x004
+#define PTE_ACCESSED  0x020
+#define PTE_DIRTY     0x040
+#define PTE_LARGE     0x080
+
+// Page fault error code bits
+#define PFEC_PRESENT  0x1
+#define PFEC_WRITE    0x2
+#define PFEC_USER     0x4
+
+// Maximum number of nested faults before the CPU shuts down
+#define INTERP_MAX_FAULT_DEPTH  2
+
+InterpCpu::InterpCpu() {
+    m_hostPages = new uint8_t*[INTERP_NUM_PAGES];
+    m_readOnlyPages = new uint8_t[INTERP_NUM_PAGES / 8];
+    memset(m_hostPages, 0, sizeof(uint8_t*) * INTERP_NUM_PAGES);
+    memset(m_readOnlyPages, 0, INTERP_NUM_PAGES / 8);
+    m_trackedPages = nullptr;
+    m_dirtyPages = nullptr;
+
+    m_exitRequested = false;
+    m_blockTierEnabled = true;
+    m_lastBlock = nullptr;
+    m_nativeLink = nullptr;
+    m_blockBoundary = false;
+    m_codeModified = false;
+    for (auto& word : m_hostWrittenPages) {
+        word = 0;
+    }
+    for (auto& word : m_hostWrittenWords) {
+        word = 0;
+    }
+    m_hostWritesPending = false;
+    m_swBreakpointsEnabled = false;
+    m_hwBreakpointsActive = false;
+    m_skipHwBreakpoint = false;
+    m_breakpointHit = false;
+    m_breakpointAddress = 0;
+    memset(&m_hwBreakpoints, 0, sizeof(m_hwBreakpoints));
+
+    InitNativeCode();
+    Reset();
+}
+
+InterpCpu::~InterpCpu() {
+    delete[] m_hostPages;
+    delete[] m_readOnlyPages;
+    delete[] m_trackedPages;
+    delete[] m_dirtyPages;
+}
+
+CPUInitStatus InterpCpu::InitializeImpl() {
+    Reset();
+    return CPUS_INIT_OK;
+}
+
+void InterpCpu::Reset() {
+    memset(m_gpr, 0, sizeof(m_gpr));
+    memset(m_cr, 0, sizeof(m_cr));
+    memset(m_dr, 0, sizeof(m_dr));
+
+    // Processor signature: family 6, model 8, stepping 10 (Pentium III Coppermine)
+    m_gpr[GPR_EDX] = 0x0000068A;
+
+    m_eip = 0xFFF0;
+    m_eflags = 0x2;
+    m_cr[0] = CR0_CD | CR0_NW | CR0_ET;
+    m_dr[6] = 0xFFFF0FF0;
+    m_dr[7] = 0x400;
+
+    for (int i = 0; i < SEG_COUNT; i++) {
+        m_segs[i].selector = 0;
+        m_segs[i].base = 0;
+        m_segs[i].limit = 0xFFFF;
+        m_segs[i].access = 0x93;
+        m_segs[i].flags = 0;
+    }
+    m_segs[SEG_CS].selector = 0xF000;
+    m_segs[SEG_CS].base = 0xFFFF0000;
+    m_segs[SEG_CS].access = 0x9B;
+
+    m_tr = { 0, 0, 0xFFFF, 0x8B, 0 };
+    m_ldtr = { 0, 0, 0xFFFF, 0x82, 0 };
+    m_gdtr = { 0, 0xFFFF };
+    m_idtr = { 0, 0xFFFF };
+    m_msrs.clear();
+
+    memset(m_fxState, 0, sizeof(m_fxState));
+    *reinterpret_cast<uint16_t*>(&m_fxState[0]) = 0x0040;   // FCW
+    *reinterpret_cast<uint32_t*>(&m_fxState[24]) = 0x1F80;  // MXCSR
+    *reinterpret_cast<uint32_t*>(&m_fxState[28]) = 0xFFFF;  // MXCSR_MASK
+
+    m_nextEip = m_eip;
+    m_inhibitInterrupts = false;
+    m_interruptShadow = false;
+    m_halted = false;
+    m_stopRequested = false;
+    m_interruptWindowRequested = false;
+    m_faultPending = false;
+    m_faultDepth = 0;
+    m_tscBase = std::chrono::steady_clock::now();
+
+    m_decodeCache.Flush();
+    FlushBlockCache();
+    FlushTLB();
+}
+
+// ----- Memory mapping -------------------------------------------------------
+
+CPUMemMapStatus InterpCpu::MemMapSubregion(MemoryRegion *subregion) {
+    log_debug("InterpCpu: Mapping 0x%X bytes to guest memory address 0x%X\n", subregion->m_size, subregion->m_start);
+
+    switch (subregion->m_type) {
+    case MEM_REGION_MMIO:
+        // Unmapped pages are routed to the I/O mapper
+        return CPUS_MMAP_OK;
+
+    case MEM_REGION_NONE:
+        // Shouldn't happen
+        assert(0);
+        return CPUS_MMAP_INVALID_TYPE;
+
+    case MEM_REGION_RAM:
+    case MEM_REGION_ROM:
+    {
+        if (subregion->m_start & INTERP_PAGE_MASK) {
+            return CPUS_MMAP_MEMORY_ADDR_MISALIGNED;
+        }
+        if (subregion->m_size & INTERP_PAGE_MASK) {
+            return CPUS_MMAP_MEMORY_SIZE_MISALIGNED;
+        }
+
+        bool readOnly = subregion->m_type == MEM_REGION_ROM;
+        uint32_t firstPage = subregion->m_start >> INTERP_PAGE_SHIFT;
+        uint32_t numPages = (uint32_t)(subregion->m_size >> INTERP_PAGE_SHIFT);
+        for (uint32_t i = 0; i < numPages; i++) {
+            uint32_t page = firstPage + i;
+            m_hostPages[page] = (uint8_t*)subregion->m_data + ((size_t)i << INTERP_PAGE_SHIFT);
+            if (readOnly) {
+                m_readOnlyPages[page >> 3] |= (1 << (page & 7));
+            }
+            else {
+                m_readOnlyPages[page >> 3] &= ~(1 << (page & 7));
+            }
+        }
+
+        FlushBlockCache();
+        FlushTLB();
+        return CPUS_MMAP_OK;
+    }
+
+    default:
+        // Shouldn't happen
+        return CPUS_MMAP_INVALID_TYPE;
+    }
+}
+
+// ----- Registers ------------------------------------------------------------
+
+CPUOperationStatus InterpCpu::RegRead(enum CpuReg reg, uint32_t *value) {
+    switch (reg) {
+    case REG_EIP:       *value = m_eip;                         break;
+    case REG_EFLAGS:    *value = m_eflags;                      break;
+    case REG_EAX:       *value = m_gpr[GPR_EAX];                break;
+    case REG_ECX:       *value = m_gpr[GPR_ECX];                break;
+    case REG_EDX:       *value = m_gpr[GPR_EDX];                break;
+    case REG_EBX:       *value = m_gpr[GPR_EBX];                break;
+    case REG_ESI:       *value = m_gpr[GPR_ESI];                break;
+    case REG_EDI:       *value = m_gpr[GPR_EDI];                break;
+    case REG_ESP:       *value = m_gpr[GPR_ESP];                break;
+    case REG_EBP:       *value = m_gpr[GPR_EBP];                break;
+    case REG_CS:        *value = m_segs[SEG_CS].selector;       break;
+    case REG_SS:        *value = m_segs[SEG_SS].selector;       break;
+    case REG_DS:        *value = m_segs[SEG_DS].selector;       break;
+    case REG_ES:        *value = m_segs[SEG_ES].selector;       break;
+    case REG_FS:        *value = m_segs[SEG_FS].selector;       break;
+    case REG_GS:        *value = m_segs[SEG_GS].selector;       break;
+    case REG_TR:        *value = m_tr.selector;                 break;
+    case REG_CR0:       *value = m_cr[0];                       break;
+    case REG_CR2:       *value = m_cr[2];                       break;
+    case REG_CR3:       *value = m_cr[3];                       break;
+    case REG_CR4:       *value = m_cr[4];                       break;
+    default:                                                    return CPUS_OP_INVALID_REGISTER;
+    }
+
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::RegWrite(enum CpuReg reg, uint32_t value) {
+    bool ok = true;
+    switch (reg) {
+    case REG_EIP:       m_eip = value;                                  break;
+    case REG_EFLAGS:    m_eflags = value | 0x2;                         break;
+    case REG_EAX:       m_gpr[GPR_EAX] = value;                         break;
+    case REG_ECX:       m_gpr[GPR_ECX] = value;                         break;
+    case REG_EDX:       m_gpr[GPR_EDX] = value;                         break;
+    case REG_EBX:       m_gpr[GPR_EBX] = value;                         break;
+    case REG_ESI:       m_gpr[GPR_ESI] = value;                         break;
+    case REG_EDI:       m_gpr[GPR_EDI] = value;                         break;
+    case REG_ESP:       m_gpr[GPR_ESP] = value;                         break;
+    case REG_EBP:       m_gpr[GPR_EBP] = value;                         break;
+    case REG_CS:        ok = LoadSegment(SEG_CS, (uint16_t)value);      break;
+    case REG_SS:        ok = LoadSegment(SEG_SS, (uint16_t)value);      break;
+    case REG_DS:        ok = LoadSegment(SEG_DS, (uint16_t)value);      break;
+    case REG_ES:        ok = LoadSegment(SEG_ES, (uint16_t)value);      break;
+    case REG_FS:        ok = LoadSegment(SEG_FS, (uint16_t)value);      break;
+    case REG_GS:        ok = LoadSegment(SEG_GS, (uint16_t)value);      break;
+    case REG_TR:        ok = LoadSystemSegment(&m_tr, (uint16_t)value); break;
+    case REG_CR0:       ok = WriteCR(0, value);                         break;
+    case REG_CR2:       ok = WriteCR(2, value);                         break;
+    case REG_CR3:       ok = WriteCR(3, value);                         break;
+    case REG_CR4:       ok = WriteCR(4, value);                         break;
+    default:                                                            return CPUS_OP_INVALID_REGISTER;
+    }
+
+    if (!ok) {
+        // Register writes from the host never raise guest exceptions
+        m_faultPending = false;
+        return CPUS_OP_INVALID_SELECTOR;
+    }
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::GetGDT(uint32_t *addr, uint32_t *size) {
+    *addr = m_gdtr.base;
+    *size = m_gdtr.limit;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::SetGDT(uint32_t addr, uint32_t size) {
+    m_gdtr.base = addr;
+    m_gdtr.limit = (uint16_t)size;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::GetIDT(uint32_t *addr, uint32_t *size) {
+    *addr = m_idtr.base;
+    *size = m_idtr.limit;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::SetIDT(uint32_t addr, uint32_t size) {
+    m_idtr.base = addr;
+    m_idtr.limit = (uint16_t)size;
+    return CPUS_OP_OK;
+}
+
+// ----- Address translation --------------------------------------------------
+
+void InterpCpu::FlushTLB() {
+    for (uint32_t i = 0; i < INTERP_TLB_ENTRIES; i++) {
+        m_tlbRead[i].tag = 1;
+        m_tlbWrite[i].tag = 1;
+    }
+    FlushTranslationCache();
+}
+
+void InterpCpu::InvalidateTLBEntry(uint32_t laddr) {
+    uint32_t index = (laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1);
+    m_tlbRead[index].tag = 1;
+    m_tlbWrite[index].tag = 1;
+    FlushTranslationCache();
+}
+
+bool InterpCpu::TranslateLinear(uint32_t laddr, bool write, uint32_t *paddr) {
+    if (!(m_cr[0] & CR0_PG)) {
+        *paddr = laddr;
+        return true;
+    }
+
+    bool user = CPL() == 3;
+    uint32_t errorCode = (write ? PFEC_WRITE : 0) | (user ? PFEC_USER : 0);
+
+    // Page directory
+    uint32_t pdeAddr = (m_cr[3] & ~INTERP_PAGE_MASK) + ((laddr >> 22) << 2);
+    uint32_t pde;
+    ReadPhys(pdeAddr, 4, &pde);
+    if (!(pde & PTE_PRESENT)) {
+        m_cr[2] = laddr;
+        return RaiseFault(14, errorCode);
+    }
+
+    bool largePage = (pde & PTE_LARGE) && (m_cr[4] & CR4_PSE);
+    uint32_t pte = pde;
+    uint32_t pteAddr = pdeAddr;
+    uint32_t flags = pde;
+    if (!largePage) {
+        // Page table
+        pteAddr = (pde & ~INTERP_PAGE_MASK) + (((laddr >> 12) & 0x3FF) << 2);
+        ReadPhys(pteAddr, 4, &pte);
+        if (!(pte & PTE_PRESENT)) {
+            m_cr[2] = laddr;
+            return RaiseFault(14, errorCode);
+        }
+        flags = pde & pte;
+    }
+
+    // Check permissions. Supervisor writes to read-only pages are only
+    // blocked when CR0.WP is set.
+    if ((user && !(flags & PTE_USER)) ||
+        (write && !(flags & PTE_WRITE) && (user || (m_cr[0] & CR0_WP)))) {
+        m_cr[2] = laddr;
+        return RaiseFault(14, errorCode | PFEC_PRESENT);
+    }
+
+    // Update accessed and dirty bits
+    if (!largePage && !(pde & PTE_ACCESSED)) {
+        pde |= PTE_ACCESSED;
+        WritePhys(pdeAddr, 4, &pde);
+    }
+    uint32_t newPte = pte | PTE_ACCESSED | (write ? PTE_DIRTY : 0);
+    if (newPte != pte) {
+        WritePhys(pteAddr, 4, &newPte);
+    }
+
+    if (largePage) {
+        *paddr = (pte & 0xFFC00000) | (laddr & 0x3FFFFF);
+    }
+    else {
+        *paddr = (pte & ~INTERP_PAGE_MASK) | (laddr & INTERP_PAGE_MASK);
+    }
+    return true;
+}
+
+// ----- Dirty page tracking --------------------------------------------------
+
+bool InterpCpu::IsValidRAMRange(uint32_t baseAddress, uint32_t size) {
+    if ((baseAddress | size) & INTERP_PAGE_MASK || size == 0 || baseAddress + (size - 1) < baseAddress) {
+        return false;
+    }
+    uint32_t firstPage = baseAddress >> INTERP_PAGE_SHIFT;
+    uint32_t numPages = size >> INTERP_PAGE_SHIFT;
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t page = firstPage + i;
+        if (m_hostPages[page] == nullptr || (m_readOnlyPages[page >> 3] & (1 << (page & 7)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+CPUOperationStatus InterpCpu::EnableDirtyTracking(uint32_t baseAddress, uint32_t size) {
+    if (!IsValidRAMRange(baseAddress, size)) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+
+    if (m_trackedPages == nullptr) {
+        m_trackedPages = new Bitmap64[INTERP_NUM_PAGES / 64];
+        m_dirtyPages = new Bitmap64[INTERP_NUM_PAGES / 64];
+        memset(m_trackedPages, 0, sizeof(Bitmap64) * INTERP_NUM_PAGES / 64);
+        memset(m_dirtyPages, 0, sizeof(Bitmap64) * INTERP_NUM_PAGES / 64);
+    }
+
+    uint32_t firstPage = baseAddress >> INTERP_PAGE_SHIFT;
+    uint32_t numPages = size >> INTERP_PAGE_SHIFT;
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t page = firstPage + i;
+        Bitmap64Set(&m_trackedPages[page >> 6], page & 63);
+        Bitmap64Clear(&m_dirtyPages[page >> 6], page & 63);
+    }
+
+    // Evict the newly tracked pages from the write TLB
+    FlushTLB();
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap) {
+    if (!IsValidRAMRange(baseAddress, size)) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+
+    uint32_t firstPage = baseAddress >> INTERP_PAGE_SHIFT;
+    uint32_t numPages = size >> INTERP_PAGE_SHIFT;
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t page = firstPage + i;
+        if (m_trackedPages == nullptr || !Bitmap64IsSet(m_trackedPages[page >> 6], page & 63)) {
+            return CPUS_OP_FAILED;
+        }
+    }
+
+    memset(bitmap, 0, sizeof(Bitmap64) * ((numPages + 63) / 64));
+
+    bool cleaned = false;
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t page = firstPage + i;
+        if (Bitmap64IsSet(m_dirtyPages[page >> 6], page & 63)) {
+            Bitmap64Set(&bitmap[i >> 6], i & 63);
+            Bitmap64Clear(&m_dirtyPages[page >> 6], page & 63);
+            cleaned = true;
+        }
+    }
+
+    // Pages that became clean must take the slow path again
+    if (cleaned) {
+        FlushTLB();
+    }
+    return CPUS_OP_OK;
+}
+
+// ----- Physical memory access -----------------------------------------------
+
+bool InterpCpu::ReadPhys(uint32_t paddr, uint32_t size, void *value) {
+    uint8_t *dst = (uint8_t *)value;
+    while (size > 0) {
+        uint32_t offset = paddr & INTERP_PAGE_MASK;
+        uint32_t chunk = INTERP_PAGE_SIZE - offset;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        uint8_t *host = m_hostPages[paddr >> INTERP_PAGE_SHIFT];
+        if (host != nullptr) {
+            memcpy(dst, host + offset, chunk);
+        }
+        else {
+            // Split MMIO accesses into naturally aligned pieces
+            uint32_t done = 0;
+            while (done < chunk) {
+                uint32_t addr = paddr + done;
+                uint8_t accessSize = ((addr & 3) == 0 && chunk - done >= 4) ? 4 : ((addr & 1) == 0 && chunk - done >= 2) ? 2 : 1;
+                uint32_t data = 0;
+                m_ioMapper->MMIORead(addr, &data, accessSize);
+                memcpy(dst + done, &data, accessSize);
+                done += accessSize;
+            }
+        }
+
+        dst += chunk;
+        paddr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool InterpCpu::WritePhys(uint32_t paddr, uint32_t size, const void *value) {
+    const uint8_t *src = (const uint8_t *)value;
+    while (size > 0) {
+        uint32_t offset = paddr & INTERP_PAGE_MASK;
+        uint32_t chunk = INTERP_PAGE_SIZE - offset;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        uint32_t page = paddr >> INTERP_PAGE_SHIFT;
+        uint8_t *host = m_hostPages[page];
+        if (host != nullptr) {
+            // Writes to ROM are ignored
+            if (!(m_readOnlyPages[page >> 3] & (1 << (page & 7)))) {
+                if (m_blockCache.IsCodePage(page)) {
+                    InvalidateCodePage(page);
+                }
+                memcpy(host + offset, src, chunk);
+                if (m_trackedPages != nullptr && Bitmap64IsSet(m_trackedPages[page >> 6], page & 63)) {
+                    Bitmap64Set(&m_dirtyPages[page >> 6], page & 63);
+                }
+            }
+        }
+        else {
+            uint32_t done = 0;
+            while (done < chunk) {
+                uint32_t addr = paddr + done;
+                uint8_t accessSize = ((addr & 3) == 0 && chunk - done >= 4) ? 4 : ((addr & 1) == 0 && chunk - done >= 2) ? 2 : 1;
+                uint32_t data = 0;
+                memcpy(&data, src + done, accessSize);
+                m_ioMapper->MMIOWrite(addr, data, accessSize);
+                done += accessSize;
+            }
+        }
+
+        src += chunk;
+        paddr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// ----- Linear memory access -------------------------------------------------
+
+bool InterpCpu::ReadLinearSlow(uint32_t laddr, uint32_t size, void *value) {
+    uint8_t *dst = (uint8_t *)value;
+    while (size > 0) {
+        uint32_t offset = laddr & INTERP_PAGE_MASK;
+        uint32_t chunk = INTERP_PAGE_SIZE - offset;
+        if (chunk > size) {
+            chunk = size;
+        }
+
+        TLBEntry& entry = m_tlbRead[(laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+        uint32_t physPage;
+        if (entry.tag == (laddr & ~INTERP_PAGE_MASK)) {
+            physPage = entry.physPage;
+        }
+        else {
+            uint32_t paddr;
+            if (!TranslateLinear(laddr, false, &paddr)) {
+                return false;
+            }
+            physPage = paddr & ~INTERP_PAGE_MASK;
+            entry.tag = laddr & ~INTERP_PAGE_MASK;
+            entry.physPage = physPage;
+            entry.host = m_hostPages[physPage >> INTERP_PAGE_SHIFT];
+        }
+
+        ReadPhys(physPage | offset, chunk, dst);
+
+        dst += chunk;
+        laddr += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+bool InterpCpu::WriteLinearSlow(uint32_t laddr, uint32_t size, const void *value) {
+    // Translate every page touched by the access before writing anything, so
+    // that a fault on a later page leaves memory untouched
+    uint32_t physPages[2];
+    uint32_t numPages = ((laddr & INTERP_PAGE_MASK) + size + INTERP_PAGE_MASK) >> INTERP_PAGE_SHIFT;
+    assert(numPages <= 2);
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t pageAddr = (laddr & ~INTERP_PAGE_MASK) + (i << INTERP_PAGE_SHIFT);
+        TLBEntry& entry = m_tlbWrite[(pageAddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+        if (entry.tag == pageAddr) {
+            physPages[i] = entry.physPage;
+            continue;
+        }
+
+        uint32_t paddr;
+        if (!TranslateLinear(i == 0 ? laddr : pageAddr, true, &paddr)) {
+            return false;
+        }
+        physPages[i] = paddr & ~INTERP_PAGE_MASK;
+
+        // ROM pages stay out of the fast path so that writes are discarded, and
+        // so do pages with translated code so that the translations are
+        // invalidated and clean tracked pages so that they are marked dirty
+        uint32_t page = physPages[i] >> INTERP_PAGE_SHIFT;
+        bool readOnly = (m_readOnlyPages[page >> 3] & (1 << (page & 7))) != 0;
+        entry.tag = pageAddr;
+        entry.physPage = physPages[i];
+        entry.host = (readOnly || m_blockCache.IsCodePage(page) || IsCleanTrackedPage(page)) ? nullptr : m_hostPages[page];
+    }
+
+    const uint8_t *src = (const uint8_t *)value;
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t offset = (i == 0) ? (laddr & INTERP_PAGE_MASK) : 0;
+        uint32_t chunk = INTERP_PAGE_SIZE - offset;
+        if (chunk > size) {
+            chunk = size;
+        }
+        WritePhys(physPages[i] | offset, chunk, src);
+        src += chunk;
+        size -= chunk;
+    }
+    return true;
+}
+
+// ----- Segmentation ---------------------------------------------------------
+
+DecodeMode InterpCpu::CurrentDecodeMode() {
+    if (!IsProtectedMode()) {
+        return DECODE_MODE_REAL16;
+    }
+    return (m_segs[SEG_CS].flags & 0x4) ? DECODE_MODE_PROT32 : DECODE_MODE_PROT16;
+}
+
+bool InterpCpu::ReadDescriptor(uint16_t selector, GDTEntry *entry) {
+    uint32_t base;
+    uint32_t limit;
+    if (selector & 0x4) {
+        base = m_ldtr.base;
+        limit = m_ldtr.limit;
+    }
+    else {
+        base = m_gdtr.base;
+        limit = m_gdtr.limit;
+    }
+
+    uint32_t offset = selector & ~7;
+    if (offset + 7 > limit) {
+        return RaiseFault(13, selector & ~3);
+    }
+    return ReadLinear(base + offset, sizeof(GDTEntry), entry);
+}
+
+void InterpCpu::LoadSegmentFromDescriptor(SegmentCache *cache, uint16_t selector, GDTEntry& entry) {
+    cache->selector = selector;
+    cache->base = entry.GetBase();
+    cache->limit = entry.GetLimit();
+    cache->access = entry.data.access;
+    cache->flags = entry.data.flags;
+}
+
+bool InterpCpu::LoadSegment(uint8_t seg, uint16_t selector) {
+    SegmentCache& cache = m_segs[seg];
+
+    if (!IsProtectedMode() || (m_eflags & VM_MASK)) {
+        // Real mode only changes the selector and base; the remaining
+        // attributes are kept, allowing "unreal mode" tricks
+        cache.selector = selector;
+        cache.base = (uint32_t)selector << 4;
+        return true;
+    }
+
+    if ((selector & ~3) == 0) {
+        if (seg == SEG_CS || seg == SEG_SS) {
+            return RaiseFault(13, 0);
+        }
+        cache.selector = selector;
+        cache.base = 0;
+        cache.limit = 0;
+        cache.access = 0;
+        cache.flags = 0;
+        return true;
+    }
+
+    GDTEntry entry;
+    if (!ReadDescriptor(selector, &entry)) {
+        return false;
+    }
+    if (!(entry.data.access & 0x80)) {
+        return RaiseFault(seg == SEG_SS ? 12 : 11, selector & ~3);
+    }
+
+    LoadSegmentFromDescriptor(&cache, selector, entry);
+    return true;
+}
+
+bool InterpCpu::LoadSystemSegment(SegmentCache *cache, uint16_t selector) {
+    if ((selector & ~3) == 0) {
+        cache->selector = selector;
+        cache->base = 0;
+        cache->limit = 0;
+        return true;
+    }
+
+    GDTEntry entry;
+    if (!ReadDescriptor(selector, &entry)) {
+        return false;
+    }
+    if (!(entry.data.access & 0x80)) {
+        return RaiseFault(11, selector & ~3);
+    }
+
+    LoadSegmentFromDescriptor(cache, selector, entry);
+    return true;
+}
+
+// ----- Exceptions and interrupts --------------------------------------------
+
+bool InterpCpu::RaiseFault(uint8_t vector) {
+    m_faultPending = true;
+    m_faultVector = vector;
+    m_faultHasError = false;
+    m_faultError = 0;
+    return false;
+}
+
+bool InterpCpu::RaiseFault(uint8_t vector, uint32_t error) {
+    m_faultPending = true;
+    m_faultVector = vector;
+    m_faultHasError = true;
+    m_faultError = error;
+    return false;
+}
+
+void InterpCpu::DeliverPendingFault(uint32_t faultEip) {
+    m_faultDepth = 0;
+    while (m_faultPending) {
+        m_faultPending = false;
+
+        uint8_t vector = m_faultVector;
+        bool hasError = m_faultHasError;
+        uint32_t error = m_faultError;
+
+        if (m_faultDepth >= INTERP_MAX_FAULT_DEPTH) {
+            log_error("InterpCpu: Triple fault at 0x%08X (vector %u)\n", faultEip, vector);
+            m_exitInfo.reason = CPU_EXIT_SHUTDOWN;
+            m_stopRequested = true;
+            return;
+        }
+        if (m_faultDepth > 0) {
+            // A fault while delivering an exception escalates to a double fault
+            vector = 8;
+            hasError = true;
+            error = 0;
+        }
+        m_faultDepth++;
+
+        DeliverInterrupt(vector, hasError, error, faultEip);
+    }
+    m_faultDepth = 0;
+}
+
+bool InterpCpu::DeliverInterrupt(uint8_t vector, bool hasError, uint32_t error, uint32_t returnEip) {
+    if (!IsProtectedMode()) {
+        return DeliverInterruptReal(vector, returnEip);
+    }
+
+    if ((uint32_t)vector * 8 + 7 > m_idtr.limit) {
+        return RaiseFault(13, vector * 8 + 2);
+    }
+
+    IDTEntry gate;
+    if (!ReadLinear(m_idtr.base + vector * 8, sizeof(IDTEntry), &gate)) {
+        return false;
+    }
+    if (!gate.data.present) {
+        return RaiseFault(11, vector * 8 + 2);
+    }
+
+    uint8_t gateType = gate.data.type & 0x7;
+    if (gateType != 6 && gateType != 7) {
+        log_warning("InterpCpu: Unsupported gate type 0x%X for vector 0x%X\n", gate.data.type, vector);
+        return RaiseFault(13, vector * 8 + 2);
+    }
+    uint8_t pushSize = (gate.data.type & 0x8) ? 4 : 2;
+    uint32_t offset = gate.GetOffset();
+    if (pushSize == 2) {
+        offset &= 0xFFFF;
+    }
+
+    uint16_t selector = gate.data.selector;
+    GDTEntry desc;
+    if ((selector & ~3) == 0) {
+        return RaiseFault(13, 0);
+    }
+    if (!ReadDescriptor(selector, &desc)) {
+        return false;
+    }
+    if (!(desc.data.access & 0x80)) {
+        return RaiseFault(11, selector & ~3);
+    }
+
+    uint8_t newCpl = (desc.data.access >> 5) & 3;
+    uint32_t oldEflags = m_eflags;
+    uint16_t oldCs = m_segs[SEG_CS].selector;
+
+    if (newCpl < CPL()) {
+        // Switch to the inner stack specified by the TSS
+        uint32_t newEsp = 0;
+        uint16_t newSs = 0;
+        if (!ReadLinear(m_tr.base + 4 + newCpl * 8, 4, &newEsp) ||
+            !ReadLinear(m_tr.base + 8 + newCpl * 8, 2, &newSs)) {
+            return false;
+        }
+
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        uint16_t oldSs = m_segs[SEG_SS].selector;
+        if (!LoadSegment(SEG_SS, (newSs & ~3) | newCpl)) {
+            return false;
+        }
+        m_gpr[GPR_ESP] = newEsp;
+        if (!StackPush(pushSize, oldSs) || !StackPush(pushSize, oldEsp)) {
+            return false;
+        }
+    }
+
+    if (!StackPush(pushSize, oldEflags) ||
+        !StackPush(pushSize, oldCs) ||
+        !StackPush(pushSize, returnEip)) {
+        return false;
+    }
+    if (hasError && !StackPush(pushSize, error)) {
+        return false;
+    }
+
+    LoadSegmentFromDescriptor(&m_segs[SEG_CS], (selector & ~3) | newCpl, desc);
+    m_eflags &= ~(TF_MASK | NT_MASK | RF_MASK | VM_MASK);
+    if (gateType == 6) {
+        // Interrupt gates disable interrupts; trap gates do not
+        m_eflags &= ~IF_MASK;
+    }
+
+    m_eip = offset;
+    m_nextEip = offset;
+    return true;
+}
+
+bool InterpCpu::DeliverInterruptReal(uint8_t vector, uint32_t returnEip) {
+    if ((uint32_t)vector * 4 + 3 > m_idtr.limit) {
+        return RaiseFault(13);
+    }
+
+    uint16_t ivt[2];
+    if (!ReadLinear(m_idtr.base + vector * 4, sizeof(ivt), ivt)) {
+        return false;
+    }
+
+    if (!StackPush(2, m_eflags) ||
+        !StackPush(2, m_segs[SEG_CS].selector) ||
+        !StackPush(2, returnEip)) {
+        return false;
+    }
+
+    m_eflags &= ~(IF_MASK | TF_MASK | AC_MASK);
+    LoadSegment(SEG_CS, ivt[1]);
+    m_eip = ivt[0];
+    m_nextEip = ivt[0];
+    return true;
+}
+
+InterruptResult InterpCpu::InterruptImpl(uint8_t vector) {
+    // Kick the execution loop so that the interrupt queue is serviced
+    RequestExit();
+    return INTR_SUCCESS;
+}
+
+void InterpCpu::RequestExit() {
+    std::lock_guard<std::mutex> lk(m_haltMutex);
+    m_exitRequested = true;
+    m_haltCond.notify_one();
+}
+
+CPUOperationStatus InterpCpu::InjectInterrupt(uint8_t vector) {
+    m_halted = false;
+    m_interruptWindowRequested = false;
+
+    DeliverInterrupt(vector, false, 0, m_eip);
+    if (m_faultPending) {
+        DeliverPendingFault(m_eip);
+    }
+    return CPUS_OP_OK;
+}
+
+bool InterpCpu::CanInjectInterrupt() {
+    return (m_eflags & IF_MASK) && !m_interruptShadow;
+}
+
+void InterpCpu::RequestInterruptWindow() {
+    m_interruptWindowRequested = true;
+}
+
+// ----- Execution ------------------------------------------------------------
+
+CPUStatus InterpCpu::RunImpl() {
+    if (m_halted) {
+        // Sleep until an interrupt arrives or the wait times out, giving the
+        // emulator loop a chance to run periodically
+        std::unique_lock<std::mutex> lk(m_haltMutex);
+        m_haltCond.wait_for(lk, std::chrono::milliseconds(1), [this] { return m_exitRequested.load(); });
+        m_exitRequested = false;
+        m_exitInfo.reason = CPU_EXIT_NORMAL;
+        return CPUS_OK;
+    }
+
+    return Execute(INTERP_SLICE_INSTRUCTIONS);
+}
+
+CPUStatus InterpCpu::StepImpl() {
+    if (m_halted) {
+        m_exitInfo.reason = CPU_EXIT_NORMAL;
+        return CPUS_OK;
+    }
+
+    return Execute(1);
+}
+
+CPUStatus InterpCpu::Execute(uint32_t maxInstructions) {
+    m_exitInfo.reason = CPU_EXIT_NORMAL;
+    m_stopRequested = false;
+
+    // Single steps and hardware breakpoints need instruction granularity
+    bool useBlocks = m_blockTierEnabled && maxInstructions > 1 && !m_hwBreakpointsActive;
+    bool atBoundary = true;
+
+    uint32_t executed = 0;
+    while (executed < maxInstructions) {
+        TranslatedBlock *block = (useBlocks && atBoundary) ? FindBlock() : nullptr;
+        if (block != nullptr) {
+            executed += ExecuteBlock(block, maxInstructions - executed);
+            if (m_stopRequested) {
+                break;
+            }
+        }
+        else {
+            m_lastBlock = nullptr;
+            m_nativeLink = nullptr;
+            if (!ExecuteOne()) {
+                break;
+            }
+            executed++;
+            atBoundary = m_blockBoundary;
+        }
+
+        if (m_exitRequested.load(std::memory_order_relaxed)) {
+            m_exitRequested = false;
+            break;
+        }
+        if (m_interruptWindowRequested && CanInjectInterrupt()) {
+            break;
+        }
+    }
+
+    return CPUS_OK;
+}
+
+bool InterpCpu::ExecuteOne() {
+    if (m_hwBreakpointsActive && CheckHardwareBreakpoints()) {
+        return false;
+    }
+
+    uint32_t startEip = m_eip;
+    m_blockBoundary = false;
+    const Instruction *ins = FetchInstruction();
+    if (ins != nullptr) {
+        m_nextEip = startEip + ins->length;
+        if (ins->mode != DECODE_MODE_PROT32) {
+            m_nextEip &= 0xFFFF;
+        }
+        if (Dispatch(*ins)) {
+            m_eip = m_nextEip;
+        }
+        m_blockBoundary = EndsBlock(*ins);
+    }
+
+    // The interrupt shadow covers the instruction following STI or a load of SS
+    m_interruptShadow = m_inhibitInterrupts;
+    m_inhibitInterrupts = false;
+
+    if (m_faultPending) {
+        m_eip = startEip;
+        DeliverPendingFault(startEip);
+        m_blockBoundary = true;
+    }
+
+    return !m_stopRequested;
+}
+
+const Instruction *InterpCpu::FetchInstruction() {
+    DecodeMode mode = CurrentDecodeMode();
+    uint32_t laddr = m_segs[SEG_CS].base + m_eip;
+    uint32_t offset = laddr & INTERP_PAGE_MASK;
+    uint32_t avail = INTERP_PAGE_SIZE - offset;
+
+    TLBEntry& entry = m_tlbRead[(laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+    uint32_t physPage;
+    if (entry.tag == (laddr & ~INTERP_PAGE_MASK)) {
+        physPage = entry.physPage;
+    }
+    else {
+        uint32_t paddr;
+        if (!TranslateLinear(laddr, false, &paddr)) {
+            return nullptr;
+        }
+        physPage = paddr & ~INTERP_PAGE_MASK;
+        entry.tag = laddr & ~INTERP_PAGE_MASK;
+        entry.physPage = physPage;
+        entry.host = m_hostPages[physPage >> INTERP_PAGE_SHIFT];
+    }
+
+    // Fast path: decode directly from host memory through the cache
+    if (entry.host != nullptr) {
+        const Instruction *ins = m_decodeCache.Fetch(physPage | offset, entry.host + offset, avail, mode);
+        if (ins != nullptr) {
+            return ins;
+        }
+        if (avail >= INTERP_MAX_INSTRUCTION_LENGTH) {
+            RaiseFault(6);
+            return nullptr;
+        }
+    }
+
+    // Slow path: the instruction crosses a page boundary or lives in MMIO.
+    // Only touch the next page if the instruction doesn't fit in this one.
+    uint8_t buffer[INTERP_MAX_INSTRUCTION_LENGTH];
+    uint32_t length = (avail < INTERP_MAX_INSTRUCTION_LENGTH) ? avail : INTERP_MAX_INSTRUCTION_LENGTH;
+    if (!ReadLinearSlow(laddr, length, buffer)) {
+        return nullptr;
+    }
+    Decoder *decoder = m_decodeCache.GetDecoder();
+    if (decoder->Decode(mode, buffer, length, &m_uncachedInstr)) {
+        return &m_uncachedInstr;
+    }
+    if (length < INTERP_MAX_INSTRUCTION_LENGTH) {
+        if (!ReadLinearSlow(laddr + length, INTERP_MAX_INSTRUCTION_LENGTH - length, buffer + length)) {
+            return nullptr;
+        }
+        if (decoder->Decode(mode, buffer, INTERP_MAX_INSTRUCTION_LENGTH, &m_uncachedInstr)) {
+            return &m_uncachedInstr;
+        }
+    }
+
+    RaiseFault(6);
+    return nullptr;
+}
+
+// ----- Breakpoints ----------------------------------------------------------
+
+bool InterpCpu::CheckHardwareBreakpoints() {
+    // Let the instruction at a breakpoint run once execution is resumed
+    if (m_skipHwBreakpoint) {
+        m_skipHwBreakpoint = false;
+        return false;
+    }
+
+    uint32_t laddr = m_segs[SEG_CS].base + m_eip;
+    for (int i = 0; i < 4; i++) {
+        auto& bp = m_hwBreakpoints.bp[i];
+        if ((bp.localEnable || bp.globalEnable) && bp.trigger == HWBP_TRIGGER_EXECUTION && (uint32_t)bp.address == laddr) {
+            m_breakpointHit = true;
+            m_breakpointAddress = laddr;
+            m_skipHwBreakpoint = true;
+            m_exitInfo.reason = CPU_EXIT_HW_BREAKPOINT;
+            return true;
+        }
+    }
+    return false;
+}
+
+CPUOperationStatus InterpCpu::EnableSoftwareBreakpoints(bool enable) {
+    m_swBreakpointsEnabled = enable;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::SetHardwareBreakpoints(HardwareBreakpoints breakpoints) {
+    m_hwBreakpoints = breakpoints;
+    m_hwBreakpointsActive = false;
+    for (int i = 0; i < 4; i++) {
+        auto& bp = m_hwBreakpoints.bp[i];
+        if (bp.localEnable || bp.globalEnable) {
+            if (bp.trigger != HWBP_TRIGGER_EXECUTION) {
+                log_warning("InterpCpu: Only execution breakpoints are supported (breakpoint %d ignored)\n", i);
+                continue;
+            }
+            m_hwBreakpointsActive = true;
+        }
+    }
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::ClearHardwareBreakpoints() {
+    memset(&m_hwBreakpoints, 0, sizeof(m_hwBreakpoints));
+    m_hwBreakpointsActive = false;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus InterpCpu::GetBreakpointAddress(uint32_t *address) {
+    if (!m_breakpointHit) {
+        return CPUS_OP_BREAKPOINT_NEVER_HIT;
+    }
+    *address = m_breakpointAddress;
+    return CPUS_OP_OK;
+}
+
+}
+}
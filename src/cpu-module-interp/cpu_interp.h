@@ -0,0 +1,369 @@
+#pragma once
+
+#include "vixen/cpu.h"
+#include "interp/decoder.h"
+#include "interp/decode_cache.h"
+#include "interp/block_cache.h"
+#include "interp/x64_emitter.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+namespace vixen {
+namespace cpu {
+
+using namespace interp;
+
+// Number of instructions executed per call to RunImpl before returning to the
+// emulator loop
+#define INTERP_SLICE_INSTRUCTIONS  100000
+
+// Guest physical address space geometry used by the host page table
+#define INTERP_PAGE_SHIFT          12
+#define INTERP_PAGE_SIZE           (1 << INTERP_PAGE_SHIFT)
+#define INTERP_PAGE_MASK           (INTERP_PAGE_SIZE - 1)
+#define INTERP_NUM_PAGES           (1 << (32 - INTERP_PAGE_SHIFT))
+
+// Number of entries in each direct-mapped TLB
+#define INTERP_TLB_ENTRIES         1024
+
+// Nominal clock rate of the Xbox CPU, used for the time stamp counter
+#define INTERP_TSC_FREQUENCY       733333333ULL
+
+/*!
+ * Cached contents of a segment descriptor.
+ */
+struct SegmentCache {
+    uint16_t selector;
+    uint32_t base;
+    uint32_t limit;
+    uint8_t access;
+    uint8_t flags;   // Upper nibble of the descriptor flags (G, D/B, L, AVL)
+};
+
+/*!
+ * Base and limit of a descriptor table register (GDTR, IDTR).
+ */
+struct DescriptorTableRegister {
+    uint32_t base;
+    uint16_t limit;
+};
+
+/*!
+ * Translation lookaside buffer entry. `tag` is the linear page address, or 1
+ * if the entry is invalid. `host` points to the host memory backing the page,
+ * or nullptr if the page is MMIO.
+ */
+struct TLBEntry {
+    uint32_t tag;
+    uint32_t physPage;
+    uint8_t *host;
+};
+
+/*!
+ * Software x86 interpreter.
+ *
+ * Implements a 32-bit protected mode CPU with paging, starting from the real
+ * mode reset state. Instructions are decoded with Zydis and kept in a cache
+ * keyed by physical address. Port I/O and MMIO are routed through the
+ * IOMapper.
+ *
+ * Basic blocks on frequently executed pages are translated into sequences of
+ * pre-decoded operations with specialized handlers for common instructions.
+ * On x86-64 hosts, 32-bit blocks are also compiled to native code that runs
+ * the simplest register operations inline, calls the handlers for everything
+ * else and jumps directly into the blocks that follow it. Single-stepping and
+ * hardware breakpoints always use the interpreter.
+ *
+ * x87, MMX and SSE arithmetic are not implemented; only the instructions
+ * needed to manage the FPU state are supported. Segment limits and most
+ * privilege checks are not enforced.
+ */
+class InterpCpu : public Cpu {
+public:
+    InterpCpu();
+    ~InterpCpu();
+
+    CPUInitStatus InitializeImpl();
+
+    CPUStatus RunImpl();
+    CPUStatus StepImpl();
+    InterruptResult InterruptImpl(uint8_t vector);
+    void RequestExit() override;
+
+    CPUMemMapStatus MemMapSubregion(MemoryRegion *subregion);
+
+    CPUOperationStatus EnableDirtyTracking(uint32_t baseAddress, uint32_t size) override;
+    CPUOperationStatus FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap) override;
+
+    CPUOperationStatus RegRead(enum CpuReg reg, uint32_t *value);
+    CPUOperationStatus RegWrite(enum CpuReg reg, uint32_t value);
+
+    CPUOperationStatus GetGDT(uint32_t *addr, uint32_t *size);
+    CPUOperationStatus SetGDT(uint32_t addr, uint32_t size);
+
+    CPUOperationStatus GetIDT(uint32_t *addr, uint32_t *size);
+    CPUOperationStatus SetIDT(uint32_t addr, uint32_t size);
+
+    CPUOperationStatus EnableSoftwareBreakpoints(bool enable) override;
+    CPUOperationStatus SetHardwareBreakpoints(HardwareBreakpoints breakpoints) override;
+    CPUOperationStatus ClearHardwareBreakpoints() override;
+    CPUOperationStatus GetBreakpointAddress(uint32_t *address) override;
+
+protected:
+    CPUOperationStatus InjectInterrupt(uint8_t vector);
+    bool CanInjectInterrupt();
+    void RequestInterruptWindow();
+
+    void OnHostWrite(uint32_t addr, uint32_t size) override;
+
+private:
+    // ----- Architectural state ----------------------------------------------
+    uint32_t m_gpr[GPR_COUNT];
+    uint32_t m_eip;
+    uint32_t m_eflags;
+    uint32_t m_cr[5];
+    uint32_t m_dr[8];
+    SegmentCache m_segs[SEG_COUNT];
+    SegmentCache m_tr;
+    SegmentCache m_ldtr;
+    DescriptorTableRegister m_gdtr;
+    DescriptorTableRegister m_idtr;
+    std::map<uint32_t, uint64_t> m_msrs;
+
+    // FXSAVE image holding the x87 and SSE control state
+    alignas(16) uint8_t m_fxState[512];
+
+    // ----- Execution state --------------------------------------------------
+    DecodeCache m_decodeCache;
+    Instruction m_uncachedInstr;
+
+    BlockCache m_blockCache;
+    bool m_blockTierEnabled;
+
+    // Last block executed, whose links are followed to find the next one
+    TranslatedBlock *m_lastBlock;
+
+    // Native code entry point, which runs blocks starting at the body of the
+    // given one until they exit or run the given number of instructions, and
+    // the shared exit sequence that returns from it
+    typedef uint32_t (*NativeEnterFunc)(InterpCpu *cpu, uint8_t *body, uint32_t maxInstructions);
+    NativeEnterFunc m_nativeEnter;
+    uint8_t *m_nativeExit;
+
+    // Jump of the last native block that exited to look up its successor,
+    // patched to go straight to the block found next
+    uint8_t *m_nativeLink;
+
+    // Set when the last interpreted instruction ended a basic block
+    bool m_blockBoundary;
+
+    // Set when a page containing translated code is written
+    bool m_codeModified;
+
+    // Pages written by the host or by devices (see OnHostWrite), one bit per
+    // page, and one bit per word of that bitmap that has bits set. Set from
+    // any thread and drained on the CPU thread before entering blocks.
+    std::atomic<uint64_t> m_hostWrittenPages[INTERP_NUM_PAGES / 64];
+    std::atomic<uint64_t> m_hostWrittenWords[INTERP_NUM_PAGES / 64 / 64];
+    std::atomic<bool> m_hostWritesPending;
+
+    // Address of the next instruction, updated by control transfers
+    uint32_t m_nextEip;
+
+    // Set by instructions that inhibit interrupts for one instruction
+    bool m_inhibitInterrupts;
+    bool m_interruptShadow;
+
+    bool m_halted;
+    bool m_stopRequested;
+    bool m_interruptWindowRequested;
+
+    std::atomic<bool> m_exitRequested;
+    std::mutex m_haltMutex;
+    std::condition_variable m_haltCond;
+
+    // Pending exception raised by the current instruction
+    bool m_faultPending;
+    uint8_t m_faultVector;
+    bool m_faultHasError;
+    uint32_t m_faultError;
+    uint8_t m_faultDepth;
+
+    std::chrono::steady_clock::time_point m_tscBase;
+
+    // ----- Breakpoints ------------------------------------------------------
+    bool m_swBreakpointsEnabled;
+    HardwareBreakpoints m_hwBreakpoints;
+    bool m_hwBreakpointsActive;
+    bool m_skipHwBreakpoint;
+    bool m_breakpointHit;
+    uint32_t m_breakpointAddress;
+
+    // ----- Memory -----------------------------------------------------------
+    uint8_t **m_hostPages;
+    uint8_t *m_readOnlyPages;
+
+    // Dirty page tracking bitmaps, allocated when tracking is first enabled.
+    // Clean tracked pages are kept out of the write TLB so that the first
+    // write to them takes the slow path and marks them dirty.
+    Bitmap64 *m_trackedPages;
+    Bitmap64 *m_dirtyPages;
+
+    inline bool IsCleanTrackedPage(uint32_t page) {
+        return m_trackedPages != nullptr
+            && Bitmap64IsSet(m_trackedPages[page >> 6], page & 63)
+            && !Bitmap64IsSet(m_dirtyPages[page >> 6], page & 63);
+    }
+
+    bool IsValidRAMRange(uint32_t baseAddress, uint32_t size);
+
+    TLBEntry m_tlbRead[INTERP_TLB_ENTRIES];
+    TLBEntry m_tlbWrite[INTERP_TLB_ENTRIES];
+
+    void Reset();
+    void FlushTLB();
+    void InvalidateTLBEntry(uint32_t laddr);
+
+    /*!
+     * Translates a linear address, raising a page fault if the translation is
+     * invalid or the access is not allowed.
+     */
+    bool TranslateLinear(uint32_t laddr, bool write, uint32_t *paddr);
+
+    bool ReadPhys(uint32_t paddr, uint32_t size, void *value);
+    bool WritePhys(uint32_t paddr, uint32_t size, const void *value);
+
+    bool ReadLinearSlow(uint32_t laddr, uint32_t size, void *value);
+    bool WriteLinearSlow(uint32_t laddr, uint32_t size, const void *value);
+
+    inline bool ReadLinear(uint32_t laddr, uint32_t size, void *value) {
+        TLBEntry& entry = m_tlbRead[(laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+        if (entry.tag == (laddr & ~INTERP_PAGE_MASK) && entry.host != nullptr && (laddr & INTERP_PAGE_MASK) + size <= INTERP_PAGE_SIZE) {
+            memcpy(value, entry.host + (laddr & INTERP_PAGE_MASK), size);
+            return true;
+        }
+        return ReadLinearSlow(laddr, size, value);
+    }
+
+    inline bool WriteLinear(uint32_t laddr, uint32_t size, const void *value) {
+        TLBEntry& entry = m_tlbWrite[(laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+        if (entry.tag == (laddr & ~INTERP_PAGE_MASK) && entry.host != nullptr && (laddr & INTERP_PAGE_MASK) + size <= INTERP_PAGE_SIZE) {
+            memcpy(entry.host + (laddr & INTERP_PAGE_MASK), value, size);
+            return true;
+        }
+        return WriteLinearSlow(laddr, size, value);
+    }
+
+    inline bool ReadSeg(uint8_t seg, uint32_t offset, uint32_t size, void *value) {
+        return ReadLinear(m_segs[seg].base + offset, size, value);
+    }
+
+    inline bool WriteSeg(uint8_t seg, uint32_t offset, uint32_t size, const void *value) {
+        return WriteLinear(m_segs[seg].base + offset, size, value);
+    }
+
+    // ----- Segmentation and modes -------------------------------------------
+    inline bool IsProtectedMode() { return (m_cr[0] & CR0_PE) != 0; }
+    inline uint8_t CPL() { return IsProtectedMode() ? (m_segs[SEG_CS].selector & 3) : 0; }
+    inline uint8_t StackSize() { return (m_segs[SEG_SS].flags & 0x4) ? 4 : 2; }
+    DecodeMode CurrentDecodeMode();
+
+    bool ReadDescriptor(uint16_t selector, GDTEntry *entry);
+    bool LoadSegment(uint8_t seg, uint16_t selector);
+    bool LoadSystemSegment(SegmentCache *cache, uint16_t selector);
+    void LoadSegmentFromDescriptor(SegmentCache *cache, uint16_t selector, GDTEntry& entry);
+
+    // ----- Exceptions and interrupts ----------------------------------------
+    bool RaiseFault(uint8_t vector);
+    bool RaiseFault(uint8_t vector, uint32_t error);
+    void DeliverPendingFault(uint32_t faultEip);
+    bool DeliverInterrupt(uint8_t vector, bool hasError, uint32_t error, uint32_t returnEip);
+    bool DeliverInterruptReal(uint8_t vector, uint32_t returnEip);
+
+    // ----- Execution --------------------------------------------------------
+    CPUStatus Execute(uint32_t maxInstructions);
+    bool ExecuteOne();
+    const Instruction *FetchInstruction();
+    bool CheckHardwareBreakpoints();
+    bool Dispatch(const Instruction& ins);
+
+    // ----- Translated blocks (cpu_interp_block.cpp) -------------------------
+    TranslatedBlock *FindBlock();
+    TranslatedBlock *TranslateBlock(uint32_t paddr, const uint8_t *host, DecodeMode mode);
+    uint32_t ExecuteBlock(TranslatedBlock *block, uint32_t maxInstructions);
+    bool ExecuteBlockOp(const BlockOp& op, uint32_t eipMask);
+    void FlushBlockCache();
+    void InvalidateCodePage(uint32_t page);
+    void InvalidateHostWrittenPages();
+
+    static bool EndsBlock(const Instruction& ins);
+    static BlockOpHandler SelectHandler(const Instruction& ins);
+
+    static bool OpGeneric(InterpCpu *cpu, const Instruction& ins);
+    static bool OpMovRegReg32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpMovRegImm32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpMovRegMem32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpMovMemReg32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpLea32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpAluRegReg32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpAluRegImm32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpPushReg32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpPopReg32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpJccRel32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpJmpRel32(InterpCpu *cpu, const Instruction& ins);
+    static bool OpCallRel32(InterpCpu *cpu, const Instruction& ins);
+
+    // ----- Native code (cpu_interp_native.cpp) ------------------------------
+    void InitNativeCode();
+    void CompileNative(TranslatedBlock *block);
+    void EmitNativeAlu(X64Emitter& e, const Instruction& ins);
+    uint32_t ExecuteNative(TranslatedBlock *block, uint32_t maxInstructions);
+
+    static bool IsNativeOp(const BlockOp& op);
+    static bool CanChain(const Instruction& ins);
+    static bool NativeStep(InterpCpu *cpu, const BlockOp *op);
+
+    // Displacement of a member from the object, used to address the CPU state
+    // from native code
+    inline int32_t NativeOffset(const void *member) const {
+        return (int32_t)((const uint8_t *)member - (const uint8_t *)this);
+    }
+
+    // ----- Instruction helpers (cpu_interp_exec.cpp) ------------------------
+    uint32_t EffectiveAddress(const Instruction& ins, const Operand& op);
+    bool ReadOperand(const Instruction& ins, const Operand& op, uint32_t *value);
+    bool WriteOperand(const Instruction& ins, const Operand& op, uint32_t value);
+
+    uint32_t ReadGPR(uint8_t reg, uint8_t size);
+    void WriteGPR(uint8_t reg, uint8_t size, uint32_t value);
+
+    inline uint32_t StackPointer() { return (StackSize() == 4) ? m_gpr[GPR_ESP] : (m_gpr[GPR_ESP] & 0xFFFF); }
+    void SetStackPointer(uint32_t value);
+    bool StackPush(uint8_t size, uint32_t value);
+    bool StackPop(uint8_t size, uint32_t *value);
+
+    bool TestCondition(uint8_t cond);
+    void SetArithFlags(uint32_t result, uint8_t size, bool cf, bool of, bool af);
+    void SetLogicFlags(uint32_t result, uint8_t size);
+    uint32_t Alu(uint8_t op, uint32_t a, uint32_t b, uint8_t size);
+    bool Shift(uint8_t op, uint32_t value, uint8_t count, uint8_t size, uint32_t *result);
+
+    bool WriteCR(uint8_t reg, uint32_t value);
+    void WriteFlags(uint32_t value, uint32_t mask);
+    bool CheckFPUAvailable(bool waitInstruction);
+
+    uint8_t SegmentOverride(const Instruction& ins, uint8_t defaultSeg);
+    bool ExecString(const Instruction& ins);
+    bool ExecFarTransfer(const Instruction& ins, uint16_t selector, uint32_t offset, bool call);
+    bool ExecIret(const Instruction& ins);
+    bool ExecMulDiv(const Instruction& ins);
+    bool ExecSystem(const Instruction& ins);
+    bool ExecFPU(const Instruction& ins);
+};
+
+}
+}
@@ -0,0 +1,400 @@
+#include "cpu_interp.h"
+#include "vixen/log.h"
+
+#include <algorithm>
+
+namespace vixen {
+namespace cpu {
+
+// ----- Block boundaries -----------------------------------------------------
+
+bool InterpCpu::EndsBlock(const Instruction& ins) {
+    switch (ins.op) {
+    // Control transfers
+    case OP_JMP: case OP_JMP_FAR: case OP_JCC: case OP_JCXZ:
+    case OP_LOOP: case OP_LOOPE: case OP_LOOPNE:
+    case OP_CALL: case OP_CALL_FAR: case OP_RET: case OP_RET_FAR:
+    case OP_INT: case OP_INT3: case OP_INTO: case OP_IRET:
+    case OP_HLT:
+        return true;
+
+    // Instructions that change the interrupt state, the decoding mode, the
+    // address space or the stack segment
+    case OP_STI: case OP_POPF: case OP_LSS:
+    case OP_LGDT: case OP_LIDT: case OP_LLDT: case OP_LTR: case OP_LMSW: case OP_CLTS:
+    case OP_INVLPG: case OP_WRMSR:
+        return true;
+
+    case OP_MOV:
+    case OP_POP:
+        return ins.operands[0].kind == OPK_SEG || ins.operands[0].kind == OPK_CR || ins.operands[0].kind == OPK_DR;
+
+    // Port I/O may raise interrupts that should be serviced promptly
+    case OP_IN: case OP_OUT: case OP_INS: case OP_OUTS:
+        return true;
+
+    // Repeated string instructions restart themselves
+    case OP_MOVS: case OP_STOS: case OP_LODS: case OP_CMPS: case OP_SCAS:
+        return (ins.prefixes & (PREFIX_REP | PREFIX_REPNE)) != 0;
+
+    default:
+        return false;
+    }
+}
+
+// ----- Specialized handlers -------------------------------------------------
+//
+// These implement the most frequent 32-bit forms of common instructions
+// without going through the generic operand accessors. Their behavior must
+// match Dispatch exactly.
+
+bool InterpCpu::OpGeneric(InterpCpu *cpu, const Instruction& ins) {
+    return cpu->Dispatch(ins);
+}
+
+bool InterpCpu::OpMovRegReg32(InterpCpu *cpu, const Instruction& ins) {
+    cpu->m_gpr[ins.operands[0].reg] = cpu->m_gpr[ins.operands[1].reg];
+    return true;
+}
+
+bool InterpCpu::OpMovRegImm32(InterpCpu *cpu, const Instruction& ins) {
+    cpu->m_gpr[ins.operands[0].reg] = ins.operands[1].imm;
+    return true;
+}
+
+bool InterpCpu::OpMovRegMem32(InterpCpu *cpu, const Instruction& ins) {
+    const Operand& src = ins.operands[1];
+    uint32_t value;
+    if (!cpu->ReadSeg(src.seg, cpu->EffectiveAddress(ins, src), 4, &value)) {
+        return false;
+    }
+    cpu->m_gpr[ins.operands[0].reg] = value;
+    return true;
+}
+
+bool InterpCpu::OpMovMemReg32(InterpCpu *cpu, const Instruction& ins) {
+    const Operand& dst = ins.operands[0];
+    return cpu->WriteSeg(dst.seg, cpu->EffectiveAddress(ins, dst), 4, &cpu->m_gpr[ins.operands[1].reg]);
+}
+
+bool InterpCpu::OpLea32(InterpCpu *cpu, const Instruction& ins) {
+    cpu->m_gpr[ins.operands[0].reg] = cpu->EffectiveAddress(ins, ins.operands[1]);
+    return true;
+}
+
+bool InterpCpu::OpAluRegReg32(InterpCpu *cpu, const Instruction& ins) {
+    uint32_t& dst = cpu->m_gpr[ins.operands[0].reg];
+    uint32_t result = cpu->Alu(ins.subop, dst, cpu->m_gpr[ins.operands[1].reg], 4);
+    if (ins.subop != ALU_CMP && ins.subop != ALU_TEST) {
+        dst = result;
+    }
+    return true;
+}
+
+bool InterpCpu::OpAluRegImm32(InterpCpu *cpu, const Instruction& ins) {
+    uint32_t& dst = cpu->m_gpr[ins.operands[0].reg];
+    uint32_t result = cpu->Alu(ins.subop, dst, ins.operands[1].imm, 4);
+    if (ins.subop != ALU_CMP && ins.subop != ALU_TEST) {
+        dst = result;
+    }
+    return true;
+}
+
+bool InterpCpu::OpPushReg32(InterpCpu *cpu, const Instruction& ins) {
+    return cpu->StackPush(4, cpu->m_gpr[ins.operands[0].reg]);
+}
+
+bool InterpCpu::OpPopReg32(InterpCpu *cpu, const Instruction& ins) {
+    uint32_t value;
+    if (!cpu->StackPop(4, &value)) {
+        return false;
+    }
+    cpu->m_gpr[ins.operands[0].reg] = value;
+    return true;
+}
+
+bool InterpCpu::OpJccRel32(InterpCpu *cpu, const Instruction& ins) {
+    if (cpu->TestCondition(ins.cond)) {
+        cpu->m_nextEip += ins.operands[0].imm;
+    }
+    return true;
+}
+
+bool InterpCpu::OpJmpRel32(InterpCpu *cpu, const Instruction& ins) {
+    cpu->m_nextEip += ins.operands[0].imm;
+    return true;
+}
+
+bool InterpCpu::OpCallRel32(InterpCpu *cpu, const Instruction& ins) {
+    if (!cpu->StackPush(4, cpu->m_nextEip)) {
+        return false;
+    }
+    cpu->m_nextEip += ins.operands[0].imm;
+    return true;
+}
+
+BlockOpHandler InterpCpu::SelectHandler(const Instruction& ins) {
+    if (ins.opSize != 4) {
+        return &OpGeneric;
+    }
+
+    const Operand& op0 = ins.operands[0];
+    const Operand& op1 = ins.operands[1];
+    bool reg0 = op0.kind == OPK_GPR && op0.size == 4;
+    bool reg1 = op1.kind == OPK_GPR && op1.size == 4;
+
+    switch (ins.op) {
+    case OP_MOV:
+        if (reg0 && reg1) return &OpMovRegReg32;
+        if (reg0 && op1.kind == OPK_IMM) return &OpMovRegImm32;
+        if (reg0 && op1.kind == OPK_MEM && op1.size == 4) return &OpMovRegMem32;
+        if (op0.kind == OPK_MEM && op0.size == 4 && reg1) return &OpMovMemReg32;
+        break;
+
+    case OP_LEA:
+        if (reg0) return &OpLea32;
+        break;
+
+    case OP_ALU:
+        if (reg0 && reg1) return &OpAluRegReg32;
+        if (reg0 && op1.kind == OPK_IMM) return &OpAluRegImm32;
+        break;
+
+    case OP_PUSH:
+        if (reg0) return &OpPushReg32;
+        break;
+
+    case OP_POP:
+        if (reg0) return &OpPopReg32;
+        break;
+
+    case OP_JCC:
+        return &OpJccRel32;
+
+    case OP_JMP:
+        if (op0.kind == OPK_REL) return &OpJmpRel32;
+        break;
+
+    case OP_CALL:
+        if (op0.kind == OPK_REL) return &OpCallRel32;
+        break;
+
+    default:
+        break;
+    }
+    return &OpGeneric;
+}
+
+// ----- Translation ----------------------------------------------------------
+
+TranslatedBlock *InterpCpu::TranslateBlock(uint32_t paddr, const uint8_t *host, DecodeMode mode) {
+    if (m_blockCache.IsFull()) {
+        FlushBlockCache();
+    }
+
+    TranslatedBlock *block = new TranslatedBlock();
+    block->startPhys = paddr;
+    block->mode = mode;
+
+    uint32_t offset = 0;
+    uint32_t avail = INTERP_PAGE_SIZE - (paddr & INTERP_PAGE_MASK);
+    while (block->ops.size() < BLOCK_CACHE_MAX_INSTRUCTIONS && offset < avail) {
+        // Instructions crossing the end of the page are left to the interpreter
+        const Instruction *ins = m_decodeCache.Fetch(paddr + offset, host + offset, avail - offset, mode);
+        if (ins == nullptr) {
+            break;
+        }
+
+        // Rare instructions are left to the interpreter
+        if (ins->op == OP_UNIMPLEMENTED || ins->op == OP_UNIMPLEMENTED_FPU) {
+            break;
+        }
+
+        BlockOp op;
+        op.handler = SelectHandler(*ins);
+        op.ins = *ins;
+        block->ops.push_back(op);
+        offset += ins->length;
+
+        if (EndsBlock(*ins)) {
+            break;
+        }
+    }
+    // Empty blocks are kept as well, so that the interpreter takes over
+    // without attempting the translation again
+    m_blockCache.Insert(block);
+    CompileNative(block);
+
+    // Writes to the page must now go through the slow path to invalidate the
+    // translations
+    uint32_t physPage = paddr & ~INTERP_PAGE_MASK;
+    for (uint32_t i = 0; i < INTERP_TLB_ENTRIES; i++) {
+        if (m_tlbWrite[i].physPage == physPage) {
+            m_tlbWrite[i].tag = 1;
+        }
+    }
+
+    return block;
+}
+
+void InterpCpu::FlushBlockCache() {
+    m_blockCache.Flush();
+    m_lastBlock = nullptr;
+    m_nativeLink = nullptr;
+}
+
+void InterpCpu::InvalidateCodePage(uint32_t page) {
+    m_blockCache.InvalidatePage(page);
+    m_codeModified = true;
+}
+
+void InterpCpu::OnHostWrite(uint32_t addr, uint32_t size) {
+    if (size == 0) {
+        return;
+    }
+
+    uint32_t page = addr >> INTERP_PAGE_SHIFT;
+    uint32_t lastPage = (uint32_t)(((uint64_t)addr + size - 1) >> INTERP_PAGE_SHIFT);
+    while (page <= lastPage) {
+        uint32_t word = page >> 6;
+        uint32_t bit = page & 63;
+        uint32_t count = std::min<uint32_t>(64 - bit, lastPage - page + 1);
+        uint64_t mask = (count == 64) ? ~0ULL : (((1ULL << count) - 1) << bit);
+        m_hostWrittenPages[word].fetch_or(mask);
+        m_hostWrittenWords[word >> 6].fetch_or(1ULL << (word & 63));
+        page += count;
+    }
+    m_hostWritesPending = true;
+}
+
+// Invalidates the translated code on pages written through OnHostWrite
+void InterpCpu::InvalidateHostWrittenPages() {
+    m_hostWritesPending = false;
+    for (uint32_t i = 0; i < INTERP_NUM_PAGES / 64 / 64; i++) {
+        uint64_t words = m_hostWrittenWords[i].exchange(0);
+        while (words != 0) {
+            uint32_t word = i * 64 + Bitmap64FindFirstSet(words);
+            words &= words - 1;
+
+            uint64_t pages = m_hostWrittenPages[word].exchange(0);
+            while (pages != 0) {
+                uint32_t page = word * 64 + Bitmap64FindFirstSet(pages);
+                pages &= pages - 1;
+                if (m_blockCache.IsCodePage(page)) {
+                    InvalidateCodePage(page);
+                }
+            }
+        }
+    }
+}
+
+// ----- Execution ------------------------------------------------------------
+
+TranslatedBlock *InterpCpu::FindBlock() {
+    // Blocks are only entered through pages already present in the TLB; the
+    // interpreter deals with misses, faults and code in MMIO
+    uint32_t laddr = m_segs[SEG_CS].base + m_eip;
+    TLBEntry& entry = m_tlbRead[(laddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+    if (entry.tag != (laddr & ~INTERP_PAGE_MASK) || entry.host == nullptr) {
+        return nullptr;
+    }
+
+    uint32_t offset = laddr & INTERP_PAGE_MASK;
+    uint32_t paddr = entry.physPage | offset;
+    DecodeMode mode = CurrentDecodeMode();
+
+    // Catch modifications that bypassed the CPU, such as DMA transfers
+    if (m_hostWritesPending) {
+        InvalidateHostWrittenPages();
+    }
+
+    // Follow the links of the previous block before doing a full lookup
+    TranslatedBlock *block = nullptr;
+    TranslatedBlock *prev = m_lastBlock;
+    if (prev != nullptr) {
+        for (int i = 0; i < 2; i++) {
+            TranslatedBlock *link = prev->links[i];
+            if (link != nullptr && link->startPhys == paddr && link->mode == mode && m_blockCache.IsValid(link)) {
+                block = link;
+                break;
+            }
+        }
+    }
+
+    if (block == nullptr) {
+        block = m_blockCache.Lookup(paddr, mode);
+        if (block == nullptr) {
+            if (!m_blockCache.RecordExecution(paddr)) {
+                return nullptr;
+            }
+            block = TranslateBlock(paddr, entry.host + offset, mode);
+
+            // The translation may have flushed the cache
+            prev = m_lastBlock;
+        }
+        if (prev != nullptr && m_blockCache.IsValid(prev)) {
+            prev->links[(prev->links[0] == nullptr) ? 0 : 1] = block;
+        }
+    }
+
+    if (block->ops.empty()) {
+        return nullptr;
+    }
+
+    // Let the native block that exited to find this one jump here directly
+    // from now on
+    if (m_nativeLink != nullptr) {
+        if (block->nativeEntry != nullptr) {
+            m_blockCache.GetCodeBuffer().PatchJump(m_nativeLink, block->nativeEntry);
+        }
+        m_nativeLink = nullptr;
+    }
+
+    return block;
+}
+
+uint32_t InterpCpu::ExecuteBlock(TranslatedBlock *block, uint32_t maxInstructions) {
+    m_codeModified = false;
+    if (block->nativeBody != nullptr) {
+        return ExecuteNative(block, maxInstructions);
+    }
+
+    uint32_t eipMask = (block->mode == DECODE_MODE_PROT32) ? 0xFFFFFFFF : 0xFFFF;
+    uint32_t executed = 0;
+    for (const BlockOp& op : block->ops) {
+        executed++;
+        if (!ExecuteBlockOp(op, eipMask)) {
+            break;
+        }
+    }
+    m_lastBlock = block;
+    return executed;
+}
+
+// Executes one operation of a block. Returns false if the block must stop
+// here.
+bool InterpCpu::ExecuteBlockOp(const BlockOp& op, uint32_t eipMask) {
+    uint32_t startEip = m_eip;
+    m_nextEip = (startEip + op.ins.length) & eipMask;
+    bool ok = op.handler(this, op.ins);
+    if (ok) {
+        m_eip = m_nextEip & eipMask;
+    }
+
+    m_interruptShadow = m_inhibitInterrupts;
+    m_inhibitInterrupts = false;
+
+    if (!ok) {
+        if (m_faultPending) {
+            m_eip = startEip;
+            DeliverPendingFault(startEip);
+        }
+        return false;
+    }
+
+    // Stop if the block modified its own code
+    return !m_stopRequested && !m_codeModified;
+}
+
+}
+}
@@ -0,0 +1,1660 @@
+#include "cpu_interp.h"
+#include "vixen/log.h"
+
+#include <stdio.h>
+
+namespace vixen {
+namespace cpu {
+
+// Maximum number of iterations of a REP string instruction executed at once.
+// Longer operations are resumed on the next instruction so that interrupts
+// can be serviced in between.
+#define INTERP_STRING_MAX_ITERATIONS  0x10000
+
+// EFLAGS bits that can be modified by POPF and IRET regardless of privilege
+#define ID_MASK               0x00200000
+#define FLAGS_WRITABLE_MASK   (CF_MASK | PF_MASK | AF_MASK | ZF_MASK | SF_MASK | TF_MASK | DF_MASK | OF_MASK | NT_MASK | AC_MASK | ID_MASK)
+
+// Flags affected by arithmetic operations
+#define FLAGS_ARITH_MASK      (CF_MASK | PF_MASK | AF_MASK | ZF_MASK | SF_MASK | OF_MASK)
+
+static inline uint32_t SizeMask(uint8_t size) {
+    return (size >= 4) ? 0xFFFFFFFF : ((1u << (size * 8)) - 1);
+}
+
+static inline uint32_t SignBit(uint8_t size) {
+    return 1u << (size * 8 - 1);
+}
+
+static inline int32_t SignExtend(uint32_t value, uint8_t size) {
+    switch (size) {
+    case 1: return (int8_t)value;
+    case 2: return (int16_t)value;
+    default: return (int32_t)value;
+    }
+}
+
+// Returns true if the byte has an even number of set bits
+static inline bool EvenParity(uint32_t value) {
+    uint8_t v = (uint8_t)value;
+    v ^= v >> 4;
+    return ((0x6996 >> (v & 0xF)) & 1) == 0;
+}
+
+static inline void AdvanceIndex(uint32_t& reg, int32_t delta, uint32_t mask) {
+    reg = (reg & ~mask) | ((reg + delta) & mask);
+}
+
+static void LogInstruction(const char *message, uint32_t cs, uint32_t eip, const Instruction& ins) {
+    char bytes[INTERP_MAX_INSTRUCTION_LENGTH * 3 + 1];
+    bytes[0] = '\0';
+    for (uint8_t i = 0; i < ins.length; i++) {
+        snprintf(&bytes[i * 3], 4, "%02X ", ins.bytes[i]);
+    }
+    log_warning("InterpCpu: %s at %04X:%08X: %s\n", message, cs, eip, bytes);
+}
+
+// ----- Operands -------------------------------------------------------------
+
+uint32_t InterpCpu::ReadGPR(uint8_t reg, uint8_t size) {
+    switch (size) {
+    case 1: return (reg < 4) ? (m_gpr[reg] & 0xFF) : ((m_gpr[reg - 4] >> 8) & 0xFF);
+    case 2: return m_gpr[reg] & 0xFFFF;
+    default: return m_gpr[reg];
+    }
+}
+
+void InterpCpu::WriteGPR(uint8_t reg, uint8_t size, uint32_t value) {
+    switch (size) {
+    case 1:
+        if (reg < 4) {
+            m_gpr[reg] = (m_gpr[reg] & ~0xFF) | (value & 0xFF);
+        }
+        else {
+            m_gpr[reg - 4] = (m_gpr[reg - 4] & ~0xFF00) | ((value & 0xFF) << 8);
+        }
+        break;
+    case 2: m_gpr[reg] = (m_gpr[reg] & ~0xFFFF) | (value & 0xFFFF); break;
+    default: m_gpr[reg] = value; break;
+    }
+}
+
+uint32_t InterpCpu::EffectiveAddress(const Instruction& ins, const Operand& op) {
+    uint32_t addr = op.disp;
+    if (op.base != INTERP_REG_NONE) {
+        addr += m_gpr[op.base];
+    }
+    if (op.index != INTERP_REG_NONE) {
+        addr += m_gpr[op.index] * op.scale;
+    }
+    if (ins.addrSize == 2) {
+        addr &= 0xFFFF;
+    }
+    return addr;
+}
+
+bool InterpCpu::ReadOperand(const Instruction& ins, const Operand& op, uint32_t *value) {
+    switch (op.kind) {
+    case OPK_GPR: *value = ReadGPR(op.reg, op.size); return true;
+    case OPK_SEG: *value = m_segs[op.reg].selector; return true;
+    case OPK_CR:  *value = m_cr[op.reg]; return true;
+    case OPK_DR:  *value = m_dr[op.reg]; return true;
+    case OPK_IMM:
+    case OPK_REL: *value = op.imm; return true;
+    case OPK_MEM:
+        *value = 0;
+        return ReadSeg(op.seg, EffectiveAddress(ins, op), op.size, value);
+    default:
+        return RaiseFault(6);
+    }
+}
+
+bool InterpCpu::WriteOperand(const Instruction& ins, const Operand& op, uint32_t value) {
+    switch (op.kind) {
+    case OPK_GPR: WriteGPR(op.reg, op.size, value); return true;
+    case OPK_SEG: return LoadSegment(op.reg, (uint16_t)value);
+    case OPK_CR:  return WriteCR(op.reg, value);
+    case OPK_DR:  m_dr[op.reg] = value; return true;
+    case OPK_MEM: return WriteSeg(op.seg, EffectiveAddress(ins, op), op.size, &value);
+    default:
+        return RaiseFault(6);
+    }
+}
+
+uint8_t InterpCpu::SegmentOverride(const Instruction& ins, uint8_t defaultSeg) {
+    uint8_t seg = defaultSeg;
+    for (uint8_t i = 0; i < ins.length; i++) {
+        switch (ins.bytes[i]) {
+        case 0x26: seg = SEG_ES; break;
+        case 0x2E: seg = SEG_CS; break;
+        case 0x36: seg = SEG_SS; break;
+        case 0x3E: seg = SEG_DS; break;
+        case 0x64: seg = SEG_FS; break;
+        case 0x65: seg = SEG_GS; break;
+        case 0x66: case 0x67: case 0xF0: case 0xF2: case 0xF3: break;
+        default: return seg;
+        }
+    }
+    return seg;
+}
+
+// ----- Stack ----------------------------------------------------------------
+
+void InterpCpu::SetStackPointer(uint32_t value) {
+    if (StackSize() == 4) {
+        m_gpr[GPR_ESP] = value;
+    }
+    else {
+        m_gpr[GPR_ESP] = (m_gpr[GPR_ESP] & ~0xFFFF) | (value & 0xFFFF);
+    }
+}
+
+bool InterpCpu::StackPush(uint8_t size, uint32_t value) {
+    uint32_t sp = StackPointer() - size;
+    if (StackSize() == 2) {
+        sp &= 0xFFFF;
+    }
+    if (!WriteSeg(SEG_SS, sp, size, &value)) {
+        return false;
+    }
+    SetStackPointer(sp);
+    return true;
+}
+
+bool InterpCpu::StackPop(uint8_t size, uint32_t *value) {
+    uint32_t sp = StackPointer();
+    *value = 0;
+    if (!ReadSeg(SEG_SS, sp, size, value)) {
+        return false;
+    }
+    SetStackPointer(sp + size);
+    return true;
+}
+
+// ----- Flags ----------------------------------------------------------------
+
+bool InterpCpu::TestCondition(uint8_t cond) {
+    bool result;
+    switch (cond >> 1) {
+    case 0: result = (m_eflags & OF_MASK) != 0; break;                                  // O
+    case 1: result = (m_eflags & CF_MASK) != 0; break;                                  // B
+    case 2: result = (m_eflags & ZF_MASK) != 0; break;                                  // Z
+    case 3: result = (m_eflags & (CF_MASK | ZF_MASK)) != 0; break;                      // BE
+    case 4: result = (m_eflags & SF_MASK) != 0; break;                                  // S
+    case 5: result = (m_eflags & PF_MASK) != 0; break;                                  // P
+    case 6: result = ((m_eflags >> SF_BIT) & 1) != ((m_eflags >> OF_BIT) & 1); break;   // L
+    default: result = (m_eflags & ZF_MASK) || (((m_eflags >> SF_BIT) & 1) != ((m_eflags >> OF_BIT) & 1)); break; // LE
+    }
+    return (cond & 1) ? !result : result;
+}
+
+void InterpCpu::SetArithFlags(uint32_t result, uint8_t size, bool cf, bool of, bool af) {
+    result &= SizeMask(size);
+    uint32_t flags = m_eflags & ~FLAGS_ARITH_MASK;
+    if (cf) flags |= CF_MASK;
+    if (EvenParity(result)) flags |= PF_MASK;
+    if (af) flags |= AF_MASK;
+    if (result == 0) flags |= ZF_MASK;
+    if (result & SignBit(size)) flags |= SF_MASK;
+    if (of) flags |= OF_MASK;
+    m_eflags = flags;
+}
+
+void InterpCpu::SetLogicFlags(uint32_t result, uint8_t size) {
+    SetArithFlags(result, size, false, false, false);
+}
+
+void InterpCpu::WriteFlags(uint32_t value, uint32_t mask) {
+    m_eflags = (m_eflags & ~mask) | (value & mask) | 0x2;
+}
+
+uint32_t InterpCpu::Alu(uint8_t op, uint32_t a, uint32_t b, uint8_t size) {
+    uint32_t mask = SizeMask(size);
+    uint32_t sign = SignBit(size);
+    uint32_t carry = (m_eflags & CF_MASK) ? 1 : 0;
+    a &= mask;
+    b &= mask;
+
+    uint32_t r;
+    bool cf, of;
+    switch (op) {
+    case ALU_ADD:
+        r = (a + b) & mask;
+        cf = r < a;
+        of = ((a ^ r) & (b ^ r) & sign) != 0;
+        break;
+    case ALU_ADC:
+        r = (a + b + carry) & mask;
+        cf = carry ? (r <= a) : (r < a);
+        of = ((a ^ r) & (b ^ r) & sign) != 0;
+        break;
+    case ALU_SUB:
+    case ALU_CMP:
+        r = (a - b) & mask;
+        cf = a < b;
+        of = ((a ^ b) & (a ^ r) & sign) != 0;
+        break;
+    case ALU_SBB:
+        r = (a - b - carry) & mask;
+        cf = carry ? (a <= b) : (a < b);
+        of = ((a ^ b) & (a ^ r) & sign) != 0;
+        break;
+    case ALU_AND:
+    case ALU_TEST:
+        r = a & b;
+        SetLogicFlags(r, size);
+        return r;
+    case ALU_OR:
+        r = a | b;
+        SetLogicFlags(r, size);
+        return r;
+    case ALU_XOR:
+        r = a ^ b;
+        SetLogicFlags(r, size);
+        return r;
+    default:
+        return 0;
+    }
+
+    SetArithFlags(r, size, cf, of, ((a ^ b ^ r) & 0x10) != 0);
+    return r;
+}
+
+bool InterpCpu::Shift(uint8_t op, uint32_t value, uint8_t count, uint8_t size, uint32_t *result) {
+    count &= 0x1F;
+    if (count == 0) {
+        return false;
+    }
+
+    uint32_t bits = size * 8;
+    uint32_t mask = SizeMask(size);
+    uint32_t sign = SignBit(size);
+    value &= mask;
+
+    uint32_t r;
+    bool cf, of;
+    switch (op) {
+    case SHIFT_ROL:
+    {
+        uint32_t c = count % bits;
+        r = c ? (((value << c) | (value >> (bits - c))) & mask) : value;
+        cf = (r & 1) != 0;
+        of = ((r & sign) != 0) != cf;
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (cf ? CF_MASK : 0) | (of ? OF_MASK : 0);
+        *result = r;
+        return true;
+    }
+    case SHIFT_ROR:
+    {
+        uint32_t c = count % bits;
+        r = c ? (((value >> c) | (value << (bits - c))) & mask) : value;
+        cf = (r & sign) != 0;
+        of = cf != ((r & (sign >> 1)) != 0);
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (cf ? CF_MASK : 0) | (of ? OF_MASK : 0);
+        *result = r;
+        return true;
+    }
+    case SHIFT_RCL:
+    case SHIFT_RCR:
+    {
+        uint32_t c = count % (bits + 1);
+        cf = (m_eflags & CF_MASK) != 0;
+        r = value;
+        for (uint32_t i = 0; i < c; i++) {
+            bool out;
+            if (op == SHIFT_RCL) {
+                out = (r & sign) != 0;
+                r = ((r << 1) | (cf ? 1 : 0)) & mask;
+            }
+            else {
+                out = (r & 1) != 0;
+                r = (r >> 1) | (cf ? sign : 0);
+            }
+            cf = out;
+        }
+        if (op == SHIFT_RCL) {
+            of = ((r & sign) != 0) != cf;
+        }
+        else {
+            of = ((r & sign) != 0) != ((r & (sign >> 1)) != 0);
+        }
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (cf ? CF_MASK : 0) | (of ? OF_MASK : 0);
+        *result = r;
+        return true;
+    }
+    case SHIFT_SHL:
+    case SHIFT_SAL:
+        r = (count < 32) ? ((value << count) & mask) : 0;
+        cf = (count <= bits) ? (((value >> (bits - count)) & 1) != 0) : false;
+        of = ((r & sign) != 0) != cf;
+        break;
+    case SHIFT_SHR:
+        r = value >> count;
+        cf = ((value >> (count - 1)) & 1) != 0;
+        of = (value & sign) != 0;
+        break;
+    case SHIFT_SAR:
+    {
+        int32_t sv = SignExtend(value, size);
+        r = (uint32_t)(sv >> count) & mask;
+        cf = ((sv >> (count - 1)) & 1) != 0;
+        of = false;
+        break;
+    }
+    default:
+        return false;
+    }
+
+    SetArithFlags(r, size, cf, of, false);
+    *result = r;
+    return true;
+}
+
+// ----- Control registers ----------------------------------------------------
+
+bool InterpCpu::WriteCR(uint8_t reg, uint32_t value) {
+    switch (reg) {
+    case 0:
+    {
+        uint32_t old = m_cr[0];
+        m_cr[0] = value | CR0_ET;
+        if ((old ^ m_cr[0]) & (CR0_PG | CR0_PE | CR0_WP)) {
+            FlushTLB();
+        }
+        return true;
+    }
+    case 2:
+        m_cr[2] = value;
+        return true;
+    case 3:
+        m_cr[3] = value;
+        FlushTLB();
+        return true;
+    case 4:
+    {
+        if (value & CR4_PAE) {
+            log_warning("InterpCpu: PAE paging is not supported\n");
+            return RaiseFault(13, 0);
+        }
+        uint32_t old = m_cr[4];
+        m_cr[4] = value;
+        if ((old ^ value) & (CR4_PSE | CR4_PGE)) {
+            FlushTLB();
+        }
+        return true;
+    }
+    default:
+        return RaiseFault(6);
+    }
+}
+
+// ----- Dispatch -------------------------------------------------------------
+
+bool InterpCpu::Dispatch(const Instruction& ins) {
+    const Operand& op0 = ins.operands[0];
+    const Operand& op1 = ins.operands[1];
+    uint32_t a, b;
+
+    switch (ins.op) {
+    // ----- Data movement ----------------------------------------------------
+    case OP_MOV:
+        if (!ReadOperand(ins, op1, &a) || !WriteOperand(ins, op0, a)) {
+            return false;
+        }
+        if (op0.kind == OPK_SEG && op0.reg == SEG_SS) {
+            m_inhibitInterrupts = true;
+        }
+        return true;
+
+    case OP_MOVZX:
+    case OP_MOVSX:
+        if (!ReadOperand(ins, op1, &a)) {
+            return false;
+        }
+        if (ins.op == OP_MOVSX) {
+            a = (uint32_t)SignExtend(a, op1.size);
+        }
+        return WriteOperand(ins, op0, a);
+
+    case OP_LEA:
+        WriteGPR(op0.reg, op0.size, EffectiveAddress(ins, op1));
+        return true;
+
+    case OP_XCHG:
+        if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, op1, &b)) {
+            return false;
+        }
+        return WriteOperand(ins, op0, b) && WriteOperand(ins, op1, a);
+
+    case OP_BSWAP:
+        a = m_gpr[op0.reg];
+        m_gpr[op0.reg] = (a >> 24) | ((a >> 8) & 0xFF00) | ((a << 8) & 0xFF0000) | (a << 24);
+        return true;
+
+    case OP_CMOVCC:
+        if (!ReadOperand(ins, op1, &a)) {
+            return false;
+        }
+        if (TestCondition(ins.cond)) {
+            WriteGPR(op0.reg, op0.size, a);
+        }
+        return true;
+
+    case OP_SETCC:
+        return WriteOperand(ins, op0, TestCondition(ins.cond) ? 1 : 0);
+
+    case OP_XLAT:
+    {
+        uint32_t addr = m_gpr[GPR_EBX] + (m_gpr[GPR_EAX] & 0xFF);
+        if (ins.addrSize == 2) {
+            addr &= 0xFFFF;
+        }
+        uint8_t value;
+        if (!ReadSeg(SegmentOverride(ins, SEG_DS), addr, 1, &value)) {
+            return false;
+        }
+        WriteGPR(GPR_EAX, 1, value);
+        return true;
+    }
+
+    case OP_CBW:
+        if (ins.opSize == 2) {
+            WriteGPR(GPR_EAX, 2, (uint32_t)SignExtend(m_gpr[GPR_EAX], 1));
+        }
+        else {
+            m_gpr[GPR_EAX] = (uint32_t)SignExtend(m_gpr[GPR_EAX], 2);
+        }
+        return true;
+
+    case OP_CWD:
+        a = (ReadGPR(GPR_EAX, ins.opSize) & SignBit(ins.opSize)) ? 0xFFFFFFFF : 0;
+        WriteGPR(GPR_EDX, ins.opSize, a);
+        return true;
+
+    case OP_LAHF:
+        WriteGPR(4, 1, (m_eflags & 0xD5) | 0x2);
+        return true;
+
+    case OP_SAHF:
+        m_eflags = (m_eflags & ~0xD5) | (ReadGPR(4, 1) & 0xD5);
+        return true;
+
+    case OP_LDS:
+    case OP_LES:
+    case OP_LFS:
+    case OP_LGS:
+    case OP_LSS:
+    {
+        static const uint8_t kTargetSegs[] = { SEG_DS, SEG_ES, SEG_FS, SEG_GS, SEG_SS };
+        uint8_t seg = kTargetSegs[ins.op - OP_LDS];
+        uint32_t addr = EffectiveAddress(ins, op1);
+        uint32_t offset = 0;
+        uint16_t selector;
+        if (!ReadSeg(op1.seg, addr, ins.opSize, &offset) ||
+            !ReadSeg(op1.seg, addr + ins.opSize, 2, &selector) ||
+            !LoadSegment(seg, selector)) {
+            return false;
+        }
+        WriteGPR(op0.reg, ins.opSize, offset);
+        if (seg == SEG_SS) {
+            m_inhibitInterrupts = true;
+        }
+        return true;
+    }
+
+    // ----- Arithmetic and logic ---------------------------------------------
+    case OP_ALU:
+        if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, op1, &b)) {
+            return false;
+        }
+        a = Alu(ins.subop, a, b, ins.opSize);
+        if (ins.subop == ALU_CMP || ins.subop == ALU_TEST) {
+            return true;
+        }
+        return WriteOperand(ins, op0, a);
+
+    case OP_INC:
+    case OP_DEC:
+    {
+        if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        // INC and DEC preserve the carry flag
+        uint32_t cf = m_eflags & CF_MASK;
+        a = Alu((ins.op == OP_INC) ? ALU_ADD : ALU_SUB, a, 1, ins.opSize);
+        m_eflags = (m_eflags & ~CF_MASK) | cf;
+        return WriteOperand(ins, op0, a);
+    }
+
+    case OP_NEG:
+        if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        return WriteOperand(ins, op0, Alu(ALU_SUB, 0, a, ins.opSize));
+
+    case OP_NOT:
+        if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        return WriteOperand(ins, op0, ~a);
+
+    case OP_MUL:
+    case OP_IMUL:
+    case OP_DIV:
+    case OP_IDIV:
+        return ExecMulDiv(ins);
+
+    case OP_SHIFT:
+    {
+        b = 1;
+        if (!ReadOperand(ins, op0, &a) || (ins.numOperands > 1 && !ReadOperand(ins, op1, &b))) {
+            return false;
+        }
+        uint32_t result;
+        if (!Shift(ins.subop, a, (uint8_t)b, ins.opSize, &result)) {
+            return true;
+        }
+        return WriteOperand(ins, op0, result);
+    }
+
+    case OP_SHLD:
+    case OP_SHRD:
+    {
+        uint32_t count;
+        if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, op1, &b) || !ReadOperand(ins, ins.operands[2], &count)) {
+            return false;
+        }
+        count &= 0x1F;
+        if (count == 0) {
+            return true;
+        }
+
+        uint8_t size = ins.opSize;
+        uint32_t bits = size * 8;
+        uint32_t mask = SizeMask(size);
+        uint32_t r;
+        bool cf;
+        if (ins.op == OP_SHLD) {
+            uint64_t combined = ((uint64_t)(a & mask) << bits) | (b & mask);
+            r = (uint32_t)((combined << count) >> bits) & mask;
+            cf = ((combined >> (2 * bits - count)) & 1) != 0;
+        }
+        else {
+            uint64_t combined = ((uint64_t)(b & mask) << bits) | (a & mask);
+            r = (uint32_t)(combined >> count) & mask;
+            cf = ((combined >> (count - 1)) & 1) != 0;
+        }
+        bool of = ((r ^ a) & SignBit(size)) != 0;
+        SetArithFlags(r, size, cf, of, false);
+        return WriteOperand(ins, op0, r);
+    }
+
+    case OP_BT:
+    {
+        if (!ReadOperand(ins, op1, &b)) {
+            return false;
+        }
+
+        // Register bit offsets address memory beyond the operand
+        Operand target = op0;
+        uint32_t bits = op0.size * 8;
+        if (op0.kind == OPK_MEM && op1.kind == OPK_GPR) {
+            int32_t offset = SignExtend(b, op1.size);
+            target.disp += (uint32_t)((offset >> (bits == 32 ? 5 : 4)) * (int32_t)op0.size);
+        }
+        b &= bits - 1;
+
+        if (!ReadOperand(ins, target, &a)) {
+            return false;
+        }
+        bool bit = ((a >> b) & 1) != 0;
+        m_eflags = (m_eflags & ~CF_MASK) | (bit ? CF_MASK : 0);
+        switch (ins.subop) {
+        case BIT_BTS: a |= (1u << b); break;
+        case BIT_BTR: a &= ~(1u << b); break;
+        case BIT_BTC: a ^= (1u << b); break;
+        default: return true;
+        }
+        return WriteOperand(ins, target, a);
+    }
+
+    case OP_BSF:
+    case OP_BSR:
+    {
+        if (!ReadOperand(ins, op1, &a)) {
+            return false;
+        }
+        a &= SizeMask(ins.opSize);
+        if (a == 0) {
+            m_eflags |= ZF_MASK;
+            return true;
+        }
+        m_eflags &= ~ZF_MASK;
+        uint32_t index = 0;
+        if (ins.op == OP_BSF) {
+            while (!(a & (1u << index))) index++;
+        }
+        else {
+            index = 31;
+            while (!(a & (1u << index))) index--;
+        }
+        WriteGPR(op0.reg, op0.size, index);
+        return true;
+    }
+
+    case OP_CMPXCHG:
+    {
+        if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, op1, &b)) {
+            return false;
+        }
+        Alu(ALU_CMP, ReadGPR(GPR_EAX, ins.opSize), a, ins.opSize);
+        if (m_eflags & ZF_MASK) {
+            return WriteOperand(ins, op0, b);
+        }
+        WriteGPR(GPR_EAX, ins.opSize, a);
+        return true;
+    }
+
+    case OP_CMPXCHG8B:
+    {
+        uint32_t addr = EffectiveAddress(ins, op0);
+        uint32_t value[2];
+        if (!ReadSeg(op0.seg, addr, 8, value)) {
+            return false;
+        }
+        if (value[0] == m_gpr[GPR_EAX] && value[1] == m_gpr[GPR_EDX]) {
+            uint32_t newValue[2] = { m_gpr[GPR_EBX], m_gpr[GPR_ECX] };
+            if (!WriteSeg(op0.seg, addr, 8, newValue)) {
+                return false;
+            }
+            m_eflags |= ZF_MASK;
+        }
+        else {
+            m_gpr[GPR_EAX] = value[0];
+            m_gpr[GPR_EDX] = value[1];
+            m_eflags &= ~ZF_MASK;
+        }
+        return true;
+    }
+
+    case OP_XADD:
+    {
+        if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, op1, &b)) {
+            return false;
+        }
+        uint32_t sum = Alu(ALU_ADD, a, b, ins.opSize);
+        return WriteOperand(ins, op1, a) && WriteOperand(ins, op0, sum);
+    }
+
+    // ----- Stack ------------------------------------------------------------
+    case OP_PUSH:
+        if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        return StackPush(ins.opSize, a);
+
+    case OP_POP:
+    {
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        if (!StackPop(ins.opSize, &a)) {
+            return false;
+        }
+        if (!WriteOperand(ins, op0, a)) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+        if (op0.kind == OPK_SEG && op0.reg == SEG_SS) {
+            m_inhibitInterrupts = true;
+        }
+        return true;
+    }
+
+    case OP_PUSHA:
+    {
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        for (uint8_t reg = GPR_EAX; reg <= GPR_EDI; reg++) {
+            uint32_t value = (reg == GPR_ESP) ? oldEsp : m_gpr[reg];
+            if (!StackPush(ins.opSize, value)) {
+                m_gpr[GPR_ESP] = oldEsp;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    case OP_POPA:
+    {
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        uint32_t values[GPR_COUNT];
+        for (int reg = GPR_EDI; reg >= GPR_EAX; reg--) {
+            if (!StackPop(ins.opSize, &values[reg])) {
+                m_gpr[GPR_ESP] = oldEsp;
+                return false;
+            }
+        }
+        for (uint8_t reg = GPR_EAX; reg <= GPR_EDI; reg++) {
+            if (reg != GPR_ESP) {
+                WriteGPR(reg, ins.opSize, values[reg]);
+            }
+        }
+        return true;
+    }
+
+    case OP_PUSHF:
+        return StackPush(ins.opSize, m_eflags & ~(VM_MASK | RF_MASK));
+
+    case OP_POPF:
+    {
+        if (!StackPop(ins.opSize, &a)) {
+            return false;
+        }
+        uint32_t mask = FLAGS_WRITABLE_MASK;
+        uint8_t iopl = (m_eflags & IOPL_MASK) >> IOPL_BIT0;
+        if (CPL() == 0) {
+            mask |= IOPL_MASK;
+        }
+        if (CPL() <= iopl) {
+            mask |= IF_MASK;
+        }
+        if (ins.opSize == 2) {
+            mask &= 0xFFFF;
+        }
+        WriteFlags(a, mask);
+        return true;
+    }
+
+    case OP_ENTER:
+    {
+        uint8_t size = ins.opSize;
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        uint8_t level = op1.imm & 0x1F;
+        if (!StackPush(size, ReadGPR(GPR_EBP, size))) {
+            return false;
+        }
+        uint32_t frame = StackPointer();
+        if (level > 0) {
+            uint32_t bp = ReadGPR(GPR_EBP, StackSize());
+            for (uint8_t i = 1; i < level; i++) {
+                bp -= size;
+                uint32_t value = 0;
+                if (!ReadSeg(SEG_SS, bp, size, &value) || !StackPush(size, value)) {
+                    m_gpr[GPR_ESP] = oldEsp;
+                    return false;
+                }
+            }
+            if (!StackPush(size, frame)) {
+                m_gpr[GPR_ESP] = oldEsp;
+                return false;
+            }
+        }
+        WriteGPR(GPR_EBP, size, frame);
+        SetStackPointer(StackPointer() - (op0.imm & 0xFFFF));
+        return true;
+    }
+
+    case OP_LEAVE:
+    {
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        SetStackPointer(ReadGPR(GPR_EBP, StackSize()));
+        if (!StackPop(ins.opSize, &a)) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+        WriteGPR(GPR_EBP, ins.opSize, a);
+        return true;
+    }
+
+    // ----- Control flow -----------------------------------------------------
+    case OP_JMP:
+        if (op0.kind == OPK_REL) {
+            a = m_nextEip + op0.imm;
+        }
+        else if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        return true;
+
+    case OP_JCC:
+        if (TestCondition(ins.cond)) {
+            a = m_nextEip + op0.imm;
+            m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        }
+        return true;
+
+    case OP_JCXZ:
+        if ((m_gpr[GPR_ECX] & SizeMask(ins.addrSize)) == 0) {
+            a = m_nextEip + op0.imm;
+            m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        }
+        return true;
+
+    case OP_LOOP:
+    case OP_LOOPE:
+    case OP_LOOPNE:
+    {
+        uint32_t count = (ReadGPR(GPR_ECX, ins.addrSize) - 1) & SizeMask(ins.addrSize);
+        WriteGPR(GPR_ECX, ins.addrSize, count);
+        bool taken = count != 0;
+        if (ins.op == OP_LOOPE) {
+            taken = taken && (m_eflags & ZF_MASK);
+        }
+        else if (ins.op == OP_LOOPNE) {
+            taken = taken && !(m_eflags & ZF_MASK);
+        }
+        if (taken) {
+            a = m_nextEip + op0.imm;
+            m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        }
+        return true;
+    }
+
+    case OP_CALL:
+        if (op0.kind == OPK_REL) {
+            a = m_nextEip + op0.imm;
+        }
+        else if (!ReadOperand(ins, op0, &a)) {
+            return false;
+        }
+        if (!StackPush(ins.opSize, m_nextEip)) {
+            return false;
+        }
+        m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        return true;
+
+    case OP_JMP_FAR:
+    case OP_CALL_FAR:
+    {
+        uint32_t offset = 0;
+        uint16_t selector;
+        if (op0.kind == OPK_PTR) {
+            offset = op0.imm;
+            selector = op0.ptrSeg;
+        }
+        else {
+            uint32_t addr = EffectiveAddress(ins, op0);
+            if (!ReadSeg(op0.seg, addr, ins.opSize, &offset) ||
+                !ReadSeg(op0.seg, addr + ins.opSize, 2, &selector)) {
+                return false;
+            }
+        }
+        return ExecFarTransfer(ins, selector, offset, ins.op == OP_CALL_FAR);
+    }
+
+    case OP_RET:
+        if (!StackPop(ins.opSize, &a)) {
+            return false;
+        }
+        if (ins.numOperands > 0) {
+            SetStackPointer(StackPointer() + (op0.imm & 0xFFFF));
+        }
+        m_nextEip = (ins.opSize == 2) ? (a & 0xFFFF) : a;
+        return true;
+
+    case OP_RET_FAR:
+    {
+        uint32_t oldEsp = m_gpr[GPR_ESP];
+        uint32_t offset, selector;
+        if (!StackPop(ins.opSize, &offset) || !StackPop(ins.opSize, &selector)) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+        if (ins.numOperands > 0) {
+            SetStackPointer(StackPointer() + (op0.imm & 0xFFFF));
+        }
+
+        bool outer = IsProtectedMode() && !(m_eflags & VM_MASK) && (selector & 3) > CPL();
+        uint32_t newEsp, newSs;
+        if (outer && (!StackPop(ins.opSize, &newEsp) || !StackPop(ins.opSize, &newSs))) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+        if (!LoadSegment(SEG_CS, (uint16_t)selector)) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+        if (outer) {
+            if (!LoadSegment(SEG_SS, (uint16_t)newSs)) {
+                return false;
+            }
+            SetStackPointer(newEsp);
+        }
+        m_nextEip = (ins.opSize == 2) ? (offset & 0xFFFF) : offset;
+        return true;
+    }
+
+    case OP_INT:
+        return DeliverInterrupt((uint8_t)op0.imm, false, 0, m_nextEip);
+
+    case OP_INT3:
+        if (m_swBreakpointsEnabled) {
+            m_breakpointHit = true;
+            m_breakpointAddress = m_segs[SEG_CS].base + m_eip;
+            m_exitInfo.reason = CPU_EXIT_SW_BREAKPOINT;
+            m_stopRequested = true;
+            return false;
+        }
+        return DeliverInterrupt(3, false, 0, m_nextEip);
+
+    case OP_INTO:
+        if (m_eflags & OF_MASK) {
+            return DeliverInterrupt(4, false, 0, m_nextEip);
+        }
+        return true;
+
+    case OP_IRET:
+        return ExecIret(ins);
+
+    // ----- Flags ------------------------------------------------------------
+    case OP_CLC: m_eflags &= ~CF_MASK; return true;
+    case OP_STC: m_eflags |= CF_MASK; return true;
+    case OP_CMC: m_eflags ^= CF_MASK; return true;
+    case OP_CLD: m_eflags &= ~DF_MASK; return true;
+    case OP_STD: m_eflags |= DF_MASK; return true;
+    case OP_CLI: m_eflags &= ~IF_MASK; return true;
+    case OP_STI:
+        if (!(m_eflags & IF_MASK)) {
+            m_inhibitInterrupts = true;
+        }
+        m_eflags |= IF_MASK;
+        return true;
+
+    // ----- Strings ----------------------------------------------------------
+    case OP_MOVS:
+    case OP_STOS:
+    case OP_LODS:
+    case OP_CMPS:
+    case OP_SCAS:
+    case OP_INS:
+    case OP_OUTS:
+        return ExecString(ins);
+
+    // ----- I/O --------------------------------------------------------------
+    case OP_IN:
+    {
+        uint16_t port = (op1.kind == OPK_IMM) ? (op1.imm & 0xFF) : (m_gpr[GPR_EDX] & 0xFFFF);
+        uint32_t value = 0;
+        m_ioMapper->IORead(port, &value, op0.size);
+        WriteGPR(GPR_EAX, op0.size, value);
+        return true;
+    }
+
+    case OP_OUT:
+    {
+        uint16_t port = (op0.kind == OPK_IMM) ? (op0.imm & 0xFF) : (m_gpr[GPR_EDX] & 0xFFFF);
+        m_ioMapper->IOWrite(port, ReadGPR(GPR_EAX, op1.size), op1.size);
+        return true;
+    }
+
+    // ----- System -----------------------------------------------------------
+    case OP_NOP:
+        return true;
+
+    case OP_HLT:
+        if (m_eflags & IF_MASK) {
+            // Wait for an interrupt
+            m_halted = true;
+        }
+        else {
+            // The CPU would never wake up
+            m_exitInfo.reason = CPU_EXIT_HLT;
+        }
+        m_stopRequested = true;
+        return true;
+
+    case OP_CPUID:
+    case OP_RDTSC:
+    case OP_RDMSR:
+    case OP_WRMSR:
+    case OP_LGDT:
+    case OP_LIDT:
+    case OP_SGDT:
+    case OP_SIDT:
+    case OP_LLDT:
+    case OP_SLDT:
+    case OP_LTR:
+    case OP_STR:
+    case OP_LMSW:
+    case OP_SMSW:
+    case OP_CLTS:
+    case OP_INVLPG:
+    case OP_WBINVD:
+        return ExecSystem(ins);
+
+    case OP_FNINIT:
+    case OP_FWAIT:
+    case OP_FNSTCW:
+    case OP_FLDCW:
+    case OP_FNSTSW:
+    case OP_FXSAVE:
+    case OP_FXRSTOR:
+    case OP_LDMXCSR:
+    case OP_STMXCSR:
+        return ExecFPU(ins);
+
+    case OP_UNIMPLEMENTED_FPU:
+        if (!CheckFPUAvailable(false)) {
+            return false;
+        }
+        LogInstruction("Unimplemented FPU/SSE instruction", m_segs[SEG_CS].selector, m_eip, ins);
+        return RaiseFault(6);
+
+    default:
+        LogInstruction("Unimplemented instruction", m_segs[SEG_CS].selector, m_eip, ins);
+        return RaiseFault(6);
+    }
+}
+
+// ----- Complex instructions -------------------------------------------------
+
+bool InterpCpu::ExecMulDiv(const Instruction& ins) {
+    const Operand& op0 = ins.operands[0];
+    uint8_t size = ins.opSize;
+    uint32_t mask = SizeMask(size);
+    uint32_t src;
+
+    // Two and three operand forms of IMUL
+    if (ins.op == OP_IMUL && ins.numOperands > 1) {
+        uint32_t a, b;
+        if (ins.numOperands == 2) {
+            if (!ReadOperand(ins, op0, &a) || !ReadOperand(ins, ins.operands[1], &b)) {
+                return false;
+            }
+        }
+        else if (!ReadOperand(ins, ins.operands[1], &a) || !ReadOperand(ins, ins.operands[2], &b)) {
+            return false;
+        }
+        int64_t r = (int64_t)SignExtend(a, size) * (int64_t)SignExtend(b, size);
+        uint32_t truncated = (uint32_t)r & mask;
+        bool overflow = r != (int64_t)SignExtend(truncated, size);
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (overflow ? (CF_MASK | OF_MASK) : 0);
+        WriteGPR(op0.reg, size, truncated);
+        return true;
+    }
+
+    if (!ReadOperand(ins, op0, &src)) {
+        return false;
+    }
+    src &= mask;
+
+    uint64_t acc;
+    switch (size) {
+    case 1: acc = m_gpr[GPR_EAX] & 0xFFFF; break;
+    case 2: acc = ((m_gpr[GPR_EDX] & 0xFFFF) << 16) | (m_gpr[GPR_EAX] & 0xFFFF); break;
+    default: acc = ((uint64_t)m_gpr[GPR_EDX] << 32) | m_gpr[GPR_EAX]; break;
+    }
+    uint32_t bits = size * 8;
+
+    uint64_t low, high;
+    switch (ins.op) {
+    case OP_MUL:
+    {
+        uint64_t r = (uint64_t)(acc & mask) * src;
+        low = r & mask;
+        high = (r >> bits) & mask;
+        bool overflow = high != 0;
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (overflow ? (CF_MASK | OF_MASK) : 0);
+        break;
+    }
+    case OP_IMUL:
+    {
+        int64_t r = (int64_t)SignExtend((uint32_t)acc, size) * (int64_t)SignExtend(src, size);
+        low = (uint64_t)r & mask;
+        high = ((uint64_t)r >> bits) & mask;
+        bool overflow = r != (int64_t)SignExtend((uint32_t)low, size);
+        m_eflags = (m_eflags & ~(CF_MASK | OF_MASK)) | (overflow ? (CF_MASK | OF_MASK) : 0);
+        break;
+    }
+    case OP_DIV:
+    {
+        if (src == 0) {
+            return RaiseFault(0);
+        }
+        uint64_t q = acc / src;
+        if (q > mask) {
+            return RaiseFault(0);
+        }
+        low = q;
+        high = acc % src;
+        break;
+    }
+    default:  // OP_IDIV
+    {
+        int64_t dividend;
+        switch (size) {
+        case 1: dividend = (int16_t)acc; break;
+        case 2: dividend = (int32_t)acc; break;
+        default: dividend = (int64_t)acc; break;
+        }
+        int64_t divisor = SignExtend(src, size);
+        if (divisor == 0 || (divisor == -1 && dividend == INT64_MIN)) {
+            return RaiseFault(0);
+        }
+        int64_t q = dividend / divisor;
+        if (q != (int64_t)SignExtend((uint32_t)q & mask, size)) {
+            return RaiseFault(0);
+        }
+        low = (uint64_t)q & mask;
+        high = (uint64_t)(dividend % divisor) & mask;
+        break;
+    }
+    }
+
+    if (size == 1) {
+        WriteGPR(GPR_EAX, 2, (uint32_t)((high << 8) | low));
+    }
+    else {
+        WriteGPR(GPR_EAX, size, (uint32_t)low);
+        WriteGPR(GPR_EDX, size, (uint32_t)high);
+    }
+    return true;
+}
+
+bool InterpCpu::ExecString(const Instruction& ins) {
+    uint8_t size = ins.opSize;
+    uint32_t addrMask = SizeMask(ins.addrSize);
+    bool rep = (ins.prefixes & (PREFIX_REP | PREFIX_REPNE)) != 0;
+    bool compare = ins.op == OP_CMPS || ins.op == OP_SCAS;
+    uint8_t srcSeg = SegmentOverride(ins, SEG_DS);
+    int32_t delta = (m_eflags & DF_MASK) ? -(int32_t)size : (int32_t)size;
+    uint16_t port = m_gpr[GPR_EDX] & 0xFFFF;
+
+    uint32_t count = m_gpr[GPR_ECX] & addrMask;
+    if (rep && count == 0) {
+        return true;
+    }
+
+    // Forward REP MOVS/STOS within pages already in the TLB can be done in
+    // bulk on host memory
+    bool bulk = rep && delta > 0 && ins.addrSize == 4 && (ins.op == OP_MOVS || ins.op == OP_STOS);
+
+    uint32_t iterations = 0;
+    for (;;) {
+        uint32_t si = m_gpr[GPR_ESI] & addrMask;
+        uint32_t di = m_gpr[GPR_EDI] & addrMask;
+
+        uint32_t done = 0;
+        if (bulk) {
+            uint32_t dstAddr = m_segs[SEG_ES].base + di;
+            TLBEntry& dstEntry = m_tlbWrite[(dstAddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+            if (dstEntry.tag == (dstAddr & ~INTERP_PAGE_MASK) && dstEntry.host != nullptr) {
+                uint8_t *dst = dstEntry.host + (dstAddr & INTERP_PAGE_MASK);
+                uint32_t n = (INTERP_PAGE_SIZE - (dstAddr & INTERP_PAGE_MASK)) / size;
+                if (n > count) {
+                    n = count;
+                }
+
+                if (ins.op == OP_STOS) {
+                    uint32_t value = ReadGPR(GPR_EAX, size);
+                    if (size == 1) {
+                        memset(dst, (int)value, n);
+                    }
+                    else {
+                        for (uint32_t i = 0; i < n; i++) {
+                            memcpy(dst + i * size, &value, size);
+                        }
+                    }
+                    done = n;
+                }
+                else {
+                    uint32_t srcAddr = m_segs[srcSeg].base + si;
+                    TLBEntry& srcEntry = m_tlbRead[(srcAddr >> INTERP_PAGE_SHIFT) & (INTERP_TLB_ENTRIES - 1)];
+                    if (srcEntry.tag == (srcAddr & ~INTERP_PAGE_MASK) && srcEntry.host != nullptr) {
+                        const uint8_t *src = srcEntry.host + (srcAddr & INTERP_PAGE_MASK);
+                        uint32_t srcAvail = (INTERP_PAGE_SIZE - (srcAddr & INTERP_PAGE_MASK)) / size;
+                        if (n > srcAvail) {
+                            n = srcAvail;
+                        }
+                        // Overlapping copies must go element by element
+                        uint32_t bytes = n * size;
+                        if (dst + bytes <= src || src + bytes <= dst) {
+                            memcpy(dst, src, bytes);
+                            done = n;
+                        }
+                    }
+                }
+            }
+        }
+
+        if (done > 0) {
+            AdvanceIndex(m_gpr[GPR_EDI], delta * (int32_t)done, addrMask);
+            if (ins.op == OP_MOVS) {
+                AdvanceIndex(m_gpr[GPR_ESI], delta * (int32_t)done, addrMask);
+            }
+        }
+        else {
+            done = 1;
+            uint32_t value = 0;
+            switch (ins.op) {
+            case OP_MOVS:
+                if (!ReadSeg(srcSeg, si, size, &value) || !WriteSeg(SEG_ES, di, size, &value)) {
+                    return false;
+                }
+                AdvanceIndex(m_gpr[GPR_ESI], delta, addrMask);
+                AdvanceIndex(m_gpr[GPR_EDI], delta, addrMask);
+                break;
+            case OP_STOS:
+                value = ReadGPR(GPR_EAX, size);
+                if (!WriteSeg(SEG_ES, di, size, &value)) {
+                    return false;
+                }
+                AdvanceIndex(m_gpr[GPR_EDI], delta, addrMask);
+                break;
+            case OP_LODS:
+                if (!ReadSeg(srcSeg, si, size, &value)) {
+                    return false;
+                }
+                WriteGPR(GPR_EAX, size, value);
+                AdvanceIndex(m_gpr[GPR_ESI], delta, addrMask);
+                break;
+            case OP_CMPS:
+            {
+                uint32_t other = 0;
+                if (!ReadSeg(srcSeg, si, size, &value) || !ReadSeg(SEG_ES, di, size, &other)) {
+                    return false;
+                }
+                Alu(ALU_CMP, value, other, size);
+                AdvanceIndex(m_gpr[GPR_ESI], delta, addrMask);
+                AdvanceIndex(m_gpr[GPR_EDI], delta, addrMask);
+                break;
+            }
+            case OP_SCAS:
+                if (!ReadSeg(SEG_ES, di, size, &value)) {
+                    return false;
+                }
+                Alu(ALU_CMP, ReadGPR(GPR_EAX, size), value, size);
+                AdvanceIndex(m_gpr[GPR_EDI], delta, addrMask);
+                break;
+            case OP_INS:
+                m_ioMapper->IORead(port, &value, size);
+                if (!WriteSeg(SEG_ES, di, size, &value)) {
+                    return false;
+                }
+                AdvanceIndex(m_gpr[GPR_EDI], delta, addrMask);
+                break;
+            case OP_OUTS:
+                if (!ReadSeg(srcSeg, si, size, &value)) {
+                    return false;
+                }
+                m_ioMapper->IOWrite(port, value, size);
+                AdvanceIndex(m_gpr[GPR_ESI], delta, addrMask);
+                break;
+            default:
+                return RaiseFault(6);
+            }
+        }
+
+        if (!rep) {
+            return true;
+        }
+
+        count = (count - done) & addrMask;
+        m_gpr[GPR_ECX] = (m_gpr[GPR_ECX] & ~addrMask) | count;
+        if (count == 0) {
+            return true;
+        }
+        if (compare) {
+            bool zf = (m_eflags & ZF_MASK) != 0;
+            if (((ins.prefixes & PREFIX_REP) && !zf) || ((ins.prefixes & PREFIX_REPNE) && zf)) {
+                return true;
+            }
+        }
+
+        iterations += done;
+        if (iterations >= INTERP_STRING_MAX_ITERATIONS) {
+            // Resume the instruction later
+            m_nextEip = m_eip;
+            return true;
+        }
+    }
+}
+
+bool InterpCpu::ExecFarTransfer(const Instruction& ins, uint16_t selector, uint32_t offset, bool call) {
+    uint8_t size = ins.opSize;
+    if (size == 2) {
+        offset &= 0xFFFF;
+    }
+
+    uint32_t oldEsp = m_gpr[GPR_ESP];
+    if (call) {
+        if (!StackPush(size, m_segs[SEG_CS].selector) || !StackPush(size, m_nextEip)) {
+            m_gpr[GPR_ESP] = oldEsp;
+            return false;
+        }
+    }
+
+    if (!IsProtectedMode() || (m_eflags & VM_MASK)) {
+        LoadSegment(SEG_CS, selector);
+        m_nextEip = offset;
+        return true;
+    }
+
+    if ((selector & ~3) == 0) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return RaiseFault(13, 0);
+    }
+
+    GDTEntry desc;
+    if (!ReadDescriptor(selector, &desc)) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return false;
+    }
+    if (!(desc.data.access & 0x10)) {
+        log_warning("InterpCpu: Far transfers through call gates and task segments are not supported (selector 0x%04X)\n", selector);
+        m_gpr[GPR_ESP] = oldEsp;
+        return RaiseFault(13, selector & ~3);
+    }
+    if (!(desc.data.access & 0x80)) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return RaiseFault(11, selector & ~3);
+    }
+
+    LoadSegmentFromDescriptor(&m_segs[SEG_CS], (selector & ~3) | CPL(), desc);
+    m_nextEip = offset;
+    return true;
+}
+
+bool InterpCpu::ExecIret(const Instruction& ins) {
+    uint8_t size = ins.opSize;
+    uint32_t oldEsp = m_gpr[GPR_ESP];
+
+    uint32_t eip, cs, flags;
+    if (!StackPop(size, &eip) || !StackPop(size, &cs) || !StackPop(size, &flags)) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return false;
+    }
+
+    if (!IsProtectedMode()) {
+        LoadSegment(SEG_CS, (uint16_t)cs);
+        WriteFlags(flags, (FLAGS_WRITABLE_MASK | IF_MASK | IOPL_MASK) & SizeMask(size));
+        m_nextEip = eip & SizeMask(size);
+        return true;
+    }
+
+    if (m_eflags & NT_MASK) {
+        log_warning("InterpCpu: Task return is not supported\n");
+        m_gpr[GPR_ESP] = oldEsp;
+        return RaiseFault(13, 0);
+    }
+    if (size == 4 && (flags & VM_MASK) && CPL() == 0) {
+        log_warning("InterpCpu: Virtual-8086 mode is not supported\n");
+        m_gpr[GPR_ESP] = oldEsp;
+        return RaiseFault(13, 0);
+    }
+
+    uint8_t cpl = CPL();
+    bool outer = (cs & 3) > cpl;
+    uint32_t newEsp, newSs;
+    if (outer && (!StackPop(size, &newEsp) || !StackPop(size, &newSs))) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return false;
+    }
+    if (!LoadSegment(SEG_CS, (uint16_t)cs)) {
+        m_gpr[GPR_ESP] = oldEsp;
+        return false;
+    }
+
+    uint32_t mask = FLAGS_WRITABLE_MASK | RF_MASK;
+    uint8_t iopl = (m_eflags & IOPL_MASK) >> IOPL_BIT0;
+    if (cpl == 0) {
+        mask |= IOPL_MASK;
+    }
+    if (cpl <= iopl) {
+        mask |= IF_MASK;
+    }
+    WriteFlags(flags, mask & SizeMask(size));
+
+    if (outer) {
+        if (!LoadSegment(SEG_SS, (uint16_t)newSs)) {
+            return false;
+        }
+        SetStackPointer(newEsp);
+    }
+
+    m_nextEip = eip & SizeMask(size);
+    return true;
+}
+
+bool InterpCpu::ExecSystem(const Instruction& ins) {
+    const Operand& op0 = ins.operands[0];
+    uint32_t value;
+
+    switch (ins.op) {
+    case OP_CPUID:
+        switch (m_gpr[GPR_EAX]) {
+        case 0:
+            m_gpr[GPR_EAX] = 2;
+            m_gpr[GPR_EBX] = 0x756E6547;  // "Genu"
+            m_gpr[GPR_EDX] = 0x49656E69;  // "ineI"
+            m_gpr[GPR_ECX] = 0x6C65746E;  // "ntel"
+            break;
+        case 1:
+            m_gpr[GPR_EAX] = 0x0000068A;
+            m_gpr[GPR_EBX] = 0;
+            m_gpr[GPR_ECX] = 0;
+            // FPU, DE, PSE, TSC, MSR, CX8, MTRR, PGE, CMOV, MMX, FXSR, SSE
+            m_gpr[GPR_EDX] = 0x0380B13D;
+            break;
+        case 2:
+            // Cache and TLB descriptors
+            m_gpr[GPR_EAX] = 0x03020101;
+            m_gpr[GPR_EBX] = 0;
+            m_gpr[GPR_ECX] = 0;
+            m_gpr[GPR_EDX] = 0x0C040882;
+            break;
+        default:
+            m_gpr[GPR_EAX] = m_gpr[GPR_EBX] = m_gpr[GPR_ECX] = m_gpr[GPR_EDX] = 0;
+            break;
+        }
+        return true;
+
+    case OP_RDTSC:
+    case OP_RDMSR:
+    {
+        if (ins.op == OP_RDTSC && (m_cr[4] & CR4_TSD) && CPL() != 0) {
+            return RaiseFault(13, 0);
+        }
+
+        uint64_t msr;
+        if (ins.op == OP_RDTSC || m_gpr[GPR_ECX] == 0x10) {
+            uint64_t nanos = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_tscBase).count();
+            msr = (nanos / 1000000000ULL) * INTERP_TSC_FREQUENCY + (nanos % 1000000000ULL) * INTERP_TSC_FREQUENCY / 1000000000ULL;
+        }
+        else {
+            auto it = m_msrs.find(m_gpr[GPR_ECX]);
+            msr = (it != m_msrs.end()) ? it->second : 0;
+        }
+        m_gpr[GPR_EAX] = (uint32_t)msr;
+        m_gpr[GPR_EDX] = (uint32_t)(msr >> 32);
+        return true;
+    }
+
+    case OP_WRMSR:
+    {
+        uint64_t msr = ((uint64_t)m_gpr[GPR_EDX] << 32) | m_gpr[GPR_EAX];
+        if (m_gpr[GPR_ECX] == 0x10) {
+            // Rebase the time stamp counter
+            uint64_t nanos = (msr / INTERP_TSC_FREQUENCY) * 1000000000ULL + (msr % INTERP_TSC_FREQUENCY) * 1000000000ULL / INTERP_TSC_FREQUENCY;
+            m_tscBase = std::chrono::steady_clock::now() - std::chrono::nanoseconds(nanos);
+        }
+        else {
+            m_msrs[m_gpr[GPR_ECX]] = msr;
+        }
+        return true;
+    }
+
+    case OP_LGDT:
+    case OP_LIDT:
+    {
+        uint32_t addr = EffectiveAddress(ins, op0);
+        uint16_t limit;
+        uint32_t base;
+        if (!ReadSeg(op0.seg, addr, 2, &limit) || !ReadSeg(op0.seg, addr + 2, 4, &base)) {
+            return false;
+        }
+        if (ins.opSize == 2) {
+            base &= 0xFFFFFF;
+        }
+        DescriptorTableRegister& reg = (ins.op == OP_LGDT) ? m_gdtr : m_idtr;
+        reg.base = base;
+        reg.limit = limit;
+        return true;
+    }
+
+    case OP_SGDT:
+    case OP_SIDT:
+    {
+        DescriptorTableRegister& reg = (ins.op == OP_SGDT) ? m_gdtr : m_idtr;
+        uint32_t addr = EffectiveAddress(ins, op0);
+        return WriteSeg(op0.seg, addr, 2, &reg.limit) && WriteSeg(op0.seg, addr + 2, 4, &reg.base);
+    }
+
+    case OP_LLDT:
+        if (!ReadOperand(ins, op0, &value)) {
+            return false;
+        }
+        return LoadSystemSegment(&m_ldtr, (uint16_t)value);
+
+    case OP_LTR:
+    {
+        if (!ReadOperand(ins, op0, &value)) {
+            return false;
+        }
+        if ((value & ~3) == 0) {
+            return RaiseFault(13, 0);
+        }
+        if (!LoadSystemSegment(&m_tr, (uint16_t)value)) {
+            return false;
+        }
+        // Mark the TSS as busy
+        uint8_t access = m_tr.access | 0x2;
+        m_tr.access = access;
+        return WriteLinear(m_gdtr.base + (value & ~7) + 5, 1, &access);
+    }
+
+    case OP_SLDT:
+        return WriteOperand(ins, op0, m_ldtr.selector);
+
+    case OP_STR:
+        return WriteOperand(ins, op0, m_tr.selector);
+
+    case OP_LMSW:
+        if (!ReadOperand(ins, op0, &value)) {
+            return false;
+        }
+        // LMSW can set PE but not clear it
+        return WriteCR(0, (m_cr[0] & ~0xE) | (value & 0xF));
+
+    case OP_SMSW:
+        return WriteOperand(ins, op0, m_cr[0]);
+
+    case OP_CLTS:
+        m_cr[0] &= ~CR0_TS;
+        return true;
+
+    case OP_INVLPG:
+        InvalidateTLBEntry(m_segs[op0.seg].base + EffectiveAddress(ins, op0));
+        return true;
+
+    case OP_WBINVD:
+        return true;
+
+    default:
+        return RaiseFault(6);
+    }
+}
+
+bool InterpCpu::CheckFPUAvailable(bool waitInstruction) {
+    if (waitInstruction) {
+        if ((m_cr[0] & (CR0_TS | CR0_MP)) == (CR0_TS | CR0_MP)) {
+            return RaiseFault(7);
+        }
+        return true;
+    }
+    if (m_cr[0] & (CR0_EM | CR0_TS)) {
+        return RaiseFault(7);
+    }
+    return true;
+}
+
+bool InterpCpu::ExecFPU(const Instruction& ins) {
+    const Operand& op0 = ins.operands[0];
+    uint16_t& fcw = *reinterpret_cast<uint16_t*>(&m_fxState[0]);
+    uint16_t& fsw = *reinterpret_cast<uint16_t*>(&m_fxState[2]);
+    uint32_t& mxcsr = *reinterpret_cast<uint32_t*>(&m_fxState[24]);
+    uint32_t value;
+
+    if (!CheckFPUAvailable(ins.op == OP_FWAIT)) {
+        return false;
+    }
+
+    switch (ins.op) {
+    case OP_FNINIT:
+        fcw = 0x037F;
+        fsw = 0;
+        // Clear the tag word, opcode and instruction/operand pointers
+        memset(&m_fxState[4], 0, 20);
+        return true;
+
+    case OP_FWAIT:
+        return true;
+
+    case OP_FNSTCW:
+        return WriteOperand(ins, op0, fcw);
+
+    case OP_FLDCW:
+        if (!ReadOperand(ins, op0, &value)) {
+            return false;
+        }
+        fcw = (uint16_t)value;
+        return true;
+
+    case OP_FNSTSW:
+        return WriteOperand(ins, op0, fsw);
+
+    case OP_FXSAVE:
+    case OP_FXRSTOR:
+    {
+        uint32_t addr = EffectiveAddress(ins, op0);
+        if ((m_segs[op0.seg].base + addr) & 0xF) {
+            return RaiseFault(13, 0);
+        }
+        if (ins.op == OP_FXSAVE) {
+            return WriteSeg(op0.seg, addr, sizeof(m_fxState), m_fxState);
+        }
+
+        uint8_t image[sizeof(m_fxState)];
+        if (!ReadSeg(op0.seg, addr, sizeof(image), image)) {
+            return false;
+        }
+        if (*reinterpret_cast<uint32_t*>(&image[24]) & 0xFFFF0000) {
+            return RaiseFault(13, 0);
+        }
+        memcpy(m_fxState, image, sizeof(image));
+        return true;
+    }
+
+    case OP_LDMXCSR:
+    case OP_STMXCSR:
+        if (!(m_cr[4] & CR4_FXSR)) {
+            return RaiseFault(6);
+        }
+        if (ins.op == OP_STMXCSR) {
+            return WriteOperand(ins, op0, mxcsr);
+        }
+        if (!ReadOperand(ins, op0, &value)) {
+            return false;
+        }
+        if (value & 0xFFFF0000) {
+            return RaiseFault(13, 0);
+        }
+        mxcsr = value;
+        return true;
+
+    default:
+        return RaiseFault(6);
+    }
+}
+
+}
+}
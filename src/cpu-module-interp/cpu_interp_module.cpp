@@ -0,0 +1,31 @@
+#include "vixen/cpu_module_decl.h"
+#include "cpu_interp_module.h"
+
+namespace vixen {
+namespace modules {
+namespace cpu {
+
+using namespace vixen::cpu;
+
+CPU_MODULE_BEGIN
+CPU_MODULE_INFO(InterpCPUModule, "Interpreter CPU Module", "0.0.1")
+CPU_MODULE_CAPS.guestDebugging();
+CPU_MODULE_END
+
+// Each call creates an independent CPU, so that several emulated machines can
+// be hosted by the same process
+Cpu *InterpCPUModule::GetCPU() {
+    return new InterpCpu();
+}
+
+void InterpCPUModule::FreeCPU(Cpu *cpu) {
+    delete cpu;
+}
+
+void InterpCPUModule::Cleanup() {
+
+}
+
+}
+}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "vixen/cpu.h"
+#include "cpu_interp.h"
+
+namespace vixen {
+namespace modules {
+namespace cpu {
+
+using namespace vixen::cpu;
+
+class InterpCPUModule : public ICPUModule {
+public:
+    Cpu *GetCPU();
+    void FreeCPU(Cpu *cpu);
+    void Cleanup();
+};
+
+}
+}
+}
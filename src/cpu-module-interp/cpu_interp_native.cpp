@@ -0,0 +1,315 @@
+#include "cpu_interp.h"
+#include "vixen/log.h"
+
+#include <stddef.h>
+
+namespace vixen {
+namespace cpu {
+
+// Flags computed by the arithmetic instructions, which native code copies
+// from the host's flags
+#define NATIVE_ARITH_FLAGS  (CF_MASK | PF_MASK | AF_MASK | ZF_MASK | SF_MASK | OF_MASK)
+
+// Stack space reserved by the entry point: the shadow space of the Windows
+// x64 calling convention, plus padding that keeps calls 16-byte aligned
+#define NATIVE_FRAME_SIZE   40
+
+// ----- Native code layout ---------------------------------------------------
+//
+// Native blocks run with these registers:
+//   RBX  the InterpCpu
+//   R12  number of instructions executed so far
+//   R13  maximum number of instructions to execute
+//   R14  the block being executed
+//   R15  the rel32 field of the jump to patch with the next block, if any
+//
+// Each block starts with a checked entry that translates CS:EIP through the
+// TLB like FindBlock does and compares the result and the page generation
+// with the block's, then falls into the body. Blocks that end with a near
+// control transfer or run into the next block finish with one exit stub per
+// successor. A stub returns to the dispatcher if the CPU must stop, then
+// jumps to the successor's checked entry once FindBlock has patched it in;
+// until then it jumps to the shared exit sequence, leaving its address in R15.
+//
+// Invalidated blocks fail their checked entry, so links to them fall back to
+// the dispatcher, which finds the new translation and patches the link again.
+// All code is discarded when the block cache is flushed.
+
+void InterpCpu::InitNativeCode() {
+    m_nativeEnter = nullptr;
+    m_nativeExit = nullptr;
+
+    CodeBuffer& code = m_blockCache.GetCodeBuffer();
+    if (!BLOCK_CACHE_NATIVE_CODE || !code.IsValid()) {
+        return;
+    }
+
+    X64Emitter e(code.GetCursor());
+
+    // uint32_t enter(InterpCpu *cpu, uint8_t *body, uint32_t maxInstructions)
+    e.Push(X64_RBX);
+    e.Push(X64_RBP);
+    e.Push(X64_R12);
+    e.Push(X64_R13);
+    e.Push(X64_R14);
+    e.Push(X64_R15);
+    e.SubRsp(NATIVE_FRAME_SIZE);
+    e.MovRegReg64(X64_RBX, X64_ARG0);
+    e.MovRegReg32(X64_R13, X64_ARG2);
+    e.AluRegReg32(X64_XOR, X64_R12, X64_R12);
+    e.AluRegReg32(X64_XOR, X64_R14, X64_R14);
+    e.AluRegReg32(X64_XOR, X64_R15, X64_R15);
+    e.JmpReg(X64_ARG1);
+
+    // Exit: record where execution stopped and return the instruction count
+    uint32_t exitOffset = e.GetOffset();
+    e.MovMemReg64(X64_RBX, NativeOffset(&m_lastBlock), X64_R14);
+    e.MovMemReg64(X64_RBX, NativeOffset(&m_nativeLink), X64_R15);
+    e.MovRegReg32(X64_RAX, X64_R12);
+    e.AddRsp(NATIVE_FRAME_SIZE);
+    e.Pop(X64_R15);
+    e.Pop(X64_R14);
+    e.Pop(X64_R13);
+    e.Pop(X64_R12);
+    e.Pop(X64_RBP);
+    e.Pop(X64_RBX);
+    e.Ret();
+
+    uint8_t *base = code.Commit(e.GetCode().data(), e.GetCode().size());
+    if (base == nullptr) {
+        log_warning("InterpCpu: Could not emit the native code entry point; using the threaded tier only\n");
+        return;
+    }
+    code.Pin();
+    m_nativeEnter = reinterpret_cast<NativeEnterFunc>(base);
+    m_nativeExit = base + exitOffset;
+}
+
+bool InterpCpu::IsNativeOp(const BlockOp& op) {
+    return op.handler == &OpMovRegReg32
+        || op.handler == &OpMovRegImm32
+        || op.handler == &OpAluRegReg32
+        || op.handler == &OpAluRegImm32
+        || op.handler == &OpJccRel32
+        || op.handler == &OpJmpRel32;
+}
+
+// Determines if a block ending with the given instruction may jump straight
+// into the next one. Near control transfers keep the code segment and the
+// decoding mode, so the successor's checked entry is enough to validate it.
+bool InterpCpu::CanChain(const Instruction& ins) {
+    switch (ins.op) {
+    case OP_JMP: case OP_JCC: case OP_JCXZ:
+    case OP_LOOP: case OP_LOOPE: case OP_LOOPNE:
+    case OP_CALL: case OP_RET:
+        return true;
+    default:
+        return !EndsBlock(ins);
+    }
+}
+
+bool InterpCpu::NativeStep(InterpCpu *cpu, const BlockOp *op) {
+    return cpu->ExecuteBlockOp(*op, 0xFFFFFFFF);
+}
+
+uint32_t InterpCpu::ExecuteNative(TranslatedBlock *block, uint32_t maxInstructions) {
+    m_nativeLink = nullptr;
+    return m_nativeEnter(this, block->nativeBody, maxInstructions);
+}
+
+// Emits a 32-bit ALU operation between registers or with an immediate,
+// computing the flags on the host exactly as Alu does
+void InterpCpu::EmitNativeAlu(X64Emitter& e, const Instruction& ins) {
+    const Operand& dst = ins.operands[0];
+    const Operand& src = ins.operands[1];
+    bool imm = src.kind == OPK_IMM;
+    bool logic = ins.subop == ALU_AND || ins.subop == ALU_OR || ins.subop == ALU_XOR || ins.subop == ALU_TEST;
+    int32_t flagsOffset = NativeOffset(&m_eflags);
+
+    e.MovRegMem32(X64_RAX, X64_RBX, NativeOffset(&m_gpr[dst.reg]));
+    if (!imm) {
+        e.MovRegMem32(X64_RCX, X64_RBX, NativeOffset(&m_gpr[src.reg]));
+    }
+    if (ins.subop == ALU_ADC || ins.subop == ALU_SBB) {
+        e.MovRegMem32(X64_RDX, X64_RBX, flagsOffset);
+        e.BtRegImm32(X64_RDX, CF_BIT);
+    }
+
+    if (ins.subop == ALU_TEST) {
+        if (imm) {
+            e.TestRegImm32(X64_RAX, src.imm);
+        }
+        else {
+            e.TestRegReg32(X64_RAX, X64_RCX);
+        }
+    }
+    else {
+        if (imm) {
+            e.AluRegImm32((X64AluOp)ins.subop, X64_RAX, src.imm);
+        }
+        else {
+            e.AluRegReg32((X64AluOp)ins.subop, X64_RAX, X64_RCX);
+        }
+    }
+
+    // Logical operations leave AF undefined on the host; the interpreter
+    // clears it
+    e.Pushfq();
+    e.Pop(X64_RDX);
+    e.AluRegImm32(X64_AND, X64_RDX, logic ? (NATIVE_ARITH_FLAGS & ~AF_MASK) : NATIVE_ARITH_FLAGS);
+    e.MovRegMem32(X64_RCX, X64_RBX, flagsOffset);
+    e.AluRegImm32(X64_AND, X64_RCX, ~(uint32_t)NATIVE_ARITH_FLAGS);
+    e.AluRegReg32(X64_OR, X64_RCX, X64_RDX);
+    e.MovMemReg32(X64_RBX, flagsOffset, X64_RCX);
+
+    if (ins.subop != ALU_CMP && ins.subop != ALU_TEST) {
+        e.MovMemReg32(X64_RBX, NativeOffset(&m_gpr[dst.reg]), X64_RAX);
+    }
+}
+
+void InterpCpu::CompileNative(TranslatedBlock *block) {
+    if (m_nativeEnter == nullptr || block->mode != DECODE_MODE_PROT32 || block->ops.empty()) {
+        return;
+    }
+
+    CodeBuffer& code = m_blockCache.GetCodeBuffer();
+    X64Emitter e(code.GetCursor());
+    X64Label miss;
+    X64Label exit;
+
+    int32_t eipOffset = NativeOffset(&m_eip);
+    int32_t tlbOffset = NativeOffset(&m_tlbRead[0]);
+
+    // ----- Checked entry: CS:EIP must map to this block, which must still be
+    // valid
+    e.MovRegMem32(X64_RAX, X64_RBX, NativeOffset(&m_segs[SEG_CS].base));
+    e.AluRegMem32(X64_ADD, X64_RAX, X64_RBX, eipOffset);
+    e.MovRegReg32(X64_RCX, X64_RAX);
+    e.ShrRegImm32(X64_RCX, INTERP_PAGE_SHIFT);
+    e.AluRegImm32(X64_AND, X64_RCX, INTERP_TLB_ENTRIES - 1);
+    e.ImulRegImm8(X64_RCX, X64_RCX, (int8_t)sizeof(TLBEntry));
+    e.LeaRegSum64(X64_RDX, X64_RBX, X64_RCX);
+    e.MovRegReg32(X64_RCX, X64_RAX);
+    e.AluRegImm32(X64_AND, X64_RCX, ~(uint32_t)INTERP_PAGE_MASK);
+    e.AluMemReg32(X64_CMP, X64_RDX, tlbOffset + (int32_t)offsetof(TLBEntry, tag), X64_RCX);
+    e.Jcc(X64_CC_NE, miss);
+    e.CmpMemImm8_64(X64_RDX, tlbOffset + (int32_t)offsetof(TLBEntry, host), 0);
+    e.Jcc(X64_CC_E, miss);
+    e.AluRegImm32(X64_AND, X64_RAX, INTERP_PAGE_MASK);
+    e.AluRegMem32(X64_OR, X64_RAX, X64_RDX, tlbOffset + (int32_t)offsetof(TLBEntry, physPage));
+    e.AluRegImm32(X64_CMP, X64_RAX, block->startPhys);
+    e.Jcc(X64_CC_NE, miss);
+    e.MovRegImm64(X64_RAX, (uint64_t)(uintptr_t)m_blockCache.GetGenerationPointer(block->startPhys >> BLOCK_CACHE_PAGE_SHIFT));
+    e.AluMemImm32(X64_CMP, X64_RAX, 0, block->generation);
+    e.Jcc(X64_CC_NE, miss);
+
+    // ----- Body
+    uint32_t bodyOffset = e.GetOffset();
+    e.MovRegImm64(X64_R14, (uint64_t)(uintptr_t)block);
+
+    // EIP and the instruction count are only stored before calling handlers
+    // and at the end of the block
+    uint32_t pendingEip = 0;
+    uint32_t pendingCount = 0;
+    auto flush = [&]() {
+        if (pendingEip != 0) {
+            e.AluMemImm32(X64_ADD, X64_RBX, eipOffset, pendingEip);
+        }
+        if (pendingCount != 0) {
+            e.AluRegImm32(X64_ADD, X64_R12, pendingCount);
+        }
+        pendingEip = 0;
+        pendingCount = 0;
+    };
+
+    // Returns to the dispatcher if the CPU must stop, otherwise jumps to the
+    // successor through a patchable jump
+    auto emitExitStub = [&]() {
+        e.CmpMemImm8(X64_RBX, NativeOffset(&m_exitRequested), 0);
+        e.Jcc(X64_CC_NE, exit);
+        e.CmpMemImm8(X64_RBX, NativeOffset(&m_interruptWindowRequested), 0);
+        e.Jcc(X64_CC_NE, exit);
+        e.CmpMemImm8(X64_RBX, NativeOffset(&m_hostWritesPending), 0);
+        e.Jcc(X64_CC_NE, exit);
+        e.AluRegReg32(X64_CMP, X64_R12, X64_R13);
+        e.Jcc(X64_CC_AE, exit);
+        e.LeaRipRelative(X64_R15, 1);
+        e.JmpAbsolute(m_nativeExit);
+    };
+
+    // Instructions run inline never inhibit interrupts, so they clear the
+    // interrupt shadow left by the instruction before them
+    bool clearShadow = true;
+    bool chain = CanChain(block->ops.back().ins);
+    for (const BlockOp& op : block->ops) {
+        const Instruction& ins = op.ins;
+        if (!IsNativeOp(op)) {
+            // The threaded handler counts even if it faults
+            pendingCount++;
+            flush();
+            e.MovRegReg64(X64_ARG0, X64_RBX);
+            e.MovRegImm64(X64_ARG1, (uint64_t)(uintptr_t)&op);
+            e.MovRegImm64(X64_RAX, (uint64_t)reinterpret_cast<uintptr_t>(&NativeStep));
+            e.CallReg(X64_RAX);
+            e.TestRegReg8(X64_RAX, X64_RAX);
+            e.Jcc(X64_CC_E, exit);
+            clearShadow = true;
+            continue;
+        }
+
+        if (clearShadow) {
+            e.MovMemImm8(X64_RBX, NativeOffset(&m_interruptShadow), 0);
+            clearShadow = false;
+        }
+        pendingEip += ins.length;
+        pendingCount++;
+
+        if (op.handler == &OpMovRegReg32) {
+            e.MovRegMem32(X64_RAX, X64_RBX, NativeOffset(&m_gpr[ins.operands[1].reg]));
+            e.MovMemReg32(X64_RBX, NativeOffset(&m_gpr[ins.operands[0].reg]), X64_RAX);
+        }
+        else if (op.handler == &OpMovRegImm32) {
+            e.MovMemImm32(X64_RBX, NativeOffset(&m_gpr[ins.operands[0].reg]), ins.operands[1].imm);
+        }
+        else if (op.handler == &OpAluRegReg32 || op.handler == &OpAluRegImm32) {
+            EmitNativeAlu(e, ins);
+        }
+        else if (op.handler == &OpJmpRel32) {
+            pendingEip += ins.operands[0].imm;
+        }
+        else if (op.handler == &OpJccRel32) {
+            // Always the last operation; the not taken path falls through to
+            // the first exit stub
+            X64Label taken;
+            flush();
+            e.MovRegMem32(X64_RAX, X64_RBX, NativeOffset(&m_eflags));
+            e.AluRegImm32(X64_AND, X64_RAX, NATIVE_ARITH_FLAGS);
+            e.Push(X64_RAX);
+            e.Popfq();
+            e.Jcc((X64Cond)ins.cond, taken);
+            emitExitStub();
+            e.Bind(taken);
+            e.AluMemImm32(X64_ADD, X64_RBX, eipOffset, ins.operands[0].imm);
+        }
+    }
+
+    flush();
+    if (chain) {
+        emitExitStub();
+    }
+
+    e.Bind(exit);
+    e.AluRegReg32(X64_XOR, X64_R15, X64_R15);
+    e.Bind(miss);
+    e.JmpAbsolute(m_nativeExit);
+
+    uint8_t *base = code.Commit(e.GetCode().data(), e.GetCode().size());
+    if (base == nullptr) {
+        return;
+    }
+    block->nativeEntry = base;
+    block->nativeBody = base + bodyOffset;
+}
+
+}
+}
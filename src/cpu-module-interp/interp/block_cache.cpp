@@ -0,0 +1,93 @@
+#include "block_cache.h"
+
+#include <string.h>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+BlockCache::BlockCache()
+    : m_code(BLOCK_CACHE_NATIVE_CODE ? BLOCK_CACHE_CODE_SIZE : 0)
+{
+    m_numBlocks = 0;
+    m_generations = new uint32_t[BLOCK_CACHE_NUM_PAGES];
+    m_heat = new uint8_t[BLOCK_CACHE_NUM_PAGES];
+    m_codePages = new uint8_t[BLOCK_CACHE_NUM_PAGES / 8];
+    memset(m_generations, 0, sizeof(uint32_t) * BLOCK_CACHE_NUM_PAGES);
+    memset(m_heat, 0, BLOCK_CACHE_NUM_PAGES);
+    memset(m_codePages, 0, BLOCK_CACHE_NUM_PAGES / 8);
+}
+
+BlockCache::~BlockCache() {
+    Flush();
+    delete[] m_generations;
+    delete[] m_heat;
+    delete[] m_codePages;
+}
+
+TranslatedBlock *BlockCache::Lookup(uint32_t paddr, DecodeMode mode) {
+    auto it = m_blocks.find(MakeKey(paddr, mode));
+    if (it == m_blocks.end()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+bool BlockCache::RecordExecution(uint32_t paddr) {
+    uint8_t& heat = m_heat[paddr >> BLOCK_CACHE_PAGE_SHIFT];
+    if (heat >= BLOCK_CACHE_HOT_THRESHOLD) {
+        return true;
+    }
+    heat++;
+    return false;
+}
+
+void BlockCache::Insert(TranslatedBlock *block) {
+    uint32_t page = block->startPhys >> BLOCK_CACHE_PAGE_SHIFT;
+    block->generation = m_generations[page];
+    block->links[0] = nullptr;
+    block->links[1] = nullptr;
+    block->nativeEntry = nullptr;
+    block->nativeBody = nullptr;
+
+    m_blocks[MakeKey(block->startPhys, block->mode)] = block;
+    m_pageBlocks[page].push_back(block);
+    m_codePages[page >> 3] |= (1 << (page & 7));
+    m_numBlocks++;
+}
+
+void BlockCache::InvalidatePage(uint32_t page) {
+    m_generations[page]++;
+    m_codePages[page >> 3] &= ~(1 << (page & 7));
+
+    auto it = m_pageBlocks.find(page);
+    if (it == m_pageBlocks.end()) {
+        return;
+    }
+    for (TranslatedBlock *block : it->second) {
+        m_blocks.erase(MakeKey(block->startPhys, block->mode));
+        m_retired.push_back(block);
+    }
+    m_pageBlocks.erase(it);
+}
+
+void BlockCache::Flush() {
+    for (auto it = m_blocks.begin(); it != m_blocks.end(); ++it) {
+        uint32_t page = it->second->startPhys >> BLOCK_CACHE_PAGE_SHIFT;
+        m_generations[page]++;
+        m_codePages[page >> 3] &= ~(1 << (page & 7));
+        delete it->second;
+    }
+    for (TranslatedBlock *block : m_retired) {
+        delete block;
+    }
+    m_blocks.clear();
+    m_pageBlocks.clear();
+    m_retired.clear();
+    m_numBlocks = 0;
+    m_code.Reset();
+}
+
+}
+}
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "decoder.h"
+#include "code_buffer.h"
+
+namespace vixen {
+namespace cpu {
+
+class InterpCpu;
+
+namespace interp {
+
+#define BLOCK_CACHE_PAGE_SHIFT       12
+#define BLOCK_CACHE_NUM_PAGES        (1 << (32 - BLOCK_CACHE_PAGE_SHIFT))
+
+// Number of block entries on a physical page before its blocks are translated
+#define BLOCK_CACHE_HOT_THRESHOLD    32
+
+// Maximum number of instructions in a translated block
+#define BLOCK_CACHE_MAX_INSTRUCTIONS 64
+
+// Maximum number of blocks (including invalidated ones) kept before the cache
+// is flushed
+#define BLOCK_CACHE_MAX_BLOCKS       32768
+
+// Native code is only emitted on x86-64 hosts; elsewhere every block uses the
+// threaded handlers
+#if defined(__x86_64__) || defined(_M_X64)
+#define BLOCK_CACHE_NATIVE_CODE      1
+#else
+#define BLOCK_CACHE_NATIVE_CODE      0
+#endif
+
+// Size of the native code buffer, and the space that must be left in it to
+// translate another block without flushing the cache
+#define BLOCK_CACHE_CODE_SIZE        (32 * 1024 * 1024)
+#define BLOCK_CACHE_MAX_BLOCK_CODE   (32 * 1024)
+
+/*!
+ * Executes one instruction of a translated block. Returns false if the
+ * instruction raised a fault or stopped execution, just like
+ * InterpCpu::Dispatch.
+ */
+typedef bool (*BlockOpHandler)(InterpCpu *cpu, const Instruction& ins);
+
+struct BlockOp {
+    BlockOpHandler handler;
+    Instruction ins;
+};
+
+/*!
+ * A straight-line sequence of instructions that starts at a physical address
+ * and ends at the first control transfer, mode change or page boundary.
+ */
+struct TranslatedBlock {
+    uint32_t startPhys;
+    DecodeMode mode;
+
+    // Generation of the page at the time the block was translated
+    uint32_t generation;
+
+    std::vector<BlockOp> ops;
+
+    // Successors found the last times the block exited; checked before doing
+    // a full lookup
+    TranslatedBlock *links[2];
+
+    // Native code, if the block was compiled. The checked entry verifies that
+    // the current code address maps to the block and that the block is still
+    // valid before falling into the body; other blocks jump to it directly.
+    uint8_t *nativeEntry;
+    uint8_t *nativeBody;
+};
+
+/*!
+ * Cache of translated basic blocks keyed by physical address and decoding
+ * mode.
+ *
+ * Each physical page has an execution counter and a generation counter.
+ * Blocks are only translated once a page becomes hot. Writes to pages holding
+ * translated code bump the page's generation, which invalidates every block
+ * on that page. Invalidated blocks are kept alive until the next flush so
+ * that stale links never dangle.
+ *
+ * The cache also owns the buffer holding the blocks' native code, which is
+ * discarded along with the blocks when the cache is flushed.
+ */
+class BlockCache {
+public:
+    BlockCache();
+    ~BlockCache();
+
+    /*!
+     * Finds a valid block starting at the given physical address.
+     */
+    TranslatedBlock *Lookup(uint32_t paddr, DecodeMode mode);
+
+    /*!
+     * Counts an entry into a block at the given physical address. Returns true
+     * if the page is hot enough to have its blocks translated.
+     */
+    bool RecordExecution(uint32_t paddr);
+
+    /*!
+     * Adds a block to the cache, taking ownership of it, and marks its page as
+     * containing code.
+     */
+    void Insert(TranslatedBlock *block);
+
+    /*!
+     * Invalidates all blocks on the given physical page.
+     */
+    void InvalidatePage(uint32_t page);
+
+    /*!
+     * Deletes all blocks.
+     */
+    void Flush();
+
+    bool IsFull() const {
+        return m_numBlocks >= BLOCK_CACHE_MAX_BLOCKS || (m_code.IsValid() && m_code.GetFree() < BLOCK_CACHE_MAX_BLOCK_CODE);
+    }
+
+    CodeBuffer& GetCodeBuffer() { return m_code; }
+
+    inline bool IsCodePage(uint32_t page) const { return (m_codePages[page >> 3] & (1 << (page & 7))) != 0; }
+    inline uint32_t GetGeneration(uint32_t page) const { return m_generations[page]; }
+
+    /*!
+     * Returns the location of a page's generation counter, which native code
+     * compares against the generation of its blocks.
+     */
+    inline const uint32_t *GetGenerationPointer(uint32_t page) const { return &m_generations[page]; }
+
+    inline bool IsValid(const TranslatedBlock *block) const {
+        return block->generation == m_generations[block->startPhys >> BLOCK_CACHE_PAGE_SHIFT];
+    }
+
+private:
+    std::unordered_map<uint64_t, TranslatedBlock *> m_blocks;
+    std::unordered_map<uint32_t, std::vector<TranslatedBlock *>> m_pageBlocks;
+    std::vector<TranslatedBlock *> m_retired;
+    uint32_t m_numBlocks;
+
+    CodeBuffer m_code;
+
+    uint32_t *m_generations;
+    uint8_t *m_heat;
+    uint8_t *m_codePages;
+
+    static inline uint64_t MakeKey(uint32_t paddr, DecodeMode mode) { return ((uint64_t)mode << 32) | paddr; }
+};
+
+}
+}
+}
@@ -0,0 +1,98 @@
+#include "code_buffer.h"
+#include "vixen/log.h"
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+#define CODE_BUFFER_PAGE_SIZE  4096
+
+CodeBuffer::CodeBuffer(size_t size) {
+    m_base = nullptr;
+    m_size = 0;
+    m_used = 0;
+    m_pinned = 0;
+    if (size == 0) {
+        return;
+    }
+
+    size = (size + CODE_BUFFER_PAGE_SIZE - 1) & ~(size_t)(CODE_BUFFER_PAGE_SIZE - 1);
+#ifdef _WIN32
+    void *mem = VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READ);
+    if (mem == nullptr) {
+        log_warning("CodeBuffer: Could not allocate %zu bytes of executable memory\n", size);
+        return;
+    }
+#else
+    void *mem = mmap(nullptr, size, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        log_warning("CodeBuffer: Could not allocate %zu bytes of executable memory\n", size);
+        return;
+    }
+#endif
+    m_base = (uint8_t *)mem;
+    m_size = size;
+}
+
+CodeBuffer::~CodeBuffer() {
+    if (m_base == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    VirtualFree(m_base, 0, MEM_RELEASE);
+#else
+    munmap(m_base, m_size);
+#endif
+}
+
+uint8_t *CodeBuffer::Commit(const uint8_t *code, size_t size) {
+    if (m_base == nullptr || size > GetFree()) {
+        return nullptr;
+    }
+    uint8_t *dst = GetCursor();
+    if (!Write(dst, code, size)) {
+        return nullptr;
+    }
+    m_used += size;
+    return dst;
+}
+
+void CodeBuffer::PatchJump(uint8_t *rel32, const uint8_t *target) {
+    int32_t rel = (int32_t)(target - (rel32 + 4));
+    Write(rel32, &rel, sizeof(rel));
+}
+
+// Makes the pages covering the range writable only for as long as it takes
+// to copy the data
+bool CodeBuffer::Write(uint8_t *dst, const void *src, size_t size) {
+    uintptr_t start = (uintptr_t)dst & ~(uintptr_t)(CODE_BUFFER_PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)dst + size + CODE_BUFFER_PAGE_SIZE - 1) & ~(uintptr_t)(CODE_BUFFER_PAGE_SIZE - 1);
+#ifdef _WIN32
+    DWORD oldProtect;
+    if (!VirtualProtect((void *)start, end - start, PAGE_READWRITE, &oldProtect)) {
+        return false;
+    }
+    memcpy(dst, src, size);
+    VirtualProtect((void *)start, end - start, PAGE_EXECUTE_READ, &oldProtect);
+    FlushInstructionCache(GetCurrentProcess(), dst, size);
+#else
+    if (mprotect((void *)start, end - start, PROT_READ | PROT_WRITE) != 0) {
+        return false;
+    }
+    memcpy(dst, src, size);
+    mprotect((void *)start, end - start, PROT_READ | PROT_EXEC);
+#endif
+    return true;
+}
+
+}
+}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+/*!
+ * Executable memory for native code.
+ *
+ * The buffer is never writable and executable at the same time: its pages
+ * are kept readable and executable, and are only made writable while code is
+ * copied into them or patched. Code is appended at a cursor and discarded all
+ * at once by Reset(), except for the code committed before Pin().
+ */
+class CodeBuffer {
+public:
+    /*!
+     * Reserves the specified number of bytes. A size of zero creates an empty
+     * buffer, as does a failure to allocate the memory.
+     */
+    CodeBuffer(size_t size);
+    ~CodeBuffer();
+
+    bool IsValid() const { return m_base != nullptr; }
+
+    /*!
+     * Returns the address at which the next code will be committed.
+     */
+    uint8_t *GetCursor() const { return m_base + m_used; }
+    size_t GetFree() const { return m_size - m_used; }
+
+    /*!
+     * Copies code to the cursor and advances it. Returns the address of the
+     * code, or nullptr if it does not fit.
+     */
+    uint8_t *Commit(const uint8_t *code, size_t size);
+
+    /*!
+     * Points the jump whose rel32 field is at the specified address to the
+     * target.
+     */
+    void PatchJump(uint8_t *rel32, const uint8_t *target);
+
+    /*!
+     * Keeps the code committed so far across resets.
+     */
+    void Pin() { m_pinned = m_used; }
+
+    /*!
+     * Discards the code committed after the last call to Pin().
+     */
+    void Reset() { m_used = m_pinned; }
+
+private:
+    bool Write(uint8_t *dst, const void *src, size_t size);
+
+    uint8_t *m_base;
+    size_t m_size;
+    size_t m_used;
+    size_t m_pinned;
+};
+
+}
+}
+}
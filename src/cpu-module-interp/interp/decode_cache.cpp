@@ -0,0 +1,98 @@
+#include "decode_cache.h"
+
+#include <string.h>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+DecodeCache::DecodeCache() {
+    m_lastPageNumber = 0xFFFFFFFF;
+    m_lastPage = nullptr;
+}
+
+DecodeCache::~DecodeCache() {
+    Flush();
+}
+
+const Instruction *DecodeCache::Fetch(uint32_t paddr, const uint8_t *code, uint32_t avail, DecodeMode mode) {
+    CachedPage *page = GetPage(paddr >> DECODE_CACHE_PAGE_SHIFT);
+    Instruction *&entry = page->entries[paddr & (DECODE_CACHE_PAGE_SIZE - 1)];
+
+    // Validate the cached entry against the current contents of memory
+    if (entry != nullptr) {
+        if (entry->mode == mode && entry->length <= avail && memcmp(entry->bytes, code, entry->length) == 0) {
+            return entry;
+        }
+    }
+    else {
+        entry = new Instruction;
+    }
+
+    uint32_t length = (avail < INTERP_MAX_INSTRUCTION_LENGTH) ? avail : INTERP_MAX_INSTRUCTION_LENGTH;
+    if (!m_decoder.Decode(mode, code, length, entry)) {
+        delete entry;
+        entry = nullptr;
+        return nullptr;
+    }
+    return entry;
+}
+
+void DecodeCache::InvalidatePage(uint32_t paddr) {
+    uint32_t pageNumber = paddr >> DECODE_CACHE_PAGE_SHIFT;
+    auto it = m_pages.find(pageNumber);
+    if (it == m_pages.end()) {
+        return;
+    }
+    FreePage(it->second);
+    m_pages.erase(it);
+    if (m_lastPageNumber == pageNumber) {
+        m_lastPageNumber = 0xFFFFFFFF;
+        m_lastPage = nullptr;
+    }
+}
+
+void DecodeCache::Flush() {
+    for (auto it = m_pages.begin(); it != m_pages.end(); ++it) {
+        FreePage(it->second);
+    }
+    m_pages.clear();
+    m_lastPageNumber = 0xFFFFFFFF;
+    m_lastPage = nullptr;
+}
+
+DecodeCache::CachedPage *DecodeCache::GetPage(uint32_t pageNumber) {
+    if (pageNumber == m_lastPageNumber) {
+        return m_lastPage;
+    }
+
+    CachedPage *page;
+    auto it = m_pages.find(pageNumber);
+    if (it != m_pages.end()) {
+        page = it->second;
+    }
+    else {
+        // Keep the cache bounded; code working sets are much smaller than this
+        if (m_pages.size() >= DECODE_CACHE_MAX_PAGES) {
+            Flush();
+        }
+        page = new CachedPage;
+        memset(page->entries, 0, sizeof(page->entries));
+        m_pages[pageNumber] = page;
+    }
+
+    m_lastPageNumber = pageNumber;
+    m_lastPage = page;
+    return page;
+}
+
+void DecodeCache::FreePage(CachedPage *page) {
+    for (uint32_t i = 0; i < DECODE_CACHE_PAGE_SIZE; i++) {
+        delete page->entries[i];
+    }
+    delete page;
+}
+
+}
+}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+
+#include "decoder.h"
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+#define DECODE_CACHE_PAGE_SHIFT  12
+#define DECODE_CACHE_PAGE_SIZE   (1 << DECODE_CACHE_PAGE_SHIFT)
+
+// Maximum number of physical pages kept in the cache before it is flushed
+#define DECODE_CACHE_MAX_PAGES   4096
+
+/*!
+ * Cache of decoded instructions keyed by physical address.
+ *
+ * Instructions are grouped by physical page. Each entry keeps a copy of the
+ * raw instruction bytes, which are compared against guest memory on every
+ * lookup; this catches self-modifying code and DMA into code pages without
+ * having to track writes.
+ *
+ * Instructions that straddle a page boundary are never cached.
+ */
+class DecodeCache {
+public:
+    DecodeCache();
+    ~DecodeCache();
+
+    /*!
+     * Retrieves the decoded instruction at the specified physical address.
+     * `code` points to the host memory backing the instruction and `avail` is
+     * the number of bytes available until the end of the page.
+     *
+     * Decodes and caches the instruction on a miss. Returns nullptr if the
+     * bytes do not form a valid instruction.
+     */
+    const Instruction *Fetch(uint32_t paddr, const uint8_t *code, uint32_t avail, DecodeMode mode);
+
+    /*!
+     * Drops all decoded instructions in the physical page containing the
+     * specified address.
+     */
+    void InvalidatePage(uint32_t paddr);
+
+    /*!
+     * Drops all decoded instructions.
+     */
+    void Flush();
+
+    Decoder *GetDecoder() { return &m_decoder; }
+
+private:
+    struct CachedPage {
+        Instruction *entries[DECODE_CACHE_PAGE_SIZE];
+    };
+
+    Decoder m_decoder;
+
+    std::unordered_map<uint32_t, CachedPage *> m_pages;
+
+    // Most recently used page
+    uint32_t m_lastPageNumber;
+    CachedPage *m_lastPage;
+
+    CachedPage *GetPage(uint32_t pageNumber);
+    void FreePage(CachedPage *page);
+};
+
+}
+}
+}
@@ -0,0 +1,382 @@
+#include "decoder.h"
+
+#include <string.h>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+static const ZydisRegister kGPR8[] = {
+    ZYDIS_REGISTER_AL, ZYDIS_REGISTER_CL, ZYDIS_REGISTER_DL, ZYDIS_REGISTER_BL,
+    ZYDIS_REGISTER_AH, ZYDIS_REGISTER_CH, ZYDIS_REGISTER_DH, ZYDIS_REGISTER_BH,
+};
+
+static const ZydisRegister kGPR16[] = {
+    ZYDIS_REGISTER_AX, ZYDIS_REGISTER_CX, ZYDIS_REGISTER_DX, ZYDIS_REGISTER_BX,
+    ZYDIS_REGISTER_SP, ZYDIS_REGISTER_BP, ZYDIS_REGISTER_SI, ZYDIS_REGISTER_DI,
+};
+
+static const ZydisRegister kGPR32[] = {
+    ZYDIS_REGISTER_EAX, ZYDIS_REGISTER_ECX, ZYDIS_REGISTER_EDX, ZYDIS_REGISTER_EBX,
+    ZYDIS_REGISTER_ESP, ZYDIS_REGISTER_EBP, ZYDIS_REGISTER_ESI, ZYDIS_REGISTER_EDI,
+};
+
+static const ZydisRegister kSegments[] = {
+    ZYDIS_REGISTER_ES, ZYDIS_REGISTER_CS, ZYDIS_REGISTER_SS,
+    ZYDIS_REGISTER_DS, ZYDIS_REGISTER_FS, ZYDIS_REGISTER_GS,
+};
+
+static const ZydisRegister kControlRegs[] = {
+    ZYDIS_REGISTER_CR0, ZYDIS_REGISTER_CR1, ZYDIS_REGISTER_CR2, ZYDIS_REGISTER_CR3,
+    ZYDIS_REGISTER_CR4,
+};
+
+static const ZydisRegister kDebugRegs[] = {
+    ZYDIS_REGISTER_DR0, ZYDIS_REGISTER_DR1, ZYDIS_REGISTER_DR2, ZYDIS_REGISTER_DR3,
+    ZYDIS_REGISTER_DR4, ZYDIS_REGISTER_DR5, ZYDIS_REGISTER_DR6, ZYDIS_REGISTER_DR7,
+};
+
+static bool FindRegister(const ZydisRegister *table, uint8_t count, ZydisRegister reg, uint8_t *index) {
+    for (uint8_t i = 0; i < count; i++) {
+        if (table[i] == reg) {
+            *index = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+#define ARRAY_COUNT(a) ((uint8_t)(sizeof(a) / sizeof(a[0])))
+
+/*!
+ * Maps a GPR of any width to its index. Returns INTERP_REG_NONE if the
+ * register is not a GPR.
+ */
+static uint8_t GPRIndexOf(ZydisRegister reg) {
+    uint8_t index;
+    if (FindRegister(kGPR32, ARRAY_COUNT(kGPR32), reg, &index)) return index;
+    if (FindRegister(kGPR16, ARRAY_COUNT(kGPR16), reg, &index)) return index;
+    return INTERP_REG_NONE;
+}
+
+Decoder::Decoder() {
+    ZydisDecoderInit(&m_decoders[DECODE_MODE_REAL16], ZYDIS_MACHINE_MODE_REAL_16, ZYDIS_ADDRESS_WIDTH_16);
+    ZydisDecoderInit(&m_decoders[DECODE_MODE_PROT16], ZYDIS_MACHINE_MODE_LEGACY_16, ZYDIS_ADDRESS_WIDTH_16);
+    ZydisDecoderInit(&m_decoders[DECODE_MODE_PROT32], ZYDIS_MACHINE_MODE_LEGACY_32, ZYDIS_ADDRESS_WIDTH_32);
+}
+
+bool Decoder::Decode(DecodeMode mode, const uint8_t *buffer, uint32_t length, Instruction *instr) {
+    ZydisDecodedInstruction zinstr;
+    if (!ZYDIS_SUCCESS(ZydisDecoderDecodeBuffer(&m_decoders[mode], buffer, length, 0, &zinstr))) {
+        return false;
+    }
+
+    memset(instr, 0, sizeof(Instruction));
+    instr->mode = mode;
+    instr->length = zinstr.length;
+    instr->opSize = zinstr.operandWidth / 8;
+    instr->addrSize = zinstr.addressWidth / 8;
+    memcpy(instr->bytes, buffer, zinstr.length);
+
+    // Scan legacy prefixes and locate the opcode
+    uint8_t pos = 0;
+    bool scanning = true;
+    while (scanning && pos < zinstr.length) {
+        switch (buffer[pos]) {
+        case 0xF0: instr->prefixes |= PREFIX_LOCK; pos++; break;
+        case 0xF2: instr->prefixes = (instr->prefixes & ~PREFIX_REP) | PREFIX_REPNE; pos++; break;
+        case 0xF3: instr->prefixes = (instr->prefixes & ~PREFIX_REPNE) | PREFIX_REP; pos++; break;
+        case 0x26: case 0x2E: case 0x36: case 0x3E: case 0x64: case 0x65:
+        case 0x66: case 0x67:
+            pos++;
+            break;
+        default:
+            scanning = false;
+            break;
+        }
+    }
+
+    uint8_t opcodeMap = 0;
+    uint8_t opcode = buffer[pos];
+    if (opcode == 0x0F && pos + 1 < zinstr.length) {
+        opcodeMap = 1;
+        opcode = buffer[++pos];
+        if ((opcode == 0x38 || opcode == 0x3A) && pos + 1 < zinstr.length) {
+            opcodeMap = (opcode == 0x38) ? 2 : 3;
+            opcode = buffer[++pos];
+        }
+    }
+    uint8_t modrmReg = (pos + 1 < zinstr.length) ? ((buffer[pos + 1] >> 3) & 7) : 0;
+
+    // Keep visible operands only; implicit semantics are handled by the
+    // implementation of each instruction
+    for (uint8_t i = 0; i < zinstr.operandCount && instr->numOperands < INTERP_MAX_OPERANDS; i++) {
+        const ZydisDecodedOperand& op = zinstr.operands[i];
+        if (op.visibility == ZYDIS_OPERAND_VISIBILITY_HIDDEN) {
+            continue;
+        }
+        if (!TranslateOperand(op, &instr->operands[instr->numOperands])) {
+            // The only unsupported operands are x87, MMX and SSE registers
+            instr->op = OP_UNIMPLEMENTED_FPU;
+            return true;
+        }
+        instr->numOperands++;
+    }
+
+    TranslateMnemonic(zinstr, opcodeMap, opcode, modrmReg, instr);
+    return true;
+}
+
+bool Decoder::TranslateOperand(const ZydisDecodedOperand& src, Operand *dst) {
+    dst->size = (uint8_t)(src.size / 8);
+    dst->base = INTERP_REG_NONE;
+    dst->index = INTERP_REG_NONE;
+
+    switch (src.type) {
+    case ZYDIS_OPERAND_TYPE_REGISTER:
+        if (FindRegister(kGPR32, ARRAY_COUNT(kGPR32), src.reg.value, &dst->reg) ||
+            FindRegister(kGPR16, ARRAY_COUNT(kGPR16), src.reg.value, &dst->reg) ||
+            FindRegister(kGPR8, ARRAY_COUNT(kGPR8), src.reg.value, &dst->reg)) {
+            dst->kind = OPK_GPR;
+            return true;
+        }
+        if (FindRegister(kSegments, ARRAY_COUNT(kSegments), src.reg.value, &dst->reg)) {
+            dst->kind = OPK_SEG;
+            return true;
+        }
+        if (FindRegister(kControlRegs, ARRAY_COUNT(kControlRegs), src.reg.value, &dst->reg)) {
+            dst->kind = OPK_CR;
+            dst->size = 4;
+            return true;
+        }
+        if (FindRegister(kDebugRegs, ARRAY_COUNT(kDebugRegs), src.reg.value, &dst->reg)) {
+            dst->kind = OPK_DR;
+            dst->size = 4;
+            return true;
+        }
+        // FPU, MMX, SSE and other registers are not supported
+        return false;
+
+    case ZYDIS_OPERAND_TYPE_MEMORY:
+        dst->kind = OPK_MEM;
+        if (!FindRegister(kSegments, ARRAY_COUNT(kSegments), src.mem.segment, &dst->seg)) {
+            dst->seg = SEG_DS;
+        }
+        dst->base = GPRIndexOf(src.mem.base);
+        dst->index = GPRIndexOf(src.mem.index);
+        dst->scale = (src.mem.index != ZYDIS_REGISTER_NONE) ? (uint8_t)src.mem.scale : 0;
+        dst->disp = src.mem.disp.hasDisplacement ? (uint32_t)src.mem.disp.value : 0;
+        if ((src.mem.base != ZYDIS_REGISTER_NONE && dst->base == INTERP_REG_NONE) ||
+            (src.mem.index != ZYDIS_REGISTER_NONE && dst->index == INTERP_REG_NONE)) {
+            return false;
+        }
+        return true;
+
+    case ZYDIS_OPERAND_TYPE_IMMEDIATE:
+        dst->kind = src.imm.isRelative ? OPK_REL : OPK_IMM;
+        dst->imm = (uint32_t)src.imm.value.u;
+        return true;
+
+    case ZYDIS_OPERAND_TYPE_POINTER:
+        dst->kind = OPK_PTR;
+        dst->imm = src.ptr.offset;
+        dst->ptrSeg = src.ptr.segment;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void Decoder::TranslateMnemonic(const ZydisDecodedInstruction& zinstr, uint8_t opcodeMap, uint8_t opcode, uint8_t modrmReg, Instruction *instr) {
+    // Condition code instruction families are identified by their opcodes
+    if ((opcodeMap == 0 && opcode >= 0x70 && opcode <= 0x7F) || (opcodeMap == 1 && opcode >= 0x80 && opcode <= 0x8F)) {
+        instr->op = OP_JCC;
+        instr->cond = opcode & 0xF;
+        return;
+    }
+    if (opcodeMap == 1 && opcode >= 0x90 && opcode <= 0x9F) {
+        instr->op = OP_SETCC;
+        instr->cond = opcode & 0xF;
+        return;
+    }
+    if (opcodeMap == 1 && opcode >= 0x40 && opcode <= 0x4F) {
+        instr->op = OP_CMOVCC;
+        instr->cond = opcode & 0xF;
+        return;
+    }
+
+    // String instructions are identified by their opcodes to avoid confusion
+    // with SSE instructions that share their mnemonics
+    if (opcodeMap == 0) {
+        // Byte-sized string instructions have even opcodes
+        if (((opcode >= 0xA4 && opcode <= 0xAF) || (opcode >= 0x6C && opcode <= 0x6F)) && (opcode & 1) == 0) {
+            instr->opSize = 1;
+        }
+
+        switch (opcode) {
+        case 0xA4: case 0xA5: instr->op = OP_MOVS; return;
+        case 0xA6: case 0xA7: instr->op = OP_CMPS; return;
+        case 0xAA: case 0xAB: instr->op = OP_STOS; return;
+        case 0xAC: case 0xAD: instr->op = OP_LODS; return;
+        case 0xAE: case 0xAF: instr->op = OP_SCAS; return;
+        case 0x6C: case 0x6D: instr->op = OP_INS;  return;
+        case 0x6E: case 0x6F: instr->op = OP_OUTS; return;
+        case 0xC2: case 0xC3: instr->op = OP_RET; return;
+        case 0xCA: case 0xCB: instr->op = OP_RET_FAR; return;
+        case 0xEA: instr->op = OP_JMP_FAR; return;
+        case 0x9A: instr->op = OP_CALL_FAR; return;
+        case 0xFF:
+            if (modrmReg == 3) { instr->op = OP_CALL_FAR; return; }
+            if (modrmReg == 5) { instr->op = OP_JMP_FAR; return; }
+            break;
+        }
+        if (opcode >= 0xD8 && opcode <= 0xDF) {
+            // Fall through to recognize the few supported x87 instructions
+            instr->op = OP_UNIMPLEMENTED_FPU;
+        }
+    }
+
+    // Byte-sized operations use the size of the first operand
+    if (instr->numOperands > 0 && instr->operands[0].size == 1 &&
+        (instr->operands[0].kind == OPK_GPR || instr->operands[0].kind == OPK_MEM)) {
+        instr->opSize = 1;
+    }
+
+    switch (zinstr.mnemonic) {
+    case ZYDIS_MNEMONIC_MOV:     instr->op = OP_MOV; break;
+    case ZYDIS_MNEMONIC_MOVZX:   instr->op = OP_MOVZX; break;
+    case ZYDIS_MNEMONIC_MOVSX:   instr->op = OP_MOVSX; break;
+    case ZYDIS_MNEMONIC_LEA:     instr->op = OP_LEA; break;
+    case ZYDIS_MNEMONIC_XCHG:    instr->op = OP_XCHG; break;
+    case ZYDIS_MNEMONIC_BSWAP:   instr->op = OP_BSWAP; break;
+    case ZYDIS_MNEMONIC_XLAT:    instr->op = OP_XLAT; break;
+    case ZYDIS_MNEMONIC_CBW:
+    case ZYDIS_MNEMONIC_CWDE:    instr->op = OP_CBW; break;
+    case ZYDIS_MNEMONIC_CWD:
+    case ZYDIS_MNEMONIC_CDQ:     instr->op = OP_CWD; break;
+    case ZYDIS_MNEMONIC_LAHF:    instr->op = OP_LAHF; break;
+    case ZYDIS_MNEMONIC_SAHF:    instr->op = OP_SAHF; break;
+    case ZYDIS_MNEMONIC_LDS:     instr->op = OP_LDS; break;
+    case ZYDIS_MNEMONIC_LES:     instr->op = OP_LES; break;
+    case ZYDIS_MNEMONIC_LFS:     instr->op = OP_LFS; break;
+    case ZYDIS_MNEMONIC_LGS:     instr->op = OP_LGS; break;
+    case ZYDIS_MNEMONIC_LSS:     instr->op = OP_LSS; break;
+
+    case ZYDIS_MNEMONIC_ADD:     instr->op = OP_ALU; instr->subop = ALU_ADD; break;
+    case ZYDIS_MNEMONIC_OR:      instr->op = OP_ALU; instr->subop = ALU_OR; break;
+    case ZYDIS_MNEMONIC_ADC:     instr->op = OP_ALU; instr->subop = ALU_ADC; break;
+    case ZYDIS_MNEMONIC_SBB:     instr->op = OP_ALU; instr->subop = ALU_SBB; break;
+    case ZYDIS_MNEMONIC_AND:     instr->op = OP_ALU; instr->subop = ALU_AND; break;
+    case ZYDIS_MNEMONIC_SUB:     instr->op = OP_ALU; instr->subop = ALU_SUB; break;
+    case ZYDIS_MNEMONIC_XOR:     instr->op = OP_ALU; instr->subop = ALU_XOR; break;
+    case ZYDIS_MNEMONIC_CMP:     instr->op = OP_ALU; instr->subop = ALU_CMP; break;
+    case ZYDIS_MNEMONIC_TEST:    instr->op = OP_ALU; instr->subop = ALU_TEST; break;
+    case ZYDIS_MNEMONIC_INC:     instr->op = OP_INC; break;
+    case ZYDIS_MNEMONIC_DEC:     instr->op = OP_DEC; break;
+    case ZYDIS_MNEMONIC_NEG:     instr->op = OP_NEG; break;
+    case ZYDIS_MNEMONIC_NOT:     instr->op = OP_NOT; break;
+    case ZYDIS_MNEMONIC_MUL:     instr->op = OP_MUL; break;
+    case ZYDIS_MNEMONIC_IMUL:    instr->op = OP_IMUL; break;
+    case ZYDIS_MNEMONIC_DIV:     instr->op = OP_DIV; break;
+    case ZYDIS_MNEMONIC_IDIV:    instr->op = OP_IDIV; break;
+    case ZYDIS_MNEMONIC_ROL:     instr->op = OP_SHIFT; instr->subop = SHIFT_ROL; break;
+    case ZYDIS_MNEMONIC_ROR:     instr->op = OP_SHIFT; instr->subop = SHIFT_ROR; break;
+    case ZYDIS_MNEMONIC_RCL:     instr->op = OP_SHIFT; instr->subop = SHIFT_RCL; break;
+    case ZYDIS_MNEMONIC_RCR:     instr->op = OP_SHIFT; instr->subop = SHIFT_RCR; break;
+    case ZYDIS_MNEMONIC_SHL:     instr->op = OP_SHIFT; instr->subop = SHIFT_SHL; break;
+    case ZYDIS_MNEMONIC_SHR:     instr->op = OP_SHIFT; instr->subop = SHIFT_SHR; break;
+    case ZYDIS_MNEMONIC_SAR:     instr->op = OP_SHIFT; instr->subop = SHIFT_SAR; break;
+    case ZYDIS_MNEMONIC_SHLD:    instr->op = OP_SHLD; break;
+    case ZYDIS_MNEMONIC_SHRD:    instr->op = OP_SHRD; break;
+    case ZYDIS_MNEMONIC_BT:      instr->op = OP_BT; instr->subop = BIT_BT; break;
+    case ZYDIS_MNEMONIC_BTS:     instr->op = OP_BT; instr->subop = BIT_BTS; break;
+    case ZYDIS_MNEMONIC_BTR:     instr->op = OP_BT; instr->subop = BIT_BTR; break;
+    case ZYDIS_MNEMONIC_BTC:     instr->op = OP_BT; instr->subop = BIT_BTC; break;
+    case ZYDIS_MNEMONIC_BSF:     instr->op = OP_BSF; break;
+    case ZYDIS_MNEMONIC_BSR:     instr->op = OP_BSR; break;
+    case ZYDIS_MNEMONIC_CMPXCHG: instr->op = OP_CMPXCHG; break;
+    case ZYDIS_MNEMONIC_CMPXCHG8B: instr->op = OP_CMPXCHG8B; break;
+    case ZYDIS_MNEMONIC_XADD:    instr->op = OP_XADD; break;
+
+    case ZYDIS_MNEMONIC_PUSH:    instr->op = OP_PUSH; break;
+    case ZYDIS_MNEMONIC_POP:     instr->op = OP_POP; break;
+    case ZYDIS_MNEMONIC_PUSHA:
+    case ZYDIS_MNEMONIC_PUSHAD:  instr->op = OP_PUSHA; break;
+    case ZYDIS_MNEMONIC_POPA:
+    case ZYDIS_MNEMONIC_POPAD:   instr->op = OP_POPA; break;
+    case ZYDIS_MNEMONIC_PUSHF:
+    case ZYDIS_MNEMONIC_PUSHFD:  instr->op = OP_PUSHF; break;
+    case ZYDIS_MNEMONIC_POPF:
+    case ZYDIS_MNEMONIC_POPFD:   instr->op = OP_POPF; break;
+    case ZYDIS_MNEMONIC_ENTER:   instr->op = OP_ENTER; break;
+    case ZYDIS_MNEMONIC_LEAVE:   instr->op = OP_LEAVE; break;
+
+    case ZYDIS_MNEMONIC_JMP:     if (instr->op != OP_JMP_FAR) instr->op = OP_JMP; break;
+    case ZYDIS_MNEMONIC_CALL:    if (instr->op != OP_CALL_FAR) instr->op = OP_CALL; break;
+    case ZYDIS_MNEMONIC_JCXZ:
+    case ZYDIS_MNEMONIC_JECXZ:   instr->op = OP_JCXZ; break;
+    case ZYDIS_MNEMONIC_LOOP:    instr->op = OP_LOOP; break;
+    case ZYDIS_MNEMONIC_LOOPE:   instr->op = OP_LOOPE; break;
+    case ZYDIS_MNEMONIC_LOOPNE:  instr->op = OP_LOOPNE; break;
+    case ZYDIS_MNEMONIC_INT:     instr->op = OP_INT; break;
+    case ZYDIS_MNEMONIC_INT3:    instr->op = OP_INT3; break;
+    case ZYDIS_MNEMONIC_INTO:    instr->op = OP_INTO; break;
+    case ZYDIS_MNEMONIC_IRET:
+    case ZYDIS_MNEMONIC_IRETD:   instr->op = OP_IRET; break;
+
+    case ZYDIS_MNEMONIC_CLC:     instr->op = OP_CLC; break;
+    case ZYDIS_MNEMONIC_STC:     instr->op = OP_STC; break;
+    case ZYDIS_MNEMONIC_CMC:     instr->op = OP_CMC; break;
+    case ZYDIS_MNEMONIC_CLD:     instr->op = OP_CLD; break;
+    case ZYDIS_MNEMONIC_STD:     instr->op = OP_STD; break;
+    case ZYDIS_MNEMONIC_CLI:     instr->op = OP_CLI; break;
+    case ZYDIS_MNEMONIC_STI:     instr->op = OP_STI; break;
+
+    case ZYDIS_MNEMONIC_IN:      instr->op = OP_IN; break;
+    case ZYDIS_MNEMONIC_OUT:     instr->op = OP_OUT; break;
+
+    case ZYDIS_MNEMONIC_NOP:
+    case ZYDIS_MNEMONIC_PAUSE:   instr->op = OP_NOP; break;
+    case ZYDIS_MNEMONIC_HLT:     instr->op = OP_HLT; break;
+    case ZYDIS_MNEMONIC_CPUID:   instr->op = OP_CPUID; break;
+    case ZYDIS_MNEMONIC_RDTSC:   instr->op = OP_RDTSC; break;
+    case ZYDIS_MNEMONIC_RDMSR:   instr->op = OP_RDMSR; break;
+    case ZYDIS_MNEMONIC_WRMSR:   instr->op = OP_WRMSR; break;
+    case ZYDIS_MNEMONIC_LGDT:    instr->op = OP_LGDT; break;
+    case ZYDIS_MNEMONIC_LIDT:    instr->op = OP_LIDT; break;
+    case ZYDIS_MNEMONIC_SGDT:    instr->op = OP_SGDT; break;
+    case ZYDIS_MNEMONIC_SIDT:    instr->op = OP_SIDT; break;
+    case ZYDIS_MNEMONIC_LLDT:    instr->op = OP_LLDT; break;
+    case ZYDIS_MNEMONIC_SLDT:    instr->op = OP_SLDT; break;
+    case ZYDIS_MNEMONIC_LTR:     instr->op = OP_LTR; break;
+    case ZYDIS_MNEMONIC_STR:     instr->op = OP_STR; break;
+    case ZYDIS_MNEMONIC_LMSW:    instr->op = OP_LMSW; break;
+    case ZYDIS_MNEMONIC_SMSW:    instr->op = OP_SMSW; break;
+    case ZYDIS_MNEMONIC_CLTS:    instr->op = OP_CLTS; break;
+    case ZYDIS_MNEMONIC_INVLPG:  instr->op = OP_INVLPG; break;
+    case ZYDIS_MNEMONIC_WBINVD:
+    case ZYDIS_MNEMONIC_INVD:    instr->op = OP_WBINVD; break;
+
+    case ZYDIS_MNEMONIC_FNINIT:  instr->op = OP_FNINIT; break;
+    case ZYDIS_MNEMONIC_FWAIT:   instr->op = OP_FWAIT; break;
+    case ZYDIS_MNEMONIC_FNSTCW:  instr->op = OP_FNSTCW; break;
+    case ZYDIS_MNEMONIC_FLDCW:   instr->op = OP_FLDCW; break;
+    case ZYDIS_MNEMONIC_FNSTSW:  instr->op = OP_FNSTSW; break;
+    case ZYDIS_MNEMONIC_FXSAVE:  instr->op = OP_FXSAVE; break;
+    case ZYDIS_MNEMONIC_FXRSTOR: instr->op = OP_FXRSTOR; break;
+    case ZYDIS_MNEMONIC_LDMXCSR: instr->op = OP_LDMXCSR; break;
+    case ZYDIS_MNEMONIC_STMXCSR: instr->op = OP_STMXCSR; break;
+
+    default:
+        // Anything else, including operations already identified by opcode
+        if (instr->op == OP_INVALID) {
+            instr->op = OP_UNIMPLEMENTED;
+        }
+        break;
+    }
+}
+
+}
+}
+}
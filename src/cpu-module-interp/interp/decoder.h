@@ -0,0 +1,205 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "Zydis/Zydis.h"
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+// Maximum length of an x86 instruction
+#define INTERP_MAX_INSTRUCTION_LENGTH  15
+
+// Maximum number of visible operands kept per instruction
+#define INTERP_MAX_OPERANDS             3
+
+// Special register index used for absent base or index registers
+#define INTERP_REG_NONE                 0xFF
+
+// General purpose register indices, in x86 encoding order
+enum GPRIndex {
+    GPR_EAX = 0,
+    GPR_ECX,
+    GPR_EDX,
+    GPR_EBX,
+    GPR_ESP,
+    GPR_EBP,
+    GPR_ESI,
+    GPR_EDI,
+    GPR_COUNT,
+};
+
+// Segment register indices, in x86 encoding order
+enum SegmentIndex {
+    SEG_ES = 0,
+    SEG_CS,
+    SEG_SS,
+    SEG_DS,
+    SEG_FS,
+    SEG_GS,
+    SEG_COUNT,
+};
+
+/*!
+ * Decoding mode, derived from CR0.PE and the D bit of the code segment.
+ */
+enum DecodeMode : uint8_t {
+    DECODE_MODE_REAL16,
+    DECODE_MODE_PROT16,
+    DECODE_MODE_PROT32,
+    DECODE_MODE_COUNT,
+};
+
+enum OperandKind : uint8_t {
+    OPK_NONE,
+    OPK_GPR,     // General purpose register
+    OPK_SEG,     // Segment register
+    OPK_CR,      // Control register
+    OPK_DR,      // Debug register
+    OPK_MEM,     // Memory reference
+    OPK_IMM,     // Immediate value
+    OPK_REL,     // Relative branch displacement
+    OPK_PTR,     // Far pointer (segment:offset)
+};
+
+/*!
+ * A decoded instruction operand.
+ */
+struct Operand {
+    OperandKind kind;
+
+    // Operand size in bytes
+    uint8_t size;
+
+    // Register index for register operands. 8-bit GPRs use the x86 encoding
+    // (AL, CL, DL, BL, AH, CH, DH, BH).
+    uint8_t reg;
+
+    // Memory operands
+    uint8_t seg;
+    uint8_t base;
+    uint8_t index;
+    uint8_t scale;
+    uint32_t disp;
+
+    // Immediate value, relative displacement or far pointer offset
+    uint32_t imm;
+    uint16_t ptrSeg;
+};
+
+/*!
+ * Operations implemented by the interpreter.
+ */
+enum Op : uint16_t {
+    OP_INVALID,
+
+    // Data movement
+    OP_MOV, OP_MOVZX, OP_MOVSX, OP_LEA, OP_XCHG, OP_BSWAP, OP_CMOVCC, OP_SETCC,
+    OP_XLAT, OP_CBW, OP_CWD, OP_LAHF, OP_SAHF,
+    OP_LDS, OP_LES, OP_LFS, OP_LGS, OP_LSS,
+
+    // Arithmetic and logic
+    OP_ALU,          // ADD, OR, ADC, SBB, AND, SUB, XOR, CMP, TEST (see AluOp)
+    OP_INC, OP_DEC, OP_NEG, OP_NOT,
+    OP_MUL, OP_IMUL, OP_DIV, OP_IDIV,
+    OP_SHIFT,        // ROL, ROR, RCL, RCR, SHL, SHR, SAR (see ShiftOp)
+    OP_SHLD, OP_SHRD,
+    OP_BT,           // BT, BTS, BTR, BTC (see BitOp)
+    OP_BSF, OP_BSR,
+    OP_CMPXCHG, OP_CMPXCHG8B, OP_XADD,
+
+    // Stack
+    OP_PUSH, OP_POP, OP_PUSHA, OP_POPA, OP_PUSHF, OP_POPF, OP_ENTER, OP_LEAVE,
+
+    // Control flow
+    OP_JMP, OP_JMP_FAR, OP_JCC, OP_JCXZ, OP_LOOP, OP_LOOPE, OP_LOOPNE,
+    OP_CALL, OP_CALL_FAR, OP_RET, OP_RET_FAR, OP_INT, OP_INT3, OP_INTO, OP_IRET,
+
+    // Flags
+    OP_CLC, OP_STC, OP_CMC, OP_CLD, OP_STD, OP_CLI, OP_STI,
+
+    // Strings
+    OP_MOVS, OP_STOS, OP_LODS, OP_CMPS, OP_SCAS, OP_INS, OP_OUTS,
+
+    // I/O
+    OP_IN, OP_OUT,
+
+    // System
+    OP_NOP, OP_HLT, OP_CPUID, OP_RDTSC, OP_RDMSR, OP_WRMSR,
+    OP_LGDT, OP_LIDT, OP_SGDT, OP_SIDT, OP_LLDT, OP_SLDT, OP_LTR, OP_STR,
+    OP_LMSW, OP_SMSW, OP_CLTS, OP_INVLPG, OP_WBINVD,
+
+    // Floating point state management
+    OP_FNINIT, OP_FWAIT, OP_FNSTCW, OP_FLDCW, OP_FNSTSW, OP_FXSAVE, OP_FXRSTOR,
+    OP_LDMXCSR, OP_STMXCSR,
+
+    // Recognized but not implemented; raises #UD (or #NM for FPU instructions)
+    OP_UNIMPLEMENTED,
+    OP_UNIMPLEMENTED_FPU,
+
+    OP_COUNT,
+};
+
+enum AluOp : uint8_t {
+    ALU_ADD, ALU_OR, ALU_ADC, ALU_SBB, ALU_AND, ALU_SUB, ALU_XOR, ALU_CMP, ALU_TEST,
+};
+
+enum ShiftOp : uint8_t {
+    SHIFT_ROL, SHIFT_ROR, SHIFT_RCL, SHIFT_RCR, SHIFT_SHL, SHIFT_SHR, SHIFT_SAL, SHIFT_SAR,
+};
+
+enum BitOp : uint8_t {
+    BIT_BT, BIT_BTS, BIT_BTR, BIT_BTC,
+};
+
+// Prefix flags
+#define PREFIX_LOCK   0x01
+#define PREFIX_REP    0x02  // REP/REPE/REPZ
+#define PREFIX_REPNE  0x04  // REPNE/REPNZ
+
+/*!
+ * An instruction decoded into a compact form that can be executed without
+ * going back to the decoder.
+ */
+struct Instruction {
+    Op op;
+    uint8_t subop;        // AluOp, ShiftOp or BitOp
+    uint8_t cond;         // Condition code for Jcc, SETcc and CMOVcc
+    uint8_t length;
+    uint8_t opSize;       // Operation size in bytes
+    uint8_t addrSize;     // Address size in bytes
+    uint8_t prefixes;
+    uint8_t numOperands;
+    DecodeMode mode;
+
+    Operand operands[INTERP_MAX_OPERANDS];
+
+    // Raw instruction bytes, used to validate cached decodes
+    uint8_t bytes[INTERP_MAX_INSTRUCTION_LENGTH];
+};
+
+/*!
+ * Decodes x86 instructions into the interpreter's instruction format using
+ * Zydis.
+ */
+class Decoder {
+public:
+    Decoder();
+
+    /*!
+     * Decodes the instruction in the given buffer. Returns false if the bytes
+     * do not form a valid instruction.
+     */
+    bool Decode(DecodeMode mode, const uint8_t *buffer, uint32_t length, Instruction *instr);
+
+private:
+    ZydisDecoder m_decoders[DECODE_MODE_COUNT];
+
+    bool TranslateOperand(const ZydisDecodedOperand& src, Operand *dst);
+    void TranslateMnemonic(const ZydisDecodedInstruction& zinstr, uint8_t opcodeMap, uint8_t opcode, uint8_t modrmReg, Instruction *instr);
+};
+
+}
+}
+}
@@ -0,0 +1,285 @@
+#include "x64_emitter.h"
+
+#include <assert.h>
+#include <string.h>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+void X64Emitter::Emit32(uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        m_code.push_back((uint8_t)(value >> (i * 8)));
+    }
+}
+
+void X64Emitter::Emit64(uint64_t value) {
+    Emit32((uint32_t)value);
+    Emit32((uint32_t)(value >> 32));
+}
+
+void X64Emitter::Rex(bool w, uint8_t reg, uint8_t rm, bool force) {
+    uint8_t rex = 0x40 | (w ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+    if (rex != 0x40 || force) {
+        Emit8(rex);
+    }
+}
+
+void X64Emitter::ModRMReg(uint8_t reg, uint8_t rm) {
+    Emit8(0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void X64Emitter::ModRMMem(uint8_t reg, X64Reg base, int32_t disp) {
+    // RSP and R12 would need a SIB byte
+    assert((base & 7) != X64_RSP);
+    Emit8(0x80 | ((reg & 7) << 3) | (base & 7));
+    Emit32((uint32_t)disp);
+}
+
+void X64Emitter::Bind(X64Label& label) {
+    label.offset = (int32_t)m_code.size();
+    for (uint32_t fixup : label.fixups) {
+        int32_t rel = label.offset - (int32_t)(fixup + 4);
+        memcpy(&m_code[fixup], &rel, sizeof(rel));
+    }
+    label.fixups.clear();
+}
+
+void X64Emitter::EmitRel32(X64Label& label) {
+    if (label.offset >= 0) {
+        Emit32((uint32_t)(label.offset - (int32_t)(m_code.size() + 4)));
+    }
+    else {
+        label.fixups.push_back((uint32_t)m_code.size());
+        Emit32(0);
+    }
+}
+
+// ----- Data movement --------------------------------------------------------
+
+void X64Emitter::MovRegMem32(X64Reg dst, X64Reg base, int32_t disp) {
+    Rex(false, dst, base);
+    Emit8(0x8B);
+    ModRMMem(dst, base, disp);
+}
+
+void X64Emitter::MovMemReg32(X64Reg base, int32_t disp, X64Reg src) {
+    Rex(false, src, base);
+    Emit8(0x89);
+    ModRMMem(src, base, disp);
+}
+
+void X64Emitter::MovMemReg64(X64Reg base, int32_t disp, X64Reg src) {
+    Rex(true, src, base);
+    Emit8(0x89);
+    ModRMMem(src, base, disp);
+}
+
+void X64Emitter::MovMemImm32(X64Reg base, int32_t disp, uint32_t imm) {
+    Rex(false, 0, base);
+    Emit8(0xC7);
+    ModRMMem(0, base, disp);
+    Emit32(imm);
+}
+
+void X64Emitter::MovMemImm8(X64Reg base, int32_t disp, uint8_t imm) {
+    Rex(false, 0, base);
+    Emit8(0xC6);
+    ModRMMem(0, base, disp);
+    Emit8(imm);
+}
+
+void X64Emitter::MovRegReg32(X64Reg dst, X64Reg src) {
+    Rex(false, src, dst);
+    Emit8(0x89);
+    ModRMReg(src, dst);
+}
+
+void X64Emitter::MovRegReg64(X64Reg dst, X64Reg src) {
+    Rex(true, src, dst);
+    Emit8(0x89);
+    ModRMReg(src, dst);
+}
+
+void X64Emitter::MovRegImm64(X64Reg dst, uint64_t imm) {
+    Rex(true, 0, dst);
+    Emit8(0xB8 | (dst & 7));
+    Emit64(imm);
+}
+
+void X64Emitter::LeaRegSum64(X64Reg dst, X64Reg base, X64Reg index) {
+    assert((base & 7) != X64_RBP && index != X64_RSP);
+    Emit8(0x48 | ((dst & 8) ? 0x04 : 0) | ((index & 8) ? 0x02 : 0) | ((base & 8) ? 0x01 : 0));
+    Emit8(0x8D);
+    Emit8(((dst & 7) << 3) | 0x04);
+    Emit8(((index & 7) << 3) | (base & 7));
+}
+
+void X64Emitter::LeaRipRelative(X64Reg dst, int32_t skip) {
+    Rex(true, dst, 0);
+    Emit8(0x8D);
+    Emit8(((dst & 7) << 3) | 0x05);
+    Emit32((uint32_t)skip);
+}
+
+void X64Emitter::Push(X64Reg reg) {
+    Rex(false, 0, reg);
+    Emit8(0x50 | (reg & 7));
+}
+
+void X64Emitter::Pop(X64Reg reg) {
+    Rex(false, 0, reg);
+    Emit8(0x58 | (reg & 7));
+}
+
+void X64Emitter::Pushfq() {
+    Emit8(0x9C);
+}
+
+void X64Emitter::Popfq() {
+    Emit8(0x9D);
+}
+
+// ----- Arithmetic -----------------------------------------------------------
+
+void X64Emitter::AluRegReg32(X64AluOp op, X64Reg dst, X64Reg src) {
+    Rex(false, src, dst);
+    Emit8(0x01 | (op << 3));
+    ModRMReg(src, dst);
+}
+
+void X64Emitter::AluRegImm32(X64AluOp op, X64Reg dst, uint32_t imm) {
+    Rex(false, 0, dst);
+    Emit8(0x81);
+    ModRMReg(op, dst);
+    Emit32(imm);
+}
+
+void X64Emitter::AluRegMem32(X64AluOp op, X64Reg dst, X64Reg base, int32_t disp) {
+    Rex(false, dst, base);
+    Emit8(0x03 | (op << 3));
+    ModRMMem(dst, base, disp);
+}
+
+void X64Emitter::AluMemReg32(X64AluOp op, X64Reg base, int32_t disp, X64Reg src) {
+    Rex(false, src, base);
+    Emit8(0x01 | (op << 3));
+    ModRMMem(src, base, disp);
+}
+
+void X64Emitter::AluMemImm32(X64AluOp op, X64Reg base, int32_t disp, uint32_t imm) {
+    Rex(false, 0, base);
+    Emit8(0x81);
+    ModRMMem(op, base, disp);
+    Emit32(imm);
+}
+
+void X64Emitter::CmpMemImm8(X64Reg base, int32_t disp, uint8_t imm) {
+    Rex(false, 0, base);
+    Emit8(0x80);
+    ModRMMem(X64_CMP, base, disp);
+    Emit8(imm);
+}
+
+void X64Emitter::CmpMemImm8_64(X64Reg base, int32_t disp, int8_t imm) {
+    Rex(true, 0, base);
+    Emit8(0x83);
+    ModRMMem(X64_CMP, base, disp);
+    Emit8((uint8_t)imm);
+}
+
+void X64Emitter::TestRegReg32(X64Reg a, X64Reg b) {
+    Rex(false, b, a);
+    Emit8(0x85);
+    ModRMReg(b, a);
+}
+
+void X64Emitter::TestRegImm32(X64Reg reg, uint32_t imm) {
+    Rex(false, 0, reg);
+    Emit8(0xF7);
+    ModRMReg(0, reg);
+    Emit32(imm);
+}
+
+void X64Emitter::TestRegReg8(X64Reg a, X64Reg b) {
+    // A REX prefix selects SPL to DIL instead of AH to BH
+    Rex(false, b, a, a >= X64_RSP || b >= X64_RSP);
+    Emit8(0x84);
+    ModRMReg(b, a);
+}
+
+void X64Emitter::ImulRegImm8(X64Reg dst, X64Reg src, int8_t imm) {
+    Rex(false, dst, src);
+    Emit8(0x6B);
+    ModRMReg(dst, src);
+    Emit8((uint8_t)imm);
+}
+
+void X64Emitter::ShrRegImm32(X64Reg reg, uint8_t imm) {
+    Rex(false, 0, reg);
+    Emit8(0xC1);
+    ModRMReg(5, reg);
+    Emit8(imm);
+}
+
+void X64Emitter::BtRegImm32(X64Reg reg, uint8_t bit) {
+    Rex(false, 0, reg);
+    Emit8(0x0F);
+    Emit8(0xBA);
+    ModRMReg(4, reg);
+    Emit8(bit);
+}
+
+void X64Emitter::AddRsp(int8_t imm) {
+    Emit8(0x48);
+    Emit8(0x83);
+    ModRMReg(X64_ADD, X64_RSP);
+    Emit8((uint8_t)imm);
+}
+
+void X64Emitter::SubRsp(int8_t imm) {
+    Emit8(0x48);
+    Emit8(0x83);
+    ModRMReg(X64_SUB, X64_RSP);
+    Emit8((uint8_t)imm);
+}
+
+// ----- Control flow ---------------------------------------------------------
+
+void X64Emitter::Jmp(X64Label& label) {
+    Emit8(0xE9);
+    EmitRel32(label);
+}
+
+void X64Emitter::Jcc(X64Cond cond, X64Label& label) {
+    Emit8(0x0F);
+    Emit8(0x80 | cond);
+    EmitRel32(label);
+}
+
+uint32_t X64Emitter::JmpAbsolute(const uint8_t *target) {
+    Emit8(0xE9);
+    uint32_t field = GetOffset();
+    Emit32((uint32_t)(int32_t)(target - (m_base + field + 4)));
+    return field;
+}
+
+void X64Emitter::JmpReg(X64Reg reg) {
+    Rex(false, 0, reg);
+    Emit8(0xFF);
+    ModRMReg(4, reg);
+}
+
+void X64Emitter::CallReg(X64Reg reg) {
+    Rex(false, 0, reg);
+    Emit8(0xFF);
+    ModRMReg(2, reg);
+}
+
+void X64Emitter::Ret() {
+    Emit8(0xC3);
+}
+
+}
+}
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+namespace vixen {
+namespace cpu {
+namespace interp {
+
+/*!
+ * x86-64 general purpose registers, in encoding order.
+ */
+enum X64Reg : uint8_t {
+    X64_RAX, X64_RCX, X64_RDX, X64_RBX, X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+    X64_R8, X64_R9, X64_R10, X64_R11, X64_R12, X64_R13, X64_R14, X64_R15,
+};
+
+// Integer argument registers of the host calling convention
+#ifdef _WIN32
+#define X64_ARG0  X64_RCX
+#define X64_ARG1  X64_RDX
+#define X64_ARG2  X64_R8
+#else
+#define X64_ARG0  X64_RDI
+#define X64_ARG1  X64_RSI
+#define X64_ARG2  X64_RDX
+#endif
+
+/*!
+ * Group 1 arithmetic operations, numbered as in the /digit field of their
+ * encodings. These match the interpreter's ALU_ADD to ALU_CMP.
+ */
+enum X64AluOp : uint8_t {
+    X64_ADD, X64_OR, X64_ADC, X64_SBB, X64_AND, X64_SUB, X64_XOR, X64_CMP,
+};
+
+/*!
+ * Condition codes, numbered as in the Jcc encodings.
+ */
+enum X64Cond : uint8_t {
+    X64_CC_O, X64_CC_NO, X64_CC_B, X64_CC_AE, X64_CC_E, X64_CC_NE, X64_CC_BE, X64_CC_A,
+    X64_CC_S, X64_CC_NS, X64_CC_P, X64_CC_NP, X64_CC_L, X64_CC_GE, X64_CC_LE, X64_CC_G,
+};
+
+/*!
+ * A position in the emitted code. Jumps to labels that are not bound yet are
+ * fixed up when the label is bound.
+ */
+struct X64Label {
+    int32_t offset = -1;
+    std::vector<uint32_t> fixups;
+};
+
+/*!
+ * Assembles the handful of x86-64 instructions used by the native block tier
+ * into a byte buffer.
+ *
+ * Code is assembled for a fixed base address, which is where it will be
+ * copied to, so that it can jump to absolute addresses with rel32
+ * displacements. Memory operands are always [base + disp32], where base is
+ * neither RSP nor R12.
+ */
+class X64Emitter {
+public:
+    X64Emitter(uint8_t *base) : m_base(base) {}
+
+    const std::vector<uint8_t>& GetCode() const { return m_code; }
+    uint32_t GetOffset() const { return (uint32_t)m_code.size(); }
+    uint8_t *GetAddress(uint32_t offset) const { return m_base + offset; }
+
+    void Bind(X64Label& label);
+
+    // ----- Data movement ----------------------------------------------------
+    void MovRegMem32(X64Reg dst, X64Reg base, int32_t disp);
+    void MovMemReg32(X64Reg base, int32_t disp, X64Reg src);
+    void MovMemReg64(X64Reg base, int32_t disp, X64Reg src);
+    void MovMemImm32(X64Reg base, int32_t disp, uint32_t imm);
+    void MovMemImm8(X64Reg base, int32_t disp, uint8_t imm);
+    void MovRegReg32(X64Reg dst, X64Reg src);
+    void MovRegReg64(X64Reg dst, X64Reg src);
+    void MovRegImm64(X64Reg dst, uint64_t imm);
+
+    /*!
+     * dst = base + index, in 64 bits.
+     */
+    void LeaRegSum64(X64Reg dst, X64Reg base, X64Reg index);
+
+    /*!
+     * Loads the address of the instruction `skip` bytes past the end of this
+     * one.
+     */
+    void LeaRipRelative(X64Reg dst, int32_t skip);
+
+    void Push(X64Reg reg);
+    void Pop(X64Reg reg);
+    void Pushfq();
+    void Popfq();
+
+    // ----- Arithmetic -------------------------------------------------------
+    void AluRegReg32(X64AluOp op, X64Reg dst, X64Reg src);
+    void AluRegImm32(X64AluOp op, X64Reg dst, uint32_t imm);
+    void AluRegMem32(X64AluOp op, X64Reg dst, X64Reg base, int32_t disp);
+    void AluMemReg32(X64AluOp op, X64Reg base, int32_t disp, X64Reg src);
+    void AluMemImm32(X64AluOp op, X64Reg base, int32_t disp, uint32_t imm);
+    void CmpMemImm8(X64Reg base, int32_t disp, uint8_t imm);
+    void CmpMemImm8_64(X64Reg base, int32_t disp, int8_t imm);
+    void TestRegReg32(X64Reg a, X64Reg b);
+    void TestRegImm32(X64Reg reg, uint32_t imm);
+    void TestRegReg8(X64Reg a, X64Reg b);
+    void ImulRegImm8(X64Reg dst, X64Reg src, int8_t imm);
+    void ShrRegImm32(X64Reg reg, uint8_t imm);
+    void BtRegImm32(X64Reg reg, uint8_t bit);
+    void AddRsp(int8_t imm);
+    void SubRsp(int8_t imm);
+
+    // ----- Control flow -----------------------------------------------------
+    void Jmp(X64Label& label);
+    void Jcc(X64Cond cond, X64Label& label);
+
+    /*!
+     * Emits a jump to an absolute address and returns the offset of its rel32
+     * field, so that it can be patched later.
+     */
+    uint32_t JmpAbsolute(const uint8_t *target);
+
+    void JmpReg(X64Reg reg);
+    void CallReg(X64Reg reg);
+    void Ret();
+
+private:
+    void Emit8(uint8_t value) { m_code.push_back(value); }
+    void Emit32(uint32_t value);
+    void Emit64(uint64_t value);
+
+    void Rex(bool w, uint8_t reg, uint8_t rm, bool force = false);
+    void ModRMReg(uint8_t reg, uint8_t rm);
+    void ModRMMem(uint8_t reg, X64Reg base, int32_t disp);
+    void EmitRel32(X64Label& label);
+
+    uint8_t *m_base;
+    std::vector<uint8_t> m_code;
+};
+
+}
+}
+}
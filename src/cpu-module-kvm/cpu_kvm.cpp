@@ -14,6 +14,12 @@ KvmCpu::KvmCpu() {
     m_kvm = nullptr;
     m_vm = nullptr;
     m_vcpu = nullptr;
+
+    m_regsDirty = true;
+    m_fpuRegsDirty = true;
+    m_regsChanged = false;
+    m_sregsChanged = false;
+    m_fpuRegsChanged = false;
 }
 
 KvmCpu::~KvmCpu() {
@@ -40,17 +46,87 @@ CPUInitStatus KvmCpu::InitializeImpl() {
             return CPUS_INIT_CREATE_VM_FAILED;
         }
 
+        // The in-kernel IRQ chip must exist before the VCPU is created so
+        // that the VCPU gets a local APIC
+        if (m_inKernelIRQChip) {
+            vmStatus = m_vm->CreateIRQChip();
+            if (vmStatus != KVMVMS_SUCCESS) {
+                log_error("KvmCpu: Failed to create the in-kernel IRQ chip\n");
+                delete m_kvm;
+                m_kvm = nullptr;
+                return CPUS_INIT_CREATE_VM_FAILED;
+            }
+        }
+
         auto vcpuStatus = m_vm->CreateVCPU(&m_vcpu);
         if (vcpuStatus != KVMVCPUS_SUCCESS) {
             delete m_kvm;
             m_kvm = nullptr;
             return CPUS_INIT_CREATE_CPU_FAILED;
         }
+
+        // Buffer writes to posted write ranges in the coalesced MMIO ring
+        if (m_vcpu->coalescedMMIORing() != nullptr) {
+            m_ioMapper->SetPostedWriteHandler(PostedWriteRangeCB, this);
+        }
+
+        // Map RAM aliases into the guest so that they don't cause exits
+        m_ioMapper->SetRAMAliasHandler(RAMAliasCB, this);
     }
 
     return CPUS_INIT_OK;
 }
 
+void KvmCpu::RAMAliasCB(uint32_t baseAddress, uint32_t size, void *hostMemory, void *userData) {
+    KvmCpu *cpu = (KvmCpu *)userData;
+    KvmVMStatus status;
+    if (hostMemory != nullptr) {
+        status = cpu->m_vm->MapUserMemoryToGuest(hostMemory, size, baseAddress);
+        if (status == KVMVMS_SUCCESS) {
+            MappedRAMAlias& alias = cpu->m_ramAliases[baseAddress];
+            alias.size = size;
+            alias.hostMemory = (uint8_t *)hostMemory;
+            if (!cpu->TrackRAMAlias(baseAddress, alias)) {
+                log_warning("KvmCpu: Failed to log dirty pages of RAM alias 0x%08x..0x%08x\n", baseAddress, baseAddress + size - 1);
+            }
+        }
+    }
+    else {
+        // Keep the writes made through the alias before it goes away
+        auto it = cpu->m_ramAliases.find(baseAddress);
+        if (it != cpu->m_ramAliases.end()) {
+            if (it->second.logged) {
+                cpu->MergeRAMAliasDirtyLog(baseAddress, it->second);
+            }
+            cpu->m_ramAliases.erase(it);
+        }
+
+        status = cpu->m_vm->UnmapGuestMemory(baseAddress);
+        cpu->m_dirtyPages.erase(baseAddress);
+    }
+
+    // Accesses keep going through the device if the alias couldn't be mapped
+    if (status != KVMVMS_SUCCESS) {
+        log_warning("KvmCpu: Failed to %s RAM alias 0x%08x..0x%08x\n", hostMemory != nullptr ? "map" : "unmap", baseAddress, baseAddress + size - 1);
+    }
+}
+
+void KvmCpu::PostedWriteRangeCB(uint32_t baseAddress, uint32_t size, bool posted, void *userData) {
+    KvmCpu *cpu = (KvmCpu *)userData;
+    KvmVMStatus status;
+    if (posted) {
+        status = cpu->m_vm->RegisterCoalescedMMIO(baseAddress, size);
+    }
+    else {
+        // Ranges are only unmapped while handling an exit, after the ring was
+        // drained, so no writes to the range are left behind
+        status = cpu->m_vm->UnregisterCoalescedMMIO(baseAddress, size);
+    }
+    if (status != KVMVMS_SUCCESS) {
+        log_warning("KvmCpu: Failed to %s coalesced MMIO range 0x%08x..0x%08x\n", posted ? "register" : "unregister", baseAddress, baseAddress + size - 1);
+    }
+}
+
 CPUStatus KvmCpu::RunImpl() {
     UpdateRegisters();
     auto status = m_vcpu->Run();
@@ -59,11 +135,16 @@ CPUStatus KvmCpu::RunImpl() {
 
 void KvmCpu::UpdateRegisters() {
     // Update registers if they've been changed
+    // Only write back the groups that were modified, so that changing a GPR
+    // doesn't require a KVM_SET_SREGS
     if (m_regsChanged) {
         m_vcpu->SetRegisters(m_regs);
-        m_vcpu->SetSRegisters(m_sregs);
         m_regsChanged = false;
     }
+    if (m_sregsChanged) {
+        m_vcpu->SetSRegisters(m_sregs);
+        m_sregsChanged = false;
+    }
     if (m_fpuRegsChanged) {
         m_vcpu->SetFPURegisters(m_fpuRegs);
         m_fpuRegsChanged = false;
@@ -75,6 +156,12 @@ CPUStatus KvmCpu::HandleExecResult(KvmVCPUStatus status) {
     m_regsDirty = true;
     m_fpuRegsDirty = true;
 
+    // The guest may have changed its page tables
+    FlushTranslationCache();
+
+    // Buffered writes happened before the exit
+    DrainCoalescedMMIO();
+
     // Check VM status
     if (status == KVMVCPUS_RUN_FAILED) {
         return CPUS_FAILED;
@@ -102,9 +189,192 @@ CPUStatus KvmCpu::HandleExecResult(KvmVCPUStatus status) {
 
 
 InterruptResult KvmCpu::InterruptImpl(uint8_t vector) {
+    // Kick the VCPU out of KVM_RUN to give the emulator a chance to inject the
+    // interrupt request
+    m_vcpu->Kick();
+
     return INTR_SUCCESS;
 }
 
+void KvmCpu::DrainCoalescedMMIO() {
+    auto ring = m_vcpu->coalescedMMIORing();
+    if (ring == nullptr) {
+        return;
+    }
+
+    uint32_t ringSize = m_vcpu->coalescedMMIORingSize();
+    uint32_t first = ring->first;
+    while (first != __atomic_load_n(&ring->last, __ATOMIC_ACQUIRE)) {
+        struct kvm_coalesced_mmio *entry = &ring->coalesced_mmio[first];
+        uint32_t addr = (uint32_t)entry->phys_addr;
+
+        // Split quadword writes into dwords
+        for (uint32_t offset = 0; offset < entry->len; offset += 4) {
+            uint32_t size = std::min<uint32_t>(entry->len - offset, 4);
+            uint32_t value = 0;
+            memcpy(&value, &entry->data[offset], size);
+            m_ioMapper->MMIOWrite(addr + offset, value, size);
+        }
+
+        first = (first + 1) % ringSize;
+        __atomic_store_n(&ring->first, first, __ATOMIC_RELEASE);
+    }
+}
+
+void KvmCpu::FlushPostedWrites() {
+    // Writes can only be delivered on the CPU thread, so force an exit if
+    // there is anything to deliver
+    auto ring = m_vcpu->coalescedMMIORing();
+    if (ring != nullptr && __atomic_load_n(&ring->first, __ATOMIC_RELAXED) != __atomic_load_n(&ring->last, __ATOMIC_RELAXED)) {
+        m_vcpu->Kick();
+    }
+}
+
+void KvmCpu::RequestExit() {
+    m_vcpu->Kick();
+}
+
+CPUOperationStatus KvmCpu::FindDirtyLogSlot(uint32_t baseAddress, uint32_t size, uint32_t *slotBase) {
+    if ((baseAddress | size) & (CPU_PHYS_PAGE_SIZE - 1) || size == 0) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+
+    // The range must lie within a single memory slot
+    uint32_t slotSize;
+    if (!m_vm->FindMemorySlot(baseAddress, slotBase, &slotSize) || (uint64_t)(baseAddress - *slotBase) + size > slotSize) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus KvmCpu::EnableDirtyTracking(uint32_t baseAddress, uint32_t size) {
+    uint32_t slotBase;
+    CPUOperationStatus status = FindDirtyLogSlot(baseAddress, size, &slotBase);
+    if (status != CPUS_OP_OK) {
+        return status;
+    }
+    if (m_dirtyPages.count(slotBase)) {
+        return CPUS_OP_OK;
+    }
+
+    if (m_vm->EnableDirtyLog(slotBase) != KVMVMS_SUCCESS) {
+        return CPUS_OP_FAILED;
+    }
+
+    uint32_t slotSize;
+    m_vm->FindMemorySlot(slotBase, &slotBase, &slotSize);
+    m_dirtyPages[slotBase].assign(((slotSize >> CPU_PHYS_PAGE_SHIFT) + 63) / 64, 0);
+
+    // Guest writes through aliases of the slot bypass its log
+    for (auto& entry : m_ramAliases) {
+        if (!TrackRAMAlias(entry.first, entry.second)) {
+            return CPUS_OP_FAILED;
+        }
+    }
+    return CPUS_OP_OK;
+}
+
+// Enables dirty logging on a RAM alias if it aliases a tracked RAM slot.
+// Returns false if logging could not be enabled.
+bool KvmCpu::TrackRAMAlias(uint32_t aliasBase, MappedRAMAlias& alias) {
+    if (alias.logged) {
+        return true;
+    }
+
+    for (auto& entry : m_dirtyPages) {
+        uint32_t slotBase = entry.first;
+        if (m_ramAliases.count(slotBase)) {
+            continue;
+        }
+
+        uint32_t slotSize;
+        uint8_t *slotMemory = (uint8_t *)m_vm->GetSlotUserMemory(slotBase);
+        if (slotMemory == nullptr || !m_vm->FindMemorySlot(slotBase, &slotBase, &slotSize)) {
+            continue;
+        }
+        if (alias.hostMemory < slotMemory || alias.hostMemory + alias.size > slotMemory + slotSize) {
+            continue;
+        }
+
+        if (m_vm->EnableDirtyLog(aliasBase) != KVMVMS_SUCCESS) {
+            return false;
+        }
+        alias.logged = true;
+        alias.ramSlot = slotBase;
+        alias.ramPage = (uint32_t)((alias.hostMemory - slotMemory) >> CPU_PHYS_PAGE_SHIFT);
+        return true;
+    }
+    return true;
+}
+
+// Moves the pages logged in a RAM alias' slot into the aliased RAM slot's
+// dirty pages
+bool KvmCpu::MergeRAMAliasDirtyLog(uint32_t aliasBase, const MappedRAMAlias& alias) {
+    uint32_t numPages = alias.size >> CPU_PHYS_PAGE_SHIFT;
+    std::vector<Bitmap64> log((numPages + 63) / 64);
+    if (m_vm->GetDirtyLog(aliasBase, log.data()) != KVMVMS_SUCCESS) {
+        return false;
+    }
+
+    std::vector<Bitmap64>& dirty = m_dirtyPages[alias.ramSlot];
+    for (uint32_t i = 0; i < numPages; i++) {
+        if (Bitmap64IsSet(log[i >> 6], i & 63)) {
+            uint32_t page = alias.ramPage + i;
+            Bitmap64Set(&dirty[page >> 6], page & 63);
+        }
+    }
+    return true;
+}
+
+CPUOperationStatus KvmCpu::FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap) {
+    uint32_t slotBase;
+    CPUOperationStatus status = FindDirtyLogSlot(baseAddress, size, &slotBase);
+    if (status != CPUS_OP_OK) {
+        return status;
+    }
+    auto it = m_dirtyPages.find(slotBase);
+    if (it == m_dirtyPages.end()) {
+        return CPUS_OP_FAILED;
+    }
+    std::vector<Bitmap64>& dirty = it->second;
+
+    // Accumulate the pages logged since the last fetch
+    std::vector<Bitmap64> log(dirty.size());
+    if (m_vm->GetDirtyLog(slotBase, log.data()) != KVMVMS_SUCCESS) {
+        return CPUS_OP_FAILED;
+    }
+    for (size_t i = 0; i < dirty.size(); i++) {
+        dirty[i] |= log[i];
+    }
+    for (auto& entry : m_ramAliases) {
+        if (entry.second.logged && entry.second.ramSlot == slotBase && !MergeRAMAliasDirtyLog(entry.first, entry.second)) {
+            return CPUS_OP_FAILED;
+        }
+    }
+
+    uint32_t firstPage = (baseAddress - slotBase) >> CPU_PHYS_PAGE_SHIFT;
+    uint32_t numPages = size >> CPU_PHYS_PAGE_SHIFT;
+    memset(bitmap, 0, sizeof(Bitmap64) * ((numPages + 63) / 64));
+    for (uint32_t i = 0; i < numPages; i++) {
+        uint32_t page = firstPage + i;
+        if (Bitmap64IsSet(dirty[page >> 6], page & 63)) {
+            Bitmap64Set(&bitmap[i >> 6], i & 63);
+            Bitmap64Clear(&dirty[page >> 6], page & 63);
+        }
+    }
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus KvmCpu::SetIRQLevel(uint8_t irqNum, bool level) {
+    if (!m_inKernelIRQChip) {
+        return CPUS_OP_UNSUPPORTED;
+    }
+    if (m_vm->SetIRQLine(irqNum, level) != KVMVMS_SUCCESS) {
+        return CPUS_OP_FAILED;
+    }
+    return CPUS_OP_OK;
+}
+
 CPUMemMapStatus KvmCpu::MemMapSubregion(MemoryRegion *subregion) {
     log_debug("KvmCpu: Mapping 0x%X bytes to guest memory address 0x%X\n", subregion->m_size, subregion->m_start);
 
@@ -133,6 +403,8 @@ CPUMemMapStatus KvmCpu::MemMapSubregion(MemoryRegion *subregion) {
         case KVMVMS_MEM_ERROR: return CPUS_MMAP_MAPPING_FAILED;
             return CPUS_MMAP_UNHANDLED_ERROR;
         case KVMVMS_CREATE_FAILED:
+        case KVMVMS_MISSING_CAP:
+        case KVMVMS_IRQCHIP_FAILED:
             // Shouldn't happen
             return CPUS_MMAP_UNHANDLED_ERROR;
         }
@@ -209,7 +481,8 @@ CPUOperationStatus KvmCpu::RegWrite(enum CpuReg reg, uint32_t value) {
     default:                                                                return CPUS_OP_INVALID_REGISTER;
     }
 
-    m_regsChanged = true;
+    FlushTranslationCacheOnWrite(reg);
+    MarkRegisterChanged(reg);
 
     return CPUS_OP_OK;
 }
@@ -275,13 +548,122 @@ CPUOperationStatus KvmCpu::RegWrite(CpuReg regs[], uint32_t values[], uint8_t nu
         case REG_CR4:       m_sregs.cr4 = values[i];                                break;
         default:                                                                    return CPUS_OP_INVALID_REGISTER;
         }
+        FlushTranslationCacheOnWrite(regs[i]);
+        MarkRegisterChanged(regs[i]);
     }
 
-    m_regsChanged = true;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus KvmCpu::GetRegisterFile(RegisterFile *regFile) {
+    REFRESH_REGISTERS;
+
+    regFile->regs[REG_EIP] = (uint32_t)m_regs.rip;
+    regFile->regs[REG_EFLAGS] = (uint32_t)m_regs.rflags;
+    regFile->regs[REG_EAX] = (uint32_t)m_regs.rax;
+    regFile->regs[REG_ECX] = (uint32_t)m_regs.rcx;
+    regFile->regs[REG_EDX] = (uint32_t)m_regs.rdx;
+    regFile->regs[REG_EBX] = (uint32_t)m_regs.rbx;
+    regFile->regs[REG_ESI] = (uint32_t)m_regs.rsi;
+    regFile->regs[REG_EDI] = (uint32_t)m_regs.rdi;
+    regFile->regs[REG_ESP] = (uint32_t)m_regs.rsp;
+    regFile->regs[REG_EBP] = (uint32_t)m_regs.rbp;
+    regFile->regs[REG_CS] = m_sregs.cs.selector;
+    regFile->regs[REG_SS] = m_sregs.ss.selector;
+    regFile->regs[REG_DS] = m_sregs.ds.selector;
+    regFile->regs[REG_ES] = m_sregs.es.selector;
+    regFile->regs[REG_FS] = m_sregs.fs.selector;
+    regFile->regs[REG_GS] = m_sregs.gs.selector;
+    regFile->regs[REG_TR] = m_sregs.tr.selector;
+    regFile->regs[REG_CR0] = (uint32_t)m_sregs.cr0;
+    regFile->regs[REG_CR2] = (uint32_t)m_sregs.cr2;
+    regFile->regs[REG_CR3] = (uint32_t)m_sregs.cr3;
+    regFile->regs[REG_CR4] = (uint32_t)m_sregs.cr4;
+    regFile->dirty = 0;
 
     return CPUS_OP_OK;
 }
 
+CPUOperationStatus KvmCpu::SetRegisterFile(RegisterFile *regFile) {
+    REFRESH_REGISTERS;
+
+    uint32_t dirty = regFile->dirty;
+
+    // The descriptors are read through the new control registers, so keep
+    // the cached state to restore it if any of them cannot be read
+    bool loadSegments = (dirty & REGFILE_SEG_MASK) != 0;
+    struct kvm_regs savedRegs;
+    struct kvm_sregs savedSregs;
+    bool savedRegsChanged = m_regsChanged;
+    bool savedSregsChanged = m_sregsChanged;
+    if (loadSegments) {
+        savedRegs = m_regs;
+        savedSregs = m_sregs;
+    }
+
+    if (dirty & REGFILE_GPR_MASK) {
+        if (dirty & REGFILE_BIT(REG_EIP))    m_regs.rip = regFile->regs[REG_EIP];
+        if (dirty & REGFILE_BIT(REG_EFLAGS)) m_regs.rflags = regFile->regs[REG_EFLAGS];
+        if (dirty & REGFILE_BIT(REG_EAX))    m_regs.rax = regFile->regs[REG_EAX];
+        if (dirty & REGFILE_BIT(REG_ECX))    m_regs.rcx = regFile->regs[REG_ECX];
+        if (dirty & REGFILE_BIT(REG_EDX))    m_regs.rdx = regFile->regs[REG_EDX];
+        if (dirty & REGFILE_BIT(REG_EBX))    m_regs.rbx = regFile->regs[REG_EBX];
+        if (dirty & REGFILE_BIT(REG_ESI))    m_regs.rsi = regFile->regs[REG_ESI];
+        if (dirty & REGFILE_BIT(REG_EDI))    m_regs.rdi = regFile->regs[REG_EDI];
+        if (dirty & REGFILE_BIT(REG_ESP))    m_regs.rsp = regFile->regs[REG_ESP];
+        if (dirty & REGFILE_BIT(REG_EBP))    m_regs.rbp = regFile->regs[REG_EBP];
+        m_regsChanged = true;
+    }
+
+    if (dirty & REGFILE_CR_MASK) {
+        if (dirty & REGFILE_BIT(REG_CR0)) m_sregs.cr0 = regFile->regs[REG_CR0];
+        if (dirty & REGFILE_BIT(REG_CR2)) m_sregs.cr2 = regFile->regs[REG_CR2];
+        if (dirty & REGFILE_BIT(REG_CR3)) m_sregs.cr3 = regFile->regs[REG_CR3];
+        if (dirty & REGFILE_BIT(REG_CR4)) m_sregs.cr4 = regFile->regs[REG_CR4];
+        FlushTranslationCache();
+        m_sregsChanged = true;
+    }
+
+    if (loadSegments) {
+        // Read all modified descriptors from the GDT in one go
+        static const CpuReg segRegs[] = { REG_CS, REG_SS, REG_DS, REG_ES, REG_FS, REG_GS, REG_TR };
+        const size_t numSegRegs = sizeof(segRegs) / sizeof(segRegs[0]);
+        CpuReg loadRegs[numSegRegs];
+        GDTEntry entries[numSegRegs];
+        uint32_t addrs[numSegRegs];
+        uint32_t sizes[numSegRegs];
+        void *values[numSegRegs];
+        uint32_t numLoads = 0;
+        for (size_t i = 0; i < numSegRegs; i++) {
+            if (dirty & REGFILE_BIT(segRegs[i])) {
+                loadRegs[numLoads] = segRegs[i];
+                addrs[numLoads] = (uint32_t)(m_sregs.gdt.base + (uint16_t)regFile->regs[segRegs[i]]);
+                sizes[numLoads] = sizeof(GDTEntry);
+                values[numLoads] = &entries[numLoads];
+                numLoads++;
+            }
+        }
+
+        auto status = VMemRead(addrs, sizes, values, numLoads);
+        if (status != CPUS_OP_OK) {
+            m_regs = savedRegs;
+            m_sregs = savedSregs;
+            m_regsChanged = savedRegsChanged;
+            m_sregsChanged = savedSregsChanged;
+            if (dirty & REGFILE_CR_MASK) {
+                FlushTranslationCache();
+            }
+            return status;
+        }
+        for (uint32_t i = 0; i < numLoads; i++) {
+            LoadSegmentDescriptor((uint16_t)regFile->regs[loadRegs[i]], entries[i], GetSegment(loadRegs[i]));
+        }
+    }
+
+    regFile->dirty = 0;
+    return CPUS_OP_OK;
+}
+
 CPUOperationStatus KvmCpu::GetGDT(uint32_t *addr, uint32_t *size) {
     REFRESH_REGISTERS;
 
@@ -297,7 +679,7 @@ CPUOperationStatus KvmCpu::SetGDT(uint32_t addr, uint32_t size) {
     m_sregs.gdt.base = addr;
     m_sregs.gdt.limit = size;
 
-    m_regsChanged = true;
+    m_sregsChanged = true;
 
     return CPUS_OP_OK;
 }
@@ -316,12 +698,18 @@ CPUOperationStatus KvmCpu::SetIDT(uint32_t addr, uint32_t size) {
     m_sregs.idt.base = addr;
     m_sregs.idt.limit = size;
 
-    m_regsChanged = true;
+    m_sregsChanged = true;
 
     return CPUS_OP_OK;
 }
 
 CPUStatus KvmCpu::HandleIO(uint8_t direction, uint16_t port, uint8_t size, uint32_t count, uint64_t dataOffset) {
+    IOStatistics *stats = m_ioMapper->AcquireStatistics();
+    IOStatistics::Clock::time_point start;
+    if (stats != nullptr) {
+        start = IOStatistics::Clock::now();
+    }
+
     uint8_t *ptr;
     if (direction) {
         ptr = (uint8_t*)((((uint64_t)m_vcpu->kvmRun()) + dataOffset) + size * count - size);
@@ -352,16 +740,32 @@ CPUStatus KvmCpu::HandleIO(uint8_t direction, uint16_t port, uint8_t size, uint3
             ptr += size;
         }
     }
+
+    if (stats != nullptr) {
+        stats->RecordExit(IO_EXIT_PIO, count, IOStatistics::NanosSince(start));
+        m_ioMapper->ReleaseStatistics();
+    }
     return CPUS_OK;
 }
 
 CPUStatus KvmCpu::HandleMMIO(uint32_t physAddress, uint32_t *data, uint8_t size, uint8_t isWrite) {
+    IOStatistics *stats = m_ioMapper->AcquireStatistics();
+    IOStatistics::Clock::time_point start;
+    if (stats != nullptr) {
+        start = IOStatistics::Clock::now();
+    }
+
     if (isWrite) {
         m_ioMapper->MMIOWrite(physAddress, *data, size);
     }
     else {
         m_ioMapper->MMIORead(physAddress, data, size);
     }
+
+    if (stats != nullptr) {
+        stats->RecordExit(IO_EXIT_MMIO, 1, IOStatistics::NanosSince(start));
+        m_ioMapper->ReleaseStatistics();
+    }
     return CPUS_OK;
 }
 
@@ -385,10 +789,15 @@ CPUOperationStatus KvmCpu::RefreshRegisters(bool refreshFPU) {
 }
 
 int KvmCpu::LoadSegmentSelector(uint16_t selector, struct kvm_segment *segment) {
-    segment->selector = selector;
-
     GDTEntry gdtEntry;
     VMemRead((uint32_t)(m_sregs.gdt.base + selector), sizeof(GDTEntry), &gdtEntry);
+    LoadSegmentDescriptor(selector, gdtEntry, segment);
+
+    return 0;
+}
+
+void KvmCpu::LoadSegmentDescriptor(uint16_t selector, GDTEntry& gdtEntry, struct kvm_segment *segment) {
+    segment->selector = selector;
 
     // Not much on this in KVM documentation. See Intel documentation for a better description.
     // "Intel Software Developer's Manual Combined Volumes: 1, 2A, 2B, 2C, 2D, 3A, 3B, 3C, 3D and 4"
@@ -406,9 +815,29 @@ int KvmCpu::LoadSegmentSelector(uint16_t selector, struct kvm_segment *segment)
     segment->base = gdtEntry.GetBase();
     segment->limit = gdtEntry.GetLimit();
 
-    m_regsChanged = true;
+    m_sregsChanged = true;
+}
 
-    return 0;
+struct kvm_segment *KvmCpu::GetSegment(enum CpuReg reg) {
+    switch (reg) {
+    case REG_CS: return &m_sregs.cs;
+    case REG_SS: return &m_sregs.ss;
+    case REG_DS: return &m_sregs.ds;
+    case REG_ES: return &m_sregs.es;
+    case REG_FS: return &m_sregs.fs;
+    case REG_GS: return &m_sregs.gs;
+    case REG_TR: return &m_sregs.tr;
+    default:     return nullptr;
+    }
+}
+
+void KvmCpu::MarkRegisterChanged(enum CpuReg reg) {
+    if (REGFILE_BIT(reg) & REGFILE_GPR_MASK) {
+        m_regsChanged = true;
+    }
+    else {
+        m_sregsChanged = true;
+    }
 }
 
 CPUOperationStatus KvmCpu::InjectInterrupt(uint8_t vector) {
@@ -4,6 +4,7 @@
 #include "kvm/kvm.h"
 
 #include <linux/kvm.h>
+#include <map>
 #include <vector>
 #include <queue>
 #include <mutex>
@@ -23,14 +24,25 @@ public:
     CPUStatus RunImpl();
     InterruptResult InterruptImpl(uint8_t vector);
 
+    CPUOperationStatus SetIRQLevel(uint8_t irqNum, bool level) override;
+
+    void FlushPostedWrites() override;
+    void RequestExit() override;
+
     CPUMemMapStatus MemMapSubregion(MemoryRegion *subregion);
 
+    CPUOperationStatus EnableDirtyTracking(uint32_t baseAddress, uint32_t size) override;
+    CPUOperationStatus FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap) override;
+
     CPUOperationStatus RegRead(enum CpuReg reg, uint32_t *value);
     CPUOperationStatus RegWrite(enum CpuReg reg, uint32_t value);
 
     CPUOperationStatus RegRead(enum CpuReg regs[], uint32_t values[], uint8_t numRegs) override;
     CPUOperationStatus RegWrite(enum CpuReg regs[], uint32_t values[], uint8_t numRegs) override;
 
+    CPUOperationStatus GetRegisterFile(RegisterFile *regFile) override;
+    CPUOperationStatus SetRegisterFile(RegisterFile *regFile) override;
+
     CPUOperationStatus GetGDT(uint32_t *addr, uint32_t *size);
     CPUOperationStatus SetGDT(uint32_t addr, uint32_t size);
 
@@ -49,22 +61,54 @@ private:
 
     bool m_regsDirty;
     bool m_fpuRegsDirty;
+
+    // Register groups modified since the last run, written back separately
     bool m_regsChanged;
+    bool m_sregsChanged;
     bool m_fpuRegsChanged;
 
     struct kvm_regs m_regs;
     struct kvm_sregs m_sregs;
     struct kvm_fpu m_fpuRegs;
 
+    // Dirty pages of memory slots with dirty logging enabled, keyed by the
+    // slot's base address. KVM logs whole slots and clears the log when it is
+    // read, so pages outside of the fetched range are kept here.
+    std::map<uint32_t, std::vector<Bitmap64>> m_dirtyPages;
+
+    // RAM aliases mapped into their own memory slots, keyed by the slot's
+    // base address. KVM logs writes per slot, so aliases of tracked RAM have
+    // their own log, which is merged into the RAM slot's dirty pages.
+    struct MappedRAMAlias {
+        uint32_t size;
+        uint8_t *hostMemory;
+
+        bool logged = false;
+        uint32_t ramSlot = 0;     // Base address of the tracked RAM slot
+        uint32_t ramPage = 0;     // First page of the alias within that slot
+    };
+    std::map<uint32_t, MappedRAMAlias> m_ramAliases;
+
+    CPUOperationStatus FindDirtyLogSlot(uint32_t baseAddress, uint32_t size, uint32_t *slotBase);
+    bool TrackRAMAlias(uint32_t aliasBase, MappedRAMAlias& alias);
+    bool MergeRAMAliasDirtyLog(uint32_t aliasBase, const MappedRAMAlias& alias);
+
     void UpdateRegisters();
     CPUStatus HandleExecResult(KvmVCPUStatus status);
 
     CPUStatus HandleIO(uint8_t direction, uint16_t port, uint8_t size, uint32_t count, uint64_t dataOffset);
     CPUStatus HandleMMIO(uint32_t physAddress, uint32_t *data, uint8_t size, uint8_t isWrite);
 
+    void DrainCoalescedMMIO();
+    static void PostedWriteRangeCB(uint32_t baseAddress, uint32_t size, bool posted, void *userData);
+    static void RAMAliasCB(uint32_t baseAddress, uint32_t size, void *hostMemory, void *userData);
+
     CPUOperationStatus RefreshRegisters(bool refreshFPU);
 
     int LoadSegmentSelector(uint16_t selector, struct kvm_segment* segment);
+    void LoadSegmentDescriptor(uint16_t selector, GDTEntry& gdtEntry, struct kvm_segment* segment);
+    struct kvm_segment *GetSegment(enum CpuReg reg);
+    void MarkRegisterChanged(enum CpuReg reg);
 
 };
 
@@ -9,14 +9,17 @@ using namespace vixen::cpu;
 
 CPU_MODULE_BEGIN
 CPU_MODULE_INFO(KvmCPUModule, "KVM CPU Module", "0.0.1")
+CPU_MODULE_CAPS.inKernelIRQChip();
 CPU_MODULE_END
 
+// Each call creates an independent CPU, so that several emulated machines can
+// be hosted by the same process
 Cpu *KvmCPUModule::GetCPU() {
-    return &m_cpu;
+    return new KvmCpu();
 }
 
 void KvmCPUModule::FreeCPU(Cpu *cpu) {
-
+    delete cpu;
 }
 
 void KvmCPUModule::Cleanup() {
@@ -14,8 +14,6 @@ public:
     Cpu *GetCPU();
     void FreeCPU(Cpu *cpu);
     void Cleanup();
-private:
-    KvmCpu m_cpu;
 };
 
 }
@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <malloc.h>
 #include <cstring>
+#include <errno.h>
 
 Kvm::Kvm() {
 
@@ -94,6 +95,121 @@ KvmVMStatus KvmVM::Initialize() {
     return KVMVMS_SUCCESS;
 }
 
+KvmVMStatus KvmVM::CreateIRQChip() {
+    if(ioctl(m_kvm.handle(), KVM_CHECK_EXTENSION, KVM_CAP_IRQCHIP) <= 0 ||
+       ioctl(m_kvm.handle(), KVM_CHECK_EXTENSION, KVM_CAP_PIT2) <= 0) {
+        return KVMVMS_MISSING_CAP;
+    }
+
+    if(ioctl(m_fd, KVM_CREATE_IRQCHIP, 0) < 0) {
+        return KVMVMS_IRQCHIP_FAILED;
+    }
+
+    // The PIT drives IRQ 0 of the in-kernel PIC directly
+    struct kvm_pit_config pitConfig;
+    memset(&pitConfig, 0, sizeof(pitConfig));
+    if(ioctl(m_fd, KVM_CREATE_PIT2, &pitConfig) < 0) {
+        return KVMVMS_IRQCHIP_FAILED;
+    }
+
+    return KVMVMS_SUCCESS;
+}
+
+KvmVMStatus KvmVM::SetIRQLine(uint32_t irq, bool level) {
+    struct kvm_irq_level irqLevel;
+    irqLevel.irq = irq;
+    irqLevel.level = level ? 1 : 0;
+
+    if(ioctl(m_fd, KVM_IRQ_LINE, &irqLevel) < 0) {
+        return KVMVMS_IRQCHIP_FAILED;
+    }
+
+    return KVMVMS_SUCCESS;
+}
+
+KvmVMStatus KvmVM::RegisterCoalescedMMIO(uint32_t address, uint32_t size) {
+    struct kvm_coalesced_mmio_zone zone;
+    memset(&zone, 0, sizeof(zone));
+    zone.addr = address;
+    zone.size = size;
+
+    if(ioctl(m_fd, KVM_REGISTER_COALESCED_MMIO, &zone) < 0) {
+        return KVMVMS_MEM_ERROR;
+    }
+
+    return KVMVMS_SUCCESS;
+}
+
+KvmVMStatus KvmVM::UnregisterCoalescedMMIO(uint32_t address, uint32_t size) {
+    struct kvm_coalesced_mmio_zone zone;
+    memset(&zone, 0, sizeof(zone));
+    zone.addr = address;
+    zone.size = size;
+
+    if(ioctl(m_fd, KVM_UNREGISTER_COALESCED_MMIO, &zone) < 0) {
+        return KVMVMS_MEM_ERROR;
+    }
+
+    return KVMVMS_SUCCESS;
+}
+
+bool KvmVM::FindMemorySlot(uint32_t guestAddress, uint32_t *slotBaseAddress, uint32_t *slotSize) {
+    for(auto record : m_memoryRecords) {
+        uint64_t base = record->memoryRegion.guest_phys_addr;
+        if(record->size != 0 && guestAddress >= base && guestAddress - base < record->size) {
+            *slotBaseAddress = (uint32_t)base;
+            *slotSize = record->size;
+            return true;
+        }
+    }
+    return false;
+}
+
+void *KvmVM::GetSlotUserMemory(uint32_t guestBaseAddress) {
+    for(auto record : m_memoryRecords) {
+        if(record->size != 0 && record->memoryRegion.guest_phys_addr == guestBaseAddress) {
+            return (void *)record->startAddr;
+        }
+    }
+    return nullptr;
+}
+
+KvmVMStatus KvmVM::EnableDirtyLog(uint32_t guestBaseAddress) {
+    for(auto record : m_memoryRecords) {
+        if(record->size == 0 || record->memoryRegion.guest_phys_addr != guestBaseAddress) {
+            continue;
+        }
+
+        record->memoryRegion.flags |= KVM_MEM_LOG_DIRTY_PAGES;
+        if(ioctl(m_fd, KVM_SET_USER_MEMORY_REGION, &record->memoryRegion) < 0) {
+            record->memoryRegion.flags &= ~KVM_MEM_LOG_DIRTY_PAGES;
+            return KVMVMS_MEM_ERROR;
+        }
+        return KVMVMS_SUCCESS;
+    }
+
+    return KVMVMS_MEM_ERROR;
+}
+
+KvmVMStatus KvmVM::GetDirtyLog(uint32_t guestBaseAddress, uint64_t *bitmap) {
+    for(auto record : m_memoryRecords) {
+        if(record->size == 0 || record->memoryRegion.guest_phys_addr != guestBaseAddress) {
+            continue;
+        }
+
+        struct kvm_dirty_log log;
+        memset(&log, 0, sizeof(log));
+        log.slot = record->memoryRegion.slot;
+        log.dirty_bitmap = bitmap;
+        if(ioctl(m_fd, KVM_GET_DIRTY_LOG, &log) < 0) {
+            return KVMVMS_MEM_ERROR;
+        }
+        return KVMVMS_SUCCESS;
+    }
+
+    return KVMVMS_MEM_ERROR;
+}
+
 KvmVCPUStatus KvmVM::CreateVCPU(KvmVCPU **vcpu) {
     *vcpu = new KvmVCPU(*this, m_vcpus.size());
     KvmVCPUStatus status = (*vcpu)->Initialize();
@@ -117,31 +233,68 @@ KvmVMStatus KvmVM::MapUserMemoryToGuest(void *userMemoryBlock, uint32_t userMemo
         return KVMVMS_MEMSIZE_MISALIGNED;
     }
 
-    KvmMemoryRecord *memoryRecord = (KvmMemoryRecord*)malloc(sizeof(KvmMemoryRecord));
-    memset(memoryRecord, 0, sizeof(KvmMemoryRecord));
+    // Reuse the slot of a removed mapping if possible
+    KvmMemoryRecord *memoryRecord = nullptr;
+    for(auto record : m_memoryRecords) {
+        if(record->size == 0) {
+            memoryRecord = record;
+            break;
+        }
+    }
+    if(memoryRecord == nullptr) {
+        memoryRecord = (KvmMemoryRecord*)malloc(sizeof(KvmMemoryRecord));
+        memset(memoryRecord, 0, sizeof(KvmMemoryRecord));
+        memoryRecord->memoryRegion.slot = (uint32_t)m_memoryRecords.size();
+        m_memoryRecords.push_back(memoryRecord);
+    }
+
     memoryRecord->size = userMemorySize;
     memoryRecord->startAddr = (uint64_t)userMemoryBlock;
     memoryRecord->memoryRegion.memory_size = userMemorySize;
     memoryRecord->memoryRegion.userspace_addr = (uint64_t)userMemoryBlock;
     memoryRecord->memoryRegion.guest_phys_addr = (uint64_t)guestBaseAddress;
-    memoryRecord->memoryRegion.slot = (uint32_t)m_memoryRecords.size();
-
-    m_memoryRecords.push_back(memoryRecord);
+    memoryRecord->memoryRegion.flags = 0;
 
-    if(ioctl(m_fd, KVM_SET_USER_MEMORY_REGION, &m_memoryRecords[m_memoryRecords.size() - 1]->memoryRegion) < 0) {
+    if(ioctl(m_fd, KVM_SET_USER_MEMORY_REGION, &memoryRecord->memoryRegion) < 0) {
+        memoryRecord->size = 0;
+        memoryRecord->memoryRegion.memory_size = 0;
         return KVMVMS_MEM_ERROR;
     }
 
     return KVMVMS_SUCCESS;
 }
 
+KvmVMStatus KvmVM::UnmapGuestMemory(uint32_t guestBaseAddress) {
+    for(auto record : m_memoryRecords) {
+        if(record->size == 0 || record->memoryRegion.guest_phys_addr != guestBaseAddress) {
+            continue;
+        }
+
+        // A slot with size zero is deleted
+        record->memoryRegion.memory_size = 0;
+        if(ioctl(m_fd, KVM_SET_USER_MEMORY_REGION, &record->memoryRegion) < 0) {
+            record->memoryRegion.memory_size = record->size;
+            return KVMVMS_MEM_ERROR;
+        }
+        record->size = 0;
+        return KVMVMS_SUCCESS;
+    }
+
+    return KVMVMS_MEM_ERROR;
+}
+
 // --------------------------------------------------------------------
 KvmVCPU::KvmVCPU(KvmVM& vm, uint32_t id) :
-    m_vm(vm), m_vcpuID(id)
+    m_vm(vm), m_vcpuID(id), m_coalescedMMIORing(nullptr), m_coalescedMMIORingSize(0),
+    m_immediateExitSupported(false), m_runThreadValid(false)
 {
 
 }
 
+// The kick signal only needs to interrupt the KVM_RUN ioctl
+static void KickSignalHandler(int signum) {
+}
+
 KvmVCPU::~KvmVCPU() {
     if(m_fd > 0) {
         close(m_fd);
@@ -173,18 +326,72 @@ KvmVCPUStatus KvmVCPU::Initialize() {
         return KVMVCPUS_CREATE_FAILED;
     }
 
+    // The coalesced MMIO ring lives in the VCPU mapping, at the page offset
+    // returned by the capability check
+    int coalescedMMIOPage = ioctl(m_vm.kvmHandle(), KVM_CHECK_EXTENSION, KVM_CAP_COALESCED_MMIO);
+    if(coalescedMMIOPage > 0) {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        m_coalescedMMIORing = (struct kvm_coalesced_mmio_ring*)((uint8_t*)m_kvmRun + coalescedMMIOPage * pageSize);
+        m_coalescedMMIORingSize = (pageSize - sizeof(struct kvm_coalesced_mmio_ring)) / sizeof(struct kvm_coalesced_mmio);
+    }
+
+    // With immediate exits, a kick that arrives right before KVM_RUN is
+    // entered is not lost
+    m_immediateExitSupported = ioctl(m_vm.kvmHandle(), KVM_CHECK_EXTENSION, KVM_CAP_IMMEDIATE_EXIT) > 0;
+
+    // Install the kick signal handler without SA_RESTART so that KVM_RUN
+    // returns EINTR
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = KickSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(KVM_KICK_SIGNAL, &sa, nullptr) < 0) {
+        return KVMVCPUS_CREATE_FAILED;
+    }
+
     return KVMVCPUS_SUCCESS;
 }
 
 KvmVCPUStatus KvmVCPU::Run() {
+    // Publish the thread to kick for the duration of KVM_RUN. The VCPU may be
+    // run from a different thread each time when it shares a thread pool with
+    // other machines.
+    {
+        std::lock_guard<std::mutex> lk(m_runThreadLock);
+        m_runThread = pthread_self();
+        m_runThreadValid = true;
+    }
+
     // Start running!
-    if(ioctl(m_fd, KVM_RUN, 0) < 0) {
+    int result = ioctl(m_fd, KVM_RUN, 0);
+    int runErrno = errno;
+    {
+        std::lock_guard<std::mutex> lk(m_runThreadLock);
+        m_runThreadValid = false;
+    }
+    m_kvmRun->immediate_exit = 0;
+    if(result < 0) {
+        // Interrupted by a kick
+        if(runErrno == EINTR) {
+            m_kvmRun->exit_reason = KVM_EXIT_INTR;
+            return KVMVCPUS_SUCCESS;
+        }
         return KVMVCPUS_RUN_FAILED;
     }
 
     return KVMVCPUS_SUCCESS;
 }
 
+void KvmVCPU::Kick() {
+    if(m_immediateExitSupported) {
+        m_kvmRun->immediate_exit = 1;
+    }
+    std::lock_guard<std::mutex> lk(m_runThreadLock);
+    if(m_runThreadValid) {
+        pthread_kill(m_runThread, KVM_KICK_SIGNAL);
+    }
+}
+
 KvmVCPUStatus KvmVCPU::Interrupt(uint8_t vector) {
     struct kvm_interrupt kvmInterrupt;
 
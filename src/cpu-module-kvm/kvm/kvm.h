@@ -1,9 +1,16 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
+#include <mutex>
 #include <linux/kvm.h>
+#include <pthread.h>
+#include <signal.h>
 #include <cstdint>
 
+// Signal used to kick a VCPU thread out of KVM_RUN
+#define KVM_KICK_SIGNAL SIGUSR1
+
 enum KvmStatus {
     KVMS_OPEN_FAILED,
     KVMS_SUCCESS,
@@ -16,7 +23,9 @@ enum KvmVMStatus {
     KVMVMS_SUCCESS,
     KVMVMS_MEM_MISALIGNED,
     KVMVMS_MEMSIZE_MISALIGNED,
-    KVMVMS_MEM_ERROR
+    KVMVMS_MEM_ERROR,
+    KVMVMS_MISSING_CAP,
+    KVMVMS_IRQCHIP_FAILED
 };
 
 enum KvmVCPUStatus {
@@ -53,8 +62,38 @@ private:
 class KvmVM {
 public:
     KvmVMStatus MapUserMemoryToGuest(void *userMemoryBlock, uint32_t userMemorySize, uint32_t guestBaseAddress);
+
+    // Removes the memory mapped at the guest address, freeing its slot
+    KvmVMStatus UnmapGuestMemory(uint32_t guestBaseAddress);
+
+    // Finds the memory slot that contains the guest address
+    bool FindMemorySlot(uint32_t guestAddress, uint32_t *slotBaseAddress, uint32_t *slotSize);
+
+    // Returns the host memory backing the memory slot mapped at the guest
+    // address, or nullptr if there is no such slot
+    void *GetSlotUserMemory(uint32_t guestBaseAddress);
+
+    // Enables logging of the pages written to in the memory slot mapped at
+    // the guest address
+    KvmVMStatus EnableDirtyLog(uint32_t guestBaseAddress);
+
+    // Retrieves and clears the dirty page log of the memory slot mapped at the
+    // guest address. The bitmap holds one bit per page of the slot.
+    KvmVMStatus GetDirtyLog(uint32_t guestBaseAddress, uint64_t *bitmap);
     KvmVCPUStatus CreateVCPU(KvmVCPU **vcpu);
 
+    // Creates the in-kernel PIC, IOAPIC and local APICs, plus the in-kernel
+    // PIT. Must be called before creating VCPUs.
+    KvmVMStatus CreateIRQChip();
+
+    // Sets the level of an IRQ line of the in-kernel IRQ chip
+    KvmVMStatus SetIRQLine(uint32_t irq, bool level);
+
+    // Makes writes to the MMIO range be buffered in the VCPUs' coalesced MMIO
+    // rings instead of causing exits
+    KvmVMStatus RegisterCoalescedMMIO(uint32_t address, uint32_t size);
+    KvmVMStatus UnregisterCoalescedMMIO(uint32_t address, uint32_t size);
+
     const int handle() const { return m_fd; }
     const int kvmHandle() const { return m_kvm.handle(); }
 
@@ -78,6 +117,11 @@ public:
     KvmVCPUStatus Run();
     KvmVCPUStatus Interrupt(uint8_t vector);
 
+    // Forces the thread running the VCPU to leave KVM_RUN as soon as possible.
+    // If the VCPU is not in KVM_RUN, makes its next run exit immediately when
+    // the host supports it. Safe to call from any thread.
+    void Kick();
+
     KvmVCPUStatus GetRegisters(struct kvm_regs* regs);
     KvmVCPUStatus SetRegisters(struct kvm_regs regs);
     KvmVCPUStatus GetSRegisters(struct kvm_sregs* sregs);
@@ -89,6 +133,11 @@ public:
 
     struct kvm_run* kvmRun() { return m_kvmRun; }
 
+    // Ring of buffered MMIO writes, or nullptr if coalesced MMIO is not
+    // supported
+    struct kvm_coalesced_mmio_ring* coalescedMMIORing() { return m_coalescedMMIORing; }
+    uint32_t coalescedMMIORingSize() const { return m_coalescedMMIORingSize; }
+
 private:
     KvmVCPU(KvmVM &vm, uint32_t id);
     ~KvmVCPU();
@@ -103,5 +152,17 @@ private:
     struct kvm_run* m_kvmRun;
     int m_kvmRunMmapSize;
 
+    struct kvm_coalesced_mmio_ring* m_coalescedMMIORing;
+    uint32_t m_coalescedMMIORingSize;
+
+    bool m_immediateExitSupported;
+
+    // The thread inside KVM_RUN, valid only while it is there. Kick signals
+    // it with the lock held, so that it never signals a thread that has moved
+    // on or exited.
+    std::mutex m_runThreadLock;
+    pthread_t m_runThread;
+    bool m_runThreadValid;
+
     friend class KvmVM;
 };
\ No newline at end of file
@@ -72,6 +72,9 @@ CPUStatus WhvpCpu::RunImpl() {
     // Run CPU
     auto status = m_vcpu->Run();
 
+    // The guest may have changed its page tables
+    FlushTranslationCache();
+
     // Check VM exit status
     if (status != WHVVCPUS_SUCCESS) {
         return CPUS_FAILED;
@@ -246,6 +249,8 @@ CPUOperationStatus WhvpCpu::RegWrite(enum CpuReg reg, uint32_t value) {
         return CPUS_OP_FAILED;
     }
 
+    FlushTranslationCacheOnWrite(reg);
+
     return CPUS_OP_OK;
 }
 
@@ -373,6 +378,10 @@ CPUOperationStatus WhvpCpu::RegWrite(CpuReg regs[], uint32_t values[], uint8_t n
         return CPUS_OP_FAILED;
     }
 
+    for (uint8_t i = 0; i < numRegs; i++) {
+        FlushTranslationCacheOnWrite(regs[i]);
+    }
+
     return CPUS_OP_OK;
 }
 
@@ -15,6 +15,16 @@ namespace cpu {
 #define PAGE_SHIFT 12
 
 Cpu::Cpu() {
+    memset(m_physPageDir, 0, sizeof(m_physPageDir));
+    memset(m_vtlb, 0, sizeof(m_vtlb));
+    m_vtlbGeneration = 1;
+    m_cachedCR3 = 0;
+    m_cachedCR3Valid = false;
+    for (uint32_t i = 0; i < CPU_PENDING_VECTOR_WORDS; i++) {
+        m_pendingVectors[i] = 0;
+    }
+    m_idle = false;
+    m_inKernelIRQChip = false;
 }
 
 Cpu::~Cpu() {
@@ -23,6 +33,11 @@ Cpu::~Cpu() {
         delete *it;
     }
     m_physMemMap.clear();
+
+    for (uint32_t i = 0; i < CPU_PHYS_DIR_ENTRIES; i++) {
+        delete[] m_physPageDir[i];
+        m_physPageDir[i] = nullptr;
+    }
 }
 
 // ----- Basic CPU operations -------------------------------------------------
@@ -52,15 +67,46 @@ CPUStatus Cpu::StepImpl() {
 }
 
 InterruptResult Cpu::Interrupt(uint8_t vector) {
-    // Acquire the pending interrupts mutex
-    std::lock_guard<std::mutex> guard(m_pendingInterruptsMutex);
+    // Mark the vector as pending. If it was already pending, the CPU has yet
+    // to service the previous request and will do so only once.
+    uint64_t mask = BITMASK64(vector & 63);
+    uint64_t prev = m_pendingVectors[vector >> 6].fetch_or(mask, std::memory_order_seq_cst);
+    if (prev & mask) {
+        return INTR_PENDING;
+    }
 
-    // Enqueue the interrupt
-    m_pendingInterrupts.push(vector);
+    // Wake up the CPU thread if it is idle
+    if (m_idle.load(std::memory_order_seq_cst)) {
+        std::lock_guard<std::mutex> lk(m_idleMutex);
+        m_idleCond.notify_all();
+    }
 
     return InterruptImpl(vector);
 }
 
+bool Cpu::WaitForInterrupt(uint32_t timeoutMs) {
+    std::unique_lock<std::mutex> lk(m_idleMutex);
+    // Pairs with Interrupt: either it sees the idle flag and notifies, or we
+    // see the pending vector
+    m_idle.store(true, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool pending = m_idleCond.wait_for(lk, std::chrono::milliseconds(timeoutMs), [this] { return NextPendingInterrupt() >= 0; });
+    m_idle.store(false, std::memory_order_relaxed);
+    return pending;
+}
+
+void Cpu::FlushPostedWrites() {
+}
+
+void Cpu::RequestExit() {
+}
+
+// ----- In-kernel interrupt controller ---------------------------------------
+
+CPUOperationStatus Cpu::SetIRQLevel(uint8_t irqNum, bool level) {
+    return CPUS_OP_UNSUPPORTED;
+}
+
 // ----- Physical memory ------------------------------------------------------
 
 CPUMemMapStatus Cpu::MemMap(MemoryRegion *mem) {
@@ -80,48 +126,186 @@ CPUMemMapStatus Cpu::MemMap(MemoryRegion *mem) {
         // Map the physical address range if valid
         if (subregion->m_type == MEM_REGION_RAM || subregion->m_type == MEM_REGION_ROM) {
             m_physMemMap.push_back(new PhysicalMemoryRange{ (char *)subregion->m_data, subregion->m_start, subregion->m_start + (uint32_t)subregion->m_size - 1 });
+
+            // Fill in the page table. Earlier mappings take precedence over
+            // overlapping ones.
+            uintptr_t flags = (subregion->m_type == MEM_REGION_ROM) ? CPU_PHYS_PAGE_READONLY : 0;
+            uint32_t numPages = (uint32_t)(subregion->m_size >> CPU_PHYS_PAGE_SHIFT);
+            for (uint32_t i = 0; i < numPages; i++) {
+                uint32_t addr = subregion->m_start + (i << CPU_PHYS_PAGE_SHIFT);
+                char **&table = m_physPageDir[addr >> CPU_PHYS_DIR_SHIFT];
+                if (table == nullptr) {
+                    table = new char*[CPU_PHYS_TABLE_ENTRIES];
+                    memset(table, 0, sizeof(char*) * CPU_PHYS_TABLE_ENTRIES);
+                }
+                char *&page = table[(addr >> CPU_PHYS_PAGE_SHIFT) & (CPU_PHYS_TABLE_ENTRIES - 1)];
+                if (page == nullptr) {
+                    page = (char *)(((uintptr_t)subregion->m_data + ((size_t)i << CPU_PHYS_PAGE_SHIFT)) | flags);
+                }
+            }
         }
     }
     return CPUS_MMAP_OK;
 }
 
 CPUOperationStatus Cpu::MemRead(uint32_t addr, uint32_t size, void *value) {
-    for (auto it = m_physMemMap.begin(); it != m_physMemMap.end(); it++) {
-        auto physMemRegion = *it;
-        if (addr >= physMemRegion->startingAddress && addr + size - 1 <= physMemRegion->endingAddress) {
-            memcpy(value, &physMemRegion->data[addr - physMemRegion->startingAddress], size);
-            return CPUS_OP_OK;
+    if (size == 0) {
+        return CPUS_OP_OK;
+    }
+    if ((uint64_t)addr + size > 0x100000000ULL) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+
+    // Make sure the whole range is mapped before copying anything
+    for (uint64_t page = addr & ~(PAGE_SIZE - 1); page < (uint64_t)addr + size; page += PAGE_SIZE) {
+        if (PhysicalToHost((uint32_t)page) == nullptr) {
+            return CPUS_OP_INVALID_ADDRESS;
         }
     }
 
-    return CPUS_OP_INVALID_ADDRESS;
+    char *dst = (char *)value;
+    while (size > 0) {
+        uint32_t chunk = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(dst, PhysicalToHost(addr), chunk);
+        dst += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+    return CPUS_OP_OK;
 }
 
 CPUOperationStatus Cpu::MemWrite(uint32_t addr, uint32_t size, void *value) {
-    for (auto it = m_physMemMap.begin(); it != m_physMemMap.end(); it++) {
-        auto physMemRegion = *it;
-        if (addr >= physMemRegion->startingAddress && addr + size - 1 <= physMemRegion->endingAddress) {
-            memcpy(&physMemRegion->data[addr - physMemRegion->startingAddress], value, size);
-            return CPUS_OP_OK;
+    if (size == 0) {
+        return CPUS_OP_OK;
+    }
+    if ((uint64_t)addr + size > 0x100000000ULL) {
+        return CPUS_OP_INVALID_ADDRESS;
+    }
+
+    // Make sure the whole range is mapped before copying anything
+    for (uint64_t page = addr & ~(PAGE_SIZE - 1); page < (uint64_t)addr + size; page += PAGE_SIZE) {
+        if (PhysicalToHost((uint32_t)page) == nullptr) {
+            return CPUS_OP_INVALID_ADDRESS;
         }
     }
 
-    return CPUS_OP_INVALID_ADDRESS;
+    const char *src = (const char *)value;
+    while (size > 0) {
+        uint32_t chunk = PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+        if (chunk > size) {
+            chunk = size;
+        }
+        memcpy(PhysicalToHost(addr), src, chunk);
+        OnHostWrite(addr, chunk);
+        src += chunk;
+        addr += chunk;
+        size -= chunk;
+    }
+    return CPUS_OP_OK;
+}
+
+void *Cpu::GetHostPointer(uint32_t addr, uint32_t size, CPUMemAccess access) {
+    if (size == 0 || (uint64_t)addr + size > 0x100000000ULL) {
+        return nullptr;
+    }
+
+    uintptr_t first = PhysicalPageEntry(addr);
+    if (first == 0) {
+        return nullptr;
+    }
+
+    // Every page must be mapped right after the previous one in host memory
+    // with the same permissions
+    uint32_t firstPage = addr >> CPU_PHYS_PAGE_SHIFT;
+    uint32_t lastPage = (uint32_t)(((uint64_t)addr + size - 1) >> CPU_PHYS_PAGE_SHIFT);
+    if (access == CPU_MEM_ACCESS_WRITE && (first & CPU_PHYS_PAGE_READONLY)) {
+        return nullptr;
+    }
+    for (uint32_t page = firstPage + 1; page <= lastPage; page++) {
+        uintptr_t expected = first + ((uintptr_t)(page - firstPage) << CPU_PHYS_PAGE_SHIFT);
+        if (PhysicalPageEntry(page << CPU_PHYS_PAGE_SHIFT) != expected) {
+            return nullptr;
+        }
+    }
+
+    if (access == CPU_MEM_ACCESS_WRITE) {
+        OnHostWrite(addr, size);
+    }
+    return (char *)(first & ~CPU_PHYS_PAGE_READONLY) + (addr & (CPU_PHYS_PAGE_SIZE - 1));
+}
+
+void Cpu::OnHostWrite(uint32_t addr, uint32_t size) {
+}
+
+// ----- Dirty page tracking --------------------------------------------------
+
+CPUOperationStatus Cpu::EnableDirtyTracking(uint32_t baseAddress, uint32_t size) {
+    return CPUS_OP_UNSUPPORTED;
+}
+
+CPUOperationStatus Cpu::FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap) {
+    return CPUS_OP_UNSUPPORTED;
 }
 
 // ----- Virtual memory -------------------------------------------------------
 
 bool Cpu::VirtualToPhysical(uint32_t vaddr, uint32_t *paddr) {
-    // TODO: check MTRR
+    std::lock_guard<std::mutex> guard(m_vtlbMutex);
+    return TranslateVirtualAddress(vaddr, paddr);
+}
 
-    // Get the PDE table address
-    uint32_t cr3; // TODO: cache cr3 value
-    RegRead(REG_CR3, &cr3);
+void Cpu::FlushTranslationCache() {
+    std::lock_guard<std::mutex> guard(m_vtlbMutex);
+    m_cachedCR3Valid = false;
+
+    // Invalidate all entries at once by moving on to the next generation,
+    // clearing the entries when the counter wraps around
+    if (++m_vtlbGeneration == 0) {
+        memset(m_vtlb, 0, sizeof(m_vtlb));
+        m_vtlbGeneration = 1;
+    }
+}
+
+bool Cpu::TranslateVirtualAddress(uint32_t vaddr, uint32_t *paddr) {
+    // Reading CR3 may be expensive on some implementations, so it is cached
+    // until the translation cache is flushed
+    if (!m_cachedCR3Valid) {
+        if (RegRead(REG_CR3, &m_cachedCR3) != CPUS_OP_OK) {
+            return false;
+        }
+        m_cachedCR3Valid = true;
+    }
+
+    uint32_t vpage = vaddr >> PAGE_SHIFT;
+    VirtualTLBEntry& entry = m_vtlb[vpage & (CPU_VTLB_ENTRIES - 1)];
+    if (entry.generation == m_vtlbGeneration && entry.cr3 == m_cachedCR3 && entry.vpage == vpage) {
+        *paddr = (entry.ppage << PAGE_SHIFT) | (vaddr & (PAGE_SIZE - 1));
+        return true;
+    }
+
+    if (!WalkPageTables(m_cachedCR3, vaddr, paddr)) {
+        return false;
+    }
+
+    entry.generation = m_vtlbGeneration;
+    entry.cr3 = m_cachedCR3;
+    entry.vpage = vpage;
+    entry.ppage = *paddr >> PAGE_SHIFT;
+    return true;
+}
+
+bool Cpu::WalkPageTables(uint32_t cr3, uint32_t vaddr, uint32_t *paddr) {
+    // TODO: check MTRR
 
     // Find the PDE entry corresponding to the given virtual address
     uint32_t pdeOffset = (vaddr >> 22) << 2;
     Pte pde;
-    MemRead(cr3 + pdeOffset, sizeof(Pte), &pde);
+    if (MemRead(cr3 + pdeOffset, sizeof(Pte), &pde) != CPUS_OP_OK) {
+        return false;
+    }
 
     // If the PDE uses large pages, it points to a 4 MB page
     if (pde.largePage) {
@@ -140,7 +324,9 @@ bool Cpu::VirtualToPhysical(uint32_t vaddr, uint32_t *paddr) {
     // Find the PTE entry
     uint32_t pteOffset = ((vaddr << 10) >> 22) << 2;
     Pte pte;
-    MemRead(pteTableAddr + pteOffset, sizeof(Pte), &pte);
+    if (MemRead(pteTableAddr + pteOffset, sizeof(Pte), &pte) != CPUS_OP_OK) {
+        return false;
+    }
 
     // If the PTE is not valid, the virtual address is not valid
     if (!pte.valid) {
@@ -153,31 +339,27 @@ bool Cpu::VirtualToPhysical(uint32_t vaddr, uint32_t *paddr) {
 }
 
 CPUOperationStatus Cpu::VMemRead(uint32_t vaddr, uint32_t size, void *value, uint32_t *bytesRead) {
-    uint32_t srcAddrStart = vaddr;
-    uint32_t srcAddrEnd = ((srcAddrStart + PAGE_SIZE) & ~(PAGE_SIZE - 1)) - 1;
+    std::lock_guard<std::mutex> guard(m_vtlbMutex);
+
     uint32_t pos = 0;
-    uint32_t copySize = srcAddrEnd - srcAddrStart + 1;
-    if (size < copySize) {
-        copySize = size;
-    }
     while (pos < size) {
+        uint32_t copySize = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (size - pos < copySize) {
+            copySize = size - pos;
+        }
+
         uint32_t physAddr;
-        if (!VirtualToPhysical(srcAddrStart, &physAddr)) {
+        if (!TranslateVirtualAddress(vaddr, &physAddr)) {
             return CPUS_OP_INVALID_ADDRESS;
         }
-
-        CPUOperationStatus result = MemRead(physAddr, copySize, &((char*)value)[pos]);
-        if (result != CPUS_OP_OK) {
-            return result;
+        char *host = PhysicalToHost(physAddr);
+        if (host == nullptr) {
+            return CPUS_OP_INVALID_ADDRESS;
         }
+        memcpy(&((char*)value)[pos], host, copySize);
 
         pos += copySize;
-        srcAddrStart = srcAddrEnd + 1;
-        srcAddrEnd += PAGE_SIZE;
-        copySize = size - pos;
-        if (PAGE_SIZE < copySize) {
-            copySize = PAGE_SIZE;
-        }
+        vaddr += copySize;
     }
 
     if (bytesRead != nullptr) {
@@ -186,32 +368,66 @@ CPUOperationStatus Cpu::VMemRead(uint32_t vaddr, uint32_t size, void *value, uin
     return CPUS_OP_OK;
 }
 
+CPUOperationStatus Cpu::VMemRead(uint32_t vaddrs[], uint32_t sizes[], void *values[], uint32_t numReads) {
+    std::lock_guard<std::mutex> guard(m_vtlbMutex);
+
+    // Host address of the most recently translated page
+    uint32_t lastVPage = 0;
+    char *lastHostPage = nullptr;
+
+    for (uint32_t i = 0; i < numReads; i++) {
+        uint32_t vaddr = vaddrs[i];
+        uint32_t pos = 0;
+        while (pos < sizes[i]) {
+            uint32_t offset = vaddr & (PAGE_SIZE - 1);
+            uint32_t copySize = PAGE_SIZE - offset;
+            if (sizes[i] - pos < copySize) {
+                copySize = sizes[i] - pos;
+            }
+
+            if (lastHostPage == nullptr || (vaddr >> PAGE_SHIFT) != lastVPage) {
+                uint32_t physAddr;
+                if (!TranslateVirtualAddress(vaddr & ~(PAGE_SIZE - 1), &physAddr)) {
+                    return CPUS_OP_INVALID_ADDRESS;
+                }
+                lastHostPage = PhysicalToHost(physAddr);
+                if (lastHostPage == nullptr) {
+                    return CPUS_OP_INVALID_ADDRESS;
+                }
+                lastVPage = vaddr >> PAGE_SHIFT;
+            }
+            memcpy(&((char*)values[i])[pos], lastHostPage + offset, copySize);
+
+            pos += copySize;
+            vaddr += copySize;
+        }
+    }
+    return CPUS_OP_OK;
+}
+
 CPUOperationStatus Cpu::VMemWrite(uint32_t vaddr, uint32_t size, void *value, uint32_t *bytesWritten) {
-    uint32_t srcAddrStart = vaddr;
-    uint32_t srcAddrEnd = ((srcAddrStart + PAGE_SIZE) & ~(PAGE_SIZE - 1)) - 1;
+    std::lock_guard<std::mutex> guard(m_vtlbMutex);
+
     uint32_t pos = 0;
-    uint32_t copySize = srcAddrEnd - srcAddrStart + 1;
-    if (size < copySize) {
-        copySize = size;
-    }
     while (pos < size) {
+        uint32_t copySize = PAGE_SIZE - (vaddr & (PAGE_SIZE - 1));
+        if (size - pos < copySize) {
+            copySize = size - pos;
+        }
+
         uint32_t physAddr;
-        if (!VirtualToPhysical(srcAddrStart, &physAddr)) {
+        if (!TranslateVirtualAddress(vaddr, &physAddr)) {
             return CPUS_OP_INVALID_ADDRESS;
         }
-
-        CPUOperationStatus result = MemWrite(physAddr, copySize, &((char*)value)[pos]);
-        if (result != CPUS_OP_OK) {
-            return result;
+        char *host = PhysicalToHost(physAddr);
+        if (host == nullptr) {
+            return CPUS_OP_INVALID_ADDRESS;
         }
+        memcpy(host, &((char*)value)[pos], copySize);
+        OnHostWrite(physAddr, copySize);
 
         pos += copySize;
-        srcAddrStart = srcAddrEnd + 1;
-        srcAddrEnd += PAGE_SIZE;
-        copySize = size - pos;
-        if (PAGE_SIZE < copySize) {
-            copySize = PAGE_SIZE;
-        }
+        vaddr += copySize;
     }
 
     if (bytesWritten != nullptr) {
@@ -277,6 +493,34 @@ CPUOperationStatus Cpu::RegCopy(CpuReg dsts[], CpuReg srcs[], uint8_t numRegs) {
     return CPUS_OP_OK;
 }
 
+CPUOperationStatus Cpu::GetRegisterFile(RegisterFile *regFile) {
+    CpuReg regs[REG_MAX];
+    for (uint8_t i = 0; i < REG_MAX; i++) {
+        regs[i] = (CpuReg)i;
+    }
+    CHECK_RESULT(RegRead(regs, regFile->regs, REG_MAX));
+    regFile->dirty = 0;
+    return CPUS_OP_OK;
+}
+
+CPUOperationStatus Cpu::SetRegisterFile(RegisterFile *regFile) {
+    CpuReg regs[REG_MAX];
+    uint32_t values[REG_MAX];
+    uint8_t numRegs = 0;
+    for (uint8_t i = 0; i < REG_MAX; i++) {
+        if (regFile->dirty & REGFILE_BIT(i)) {
+            regs[numRegs] = (CpuReg)i;
+            values[numRegs] = regFile->regs[i];
+            numRegs++;
+        }
+    }
+    if (numRegs > 0) {
+        CHECK_RESULT(RegWrite(regs, values, numRegs));
+    }
+    regFile->dirty = 0;
+    return CPUS_OP_OK;
+}
+
 CPUOperationStatus Cpu::GetGDTEntry(uint16_t selector, GDTEntry *entry) {
     uint32_t base;
     uint32_t limit;
@@ -419,7 +663,7 @@ void Cpu::HandleInterruptQueue() {
     }
 
     // Inject an interrupt if available and possible
-    if (m_pendingInterrupts.size() > 0) {
+    if (NextPendingInterrupt() >= 0) {
         if (CanInjectInterrupt()) {
             InjectPendingInterrupt();
         }
@@ -431,31 +675,36 @@ void Cpu::HandleInterruptQueue() {
 }
 
 void Cpu::InjectPendingInterrupt() {
-    // If there aren't enough credits or there are no pending interrupts, get out
-    if (m_interruptHandlerCredits < kInterruptHandlerCost || m_pendingInterrupts.size() == 0) {
+    // If there aren't enough credits, get out
+    if (m_interruptHandlerCredits < kInterruptHandlerCost) {
+        return;
+    }
+
+    // If there are no pending interrupts, get out
+    int vector = NextPendingInterrupt();
+    if (vector < 0) {
         return;
     }
 
     // Spend the credits and handle one interrupt
     m_interruptHandlerCredits -= kInterruptHandlerCost;
 
-    // Acquire the pending interrupts mutex
-    std::lock_guard<std::mutex> guard(m_pendingInterruptsMutex);
-
-    // Dequeue the next interrupt vector
-    uint8_t vector = m_pendingInterrupts.front();
-    m_pendingInterrupts.pop();
-
-#ifdef _DEBUG
-    if (m_pendingInterrupts.size() > 100) {
-        log_warning("Pending interrupts queue growing too long!\n");
-    }
-#endif
+    // Clear the pending bit before injecting, so that a new request for the
+    // same vector raised from now on is not lost
+    m_pendingVectors[vector >> 6].fetch_and(~BITMASK64(vector & 63), std::memory_order_acq_rel);
 
     // Inject the interrupt into the VCPU
-    InjectInterrupt(vector);
+    InjectInterrupt((uint8_t)vector);
+}
 
-    return;
+int Cpu::NextPendingInterrupt() {
+    for (uint32_t i = 0; i < CPU_PENDING_VECTOR_WORDS; i++) {
+        int bit = Bitmap64FindFirstSet(m_pendingVectors[i].load(std::memory_order_acquire));
+        if (bit >= 0) {
+            return (int)(i * 64) + bit;
+        }
+    }
+    return -1;
 }
 
 }
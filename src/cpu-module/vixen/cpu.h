@@ -3,9 +3,11 @@
 #include <stdint.h>
 #include <string.h>
 #include <vector>
-#include <queue>
+#include <atomic>
+#include <condition_variable>
 #include <mutex>
 
+#include "vixen/bitmap.h"
 #include "vixen/memregion.h"
 #include "vixen/gdt.h"
 #include "vixen/idt.h"
@@ -119,6 +121,32 @@ enum CpuReg {
     REG_MAX,
 };
 
+// Bit masks of registers in a RegisterFile
+#define REGFILE_BIT(reg)   (1u << (reg))
+#define REGFILE_GPR_MASK   (REGFILE_BIT(REG_EIP) | REGFILE_BIT(REG_EFLAGS) | \
+                            REGFILE_BIT(REG_EAX) | REGFILE_BIT(REG_ECX) | REGFILE_BIT(REG_EDX) | REGFILE_BIT(REG_EBX) | \
+                            REGFILE_BIT(REG_ESI) | REGFILE_BIT(REG_EDI) | REGFILE_BIT(REG_ESP) | REGFILE_BIT(REG_EBP))
+#define REGFILE_SEG_MASK   (REGFILE_BIT(REG_CS) | REGFILE_BIT(REG_SS) | REGFILE_BIT(REG_DS) | REGFILE_BIT(REG_ES) | \
+                            REGFILE_BIT(REG_FS) | REGFILE_BIT(REG_GS) | REGFILE_BIT(REG_TR))
+#define REGFILE_CR_MASK    (REGFILE_BIT(REG_CR0) | REGFILE_BIT(REG_CR2) | REGFILE_BIT(REG_CR3) | REGFILE_BIT(REG_CR4))
+
+static_assert(REG_MAX <= 32, "RegisterFile dirty mask is too small");
+
+/*!
+ * Snapshot of the CPU registers, indexed by CpuReg.
+ *
+ * Modifying a register through Set marks it as dirty, so that writing the
+ * snapshot back to the CPU only touches the registers that changed.
+ */
+struct RegisterFile {
+    uint32_t regs[REG_MAX];
+    uint32_t dirty;
+
+    inline uint32_t Get(enum CpuReg reg) const { return regs[reg]; }
+    inline void Set(enum CpuReg reg, uint32_t value) { regs[reg] = value; dirty |= REGFILE_BIT(reg); }
+    inline bool IsDirty(enum CpuReg reg) const { return (dirty & REGFILE_BIT(reg)) != 0; }
+};
+
 // Last register to save in CpuContext
 #define REG_CONTEXT_MAX   ((size_t)(REG_GDT_LIMIT + 1))
 
@@ -157,6 +185,41 @@ struct PhysicalMemoryRange {
     uint32_t endingAddress;
 };
 
+// Number of entries in the software TLB used by virtual memory accesses
+#define CPU_VTLB_ENTRIES      256
+
+// Geometry of the table that maps guest physical pages to host memory
+#define CPU_PHYS_PAGE_SHIFT   12
+#define CPU_PHYS_PAGE_SIZE    (1 << CPU_PHYS_PAGE_SHIFT)
+#define CPU_PHYS_DIR_SHIFT    22
+#define CPU_PHYS_DIR_ENTRIES  (1 << (32 - CPU_PHYS_DIR_SHIFT))
+#define CPU_PHYS_TABLE_ENTRIES (1 << (CPU_PHYS_DIR_SHIFT - CPU_PHYS_PAGE_SHIFT))
+
+// Flag set in the low bits of page table entries that map ROM
+#define CPU_PHYS_PAGE_READONLY ((uintptr_t)1)
+
+/*!
+ * Kinds of access to physical memory made through host pointers.
+ */
+enum CPUMemAccess {
+    CPU_MEM_ACCESS_READ,
+    CPU_MEM_ACCESS_WRITE,
+};
+
+// Number of 64-bit words in the pending interrupt vector bitmap
+#define CPU_PENDING_VECTOR_WORDS (256 / 64)
+
+/*!
+ * Software TLB entry. Entries are only valid if their generation matches the
+ * TLB's current generation.
+ */
+struct VirtualTLBEntry {
+    uint32_t generation;
+    uint32_t cr3;
+    uint32_t vpage;
+    uint32_t ppage;
+};
+
 enum HardwareBreakpointTrigger {
     HWBP_TRIGGER_EXECUTION = 0,
     HWBP_TRIGGER_DATA_WRITE,
@@ -219,11 +282,68 @@ public:
      *
      * If interrupts are disabled, returns INTR_DISABLED.
      * If the interrupt was masked, returns INTR_MASKED.
-     * Otherwise it enqueues the interrupt request, stops CPU emulation and
+     * If the vector is already pending, returns INTR_PENDING; each vector is
+     * queued at most once.
+     * Otherwise it marks the vector as pending, stops CPU emulation and
      * returns INTR_SUCCESS.
+     *
+     * This function is lock-free and may be called from any thread.
      */
     InterruptResult Interrupt(uint8_t vector);
 
+    /*!
+     * Blocks the calling thread until an interrupt is pending or the timeout
+     * expires. Used to idle the CPU after it halts.
+     *
+     * Returns true if an interrupt is pending.
+     */
+    bool WaitForInterrupt(uint32_t timeoutMs);
+
+    /*!
+     * Makes the CPU deliver the writes to posted write ranges (see
+     * IOMapper::AddPostedWriteRange) that it buffered so far. The writes are
+     * delivered on the CPU thread as soon as possible.
+     *
+     * This function may be called from any thread. Does nothing if the CPU
+     * does not buffer writes.
+     */
+    virtual void FlushPostedWrites();
+
+    /*!
+     * Makes Run return as soon as possible, even if the guest does not exit
+     * on its own. Used to preempt the CPU at the end of a time slice.
+     *
+     * This function may be called from any thread. Does nothing if the CPU
+     * cannot be interrupted while running.
+     */
+    virtual void RequestExit();
+
+    // ----- In-kernel interrupt controller -----------------------------------
+
+    /*!
+     * Requests the hypervisor to emulate the interrupt controllers and the
+     * interval timer. Guest accesses to their I/O ports are then handled
+     * without leaving the hypervisor, and IRQs must be delivered with
+     * SetIRQLevel instead of Interrupt.
+     *
+     * Must be called before Initialize, and only if the CPU module reports
+     * the inKernelIRQChip capability.
+     */
+    void UseInKernelIRQChip(bool enable) { m_inKernelIRQChip = enable; }
+
+    /*!
+     * Determines if the interrupt controller is emulated by the hypervisor.
+     */
+    bool HasInKernelIRQChip() const { return m_inKernelIRQChip; }
+
+    /*!
+     * Sets the level of an IRQ line of the in-kernel interrupt controller.
+     *
+     * This is an optional operation, only available when the in-kernel
+     * interrupt controller is in use.
+     */
+    virtual CPUOperationStatus SetIRQLevel(uint8_t irqNum, bool level);
+
     // ----- Physical memory --------------------------------------------------
 
     /*!
@@ -246,6 +366,52 @@ public:
      */
     CPUOperationStatus MemWrite(uint32_t addr, uint32_t size, void *value);
 
+    /*!
+     * Returns a pointer to the host memory backing the specified range of
+     * physical memory, or nullptr if the range is not entirely backed by RAM
+     * or ROM, or if its pages are not contiguous in host memory. ROM is only
+     * returned for reads.
+     *
+     * Used by devices to access guest memory for DMA without copying. May be
+     * called from any thread once memory is mapped.
+     *
+     * Requesting write access tells the CPU that the whole range may be
+     * written, so devices should only map the range they write to. The writes
+     * must be complete before the guest is told about them, such as through
+     * an interrupt or a status register.
+     */
+    void *GetHostPointer(uint32_t addr, uint32_t size, CPUMemAccess access);
+
+    // ----- Dirty page tracking ----------------------------------------------
+
+    /*!
+     * Starts recording which pages of the specified range of RAM are written
+     * to by the guest. The range must be page-aligned and lie within a single
+     * RAM region. Writes made through MemWrite or directly to host memory are
+     * not recorded. CPUs that map RAM aliases (see IOMapper::AddRAMAlias)
+     * into the guest record writes through them as writes to the aliased RAM.
+     *
+     * Tracking is never disabled once enabled. Ranges that are not tracked
+     * incur no overhead.
+     *
+     * This is an optional operation.
+     */
+    virtual CPUOperationStatus EnableDirtyTracking(uint32_t baseAddress, uint32_t size);
+
+    /*!
+     * Retrieves the pages written to since dirty tracking was enabled or
+     * since the last call, and marks them as clean. Bit n of the bitmap
+     * corresponds to the page at baseAddress + n * CPU_PHYS_PAGE_SIZE; the
+     * bitmap must hold at least (size / CPU_PHYS_PAGE_SIZE + 63) / 64
+     * entries.
+     *
+     * The range must be tracked. Must be called on the thread running the
+     * CPU, or while the CPU is not running.
+     *
+     * This is an optional operation.
+     */
+    virtual CPUOperationStatus FetchAndClearDirtyBitmap(uint32_t baseAddress, uint32_t size, Bitmap64 *bitmap);
+
     // ----- Virtual memory ---------------------------------------------------
 
     /*!
@@ -262,6 +428,13 @@ public:
      */
     CPUOperationStatus VMemRead(uint32_t vaddr, uint32_t size, void *value, uint32_t *bytesRead = nullptr);
 
+    /*!
+     * Reads multiple portions of virtual memory in bulk. Each address is
+     * translated once per page, and consecutive reads from the same page reuse
+     * the translation.
+     */
+    CPUOperationStatus VMemRead(uint32_t vaddrs[], uint32_t sizes[], void *values[], uint32_t numReads);
+
     /*!
      * Writes the specified value into virtual memory. x86 virtual address
      * translation is performed based on the current registers and memory
@@ -270,6 +443,17 @@ public:
      */
     CPUOperationStatus VMemWrite(uint32_t vaddr, uint32_t size, void *value, uint32_t *bytesWritten = nullptr);
 
+    /*!
+     * Flushes the software TLB and the cached CR3 value used by virtual memory
+     * accesses.
+     *
+     * Implementations must invoke this whenever the guest may have changed its
+     * paging structures or control registers, which includes CR0, CR3 and CR4
+     * writes and, for hardware-assisted backends, every return from guest
+     * execution.
+     */
+    void FlushTranslationCache();
+
     // ----- Stack ------------------------------------------------------------
 
     /*!
@@ -315,6 +499,24 @@ public:
      */
     CPUOperationStatus RegCopy(enum CpuReg dsts[], enum CpuReg srcs[], uint8_t numRegs);
 
+    /*!
+     * Reads all registers into a snapshot and clears its dirty bits.
+     *
+     * Implementations should override this to fetch the entire register state
+     * in as few round-trips as possible.
+     */
+    virtual CPUOperationStatus GetRegisterFile(RegisterFile *regFile);
+
+    /*!
+     * Writes back the registers marked as dirty in the snapshot, then clears
+     * its dirty bits. If this fails, the snapshot and the CPU are left as they
+     * were.
+     *
+     * Implementations should override this to only update the register groups
+     * (general purpose, segment and control registers) that were modified.
+     */
+    virtual CPUOperationStatus SetRegisterFile(RegisterFile *regFile);
+
     /*!
      * Gets the Global Descriptor Table.
      */
@@ -487,6 +689,12 @@ protected:
      */
     IOMapper *m_ioMapper;
 
+    /*!
+     * Whether the interrupt controller and the interval timer are emulated
+     * by the hypervisor.
+     */
+    bool m_inKernelIRQChip;
+
     /*!
      * Allows the implementation to do further initialization.
      */
@@ -524,17 +732,92 @@ protected:
      */
     virtual void RequestInterruptWindow() = 0;
 
+    /*!
+     * Invoked when guest RAM is modified without the guest CPU's involvement:
+     * after MemWrite and VMemWrite, and when GetHostPointer hands out write
+     * access. Implementations that cache guest code use this to invalidate
+     * it. May be invoked from any thread.
+     */
+    virtual void OnHostWrite(uint32_t addr, uint32_t size);
+
+    /*!
+     * Flushes the software TLB if the given register affects address
+     * translation. Implementations invoke this when writing to registers.
+     */
+    inline void FlushTranslationCacheOnWrite(enum CpuReg reg) {
+        if (reg == REG_CR0 || reg == REG_CR3 || reg == REG_CR4) {
+            FlushTranslationCache();
+        }
+    }
+
 private:
-    // TODO: use an AVL tree instead of a vector to speed up lookups
     std::vector<PhysicalMemoryRange *> m_physMemMap;
 
-    std::mutex m_interruptMutex;
-    std::mutex m_pendingInterruptsMutex;
-    std::queue<uint8_t> m_pendingInterrupts;
+    // Two-level table mapping guest physical pages to host memory. Second
+    // level tables are allocated on demand.
+    char **m_physPageDir[CPU_PHYS_DIR_ENTRIES];
+
+    std::mutex m_vtlbMutex;
+    VirtualTLBEntry m_vtlb[CPU_VTLB_ENTRIES];
+    uint32_t m_vtlbGeneration;
+    uint32_t m_cachedCR3;
+    bool m_cachedCR3Valid;
+
+    /*!
+     * Returns the page table entry for the given physical address: a pointer
+     * to the host page, tagged with CPU_PHYS_PAGE_READONLY for ROM, or
+     * nullptr if the address is not backed by RAM or ROM.
+     */
+    inline uintptr_t PhysicalPageEntry(uint32_t addr) {
+        char **table = m_physPageDir[addr >> CPU_PHYS_DIR_SHIFT];
+        if (table == nullptr) {
+            return 0;
+        }
+        return (uintptr_t)table[(addr >> CPU_PHYS_PAGE_SHIFT) & (CPU_PHYS_TABLE_ENTRIES - 1)];
+    }
+
+    /*!
+     * Returns a pointer to the host memory backing the given physical address,
+     * or nullptr if the address is not backed by RAM or ROM.
+     */
+    inline char *PhysicalToHost(uint32_t addr) {
+        uintptr_t entry = PhysicalPageEntry(addr);
+        if (entry == 0) {
+            return nullptr;
+        }
+        return (char *)(entry & ~CPU_PHYS_PAGE_READONLY) + (addr & (CPU_PHYS_PAGE_SIZE - 1));
+    }
+
+    /*!
+     * Translates a virtual address through the software TLB. Must be called
+     * with the TLB mutex held.
+     */
+    bool TranslateVirtualAddress(uint32_t vaddr, uint32_t *paddr);
+
+    /*!
+     * Walks the guest page tables to translate a virtual address.
+     */
+    bool WalkPageTables(uint32_t cr3, uint32_t vaddr, uint32_t *paddr);
+
+    // Pending interrupt vectors, one bit per vector. Bits are set by any
+    // thread in Interrupt and cleared by the CPU thread when injected.
+    std::atomic<uint64_t> m_pendingVectors[CPU_PENDING_VECTOR_WORDS];
     uint8_t m_interruptHandlerCredits;
 
+    // Signaled when an interrupt becomes pending while a thread is waiting
+    // in WaitForInterrupt
+    std::atomic<bool> m_idle;
+    std::mutex m_idleMutex;
+    std::condition_variable m_idleCond;
+
     void HandleInterruptQueue();
     void InjectPendingInterrupt();
+
+    /*!
+     * Returns the pending vector with the highest priority, or -1 if there are
+     * no pending interrupts. As with the 8259 PIC, lower vectors take priority.
+     */
+    int NextPendingInterrupt();
 };
 
 }
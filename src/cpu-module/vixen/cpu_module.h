@@ -14,7 +14,7 @@ using namespace vixen::cpu;
 
 // The CPU module API version
 // Increment this if there are any ABI breaking changes or new features
-const int apiVersion = 1;
+const int apiVersion = 2;
 
 
 // Base interface for CPU modules
@@ -51,6 +51,10 @@ struct Info {
 struct Capabilities {
     // Supports guest debugging operations such as single stepping and breakpoints
     bool guestDebugging;
+
+    // Can emulate the interrupt controller and the interval timer in the
+    // hypervisor (see Cpu::UseInKernelIRQChip)
+    bool inKernelIRQChip;
 };
 
 }
@@ -55,6 +55,7 @@ namespace cpu {
 struct CapabilitiesBuilder {
     Capabilities caps;
     CapabilitiesBuilder& guestDebugging() { caps.guestDebugging = true; return *this; }
+    CapabilitiesBuilder& inKernelIRQChip() { caps.inKernelIRQChip = true; return *this; }
     operator Capabilities() { return caps; }
 };
 
@@ -0,0 +1,389 @@
+// Device thread stress test
+//
+// Drives the devices that are accessed from more than one thread all at once:
+// a fake CPU thread dispatches guest I/O and MMIO through the I/O mapper and
+// services interrupts, while the scheduler thread fires the NV2A VBlank and
+// serial port timers, the NV2A PFIFO threads and the Bus Master IDE workers
+// wait for work, a host serial thread feeds characters into the UART and
+// timer threads toggle IRQ lines on the PIC.
+//
+// The test is meant to be run under ThreadSanitizer; configure the build with
+// -DVIXEN_TSAN=ON. It fails if the devices stop making progress.
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "vixen/alloc.h"
+#include "vixen/cpu.h"
+#include "vixen/io.h"
+#include "vixen/log.h"
+#include "vixen/memregion.h"
+#include "vixen/scheduler.h"
+#include "vixen/virtual_clock.h"
+#include "vixen/hw/ata/ata.h"
+#include "vixen/hw/basic/char.h"
+#include "vixen/hw/basic/i8259.h"
+#include "vixen/hw/basic/irq.h"
+#include "vixen/hw/basic/serial.h"
+#include "vixen/hw/bus/pcibus.h"
+#include "vixen/hw/nv2a/nv2a_int.h"
+#include "vixen/hw/pci/bmide.h"
+#include "vixen/hw/pci/nv2a.h"
+#include "vixen/hw/pci/pci_common.h"
+#include "vixen/hw/pci/pci_regs.h"
+
+using namespace vixen;
+using namespace vixen::cpu;
+using namespace vixen::hw::bmide;
+
+// ----- Configuration --------------------------------------------------------
+
+static const uint32_t kRAMSize = 4 * 1024 * 1024;
+static const auto kTestDuration = std::chrono::seconds(3);
+
+static const uint32_t kNV2ABase = 0xFD000000;
+static const uint32_t kBMIDEBase = 0xFF60;
+static const uint32_t kSerialBase = PORT_SERIAL_BASE_1;
+
+static const uint8_t kSerialIRQ = 4;
+static const uint8_t kTimerIRQs[] = { 3, 10 };
+
+// Bus Master IDE transfers read a single sector into RAM
+static const uint32_t kPRDTableAddress = 0x1000;
+static const uint32_t kDMABufferAddress = 0x2000;
+
+// ----- Host serial port -----------------------------------------------------
+
+/*!
+ * Character driver that keeps the UART's receive FIFO full from its own
+ * thread, as a host serial port would.
+ */
+class StressCharDriver : public CharDriver {
+public:
+    bool Init() override { return true; }
+    int Write(const uint8_t *buf, int len) override { m_written += len; return len; }
+    void AcceptInput() override {}
+    void Stop() override {}
+
+    void SetBreakEnable(bool breakEnable) override {}
+    void SetSerialParameters(SerialParams *params) override {}
+
+    void Start() {
+        m_running = true;
+        m_thread = std::thread([this] { Run(); });
+    }
+
+    void Join() {
+        m_running = false;
+        m_thread.join();
+    }
+
+    std::atomic<uint32_t> m_received { 0 };
+    std::atomic<uint32_t> m_written { 0 };
+
+private:
+    void Run() {
+        uint8_t chr = 0;
+        while (m_running) {
+            if (CanReceive() > 0) {
+                Receive(&chr, 1);
+                chr++;
+                m_received++;
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::thread m_thread;
+    std::atomic<bool> m_running { false };
+};
+
+// ----- CPU ------------------------------------------------------------------
+
+/*!
+ * CPU that behaves like a guest driving the devices: each run dispatches a
+ * batch of port and MMIO accesses and acknowledges the interrupts it took.
+ */
+class StressCpu : public Cpu {
+public:
+    CPUMemMapStatus MemMapSubregion(MemoryRegion *subregion) override { return CPUS_MMAP_OK; }
+
+    CPUOperationStatus RegRead(enum CpuReg reg, uint32_t *value) override { *value = 0; return CPUS_OP_OK; }
+    CPUOperationStatus RegWrite(enum CpuReg reg, uint32_t value) override { return CPUS_OP_OK; }
+    CPUOperationStatus GetGDT(uint32_t *base, uint32_t *limit) override { *base = *limit = 0; return CPUS_OP_OK; }
+    CPUOperationStatus SetGDT(uint32_t base, uint32_t limit) override { return CPUS_OP_OK; }
+    CPUOperationStatus GetIDT(uint32_t *base, uint32_t *limit) override { *base = *limit = 0; return CPUS_OP_OK; }
+    CPUOperationStatus SetIDT(uint32_t base, uint32_t limit) override { return CPUS_OP_OK; }
+
+    uint32_t m_interrupts = 0;
+    uint32_t m_vblanks = 0;
+    uint32_t m_dmaTransfers = 0;
+    uint32_t m_serialReads = 0;
+
+protected:
+    CPUInitStatus InitializeImpl() override { return CPUS_INIT_OK; }
+    CPUStatus RunImpl() override;
+    InterruptResult InterruptImpl(uint8_t vector) override { return INTR_SUCCESS; }
+    CPUOperationStatus InjectInterrupt(uint8_t vector) override;
+    bool CanInjectInterrupt() override { return true; }
+    void RequestInterruptWindow() override {}
+
+private:
+    void HandleInterrupt(uint8_t vector);
+    void RunBMIDE(uint32_t channelBase);
+
+    uint32_t m_iteration = 0;
+};
+
+CPUOperationStatus StressCpu::InjectInterrupt(uint8_t vector) {
+    m_interrupts++;
+    HandleInterrupt(vector);
+    return CPUS_OP_OK;
+}
+
+void StressCpu::HandleInterrupt(uint8_t vector) {
+    uint32_t value;
+
+    // IRQ 1: NV2A
+    if (vector == 0x21) {
+        m_ioMapper->MMIORead(kNV2ABase + NV_PMC_ADDR + NV_PMC_INTR_0, &value, 4);
+        if (value & NV_PMC_INTR_0_PCRTC) {
+            m_ioMapper->MMIOWrite(kNV2ABase + NV_PCRTC_ADDR + NV_PCRTC_INTR_0, NV_PCRTC_INTR_0_VBLANK, 4);
+            m_vblanks++;
+        }
+    }
+
+    // IRQ 4: serial port. The IRQ is edge triggered, so handle every pending
+    // condition until the UART lowers it.
+    if (vector == 0x20 + kSerialIRQ) {
+        for (;;) {
+            uint32_t iir;
+            m_ioMapper->IORead(kSerialBase + 2, &iir, 1);
+            if (iir & 0x01) {
+                break;
+            }
+            switch (iir & 0x0E) {
+            case 0x04:  // Received data
+            case 0x0C:  // Character timeout
+                m_ioMapper->IORead(kSerialBase + 5, &value, 1);  // LSR
+                while (value & 0x01) {
+                    m_ioMapper->IORead(kSerialBase, &value, 1);  // RBR
+                    m_serialReads++;
+                    m_ioMapper->IORead(kSerialBase + 5, &value, 1);
+                }
+                break;
+            case 0x06:  // Line status
+                m_ioMapper->IORead(kSerialBase + 5, &value, 1);
+                break;
+            case 0x00:  // Modem status
+                m_ioMapper->IORead(kSerialBase + 6, &value, 1);
+                break;
+            default:    // Transmitter empty, cleared by reading the IIR
+                break;
+            }
+        }
+    }
+
+    // End of interrupt
+    if (vector >= 0x28) {
+        m_ioMapper->IOWrite(PORT_PIC_SLAVE_COMMAND, 0x20, 1);
+    }
+    m_ioMapper->IOWrite(PORT_PIC_MASTER_COMMAND, 0x20, 1);
+}
+
+void StressCpu::RunBMIDE(uint32_t channelBase) {
+    uint32_t status;
+    m_ioMapper->IORead(channelBase + RegPrimaryStatus, &status, 1);
+    if (status & StActive) {
+        // Let the transfer run for a while, then stop it
+        if ((m_iteration & 15) == 0) {
+            m_ioMapper->IOWrite(channelBase + RegPrimaryCommand, CmdReadWriteControl, 1);
+        }
+        return;
+    }
+
+    // The channels have no ATA command to transfer data for, so keep the
+    // resulting warnings down
+    if ((m_iteration & 255) != 0) {
+        return;
+    }
+
+    m_dmaTransfers++;
+    m_ioMapper->IOWrite(channelBase + RegPrimaryStatus, StInterrupt | StError, 1);
+    m_ioMapper->IOWrite(channelBase + RegPrimaryPRDTableAddress, kPRDTableAddress, 4);
+    m_ioMapper->IOWrite(channelBase + RegPrimaryCommand, CmdReadWriteControl | CmdStartStopBusMaster, 1);
+}
+
+CPUStatus StressCpu::RunImpl() {
+    uint32_t value;
+    m_iteration++;
+
+    // Poll the GPU timer and toggle the PFIFO puller, waking up its thread
+    m_ioMapper->MMIORead(kNV2ABase + NV_PTIMER_ADDR + NV_PTIMER_TIME_0, &value, 4);
+    m_ioMapper->MMIOWrite(kNV2ABase + NV_PFIFO_ADDR + NV_PFIFO_CACHE1_PULL0, m_iteration & NV_PFIFO_CACHE1_PULL0_ACCESS, 4);
+
+    // Start and stop DMA transfers on both IDE channels
+    RunBMIDE(kBMIDEBase);
+    RunBMIDE(kBMIDEBase + RegSecondaryCommand);
+
+    // Transmit on the serial port and read back the modem status
+    m_ioMapper->IOWrite(kSerialBase, m_iteration & 0xFF, 1);  // THR
+    m_ioMapper->IORead(kSerialBase + 6, &value, 1);           // MSR
+
+    // Mask and unmask the timer IRQs
+    m_ioMapper->IOWrite(PORT_PIC_MASTER_DATA, (m_iteration & 1) << kTimerIRQs[0], 1);
+    m_ioMapper->IOWrite(PORT_PIC_SLAVE_DATA, ((m_iteration >> 1) & 1) << (kTimerIRQs[1] - 8), 1);
+    return CPUS_OK;
+}
+
+// ----- Guest setup ----------------------------------------------------------
+
+static void WritePCIConfig(IOMapper& mapper, uint8_t bus, uint8_t devfn, uint8_t reg, uint32_t value) {
+    mapper.IOWrite(PORT_PCI_CONFIG_ADDRESS, 0x80000000 | (bus << 16) | (devfn << 8) | reg, 4);
+    mapper.IOWrite(PORT_PCI_CONFIG_DATA, value, 4);
+}
+
+static void InitGuest(IOMapper& mapper, uint8_t *ram) {
+    // Program the PICs: vectors 0x20 and 0x28, slave on IRQ 2
+    mapper.IOWrite(PORT_PIC_MASTER_COMMAND, 0x11, 1);
+    mapper.IOWrite(PORT_PIC_MASTER_DATA, 0x20, 1);
+    mapper.IOWrite(PORT_PIC_MASTER_DATA, 0x04, 1);
+    mapper.IOWrite(PORT_PIC_MASTER_DATA, 0x01, 1);
+    mapper.IOWrite(PORT_PIC_SLAVE_COMMAND, 0x11, 1);
+    mapper.IOWrite(PORT_PIC_SLAVE_DATA, 0x28, 1);
+    mapper.IOWrite(PORT_PIC_SLAVE_DATA, 0x02, 1);
+    mapper.IOWrite(PORT_PIC_SLAVE_DATA, 0x01, 1);
+    mapper.IOWrite(PORT_PIC_MASTER_DATA, 0x00, 1);
+    mapper.IOWrite(PORT_PIC_SLAVE_DATA, 0x00, 1);
+
+    // Assign the BARs
+    WritePCIConfig(mapper, 1, PCI_DEVFN(0, 0), PCI_BASE_ADDRESS_0, kNV2ABase);
+    WritePCIConfig(mapper, 0, PCI_DEVFN(9, 0), PCI_BASE_ADDRESS_4, kBMIDEBase | PCI_BAR_TYPE_IO);
+
+    // Set up the GPU timer and enable VBlank interrupts
+    mapper.MMIOWrite(kNV2ABase + NV_PTIMER_ADDR + NV_PTIMER_NUMERATOR, 1, 4);
+    mapper.MMIOWrite(kNV2ABase + NV_PTIMER_ADDR + NV_PTIMER_DENOMINATOR, 1, 4);
+    mapper.MMIOWrite(kNV2ABase + NV_PMC_ADDR + NV_PMC_INTR_EN_0, NV_PMC_INTR_EN_0_HARDWARE, 4);
+    mapper.MMIOWrite(kNV2ABase + NV_PCRTC_ADDR + NV_PCRTC_INTR_EN_0, NV_PCRTC_INTR_0_VBLANK, 4);
+
+    // Enable the serial port FIFOs and all of its interrupts
+    mapper.IOWrite(kSerialBase + 2, 0x07, 1);  // FCR
+    mapper.IOWrite(kSerialBase + 4, 0x0B, 1);  // MCR
+    mapper.IOWrite(kSerialBase + 1, 0x0F, 1);  // IER
+
+    // Build the PRD table used by the Bus Master IDE transfers
+    PhysicalRegionDescriptor prd;
+    memset(&prd, 0, sizeof(prd));
+    prd.basePhysicalAddress = kDMABufferAddress;
+    prd.byteCount = 512;
+    prd.endOfTable = 1;
+    memcpy(ram + kPRDTableAddress, &prd, sizeof(prd));
+}
+
+// ----- Test -----------------------------------------------------------------
+
+int main(int argc, char *argv[]) {
+    VirtualClock clock;
+    clock.SetMode(VCM_Scaled, 20.0f);
+    Scheduler scheduler(clock);
+    IOMapper mapper;
+
+    uint8_t *ram = (uint8_t *)valloc(kRAMSize);
+    memset(ram, 0, kRAMSize);
+
+    StressCpu cpu;
+    MemoryRegion memRegion(MEM_REGION_NONE, 0x00000000, 0x100000000ULL, nullptr);
+    MemoryRegion *ramRegion = new MemoryRegion(MEM_REGION_RAM, 0x00000000, kRAMSize, ram);
+    memRegion.AddSubRegion(ramRegion);
+    if (cpu.Initialize(&mapper) != CPUS_INIT_OK || cpu.MemMap(&memRegion) != CPUS_MMAP_OK) {
+        log_fatal("Failed to initialize the CPU\n");
+        return 1;
+    }
+
+    // Create the devices
+    i8259 *pic = new i8259(cpu);
+    IRQ *irqs = AllocateIRQs(pic, 16);
+    hw::ata::ATA *ata = new hw::ata::ATA(*pic);
+
+    StressCharDriver chr;
+    Serial *serial = new Serial(*pic, scheduler, kSerialBase);
+    serial->SetIRQ(kSerialIRQ);
+    serial->Init(&chr);
+
+    PCIBus *pciBus = new PCIBus();
+    BMIDEDevice *bmide = new BMIDEDevice(cpu, *ata);
+    NV2ADevice *nv2a = new NV2ADevice(cpu, ram, kRAMSize, *pic, scheduler, 0);
+    pciBus->ConnectDevice(PCI_DEVID(0, PCI_DEVFN(9, 0)), bmide);
+    pciBus->ConnectDevice(PCI_DEVID(1, PCI_DEVFN(0, 0)), nv2a);
+
+    pic->Reset();
+    ata->Reset();
+
+    pic->MapIO(&mapper);
+    ata->MapIO(&mapper);
+    serial->MapIO(&mapper);
+    pciBus->MapIO(&mapper);
+
+    InitGuest(mapper, ram);
+
+    // Start the device threads
+    scheduler.Start();
+    chr.Start();
+
+    std::atomic<bool> running { true };
+    std::vector<std::thread> timerThreads;
+    for (uint8_t irq : kTimerIRQs) {
+        timerThreads.emplace_back([&running, &irqs, irq] {
+            bool level = false;
+            while (running) {
+                level = !level;
+                irqs[irq].Handle(level);
+                std::this_thread::yield();
+            }
+            irqs[irq].Handle(false);
+        });
+    }
+
+    // Run the guest, occasionally skipping ahead to the next timer deadline
+    // as the emulator does when the guest is idle
+    uint32_t iterations = 0;
+    auto end = std::chrono::steady_clock::now() + kTestDuration;
+    while (std::chrono::steady_clock::now() < end) {
+        cpu.Run();
+        if ((++iterations & 63) == 0 && scheduler.SkipToNextDeadline()) {
+            scheduler.WaitForExpired();
+        }
+    }
+
+    // Stop everything
+    running = false;
+    for (auto& thread : timerThreads) {
+        thread.join();
+    }
+    chr.Join();
+    scheduler.Stop();
+
+    log_info("Device stress test: %u iterations, %u interrupts, %u VBlanks, %u DMA transfers, %u/%u serial characters read\n",
+        iterations, cpu.m_interrupts, cpu.m_vblanks, cpu.m_dmaTransfers, cpu.m_serialReads, chr.m_received.load());
+
+    bool passed = cpu.m_interrupts > 0 && cpu.m_vblanks > 0 && cpu.m_dmaTransfers > 0 && cpu.m_serialReads > 0;
+    if (!passed) {
+        log_error("Device stress test: devices stopped making progress\n");
+    }
+
+    delete nv2a;
+    delete bmide;
+    delete pciBus;
+    delete serial;
+    delete ata;
+    delete[] irqs;
+    delete pic;
+    vfree(ram);
+
+    return passed ? 0 : 1;
+}